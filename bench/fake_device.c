@@ -0,0 +1,801 @@
+/*
+ * fake_device.c
+ * Loopback device emulator standing in for usbmuxd
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <usbmuxd.h>
+#include <plist/plist.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/rsa.h>
+#include <openssl/pem.h>
+#endif
+
+#include <endianness.h>
+#include "common/userpref.h"
+#include "common/thread.h"
+#include "fake_device.h"
+
+/*
+ * The fake device replaces libusbmuxd: idevicebench defines the usbmuxd_*
+ * functions itself, and since the executable comes first in the symbol
+ * lookup order, libimobiledevice calls these instead of the ones in
+ * libusbmuxd. Every connection is one end of a socketpair whose other end
+ * is served by a thread running the handler registered for the port.
+ */
+#define FAKE_USBMUXD_API __attribute__((visibility("default")))
+
+#define FAKE_MAX_SERVICES 32
+#define FAKE_MAX_PLIST_SIZE (16 * 1024 * 1024)
+
+#define FAKE_SYSTEM_BUID "BENCH-0000-0000-0000-000000000000"
+#define FAKE_HOST_ID "BENCH-HOST-0000-0000-000000000000"
+
+struct fake_service {
+	char *name;
+	uint16_t port;
+	fake_service_handler_t handler;
+	int ssl;
+	void *user_data;
+};
+
+static struct fake_service services[FAKE_MAX_SERVICES];
+static int service_count = 0;
+static mutex_t services_mutex;
+
+static mutex_t pair_record_mutex;
+static char *pair_record_data = NULL;
+static uint32_t pair_record_size = 0;
+
+static int session_ssl = 0;
+static unsigned int session_count = 0;
+
+#ifdef HAVE_OPENSSL
+static SSL_CTX *ssl_ctx = NULL;
+
+/**
+ * Creates a key pair for the device and lets the library code that pairs
+ * with a real device issue the certificates for it.
+ */
+static int fake_device_create_credentials(plist_t pair_record)
+{
+	key_data_t public_key = { NULL, 0 };
+	key_data_t device_cert_pem = { NULL, 0 };
+	BIGNUM *e = BN_new();
+	RSA *keypair = RSA_new();
+	EVP_PKEY *device_key = NULL;
+	X509 *device_cert = NULL;
+	BIO *membp;
+	char *bdata = NULL;
+	int res = -1;
+
+	BN_set_word(e, 65537);
+	if (RSA_generate_key_ex(keypair, 2048, e, NULL) != 1) {
+		BN_free(e);
+		RSA_free(keypair);
+		return -1;
+	}
+	BN_free(e);
+
+	membp = BIO_new(BIO_s_mem());
+	if (PEM_write_bio_RSAPublicKey(membp, keypair) > 0) {
+		public_key.size = BIO_get_mem_data(membp, &bdata);
+		public_key.data = (unsigned char*)malloc(public_key.size);
+		memcpy(public_key.data, bdata, public_key.size);
+	}
+	BIO_free(membp);
+
+	device_key = EVP_PKEY_new();
+	EVP_PKEY_assign_RSA(device_key, keypair);
+
+	if (public_key.data && (pair_record_generate_keys_and_certs(pair_record, public_key) == USERPREF_E_SUCCESS)
+	    && (pair_record_import_crt_with_name(pair_record, USERPREF_DEVICE_CERTIFICATE_KEY, &device_cert_pem) == USERPREF_E_SUCCESS)) {
+		membp = BIO_new_mem_buf(device_cert_pem.data, device_cert_pem.size);
+		PEM_read_bio_X509(membp, &device_cert, NULL, NULL);
+		BIO_free(membp);
+	}
+	free(public_key.data);
+	free(device_cert_pem.data);
+
+	if (device_cert) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		ssl_ctx = SSL_CTX_new(TLS_server_method());
+		if (ssl_ctx) {
+			/* accept the TLS 1.0 and SHA1 the library still uses */
+			SSL_CTX_set_security_level(ssl_ctx, 0);
+			SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_VERSION);
+		}
+#else
+		ssl_ctx = SSL_CTX_new(SSLv23_server_method());
+#endif
+		if (ssl_ctx && (SSL_CTX_use_certificate(ssl_ctx, device_cert) == 1) && (SSL_CTX_use_PrivateKey(ssl_ctx, device_key) == 1)) {
+			res = 0;
+		} else if (ssl_ctx) {
+			SSL_CTX_free(ssl_ctx);
+			ssl_ctx = NULL;
+		}
+		X509_free(device_cert);
+	}
+	EVP_PKEY_free(device_key);
+
+	return res;
+}
+#endif
+
+static void lockdownd_handler(struct fake_connection *conn);
+
+int fake_device_init(void)
+{
+	plist_t pair_record = plist_new_dict();
+
+	mutex_init(&services_mutex);
+	mutex_init(&pair_record_mutex);
+
+	pair_record_set_host_id(pair_record, FAKE_HOST_ID);
+	plist_dict_set_item(pair_record, USERPREF_SYSTEM_BUID_KEY, plist_new_string(FAKE_SYSTEM_BUID));
+
+#ifdef HAVE_OPENSSL
+	if (fake_device_create_credentials(pair_record) == 0) {
+		session_ssl = 1;
+	} else {
+		fprintf(stderr, "WARNING: Could not create SSL credentials for the fake device, SSL is disabled.\n");
+	}
+#endif
+
+	plist_to_xml(pair_record, &pair_record_data, &pair_record_size);
+	plist_free(pair_record);
+	if (!pair_record_data) {
+		return -1;
+	}
+
+	return fake_device_add_service(NULL, FAKE_LOCKDOWN_PORT, lockdownd_handler, 0, NULL);
+}
+
+void fake_device_cleanup(void)
+{
+	int i;
+
+	mutex_lock(&services_mutex);
+	for (i = 0; i < service_count; i++) {
+		free(services[i].name);
+		services[i].name = NULL;
+	}
+	service_count = 0;
+	mutex_unlock(&services_mutex);
+
+	mutex_lock(&pair_record_mutex);
+	free(pair_record_data);
+	pair_record_data = NULL;
+	pair_record_size = 0;
+	mutex_unlock(&pair_record_mutex);
+
+#ifdef HAVE_OPENSSL
+	if (ssl_ctx) {
+		SSL_CTX_free(ssl_ctx);
+		ssl_ctx = NULL;
+	}
+#endif
+}
+
+int fake_device_add_service(const char *name, uint16_t port, fake_service_handler_t handler, int ssl, void *user_data)
+{
+	int res = -1;
+
+	mutex_lock(&services_mutex);
+	if (service_count < FAKE_MAX_SERVICES) {
+		struct fake_service *service = &services[service_count++];
+		service->name = (name) ? strdup(name) : NULL;
+		service->port = port;
+		service->handler = handler;
+		service->ssl = ssl;
+		service->user_data = user_data;
+		res = 0;
+	}
+	mutex_unlock(&services_mutex);
+
+	return res;
+}
+
+static int fake_device_find_service(const char *name, uint16_t port, struct fake_service *service)
+{
+	int found = 0;
+	int i;
+
+	mutex_lock(&services_mutex);
+	for (i = 0; i < service_count; i++) {
+		if ((name && services[i].name && !strcmp(services[i].name, name)) || (!name && (services[i].port == port))) {
+			*service = services[i];
+			found = 1;
+			break;
+		}
+	}
+	mutex_unlock(&services_mutex);
+
+	return found;
+}
+
+int fake_device_has_ssl(void)
+{
+#ifdef HAVE_OPENSSL
+	return (ssl_ctx != NULL);
+#else
+	return 0;
+#endif
+}
+
+void fake_device_disable_ssl(void)
+{
+	session_ssl = 0;
+}
+
+int fake_connection_read(struct fake_connection *conn, void *data, uint32_t len)
+{
+	uint32_t done = 0;
+
+	while (done < len) {
+#ifdef HAVE_OPENSSL
+		if (conn->ssl) {
+			int r = SSL_read((SSL*)conn->ssl, (char*)data + done, (int)(len - done));
+			if (r <= 0) {
+				if (SSL_get_error((SSL*)conn->ssl, r) == SSL_ERROR_ZERO_RETURN) {
+					/* answer the close notify so the client's shutdown completes */
+					SSL_shutdown((SSL*)conn->ssl);
+				}
+				return -1;
+			}
+			done += r;
+			continue;
+		}
+#endif
+		ssize_t r = recv(conn->fd, (char*)data + done, len - done, 0);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		done += r;
+	}
+
+	return 0;
+}
+
+int fake_connection_write(struct fake_connection *conn, const void *data, uint32_t len)
+{
+	uint32_t done = 0;
+
+	while (done < len) {
+#ifdef HAVE_OPENSSL
+		if (conn->ssl) {
+			int r = SSL_write((SSL*)conn->ssl, (const char*)data + done, (int)(len - done));
+			if (r <= 0) {
+				return -1;
+			}
+			done += r;
+			continue;
+		}
+#endif
+		ssize_t r = send(conn->fd, (const char*)data + done, len - done, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		done += r;
+	}
+
+	return 0;
+}
+
+int fake_connection_start_ssl(struct fake_connection *conn)
+{
+#ifdef HAVE_OPENSSL
+	SSL *ssl;
+
+	if (!ssl_ctx || conn->ssl) {
+		return -1;
+	}
+	ssl = SSL_new(ssl_ctx);
+	if (!ssl) {
+		return -1;
+	}
+	SSL_set_fd(ssl, conn->fd);
+	if (SSL_accept(ssl) != 1) {
+		SSL_free(ssl);
+		return -1;
+	}
+	conn->ssl = ssl;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void fake_connection_stop_ssl(struct fake_connection *conn)
+{
+#ifdef HAVE_OPENSSL
+	if (conn->ssl) {
+		/* see: https://www.openssl.org/docs/ssl/SSL_shutdown.html#RETURN_VALUES */
+		if (SSL_shutdown((SSL*)conn->ssl) == 0) {
+			SSL_shutdown((SSL*)conn->ssl);
+		}
+		SSL_free((SSL*)conn->ssl);
+		conn->ssl = NULL;
+	}
+#endif
+}
+
+int fake_connection_receive_plist(struct fake_connection *conn, plist_t *plist, int *binary)
+{
+	uint32_t pktlen = 0;
+	char *content;
+
+	*plist = NULL;
+	if (fake_connection_read(conn, &pktlen, sizeof(pktlen)) < 0) {
+		return -1;
+	}
+	pktlen = be32toh(pktlen);
+	if ((pktlen == 0) || (pktlen > FAKE_MAX_PLIST_SIZE)) {
+		return -1;
+	}
+	content = (char*)malloc(pktlen);
+	if (!content) {
+		return -1;
+	}
+	if (fake_connection_read(conn, content, pktlen) < 0) {
+		free(content);
+		return -1;
+	}
+	if ((pktlen > 8) && !memcmp(content, "bplist00", 8)) {
+		plist_from_bin(content, pktlen, plist);
+		if (binary)
+			*binary = 1;
+	} else {
+		plist_from_xml(content, pktlen, plist);
+		if (binary)
+			*binary = 0;
+	}
+	free(content);
+
+	return (*plist) ? 0 : -1;
+}
+
+int fake_connection_send_plist(struct fake_connection *conn, plist_t plist, int binary)
+{
+	char *content = NULL;
+	uint32_t length = 0;
+	char *packet;
+	uint32_t nlen;
+	int res;
+
+	if (binary) {
+		plist_to_bin(plist, &content, &length);
+	} else {
+		plist_to_xml(plist, &content, &length);
+	}
+	if (!content || (length == 0)) {
+		free(content);
+		return -1;
+	}
+
+	/* length and plist go out in one write like the real device does */
+	packet = (char*)malloc(sizeof(nlen) + length);
+	if (!packet) {
+		free(content);
+		return -1;
+	}
+	nlen = htobe32(length);
+	memcpy(packet, &nlen, sizeof(nlen));
+	memcpy(packet + sizeof(nlen), content, length);
+	free(content);
+
+	res = fake_connection_write(conn, packet, sizeof(nlen) + length);
+	free(packet);
+
+	return res;
+}
+
+/* lockdownd */
+
+static const struct {
+	const char *key;
+	const char *value;
+} lockdownd_values[] = {
+	{ "DeviceClass", "iPhone" },
+	{ "DeviceName", "idevicebench" },
+	{ "ProductType", "iPhone12,1" },
+	{ "ProductVersion", FAKE_DEVICE_PRODUCT_VERSION },
+	{ "BuildVersion", "18A373" },
+	{ "UniqueDeviceID", FAKE_DEVICE_UDID },
+	{ NULL, NULL }
+};
+
+static void lockdownd_get_value(plist_t request, plist_t reply)
+{
+	plist_t node = plist_dict_get_item(request, "Key");
+	char *key = NULL;
+	int i;
+
+	if (node && (plist_get_node_type(node) == PLIST_STRING)) {
+		plist_get_string_val(node, &key);
+	}
+	if (!key) {
+		plist_t values = plist_new_dict();
+		for (i = 0; lockdownd_values[i].key; i++) {
+			plist_dict_set_item(values, lockdownd_values[i].key, plist_new_string(lockdownd_values[i].value));
+		}
+		plist_dict_set_item(reply, "Value", values);
+		return;
+	}
+
+	plist_dict_set_item(reply, "Key", plist_new_string(key));
+	for (i = 0; lockdownd_values[i].key; i++) {
+		if (!strcmp(lockdownd_values[i].key, key)) {
+			plist_dict_set_item(reply, "Value", plist_new_string(lockdownd_values[i].value));
+			break;
+		}
+	}
+	if (!lockdownd_values[i].key) {
+		plist_dict_set_item(reply, "Error", plist_new_string("MissingValue"));
+	}
+	free(key);
+}
+
+static void lockdownd_start_service(plist_t request, plist_t reply)
+{
+	struct fake_service service;
+	plist_t node = plist_dict_get_item(request, "Service");
+	char *name = NULL;
+
+	if (node && (plist_get_node_type(node) == PLIST_STRING)) {
+		plist_get_string_val(node, &name);
+	}
+	if (name && fake_device_find_service(name, 0, &service)) {
+		plist_dict_set_item(reply, "Service", plist_new_string(name));
+		plist_dict_set_item(reply, "Port", plist_new_uint(service.port));
+		plist_dict_set_item(reply, "EnableServiceSSL", plist_new_bool(service.ssl));
+	} else {
+		plist_dict_set_item(reply, "Error", plist_new_string("InvalidService"));
+	}
+	free(name);
+}
+
+static void lockdownd_handler(struct fake_connection *conn)
+{
+	plist_t request = NULL;
+	int binary = 0;
+
+	while (fake_connection_receive_plist(conn, &request, &binary) == 0) {
+		plist_t reply = plist_new_dict();
+		plist_t node = plist_dict_get_item(request, "Request");
+		char *name = NULL;
+		int start_ssl = 0;
+		int stop_ssl = 0;
+
+		if (node && (plist_get_node_type(node) == PLIST_STRING)) {
+			plist_get_string_val(node, &name);
+		}
+
+		if (!name) {
+			plist_dict_set_item(reply, "Error", plist_new_string("InvalidRequest"));
+		} else {
+			plist_dict_set_item(reply, "Request", plist_new_string(name));
+			if (!strcmp(name, "QueryType")) {
+				plist_dict_set_item(reply, "Type", plist_new_string("com.apple.mobile.lockdown"));
+			} else if (!strcmp(name, "GetValue")) {
+				lockdownd_get_value(request, reply);
+			} else if (!strcmp(name, "ValidatePair") || !strcmp(name, "Goodbye")) {
+				plist_dict_set_item(reply, "Result", plist_new_string("Success"));
+			} else if (!strcmp(name, "StartSession")) {
+				char session_id[32];
+				snprintf(session_id, sizeof(session_id), "BENCH-SESSION-%u", __atomic_add_fetch(&session_count, 1, __ATOMIC_RELAXED));
+				plist_dict_set_item(reply, "SessionID", plist_new_string(session_id));
+				plist_dict_set_item(reply, "EnableSessionSSL", plist_new_bool(session_ssl));
+				start_ssl = session_ssl;
+			} else if (!strcmp(name, "StopSession")) {
+				plist_dict_set_item(reply, "Result", plist_new_string("Success"));
+				stop_ssl = (conn->ssl != NULL);
+			} else if (!strcmp(name, "StartService")) {
+				lockdownd_start_service(request, reply);
+			} else {
+				plist_dict_set_item(reply, "Error", plist_new_string("InvalidRequest"));
+			}
+		}
+		plist_free(request);
+		request = NULL;
+
+		int res = fake_connection_send_plist(conn, reply, binary);
+		plist_free(reply);
+		free(name);
+		if (res < 0) {
+			break;
+		}
+		if (start_ssl && (fake_connection_start_ssl(conn) < 0)) {
+			break;
+		}
+		if (stop_ssl) {
+			fake_connection_stop_ssl(conn);
+		}
+	}
+}
+
+/* connections */
+
+struct fake_connection_thread {
+	struct fake_connection conn;
+	struct fake_service service;
+};
+
+static void *fake_connection_run(void *arg)
+{
+	struct fake_connection_thread *ct = (struct fake_connection_thread*)arg;
+
+	if (!ct->service.ssl || (fake_connection_start_ssl(&ct->conn) == 0)) {
+		ct->service.handler(&ct->conn);
+	}
+	fake_connection_stop_ssl(&ct->conn);
+	close(ct->conn.fd);
+	free(ct);
+
+	return NULL;
+}
+
+/* usbmuxd */
+
+static void fake_device_info(usbmuxd_device_info_t *info)
+{
+	memset(info, '\0', sizeof(usbmuxd_device_info_t));
+	info->handle = FAKE_DEVICE_HANDLE;
+	info->product_id = 0x12a8;
+	strncpy(info->udid, FAKE_DEVICE_UDID, sizeof(info->udid) - 1);
+}
+
+FAKE_USBMUXD_API int usbmuxd_subscribe(usbmuxd_event_cb_t callback, void *user_data)
+{
+	usbmuxd_event_t event;
+
+	if (!callback)
+		return -EINVAL;
+
+	memset(&event, '\0', sizeof(usbmuxd_event_t));
+	event.event = UE_DEVICE_ADD;
+	fake_device_info(&event.device);
+	callback(&event, user_data);
+
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_unsubscribe(void)
+{
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_get_device_list(usbmuxd_device_info_t **device_list)
+{
+	usbmuxd_device_info_t *list = (usbmuxd_device_info_t*)calloc(2, sizeof(usbmuxd_device_info_t));
+
+	if (!list)
+		return -ENOMEM;
+
+	/* the list is terminated by an entry with handle 0 */
+	fake_device_info(&list[0]);
+	*device_list = list;
+
+	return 1;
+}
+
+FAKE_USBMUXD_API int usbmuxd_device_list_free(usbmuxd_device_info_t **device_list)
+{
+	if (device_list) {
+		free(*device_list);
+		*device_list = NULL;
+	}
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_get_device_by_udid(const char *udid, usbmuxd_device_info_t *device)
+{
+	if (udid && strcmp(udid, FAKE_DEVICE_UDID)) {
+		return 0;
+	}
+	fake_device_info(device);
+	return 1;
+}
+
+FAKE_USBMUXD_API int usbmuxd_connect(const int handle, const unsigned short port)
+{
+	struct fake_connection_thread *ct;
+	struct fake_service service;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fds[2];
+
+	if (handle != FAKE_DEVICE_HANDLE) {
+		return -ENODEV;
+	}
+	if (!fake_device_find_service(NULL, port, &service)) {
+		return -ECONNREFUSED;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		return -errno;
+	}
+
+	ct = (struct fake_connection_thread*)calloc(1, sizeof(struct fake_connection_thread));
+	if (!ct) {
+		close(fds[0]);
+		close(fds[1]);
+		return -ENOMEM;
+	}
+	ct->conn.fd = fds[1];
+	ct->conn.port = port;
+	ct->conn.user_data = service.user_data;
+	ct->service = service;
+
+	/* nobody waits for the device side of a connection to finish */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, fake_connection_run, ct) != 0) {
+		pthread_attr_destroy(&attr);
+		close(fds[0]);
+		close(fds[1]);
+		free(ct);
+		return -EAGAIN;
+	}
+	pthread_attr_destroy(&attr);
+
+	return fds[0];
+}
+
+FAKE_USBMUXD_API int usbmuxd_disconnect(int sfd)
+{
+	return (close(sfd) < 0) ? -errno : 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_send(int sfd, const char *data, uint32_t len, uint32_t *sent_bytes)
+{
+	ssize_t res = send(sfd, data, len, MSG_NOSIGNAL);
+	if (res < 0) {
+		*sent_bytes = 0;
+		return -errno;
+	}
+	*sent_bytes = (uint32_t)res;
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_recv_timeout(int sfd, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
+{
+	struct pollfd pfd;
+	ssize_t res;
+
+	*recv_bytes = 0;
+
+	pfd.fd = sfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	do {
+		res = poll(&pfd, 1, (int)timeout);
+	} while (res < 0 && errno == EINTR);
+	if (res < 0) {
+		return -errno;
+	}
+	if (res == 0) {
+		/* a timeout is reported as success with no data */
+		return 0;
+	}
+
+	res = recv(sfd, data, len, 0);
+	if (res < 0) {
+		return -errno;
+	}
+	if (res == 0) {
+		return -ECONNRESET;
+	}
+	*recv_bytes = (uint32_t)res;
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_recv(int sfd, char *data, uint32_t len, uint32_t *recv_bytes)
+{
+	return usbmuxd_recv_timeout(sfd, data, len, recv_bytes, 5000);
+}
+
+FAKE_USBMUXD_API int usbmuxd_read_buid(char **buid)
+{
+	if (!buid)
+		return -EINVAL;
+
+	*buid = strdup(FAKE_SYSTEM_BUID);
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_read_pair_record(const char *record_id, char **record_data, uint32_t *record_size)
+{
+	int res = -ENOENT;
+
+	if (!record_id || !record_data || !record_size)
+		return -EINVAL;
+
+	*record_data = NULL;
+	*record_size = 0;
+
+	mutex_lock(&pair_record_mutex);
+	if (pair_record_data && !strcmp(record_id, FAKE_DEVICE_UDID)) {
+		*record_data = (char*)malloc(pair_record_size);
+		if (*record_data) {
+			memcpy(*record_data, pair_record_data, pair_record_size);
+			*record_size = pair_record_size;
+			res = 0;
+		} else {
+			res = -ENOMEM;
+		}
+	}
+	mutex_unlock(&pair_record_mutex);
+
+	return res;
+}
+
+FAKE_USBMUXD_API int usbmuxd_save_pair_record(const char *record_id, const char *record_data, uint32_t record_size)
+{
+	char *data;
+
+	if (!record_id || !record_data || (record_size == 0))
+		return -EINVAL;
+	if (strcmp(record_id, FAKE_DEVICE_UDID))
+		return -ENODEV;
+
+	data = (char*)malloc(record_size);
+	if (!data)
+		return -ENOMEM;
+	memcpy(data, record_data, record_size);
+
+	mutex_lock(&pair_record_mutex);
+	free(pair_record_data);
+	pair_record_data = data;
+	pair_record_size = record_size;
+	mutex_unlock(&pair_record_mutex);
+
+	return 0;
+}
+
+FAKE_USBMUXD_API int usbmuxd_delete_pair_record(const char *record_id)
+{
+	if (!record_id)
+		return -EINVAL;
+	if (strcmp(record_id, FAKE_DEVICE_UDID))
+		return -ENOENT;
+
+	mutex_lock(&pair_record_mutex);
+	free(pair_record_data);
+	pair_record_data = NULL;
+	pair_record_size = 0;
+	mutex_unlock(&pair_record_mutex);
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * fake_device.h
+ * Loopback device emulator standing in for usbmuxd - header file
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __FAKE_DEVICE_H
+#define __FAKE_DEVICE_H
+
+#include <stdint.h>
+#include <plist/plist.h>
+
+#define FAKE_DEVICE_UDID "0000bench0000000000000000000000000000000"
+#define FAKE_DEVICE_HANDLE 1
+#define FAKE_DEVICE_PRODUCT_VERSION "14.0"
+
+#define FAKE_LOCKDOWN_PORT 62078
+
+/** One end of a connection to a service of the fake device. */
+struct fake_connection {
+	int fd;
+	uint16_t port;
+	void *ssl;
+	void *user_data;
+};
+
+typedef void (*fake_service_handler_t)(struct fake_connection *conn);
+
+/**
+ * Sets up the fake device, creating a pair record for it.
+ *
+ * @return 0 on success or -1 if the pair record could not be created.
+ */
+int fake_device_init(void);
+
+void fake_device_cleanup(void);
+
+/**
+ * Makes a service available on the fake device. Every connection to the
+ * port is served by a new thread running the handler. Named services can
+ * be started through lockdownd, unnamed ones only by connecting to their
+ * port directly.
+ *
+ * @param name The service name lockdownd knows it by, or NULL
+ * @param port The port the service listens on
+ * @param handler The function serving a connection
+ * @param ssl Whether an SSL handshake is expected right after connecting
+ * @param user_data Passed to the handler with every connection
+ *
+ * @return 0 on success or -1 if too many services are registered.
+ */
+int fake_device_add_service(const char *name, uint16_t port, fake_service_handler_t handler, int ssl, void *user_data);
+
+/**
+ * @return 1 if the fake device can speak SSL, 0 otherwise.
+ */
+int fake_device_has_ssl(void);
+
+/**
+ * Disables SSL for lockdownd sessions, used when the library can not
+ * complete a handshake with the fake device.
+ */
+void fake_device_disable_ssl(void);
+
+/**
+ * Reads exactly len bytes from the connection.
+ *
+ * @return 0 on success or -1 on error or if the connection was closed.
+ */
+int fake_connection_read(struct fake_connection *conn, void *data, uint32_t len);
+
+/**
+ * Writes len bytes to the connection.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int fake_connection_write(struct fake_connection *conn, const void *data, uint32_t len);
+
+/**
+ * Performs the server side of an SSL handshake on the connection.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int fake_connection_start_ssl(struct fake_connection *conn);
+
+/**
+ * Shuts down SSL on the connection, continuing in plain text.
+ */
+void fake_connection_stop_ssl(struct fake_connection *conn);
+
+/**
+ * Receives a length prefixed XML or binary plist.
+ *
+ * @param binary Set to 1 if the plist was binary, may be NULL
+ *
+ * @return 0 on success or -1 on error.
+ */
+int fake_connection_receive_plist(struct fake_connection *conn, plist_t *plist, int *binary);
+
+/**
+ * Sends a length prefixed plist in XML or binary format.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int fake_connection_send_plist(struct fake_connection *conn, plist_t plist, int binary);
+
+#endif
@@ -0,0 +1,1217 @@
+/*
+ * idevicebench.c
+ * Benchmarks of the transport and protocol layers against a fake device
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ftw.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/service.h>
+#include <libimobiledevice/property_list_service.h>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/mobilebackup2.h>
+#include <libimobiledevice/syslog_relay.h>
+#include <plist/plist.h>
+
+#include <endianness.h>
+#include "common/utils.h"
+#include "common/histogram.h"
+#include "common/thread.h"
+#include "fake_device.h"
+#include "responders.h"
+
+#define BENCH_LABEL "idevicebench"
+#define BENCH_CHUNK_SIZE (64 * 1024)
+#define BENCH_STREAM_SIZE (64 * 1024 * 1024)
+#define BENCH_BACKUP_FILE_SIZE (256 * 1024)
+#define BENCH_SYSLOG_LINES 200000
+
+struct bench_result {
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t usec;
+	uint64_t start;
+	struct histogram latency;  /* per operation, in microseconds */
+	const char *skipped;       /* reason if the benchmark did not run */
+	const char *error;         /* set if the benchmark failed */
+};
+
+struct bench_context {
+	idevice_t device;
+	uint32_t scale;
+	int ssl;
+	char *buffer;
+};
+
+typedef void (*bench_func_t)(struct bench_context *ctx, struct bench_result *result);
+
+static void bench_start(struct bench_result *result)
+{
+	result->start = time_monotonic_usec();
+}
+
+static void bench_stop(struct bench_result *result)
+{
+	result->usec = time_monotonic_usec() - result->start;
+}
+
+/**
+ * Counts an operation that began at the given time.
+ */
+static void bench_op(struct bench_result *result, uint64_t begin, uint64_t bytes)
+{
+	histogram_record(&result->latency, time_monotonic_usec() - begin);
+	result->ops++;
+	result->bytes += bytes;
+}
+
+/* idevice_connection */
+
+static int connection_send_all(idevice_connection_t connection, const char *data, uint32_t length)
+{
+	uint32_t done = 0;
+
+	while (done < length) {
+		uint32_t sent = 0;
+		if ((idevice_connection_send(connection, data + done, length - done, &sent) != IDEVICE_E_SUCCESS) || (sent == 0)) {
+			return -1;
+		}
+		done += sent;
+	}
+	return 0;
+}
+
+static int connection_receive_all(idevice_connection_t connection, char *data, uint32_t length)
+{
+	uint32_t done = 0;
+
+	while (done < length) {
+		uint32_t received = 0;
+		if ((idevice_connection_receive(connection, data + done, length - done, &received) != IDEVICE_E_SUCCESS) || (received == 0)) {
+			return -1;
+		}
+		done += received;
+	}
+	return 0;
+}
+
+static idevice_connection_t bench_connect(struct bench_context *ctx, struct bench_result *result, uint16_t port, int ssl)
+{
+	idevice_connection_t connection = NULL;
+
+	if (ssl && !ctx->ssl) {
+		result->skipped = "SSL not available";
+		return NULL;
+	}
+	if (idevice_connect(ctx->device, port, &connection) != IDEVICE_E_SUCCESS) {
+		result->error = "could not connect";
+		return NULL;
+	}
+	if (ssl && (idevice_connection_enable_ssl(connection) != IDEVICE_E_SUCCESS)) {
+		idevice_disconnect(connection);
+		result->error = "SSL handshake failed";
+		return NULL;
+	}
+	return connection;
+}
+
+static void connection_roundtrip(struct bench_context *ctx, struct bench_result *result, uint16_t port, int ssl)
+{
+	const uint32_t count = 10000 * ctx->scale;
+	const uint32_t length = 64;
+	uint32_t nlen = htobe32(length);
+	idevice_iovec_t iov[2];
+	uint32_t i;
+
+	idevice_connection_t connection = bench_connect(ctx, result, port, ssl);
+	if (!connection)
+		return;
+
+	iov[0].data = (const char*)&nlen;
+	iov[0].length = sizeof(nlen);
+	iov[1].data = ctx->buffer;
+	iov[1].length = length;
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		uint64_t begin = time_monotonic_usec();
+		uint32_t sent = 0;
+		if ((idevice_connection_sendv(connection, iov, 2, &sent) != IDEVICE_E_SUCCESS) || (sent != sizeof(nlen) + length)
+		    || (connection_receive_all(connection, ctx->buffer, length) < 0)) {
+			result->error = "echo failed";
+			break;
+		}
+		bench_op(result, begin, length);
+	}
+	bench_stop(result);
+
+	idevice_disconnect(connection);
+}
+
+static void connection_send(struct bench_context *ctx, struct bench_result *result, uint16_t port, int ssl)
+{
+	const uint64_t total = (uint64_t)BENCH_STREAM_SIZE * ctx->scale;
+	uint64_t length = htobe64(total);
+	uint64_t done = 0;
+	char ack = 0;
+
+	idevice_connection_t connection = bench_connect(ctx, result, port, ssl);
+	if (!connection)
+		return;
+
+	bench_start(result);
+	if (connection_send_all(connection, (const char*)&length, sizeof(length)) < 0) {
+		result->error = "send failed";
+	}
+	while (!result->error && (done < total)) {
+		uint64_t begin = time_monotonic_usec();
+		if (connection_send_all(connection, ctx->buffer, BENCH_CHUNK_SIZE) < 0) {
+			result->error = "send failed";
+			break;
+		}
+		bench_op(result, begin, BENCH_CHUNK_SIZE);
+		done += BENCH_CHUNK_SIZE;
+	}
+	/* the device acknowledges once everything arrived */
+	if (!result->error && (connection_receive_all(connection, &ack, 1) < 0)) {
+		result->error = "no acknowledgement";
+	}
+	bench_stop(result);
+
+	idevice_disconnect(connection);
+}
+
+static void connection_receive(struct bench_context *ctx, struct bench_result *result, uint16_t port, int ssl)
+{
+	const uint64_t total = (uint64_t)BENCH_STREAM_SIZE * ctx->scale;
+	uint64_t length = htobe64(total);
+	uint64_t done = 0;
+
+	idevice_connection_t connection = bench_connect(ctx, result, port, ssl);
+	if (!connection)
+		return;
+
+	bench_start(result);
+	if (connection_send_all(connection, (const char*)&length, sizeof(length)) < 0) {
+		result->error = "send failed";
+	}
+	while (!result->error && (done < total)) {
+		uint64_t begin = time_monotonic_usec();
+		if (connection_receive_all(connection, ctx->buffer, BENCH_CHUNK_SIZE) < 0) {
+			result->error = "receive failed";
+			break;
+		}
+		bench_op(result, begin, BENCH_CHUNK_SIZE);
+		done += BENCH_CHUNK_SIZE;
+	}
+	bench_stop(result);
+
+	idevice_disconnect(connection);
+}
+
+static void bench_connection_roundtrip(struct bench_context *ctx, struct bench_result *result)
+{
+	connection_roundtrip(ctx, result, BENCH_PORT_ECHO, 0);
+}
+
+static void bench_connection_send(struct bench_context *ctx, struct bench_result *result)
+{
+	connection_send(ctx, result, BENCH_PORT_SINK, 0);
+}
+
+static void bench_connection_receive(struct bench_context *ctx, struct bench_result *result)
+{
+	connection_receive(ctx, result, BENCH_PORT_SOURCE, 0);
+}
+
+static void bench_ssl_handshake(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = 100 * ctx->scale;
+	uint32_t i;
+
+	if (!ctx->ssl) {
+		result->skipped = "SSL not available";
+		return;
+	}
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		uint64_t begin = time_monotonic_usec();
+		idevice_connection_t connection = bench_connect(ctx, result, BENCH_PORT_ECHO_SSL, 1);
+		if (!connection)
+			break;
+		idevice_disconnect(connection);
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+}
+
+static void bench_ssl_roundtrip(struct bench_context *ctx, struct bench_result *result)
+{
+	connection_roundtrip(ctx, result, BENCH_PORT_ECHO_SSL, 1);
+}
+
+static void bench_ssl_send(struct bench_context *ctx, struct bench_result *result)
+{
+	connection_send(ctx, result, BENCH_PORT_SINK_SSL, 1);
+}
+
+static void bench_ssl_receive(struct bench_context *ctx, struct bench_result *result)
+{
+	connection_receive(ctx, result, BENCH_PORT_SOURCE_SSL, 1);
+}
+
+/* lockdownd */
+
+static void bench_lockdown_handshake(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = 100 * ctx->scale;
+	uint32_t i;
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		lockdownd_client_t lockdown = NULL;
+		uint64_t begin = time_monotonic_usec();
+		if (lockdownd_client_new_with_handshake(ctx->device, &lockdown, BENCH_LABEL) != LOCKDOWN_E_SUCCESS) {
+			result->error = "handshake failed";
+			break;
+		}
+		lockdownd_client_free(lockdown);
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+}
+
+static void bench_lockdown_get_value(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = 5000 * ctx->scale;
+	lockdownd_client_t lockdown = NULL;
+	uint32_t i;
+
+	if (lockdownd_client_new_with_handshake(ctx->device, &lockdown, BENCH_LABEL) != LOCKDOWN_E_SUCCESS) {
+		result->error = "handshake failed";
+		return;
+	}
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		plist_t value = NULL;
+		uint64_t begin = time_monotonic_usec();
+		if (lockdownd_get_value(lockdown, NULL, "ProductType", &value) != LOCKDOWN_E_SUCCESS) {
+			result->error = "GetValue failed";
+			break;
+		}
+		plist_free(value);
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+
+	lockdownd_client_free(lockdown);
+}
+
+static void bench_lockdown_start_service(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = 2000 * ctx->scale;
+	lockdownd_client_t lockdown = NULL;
+	uint32_t i;
+
+	if (lockdownd_client_new_with_handshake(ctx->device, &lockdown, BENCH_LABEL) != LOCKDOWN_E_SUCCESS) {
+		result->error = "handshake failed";
+		return;
+	}
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		lockdownd_service_descriptor_t service = NULL;
+		uint64_t begin = time_monotonic_usec();
+		if (lockdownd_start_service(lockdown, AFC_SERVICE_NAME, &service) != LOCKDOWN_E_SUCCESS) {
+			result->error = "StartService failed";
+			break;
+		}
+		lockdownd_service_descriptor_free(service);
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+
+	lockdownd_client_free(lockdown);
+}
+
+/* property_list_service */
+
+static void plist_service_roundtrip(struct bench_context *ctx, struct bench_result *result, int binary)
+{
+	const uint32_t count = 10000 * ctx->scale;
+	property_list_service_client_t client = NULL;
+	plist_t message;
+	char key[16];
+	uint32_t i;
+
+	service_client_factory_start_service(ctx->device, BENCH_PLIST_ECHO_SERVICE_NAME, (void**)&client, BENCH_LABEL, SERVICE_CONSTRUCTOR(property_list_service_client_new), NULL);
+	if (!client) {
+		result->error = "could not start service";
+		return;
+	}
+
+	/* about the size and shape of a typical service request */
+	message = plist_new_dict();
+	plist_dict_set_item(message, "Request", plist_new_string("Bench"));
+	plist_dict_set_item(message, "Label", plist_new_string(BENCH_LABEL));
+	for (i = 0; i < 16; i++) {
+		snprintf(key, sizeof(key), "Key%u", i);
+		plist_dict_set_item(message, key, (i & 1) ? plist_new_uint(i) : plist_new_string("com.apple.mobile.bench.value"));
+	}
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		plist_t reply = NULL;
+		property_list_service_error_t err;
+		uint64_t begin = time_monotonic_usec();
+		if (binary) {
+			err = property_list_service_send_binary_plist(client, message);
+		} else {
+			err = property_list_service_send_xml_plist(client, message);
+		}
+		if ((err != PROPERTY_LIST_SERVICE_E_SUCCESS) || (property_list_service_receive_plist(client, &reply) != PROPERTY_LIST_SERVICE_E_SUCCESS)) {
+			result->error = "echo failed";
+			break;
+		}
+		plist_free(reply);
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+
+	plist_free(message);
+	property_list_service_client_free(client);
+}
+
+static void bench_plist_service_xml(struct bench_context *ctx, struct bench_result *result)
+{
+	plist_service_roundtrip(ctx, result, 0);
+}
+
+static void bench_plist_service_binary(struct bench_context *ctx, struct bench_result *result)
+{
+	plist_service_roundtrip(ctx, result, 1);
+}
+
+/* afc */
+
+static afc_client_t bench_afc_start(struct bench_context *ctx, struct bench_result *result)
+{
+	afc_client_t afc = NULL;
+
+	if (afc_client_start_service(ctx->device, &afc, BENCH_LABEL) != AFC_E_SUCCESS) {
+		result->error = "could not start service";
+		return NULL;
+	}
+	return afc;
+}
+
+static void bench_afc_file_info(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = 10000 * ctx->scale;
+	uint32_t i;
+
+	afc_client_t afc = bench_afc_start(ctx, result);
+	if (!afc)
+		return;
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		char **info = NULL;
+		uint64_t begin = time_monotonic_usec();
+		if (afc_get_file_info(afc, "/DCIM/100APPLE/IMG_0001.JPG", &info) != AFC_E_SUCCESS) {
+			result->error = "GetFileInfo failed";
+			break;
+		}
+		afc_dictionary_free(info);
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+
+	afc_client_free(afc);
+}
+
+#define BENCH_AFC_BATCH_SIZE 64
+#define BENCH_AFC_THREADS 4
+
+/**
+ * Checks the pipelined GetFileInfo path, every response has to carry the
+ * size the responder derives from the path of its own request.
+ */
+static void bench_afc_file_info_batch(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = (10000 * ctx->scale) / BENCH_AFC_BATCH_SIZE;
+	char names[BENCH_AFC_BATCH_SIZE][32];
+	const char *paths[BENCH_AFC_BATCH_SIZE];
+	afc_file_info_t infos[BENCH_AFC_BATCH_SIZE];
+	uint32_t i, j;
+
+	afc_client_t afc = bench_afc_start(ctx, result);
+	if (!afc)
+		return;
+
+	bench_start(result);
+	for (i = 0; !result->error && (i < count); i++) {
+		uint64_t begin = time_monotonic_usec();
+		for (j = 0; j < BENCH_AFC_BATCH_SIZE; j++) {
+			snprintf(names[j], sizeof(names[j]), BENCH_AFC_SIZED_PATH_PREFIX "%u", i * BENCH_AFC_BATCH_SIZE + j);
+			paths[j] = names[j];
+		}
+		if (afc_get_file_info_batch(afc, paths, BENCH_AFC_BATCH_SIZE, infos, NULL) != AFC_E_SUCCESS) {
+			result->error = "GetFileInfo failed";
+			break;
+		}
+		for (j = 0; j < BENCH_AFC_BATCH_SIZE; j++) {
+			if (infos[j].size != i * BENCH_AFC_BATCH_SIZE + j) {
+				result->error = "response matched to the wrong request";
+				break;
+			}
+		}
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+
+	afc_client_free(afc);
+}
+
+struct afc_info_worker {
+	afc_client_t afc;
+	uint32_t first;
+	uint32_t count;
+	uint32_t done;
+	const char *error;
+};
+
+static void* afc_info_worker_run(void *data)
+{
+	struct afc_info_worker *worker = (struct afc_info_worker*)data;
+	char path[32];
+	uint32_t i;
+
+	for (i = 0; i < worker->count; i++) {
+		afc_file_info_t info;
+		snprintf(path, sizeof(path), BENCH_AFC_SIZED_PATH_PREFIX "%u", worker->first + i);
+		if (afc_get_file_info_parsed(worker->afc, path, &info) != AFC_E_SUCCESS) {
+			worker->error = "GetFileInfo failed";
+			break;
+		}
+		if (info.size != worker->first + i) {
+			worker->error = "response matched to the wrong request";
+			break;
+		}
+		worker->done++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Checks that concurrent callers sharing one client each get their own
+ * responses, including those received and queued by another caller.
+ */
+static void bench_afc_file_info_threads(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = (10000 * ctx->scale) / BENCH_AFC_THREADS;
+	struct afc_info_worker workers[BENCH_AFC_THREADS];
+	thread_t threads[BENCH_AFC_THREADS];
+	int started = 0;
+	int i;
+
+	afc_client_t afc = bench_afc_start(ctx, result);
+	if (!afc)
+		return;
+
+	memset(workers, '\0', sizeof(workers));
+	bench_start(result);
+	for (i = 0; i < BENCH_AFC_THREADS; i++) {
+		workers[i].afc = afc;
+		workers[i].first = i * count;
+		workers[i].count = count;
+		if (thread_new(&threads[i], afc_info_worker_run, &workers[i]) != 0) {
+			result->error = "could not start thread";
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++) {
+		thread_join(threads[i]);
+		thread_free(threads[i]);
+		result->ops += workers[i].done;
+		if (workers[i].error && !result->error) {
+			result->error = workers[i].error;
+		}
+	}
+	bench_stop(result);
+
+	afc_client_free(afc);
+}
+
+static void bench_afc_open_close(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t count = 5000 * ctx->scale;
+	uint32_t i;
+
+	afc_client_t afc = bench_afc_start(ctx, result);
+	if (!afc)
+		return;
+
+	bench_start(result);
+	for (i = 0; i < count; i++) {
+		uint64_t handle = 0;
+		uint64_t begin = time_monotonic_usec();
+		if ((afc_file_open(afc, "/DCIM/100APPLE/IMG_0001.JPG", AFC_FOPEN_RDONLY, &handle) != AFC_E_SUCCESS)
+		    || (afc_file_close(afc, handle) != AFC_E_SUCCESS)) {
+			result->error = "open/close failed";
+			break;
+		}
+		bench_op(result, begin, 0);
+	}
+	bench_stop(result);
+
+	afc_client_free(afc);
+}
+
+static void afc_transfer(struct bench_context *ctx, struct bench_result *result, int write, int parallel)
+{
+	const uint64_t total = (uint64_t)BENCH_STREAM_SIZE * ctx->scale;
+	uint64_t handle = 0;
+	uint64_t done = 0;
+	char *data = NULL;
+
+	afc_client_t afc = bench_afc_start(ctx, result);
+	if (!afc)
+		return;
+
+	if (afc_file_open(afc, "/bench.dat", (write) ? AFC_FOPEN_WRONLY : AFC_FOPEN_RDONLY, &handle) != AFC_E_SUCCESS) {
+		result->error = "open failed";
+		afc_client_free(afc);
+		return;
+	}
+
+	if (parallel) {
+		data = (char*)malloc(total);
+		if (!data) {
+			result->error = "out of memory";
+			afc_file_close(afc, handle);
+			afc_client_free(afc);
+			return;
+		}
+		memset(data, 'x', total);
+	}
+
+	bench_start(result);
+	if (parallel) {
+		uint64_t begin = time_monotonic_usec();
+		afc_error_t err;
+		if (write) {
+			err = afc_file_write_parallel(afc, handle, 0, data, total, BENCH_CHUNK_SIZE, 8, &done);
+		} else {
+			err = afc_file_read_parallel(afc, handle, 0, data, total, BENCH_CHUNK_SIZE, 8, &done);
+		}
+		if ((err != AFC_E_SUCCESS) || (done != total)) {
+			result->error = "transfer failed";
+		} else {
+			bench_op(result, begin, total);
+		}
+	} else {
+		while (done < total) {
+			uint32_t bytes = 0;
+			afc_error_t err;
+			uint64_t begin = time_monotonic_usec();
+			if (write) {
+				err = afc_file_write(afc, handle, ctx->buffer, BENCH_CHUNK_SIZE, &bytes);
+			} else {
+				err = afc_file_read(afc, handle, ctx->buffer, BENCH_CHUNK_SIZE, &bytes);
+			}
+			if ((err != AFC_E_SUCCESS) || (bytes == 0)) {
+				result->error = "transfer failed";
+				break;
+			}
+			bench_op(result, begin, bytes);
+			done += bytes;
+		}
+	}
+	bench_stop(result);
+
+	free(data);
+	afc_file_close(afc, handle);
+	afc_client_free(afc);
+}
+
+static void bench_afc_read(struct bench_context *ctx, struct bench_result *result)
+{
+	afc_transfer(ctx, result, 0, 0);
+}
+
+static void bench_afc_read_parallel(struct bench_context *ctx, struct bench_result *result)
+{
+	afc_transfer(ctx, result, 0, 1);
+}
+
+static void bench_afc_write(struct bench_context *ctx, struct bench_result *result)
+{
+	afc_transfer(ctx, result, 1, 0);
+}
+
+static void bench_afc_write_parallel(struct bench_context *ctx, struct bench_result *result)
+{
+	afc_transfer(ctx, result, 1, 1);
+}
+
+/* mobilebackup2 */
+
+#define CODE_SUCCESS 0x00
+#define CODE_FILE_DATA 0x0c
+
+static mobilebackup2_client_t bench_backup_start(struct bench_context *ctx, struct bench_result *result, const char *request, uint32_t files)
+{
+	mobilebackup2_client_t mobilebackup2 = NULL;
+	double local_versions[2] = { 2.0, 2.1 };
+	double remote_version = 0.0;
+	plist_t options;
+
+	if (mobilebackup2_client_start_service(ctx->device, &mobilebackup2, BENCH_LABEL) != MOBILEBACKUP2_E_SUCCESS) {
+		result->error = "could not start service";
+		return NULL;
+	}
+	if (mobilebackup2_version_exchange(mobilebackup2, local_versions, 2, &remote_version) != MOBILEBACKUP2_E_SUCCESS) {
+		result->error = "version exchange failed";
+		mobilebackup2_client_free(mobilebackup2);
+		return NULL;
+	}
+
+	options = plist_new_dict();
+	plist_dict_set_item(options, BENCH_BACKUP_FILE_COUNT_KEY, plist_new_uint(files));
+	plist_dict_set_item(options, BENCH_BACKUP_FILE_SIZE_KEY, plist_new_uint(BENCH_BACKUP_FILE_SIZE));
+	bench_start(result);
+	if (mobilebackup2_send_request(mobilebackup2, request, FAKE_DEVICE_UDID, FAKE_DEVICE_UDID, options) != MOBILEBACKUP2_E_SUCCESS) {
+		result->error = "request failed";
+		mobilebackup2_client_free(mobilebackup2);
+		mobilebackup2 = NULL;
+	}
+	plist_free(options);
+
+	return mobilebackup2;
+}
+
+static int backup_receive_all(mobilebackup2_client_t mobilebackup2, char *data, uint32_t length)
+{
+	uint32_t done = 0;
+
+	while (done < length) {
+		uint32_t received = 0;
+		if ((mobilebackup2_receive_raw(mobilebackup2, data + done, length - done, &received) != MOBILEBACKUP2_E_SUCCESS) || (received == 0)) {
+			return -1;
+		}
+		done += received;
+	}
+	return 0;
+}
+
+/**
+ * Finishes a file transfer and waits for the device to end the operation.
+ */
+static void bench_backup_finish(mobilebackup2_client_t mobilebackup2, struct bench_result *result)
+{
+	plist_t message = NULL;
+	char *dlmessage = NULL;
+	plist_t status = plist_new_dict();
+
+	if (!result->error) {
+		if ((mobilebackup2_send_status_response(mobilebackup2, 0, NULL, status) != MOBILEBACKUP2_E_SUCCESS)
+		    || (mobilebackup2_receive_message(mobilebackup2, &message, &dlmessage) != MOBILEBACKUP2_E_SUCCESS)
+		    || !dlmessage || strcmp(dlmessage, "DLMessageProcessMessage")) {
+			result->error = "operation did not finish";
+		}
+	}
+	bench_stop(result);
+
+	plist_free(status);
+	plist_free(message);
+	free(dlmessage);
+	mobilebackup2_client_free(mobilebackup2);
+}
+
+static void bench_backup_receive(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t files = (BENCH_STREAM_SIZE / BENCH_BACKUP_FILE_SIZE) * ctx->scale;
+	plist_t message = NULL;
+	char *dlmessage = NULL;
+	char name[4096];
+
+	mobilebackup2_client_t mobilebackup2 = bench_backup_start(ctx, result, "Backup", files);
+	if (!mobilebackup2)
+		return;
+
+	if ((mobilebackup2_receive_message(mobilebackup2, &message, &dlmessage) != MOBILEBACKUP2_E_SUCCESS)
+	    || !dlmessage || strcmp(dlmessage, "DLMessageUploadFiles")) {
+		result->error = "no files offered";
+	}
+	plist_free(message);
+	free(dlmessage);
+
+	/* same wire format as mb2_handle_receive_files() in idevicebackup2 */
+	while (!result->error) {
+		uint64_t begin = time_monotonic_usec();
+		uint64_t bytes = 0;
+		uint32_t nlen = 0;
+		char code = 0;
+		int i;
+
+		for (i = 0; i < 2; i++) {
+			if (backup_receive_all(mobilebackup2, (char*)&nlen, sizeof(nlen)) < 0) {
+				result->error = "receive failed";
+				break;
+			}
+			nlen = be32toh(nlen);
+			if ((nlen == 0) || (nlen >= sizeof(name))) {
+				break;
+			}
+			if (backup_receive_all(mobilebackup2, name, nlen) < 0) {
+				result->error = "receive failed";
+				break;
+			}
+		}
+		if (result->error || (nlen == 0)) {
+			break;
+		}
+		if (nlen >= sizeof(name)) {
+			result->error = "invalid file name";
+			break;
+		}
+		do {
+			if ((backup_receive_all(mobilebackup2, (char*)&nlen, sizeof(nlen)) < 0) || (backup_receive_all(mobilebackup2, &code, 1) < 0)) {
+				result->error = "receive failed";
+				break;
+			}
+			nlen = be32toh(nlen);
+			while (nlen > 1) {
+				uint32_t chunk = ((nlen - 1) < BENCH_CHUNK_SIZE) ? nlen - 1 : BENCH_CHUNK_SIZE;
+				if (backup_receive_all(mobilebackup2, ctx->buffer, chunk) < 0) {
+					result->error = "receive failed";
+					break;
+				}
+				bytes += chunk;
+				nlen -= chunk;
+			}
+		} while (!result->error && (code == CODE_FILE_DATA));
+		if (!result->error) {
+			bench_op(result, begin, bytes);
+		}
+	}
+
+	bench_backup_finish(mobilebackup2, result);
+}
+
+static void bench_backup_send(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint32_t files = (BENCH_STREAM_SIZE / BENCH_BACKUP_FILE_SIZE) * ctx->scale;
+	plist_t message = NULL;
+	char *dlmessage = NULL;
+	uint32_t count = 0;
+	uint32_t i;
+
+	mobilebackup2_client_t mobilebackup2 = bench_backup_start(ctx, result, "Restore", files);
+	if (!mobilebackup2)
+		return;
+
+	if ((mobilebackup2_receive_message(mobilebackup2, &message, &dlmessage) != MOBILEBACKUP2_E_SUCCESS)
+	    || !dlmessage || strcmp(dlmessage, "DLMessageDownloadFiles")) {
+		result->error = "no files requested";
+	} else {
+		count = plist_array_get_size(plist_array_get_item(message, 1));
+	}
+	free(dlmessage);
+
+	/* same wire format as mb2_handle_send_files() in idevicebackup2 */
+	for (i = 0; !result->error && (i < count); i++) {
+		plist_t node = plist_array_get_item(plist_array_get_item(message, 1), i);
+		char *path = NULL;
+		char hdr[5];
+		uint32_t nlen;
+		uint32_t pathlen;
+		uint32_t sent = 0;
+		uint32_t done = 0;
+		idevice_iovec_t iov[2];
+		uint64_t begin = time_monotonic_usec();
+
+		plist_get_string_val(node, &path);
+		if (!path) {
+			result->error = "invalid file list";
+			break;
+		}
+		pathlen = (uint32_t)strlen(path);
+		nlen = htobe32(pathlen);
+		iov[0].data = (const char*)&nlen;
+		iov[0].length = sizeof(nlen);
+		iov[1].data = path;
+		iov[1].length = pathlen;
+		if ((mobilebackup2_send_rawv(mobilebackup2, iov, 2, &sent) != MOBILEBACKUP2_E_SUCCESS) || (sent != sizeof(nlen) + pathlen)) {
+			result->error = "send failed";
+		}
+		free(path);
+
+		while (!result->error && (done < BENCH_BACKUP_FILE_SIZE)) {
+			uint32_t length = ((BENCH_BACKUP_FILE_SIZE - done) < BENCH_BACKUP_BLOCK_SIZE) ? BENCH_BACKUP_FILE_SIZE - done : BENCH_BACKUP_BLOCK_SIZE;
+			nlen = htobe32(length + 1);
+			memcpy(hdr, &nlen, sizeof(nlen));
+			hdr[4] = CODE_FILE_DATA;
+			iov[0].data = hdr;
+			iov[0].length = sizeof(hdr);
+			iov[1].data = ctx->buffer;
+			iov[1].length = length;
+			if ((mobilebackup2_send_rawv(mobilebackup2, iov, 2, &sent) != MOBILEBACKUP2_E_SUCCESS) || (sent != sizeof(hdr) + length)) {
+				result->error = "send failed";
+				break;
+			}
+			done += length;
+		}
+		if (!result->error) {
+			nlen = htobe32(1);
+			memcpy(hdr, &nlen, sizeof(nlen));
+			hdr[4] = CODE_SUCCESS;
+			if ((mobilebackup2_send_raw(mobilebackup2, hdr, sizeof(hdr), &sent) != MOBILEBACKUP2_E_SUCCESS) || (sent != sizeof(hdr))) {
+				result->error = "send failed";
+				break;
+			}
+			bench_op(result, begin, done);
+		}
+	}
+	plist_free(message);
+
+	if (!result->error) {
+		uint32_t zero = 0;
+		uint32_t sent = 0;
+		if ((mobilebackup2_send_raw(mobilebackup2, (const char*)&zero, sizeof(zero), &sent) != MOBILEBACKUP2_E_SUCCESS) || (sent != sizeof(zero))) {
+			result->error = "send failed";
+		}
+	}
+
+	bench_backup_finish(mobilebackup2, result);
+}
+
+/* syslog_relay */
+
+struct syslog_lines {
+	uint64_t lines;
+	uint64_t bytes;
+};
+
+static void syslog_lines_cb(const char **lines, const uint32_t *lengths, uint32_t count, void *user_data)
+{
+	struct syslog_lines *received = (struct syslog_lines*)user_data;
+	uint64_t bytes = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		bytes += lengths[i] + 1;
+	}
+	__atomic_add_fetch(&received->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&received->lines, count, __ATOMIC_RELEASE);
+}
+
+static void bench_syslog_relay(struct bench_context *ctx, struct bench_result *result)
+{
+	const uint64_t count = (uint64_t)BENCH_SYSLOG_LINES;
+	struct syslog_lines received = { 0, 0 };
+	syslog_relay_client_t syslog = NULL;
+	uint64_t deadline;
+
+	if (syslog_relay_client_start_service(ctx->device, &syslog, BENCH_LABEL) != SYSLOG_RELAY_E_SUCCESS) {
+		result->error = "could not start service";
+		return;
+	}
+
+	bench_start(result);
+	if (syslog_relay_start_capture_batch(syslog, syslog_lines_cb, &received) != SYSLOG_RELAY_E_SUCCESS) {
+		result->error = "could not start capture";
+	}
+	deadline = time_monotonic_usec() + 60 * 1000000ULL;
+	while (!result->error && (__atomic_load_n(&received.lines, __ATOMIC_ACQUIRE) < count)) {
+		if (time_monotonic_usec() > deadline) {
+			result->error = "timed out";
+			break;
+		}
+		usleep(100);
+	}
+	bench_stop(result);
+
+	syslog_relay_stop_capture(syslog);
+	syslog_relay_client_free(syslog);
+
+	/* lines arrive in batches, there is no meaningful per line latency */
+	result->ops = received.lines;
+	result->bytes = received.bytes;
+}
+
+static struct {
+	const char *name;
+	const char *description;
+	bench_func_t func;
+} benchmarks[] = {
+	{ "connection.roundtrip", "64 byte echo over a plain connection", bench_connection_roundtrip },
+	{ "connection.send", "stream to the device in 64 KiB sends", bench_connection_send },
+	{ "connection.receive", "stream from the device in 64 KiB receives", bench_connection_receive },
+	{ "ssl.handshake", "connect, SSL handshake and disconnect", bench_ssl_handshake },
+	{ "ssl.roundtrip", "64 byte echo over an SSL connection", bench_ssl_roundtrip },
+	{ "ssl.send", "SSL stream to the device in 64 KiB sends", bench_ssl_send },
+	{ "ssl.receive", "SSL stream from the device in 64 KiB receives", bench_ssl_receive },
+	{ "lockdown.handshake", "lockdownd client with handshake and session", bench_lockdown_handshake },
+	{ "lockdown.get_value", "GetValue in a session", bench_lockdown_get_value },
+	{ "lockdown.start_service", "StartService in a session", bench_lockdown_start_service },
+	{ "plist_service.xml", "XML plist request/response", bench_plist_service_xml },
+	{ "plist_service.binary", "binary plist request/response", bench_plist_service_binary },
+	{ "afc.file_info", "GetFileInfo", bench_afc_file_info },
+	{ "afc.file_info_batch", "GetFileInfo in pipelined batches of 64", bench_afc_file_info_batch },
+	{ "afc.file_info_threads", "GetFileInfo from 4 threads sharing a client", bench_afc_file_info_threads },
+	{ "afc.open_close", "FileRefOpen and FileRefClose", bench_afc_open_close },
+	{ "afc.read", "sequential 64 KiB reads", bench_afc_read },
+	{ "afc.read_parallel", "64 KiB reads, 8 in flight", bench_afc_read_parallel },
+	{ "afc.write", "sequential 64 KiB writes", bench_afc_write },
+	{ "afc.write_parallel", "64 KiB writes, 8 in flight", bench_afc_write_parallel },
+	{ "backup.receive", "backup file stream from the device", bench_backup_receive },
+	{ "backup.send", "restore file stream to the device", bench_backup_send },
+	{ "syslog_relay.lines", "syslog lines split into batches", bench_syslog_relay },
+	{ NULL, NULL, NULL }
+};
+
+static int bench_selected(const char *name, char **patterns, int count)
+{
+	int i;
+
+	if (count == 0)
+		return 1;
+
+	for (i = 0; i < count; i++) {
+		if (!strncmp(name, patterns[i], strlen(patterns[i])))
+			return 1;
+	}
+	return 0;
+}
+
+static void print_text(const char *name, const struct bench_result *result)
+{
+	if (result->skipped) {
+		printf("%-24s skipped: %s\n", name, result->skipped);
+		return;
+	}
+	if (result->error) {
+		printf("%-24s FAILED: %s\n", name, result->error);
+		return;
+	}
+	printf("%-24s %10" PRIu64 " %9.3f %12.1f", name, result->ops, (double)result->usec / 1000000.0, (result->usec) ? (double)result->ops * 1000000.0 / (double)result->usec : 0.0);
+	if (result->bytes > 0) {
+		printf(" %10.1f", (result->usec) ? (double)result->bytes / (double)result->usec : 0.0);
+	} else {
+		printf(" %10s", "-");
+	}
+	if (result->latency.count > 0) {
+		printf(" %9" PRIu64 " %9" PRIu64 "\n", histogram_percentile(&result->latency, 50.0), histogram_percentile(&result->latency, 99.0));
+	} else {
+		printf(" %9s %9s\n", "-", "-");
+	}
+}
+
+static void print_json(const char *name, const struct bench_result *result, int first)
+{
+	printf("%s\n  {\"name\": \"%s\"", (first) ? "" : ",", name);
+	if (result->skipped) {
+		printf(", \"skipped\": \"%s\"}", result->skipped);
+		return;
+	}
+	if (result->error) {
+		printf(", \"error\": \"%s\"}", result->error);
+		return;
+	}
+	printf(", \"ops\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"usec\": %" PRIu64, result->ops, result->bytes, result->usec);
+	if (result->latency.count > 0) {
+		char *json = histogram_to_json(&result->latency);
+		if (json) {
+			printf(", \"latency_usec\": %s", json);
+			free(json);
+		}
+	}
+	printf("}");
+}
+
+static int remove_cb(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void print_usage(int argc, char **argv)
+{
+	char *name = NULL;
+
+	name = strrchr(argv[0], '/');
+	printf("Usage: %s [OPTIONS] [BENCHMARK ...]\n", (name ? name + 1: argv[0]));
+	printf("Benchmark the transport and protocol layers against an emulated device.\n\n");
+	printf("Runs all benchmarks or the ones whose names start with one of the\n");
+	printf("given BENCHMARK arguments. No device or usbmuxd is needed.\n\n");
+	printf("  -s, --scale N\t\tmultiply the amount of work by N\n");
+	printf("  -j, --json\t\tprint the results as a JSON array\n");
+	printf("  -l, --list\t\tlist the available benchmarks\n");
+	printf("  -h, --help\t\tprints usage information\n");
+	printf("\n");
+	printf("Throughput is given in MB/s, latencies per operation in microseconds.\n");
+	printf("\n");
+	printf("Homepage: <" PACKAGE_URL ">\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_context ctx;
+	char cache_dir[] = "/tmp/idevicebench.XXXXXX";
+	char **patterns = NULL;
+	int pattern_count = 0;
+	int json = 0;
+	int failed = 0;
+	int first = 1;
+	int i;
+
+	memset(&ctx, '\0', sizeof(ctx));
+	ctx.scale = 1;
+
+	patterns = (char**)calloc(argc, sizeof(char*));
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--scale")) {
+			i++;
+			if (!argv[i] || (atoi(argv[i]) <= 0)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			ctx.scale = (uint32_t)atoi(argv[i]);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--json")) {
+			json = 1;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--list")) {
+			int j;
+			for (j = 0; benchmarks[j].name; j++) {
+				printf("%-24s %s\n", benchmarks[j].name, benchmarks[j].description);
+			}
+			return 0;
+		}
+		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			print_usage(argc, argv);
+			return 0;
+		}
+		else if (argv[i][0] != '-') {
+			patterns[pattern_count++] = argv[i];
+			continue;
+		}
+		else {
+			print_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	/* keep cached device facts of the fake device away from real ones */
+	if (!mkdtemp(cache_dir)) {
+		fprintf(stderr, "ERROR: Could not create a temporary directory.\n");
+		return -1;
+	}
+	setenv("XDG_CACHE_HOME", cache_dir, 1);
+
+	if ((fake_device_init() < 0) || (responders_register(BENCH_SYSLOG_LINES * ctx.scale) < 0)) {
+		fprintf(stderr, "ERROR: Could not set up the fake device.\n");
+		nftw(cache_dir, remove_cb, 8, FTW_DEPTH | FTW_PHYS);
+		return -1;
+	}
+
+	if (idevice_new(&ctx.device, FAKE_DEVICE_UDID) != IDEVICE_E_SUCCESS) {
+		fprintf(stderr, "ERROR: Could not open the fake device.\n");
+		fake_device_cleanup();
+		nftw(cache_dir, remove_cb, 8, FTW_DEPTH | FTW_PHYS);
+		return -1;
+	}
+
+	ctx.buffer = (char*)malloc(BENCH_CHUNK_SIZE);
+	memset(ctx.buffer, 'x', BENCH_CHUNK_SIZE);
+
+	/* lockdownd only offers SSL sessions if the library can handshake with the fake device */
+	if (fake_device_has_ssl()) {
+		idevice_connection_t connection = NULL;
+		if (idevice_connect(ctx.device, BENCH_PORT_ECHO_SSL, &connection) == IDEVICE_E_SUCCESS) {
+			ctx.ssl = (idevice_connection_enable_ssl(connection) == IDEVICE_E_SUCCESS);
+			idevice_disconnect(connection);
+		}
+		if (!ctx.ssl) {
+			fprintf(stderr, "WARNING: SSL handshake with the fake device failed, running without SSL.\n");
+		}
+	}
+	if (!ctx.ssl) {
+		fake_device_disable_ssl();
+	}
+
+	if (json) {
+		printf("[");
+	} else {
+		printf("%-24s %10s %9s %12s %10s %9s %9s\n", "benchmark", "ops", "seconds", "ops/s", "MB/s", "p50 us", "p99 us");
+	}
+	for (i = 0; benchmarks[i].name; i++) {
+		struct bench_result *result;
+
+		if (!bench_selected(benchmarks[i].name, patterns, pattern_count))
+			continue;
+
+		result = (struct bench_result*)calloc(1, sizeof(struct bench_result));
+		if (!result)
+			break;
+		histogram_reset(&result->latency);
+		benchmarks[i].func(&ctx, result);
+		if (result->error)
+			failed = 1;
+
+		if (json) {
+			print_json(benchmarks[i].name, result, first);
+		} else {
+			print_text(benchmarks[i].name, result);
+		}
+		fflush(stdout);
+		first = 0;
+		free(result);
+	}
+	if (json) {
+		printf("\n]\n");
+	}
+
+	idevice_free(ctx.device);
+	fake_device_cleanup();
+	free(ctx.buffer);
+	free(patterns);
+	nftw(cache_dir, remove_cb, 8, FTW_DEPTH | FTW_PHYS);
+
+	return (failed) ? 1 : 0;
+}
@@ -0,0 +1,558 @@
+/*
+ * responders.c
+ * Scripted service responders of the fake device
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <plist/plist.h>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/mobilebackup2.h>
+#include <libimobiledevice/syslog_relay.h>
+
+#include <endianness.h>
+#include "src/afc.h"
+#include "fake_device.h"
+#include "responders.h"
+
+#define RESPONDER_CHUNK_SIZE (64 * 1024)
+#define AFC_MAX_DATA_LENGTH (16 * 1024 * 1024)
+
+/* device link protocol version and file streaming codes, see idevicebackup2 */
+#define DL_VERSION_MAJOR 300
+#define DL_VERSION_MINOR 0
+#define CODE_SUCCESS 0x00
+#define CODE_FILE_DATA 0x0c
+
+/* data every responder sends, only its size matters */
+static char fill_data[RESPONDER_CHUNK_SIZE];
+
+static int responder_discard(struct fake_connection *conn, uint64_t length)
+{
+	char buf[RESPONDER_CHUNK_SIZE];
+
+	while (length > 0) {
+		uint32_t chunk = (length < sizeof(buf)) ? (uint32_t)length : (uint32_t)sizeof(buf);
+		if (fake_connection_read(conn, buf, chunk) < 0) {
+			return -1;
+		}
+		length -= chunk;
+	}
+	return 0;
+}
+
+static int responder_fill(struct fake_connection *conn, uint64_t length)
+{
+	while (length > 0) {
+		uint32_t chunk = (length < sizeof(fill_data)) ? (uint32_t)length : (uint32_t)sizeof(fill_data);
+		if (fake_connection_write(conn, fill_data, chunk) < 0) {
+			return -1;
+		}
+		length -= chunk;
+	}
+	return 0;
+}
+
+/* raw services */
+
+static void echo_handler(struct fake_connection *conn)
+{
+	char *buf = NULL;
+	uint32_t size = 0;
+	uint32_t length = 0;
+
+	while (fake_connection_read(conn, &length, sizeof(length)) == 0) {
+		length = be32toh(length);
+		if (length > size) {
+			char *newbuf = (char*)realloc(buf, length);
+			if (!newbuf) {
+				break;
+			}
+			buf = newbuf;
+			size = length;
+		}
+		if ((fake_connection_read(conn, buf, length) < 0) || (fake_connection_write(conn, buf, length) < 0)) {
+			break;
+		}
+	}
+	free(buf);
+}
+
+static void sink_handler(struct fake_connection *conn)
+{
+	uint64_t length = 0;
+	char ack = 1;
+
+	while (fake_connection_read(conn, &length, sizeof(length)) == 0) {
+		if ((responder_discard(conn, be64toh(length)) < 0) || (fake_connection_write(conn, &ack, 1) < 0)) {
+			break;
+		}
+	}
+}
+
+static void source_handler(struct fake_connection *conn)
+{
+	uint64_t length = 0;
+
+	while (fake_connection_read(conn, &length, sizeof(length)) == 0) {
+		if (responder_fill(conn, be64toh(length)) < 0) {
+			break;
+		}
+	}
+}
+
+static void plist_echo_handler(struct fake_connection *conn)
+{
+	plist_t plist = NULL;
+	int binary = 0;
+
+	while (fake_connection_receive_plist(conn, &plist, &binary) == 0) {
+		int res = fake_connection_send_plist(conn, plist, binary);
+		plist_free(plist);
+		plist = NULL;
+		if (res < 0) {
+			break;
+		}
+	}
+}
+
+/* com.apple.afc */
+
+static int afc_send_response(struct fake_connection *conn, uint64_t packet_num, uint64_t operation, const char *data, uint32_t length, int fill)
+{
+	AFCPacket header;
+
+	memcpy(header.magic, AFC_MAGIC, AFC_MAGIC_LEN);
+	header.entire_length = sizeof(AFCPacket) + length;
+	header.this_length = sizeof(AFCPacket) + ((fill) ? 0 : length);
+	header.packet_num = packet_num;
+	header.operation = operation;
+	AFCPacket_to_LE(&header);
+
+	if (fake_connection_write(conn, &header, sizeof(AFCPacket)) < 0) {
+		return -1;
+	}
+	if (fill) {
+		return responder_fill(conn, length);
+	}
+	return (length > 0) ? fake_connection_write(conn, data, length) : 0;
+}
+
+static int afc_send_status(struct fake_connection *conn, uint64_t packet_num, uint64_t status)
+{
+	uint64_t value = htole64(status);
+	return afc_send_response(conn, packet_num, AFC_OP_STATUS, (const char*)&value, sizeof(value), 0);
+}
+
+static int afc_send_uint64(struct fake_connection *conn, uint64_t packet_num, uint64_t operation, uint64_t value)
+{
+	value = htole64(value);
+	return afc_send_response(conn, packet_num, operation, (const char*)&value, sizeof(value), 0);
+}
+
+/* key/value pairs separated by NUL bytes, like the real device sends them */
+static const char afc_file_info_rest[] =
+	"st_blocks\0" "2048\0"
+	"st_nlink\0" "1\0"
+	"st_ifmt\0" "S_IFREG\0"
+	"st_mtime\0" "1600000000000000000\0"
+	"st_birthtime\0" "1600000000000000000";
+
+static int afc_send_file_info(struct fake_connection *conn, uint64_t packet_num, const char *path, uint32_t path_length)
+{
+	char info[256];
+	uint64_t size = 1048576;
+	int len;
+
+	if ((path_length > strlen(BENCH_AFC_SIZED_PATH_PREFIX)) && (strnlen(path, path_length) < path_length)
+	    && !strncmp(path, BENCH_AFC_SIZED_PATH_PREFIX, strlen(BENCH_AFC_SIZED_PATH_PREFIX))) {
+		size = strtoull(path + strlen(BENCH_AFC_SIZED_PATH_PREFIX), NULL, 10);
+	}
+	len = snprintf(info, sizeof(info), "st_size%c%" PRIu64 "%c", '\0', size, '\0');
+	memcpy(info + len, afc_file_info_rest, sizeof(afc_file_info_rest));
+
+	return afc_send_response(conn, packet_num, AFC_OP_DATA, info, len + sizeof(afc_file_info_rest), 0);
+}
+
+static const char afc_device_info[] =
+	"Model\0" "iPhone12,1\0"
+	"FSTotalBytes\0" "63999004672\0"
+	"FSFreeBytes\0" "31999502336\0"
+	"FSBlockSize\0" "4096";
+
+static const char afc_directory[] = ".\0" "..\0" "file";
+
+static void afc_handler(struct fake_connection *conn)
+{
+	char data[4096];
+	uint64_t next_handle = 1;
+	AFCPacket header;
+
+	while (fake_connection_read(conn, &header, sizeof(AFCPacket)) == 0) {
+		uint64_t data_length;
+		uint64_t payload_length;
+		uint64_t length;
+		int res;
+
+		AFCPacket_from_LE(&header);
+		if (memcmp(header.magic, AFC_MAGIC, AFC_MAGIC_LEN) || (header.this_length < sizeof(AFCPacket)) || (header.entire_length < header.this_length)) {
+			break;
+		}
+
+		/* keep the operation data, drop any payload like written file data */
+		data_length = header.this_length - sizeof(AFCPacket);
+		payload_length = header.entire_length - header.this_length;
+		if (data_length > sizeof(data)) {
+			payload_length += data_length - sizeof(data);
+			data_length = sizeof(data);
+		}
+		if ((fake_connection_read(conn, data, (uint32_t)data_length) < 0) || (responder_discard(conn, payload_length) < 0)) {
+			break;
+		}
+
+		switch (header.operation) {
+		case AFC_OP_GET_FILE_INFO:
+			res = afc_send_file_info(conn, header.packet_num, data, (uint32_t)data_length);
+			break;
+		case AFC_OP_GET_DEVINFO:
+			res = afc_send_response(conn, header.packet_num, AFC_OP_DATA, afc_device_info, sizeof(afc_device_info), 0);
+			break;
+		case AFC_OP_READ_DIR:
+			res = afc_send_response(conn, header.packet_num, AFC_OP_DATA, afc_directory, sizeof(afc_directory), 0);
+			break;
+		case AFC_OP_FILE_OPEN:
+			res = afc_send_uint64(conn, header.packet_num, AFC_OP_FILE_OPEN_RES, next_handle++);
+			break;
+		case AFC_OP_FILE_TELL:
+			res = afc_send_uint64(conn, header.packet_num, AFC_OP_FILE_TELL_RES, 0);
+			break;
+		case AFC_OP_FILE_READ:
+		case AFC_OP_FILE_READ_OFFSET:
+			/* files have any size that is asked for */
+			if (data_length < ((header.operation == AFC_OP_FILE_READ) ? 16 : 24)) {
+				res = afc_send_status(conn, header.packet_num, AFC_E_INVALID_ARG);
+				break;
+			}
+			memcpy(&length, data + data_length - 8, sizeof(length));
+			length = le64toh(length);
+			if (length > AFC_MAX_DATA_LENGTH) {
+				length = AFC_MAX_DATA_LENGTH;
+			}
+			res = afc_send_response(conn, header.packet_num, AFC_OP_DATA, NULL, (uint32_t)length, 1);
+			break;
+		case AFC_OP_MAKE_DIR:
+		case AFC_OP_REMOVE_PATH:
+		case AFC_OP_RENAME_PATH:
+		case AFC_OP_TRUNCATE:
+		case AFC_OP_FILE_WRITE:
+		case AFC_OP_FILE_WRITE_OFFSET:
+		case AFC_OP_FILE_SEEK:
+		case AFC_OP_FILE_CLOSE:
+		case AFC_OP_FILE_SET_SIZE:
+		case AFC_OP_FILE_LOCK:
+		case AFC_OP_SET_FILE_MOD_TIME:
+			res = afc_send_status(conn, header.packet_num, AFC_E_SUCCESS);
+			break;
+		default:
+			res = afc_send_status(conn, header.packet_num, AFC_E_OP_NOT_SUPPORTED);
+			break;
+		}
+		if (res < 0) {
+			break;
+		}
+	}
+}
+
+/* com.apple.mobilebackup2 */
+
+static int dl_send(struct fake_connection *conn, plist_t array)
+{
+	int res = fake_connection_send_plist(conn, array, 1);
+	plist_free(array);
+	return res;
+}
+
+static int dl_send_process_message(struct fake_connection *conn, plist_t dict)
+{
+	plist_t array = plist_new_array();
+	plist_array_append_item(array, plist_new_string("DLMessageProcessMessage"));
+	plist_array_append_item(array, dict);
+	return dl_send(conn, array);
+}
+
+static int dl_send_response(struct fake_connection *conn, uint64_t error_code)
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_set_item(dict, "MessageName", plist_new_string("Response"));
+	plist_dict_set_item(dict, "ErrorCode", plist_new_uint(error_code));
+	return dl_send_process_message(conn, dict);
+}
+
+static int backup_send_name(struct fake_connection *conn, const char *name)
+{
+	uint32_t length = (uint32_t)strlen(name);
+	uint32_t nlen = htobe32(length);
+
+	if (fake_connection_write(conn, &nlen, sizeof(nlen)) < 0) {
+		return -1;
+	}
+	return fake_connection_write(conn, name, length);
+}
+
+/**
+ * Streams files to the host the way the device does during a backup, see
+ * mb2_handle_receive_files() in idevicebackup2.
+ */
+static int backup_send_files(struct fake_connection *conn, uint64_t count, uint64_t size)
+{
+	plist_t array = plist_new_array();
+	char name[64];
+	char hdr[5];
+	uint32_t nlen;
+	uint64_t i;
+
+	plist_array_append_item(array, plist_new_string("DLMessageUploadFiles"));
+	plist_array_append_item(array, plist_new_dict());
+	plist_array_append_item(array, plist_new_string("___EmptyParameterString___"));
+	plist_array_append_item(array, plist_new_uint(count * size));
+	if (dl_send(conn, array) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		uint64_t sent = 0;
+
+		snprintf(name, sizeof(name), "%s/%02x/%040" PRIx64, FAKE_DEVICE_UDID, (unsigned int)(i & 0xff), i);
+		if ((backup_send_name(conn, name) < 0) || (backup_send_name(conn, name + strlen(FAKE_DEVICE_UDID) + 1) < 0)) {
+			return -1;
+		}
+		while (sent < size) {
+			uint32_t block = ((size - sent) < BENCH_BACKUP_BLOCK_SIZE) ? (uint32_t)(size - sent) : BENCH_BACKUP_BLOCK_SIZE;
+			nlen = htobe32(block + 1);
+			memcpy(hdr, &nlen, sizeof(nlen));
+			hdr[4] = CODE_FILE_DATA;
+			if ((fake_connection_write(conn, hdr, sizeof(hdr)) < 0) || (responder_fill(conn, block) < 0)) {
+				return -1;
+			}
+			sent += block;
+		}
+		nlen = htobe32(1);
+		memcpy(hdr, &nlen, sizeof(nlen));
+		hdr[4] = CODE_SUCCESS;
+		if (fake_connection_write(conn, hdr, sizeof(hdr)) < 0) {
+			return -1;
+		}
+	}
+
+	/* a zero length name ends the transfer */
+	nlen = 0;
+	return fake_connection_write(conn, &nlen, sizeof(nlen));
+}
+
+/**
+ * Asks the host for files and receives them the way the device does during
+ * a restore, see mb2_handle_send_files() in idevicebackup2.
+ */
+static int backup_receive_files(struct fake_connection *conn, uint64_t count)
+{
+	plist_t array = plist_new_array();
+	plist_t files = plist_new_array();
+	char name[64];
+	uint32_t nlen;
+	char code;
+	uint64_t i;
+
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "%s/%02x/%040" PRIx64, FAKE_DEVICE_UDID, (unsigned int)(i & 0xff), i);
+		plist_array_append_item(files, plist_new_string(name));
+	}
+	plist_array_append_item(array, plist_new_string("DLMessageDownloadFiles"));
+	plist_array_append_item(array, files);
+	plist_array_append_item(array, plist_new_real(0.0));
+	if (dl_send(conn, array) < 0) {
+		return -1;
+	}
+
+	while (1) {
+		if (fake_connection_read(conn, &nlen, sizeof(nlen)) < 0) {
+			return -1;
+		}
+		nlen = be32toh(nlen);
+		if (nlen == 0) {
+			break;
+		}
+		if ((nlen > 4096) || (responder_discard(conn, nlen) < 0)) {
+			return -1;
+		}
+		do {
+			if ((fake_connection_read(conn, &nlen, sizeof(nlen)) < 0) || (fake_connection_read(conn, &code, 1) < 0)) {
+				return -1;
+			}
+			nlen = be32toh(nlen);
+			if ((nlen == 0) || (responder_discard(conn, nlen - 1) < 0)) {
+				return -1;
+			}
+		} while (code == CODE_FILE_DATA);
+	}
+
+	return 0;
+}
+
+static uint64_t backup_get_option(plist_t message, const char *key, uint64_t default_value)
+{
+	plist_t node = plist_access_path(message, 2, "Options", key);
+	uint64_t value = default_value;
+
+	if (node && (plist_get_node_type(node) == PLIST_UINT)) {
+		plist_get_uint_val(node, &value);
+	}
+	return value;
+}
+
+static void mobilebackup2_handler(struct fake_connection *conn)
+{
+	plist_t array;
+	plist_t message = NULL;
+	int binary = 0;
+
+	array = plist_new_array();
+	plist_array_append_item(array, plist_new_string("DLMessageVersionExchange"));
+	plist_array_append_item(array, plist_new_uint(DL_VERSION_MAJOR));
+	plist_array_append_item(array, plist_new_uint(DL_VERSION_MINOR));
+	if (dl_send(conn, array) < 0) {
+		return;
+	}
+	if (fake_connection_receive_plist(conn, &message, &binary) < 0) {
+		return;
+	}
+	plist_free(message);
+	message = NULL;
+
+	array = plist_new_array();
+	plist_array_append_item(array, plist_new_string("DLMessageDeviceReady"));
+	if (dl_send(conn, array) < 0) {
+		return;
+	}
+
+	while (fake_connection_receive_plist(conn, &message, &binary) == 0) {
+		plist_t node = plist_array_get_item(message, 0);
+		char *dlmessage = NULL;
+		char *name = NULL;
+		int res = 0;
+
+		if (node && (plist_get_node_type(node) == PLIST_STRING)) {
+			plist_get_string_val(node, &dlmessage);
+		}
+		if (!dlmessage || !strcmp(dlmessage, "DLMessageDisconnect")) {
+			free(dlmessage);
+			plist_free(message);
+			break;
+		}
+
+		if (!strcmp(dlmessage, "DLMessageProcessMessage")) {
+			node = plist_access_path(message, 2, 1, "MessageName");
+			if (node && (plist_get_node_type(node) == PLIST_STRING)) {
+				plist_get_string_val(node, &name);
+			}
+			plist_t request = plist_array_get_item(message, 1);
+			if (name && !strcmp(name, "Hello")) {
+				plist_t dict = plist_new_dict();
+				plist_dict_set_item(dict, "MessageName", plist_new_string("Response"));
+				plist_dict_set_item(dict, "ErrorCode", plist_new_uint(0));
+				plist_dict_set_item(dict, "ProtocolVersion", plist_new_real(2.1));
+				res = dl_send_process_message(conn, dict);
+			} else if (name && !strcmp(name, "Backup")) {
+				res = backup_send_files(conn, backup_get_option(request, BENCH_BACKUP_FILE_COUNT_KEY, 1), backup_get_option(request, BENCH_BACKUP_FILE_SIZE_KEY, 0));
+			} else if (name && !strcmp(name, "Restore")) {
+				if (backup_receive_files(conn, backup_get_option(request, BENCH_BACKUP_FILE_COUNT_KEY, 1)) < 0) {
+					res = -1;
+				}
+			} else {
+				res = dl_send_response(conn, 1);
+			}
+		} else if (!strcmp(dlmessage, "DLMessageStatusResponse")) {
+			/* the host finished a file transfer, which ends the operation */
+			res = dl_send_response(conn, 0);
+		}
+		free(name);
+		free(dlmessage);
+		plist_free(message);
+		message = NULL;
+		if (res < 0) {
+			break;
+		}
+	}
+}
+
+/* com.apple.syslog_relay */
+
+static void syslog_relay_handler(struct fake_connection *conn)
+{
+	uint32_t lines = *(uint32_t*)conn->user_data;
+	char buf[RESPONDER_CHUNK_SIZE];
+	char line[BENCH_SYSLOG_LINE_LENGTH + 1];
+	uint32_t per_chunk = sizeof(buf) / BENCH_SYSLOG_LINE_LENGTH;
+	uint32_t i;
+	char c;
+
+	/* a typical line, padded to a fixed length so the byte count is known */
+	snprintf(line, sizeof(line), "%-*s\n", BENCH_SYSLOG_LINE_LENGTH - 1, "Oct 18 12:00:00 iPhone kernel(Sandbox)[0] <Notice>: Sandbox: bench(42) allow file-read-data /var/mobile");
+	for (i = 0; i < per_chunk; i++) {
+		memcpy(buf + i * BENCH_SYSLOG_LINE_LENGTH, line, BENCH_SYSLOG_LINE_LENGTH);
+	}
+
+	while (lines > 0) {
+		uint32_t count = (lines < per_chunk) ? lines : per_chunk;
+		if (fake_connection_write(conn, buf, count * BENCH_SYSLOG_LINE_LENGTH) < 0) {
+			return;
+		}
+		lines -= count;
+	}
+
+	/* the relay never ends on its own, wait for the host to hang up */
+	fake_connection_read(conn, &c, 1);
+}
+
+int responders_register(uint32_t syslog_lines)
+{
+	static uint32_t lines;
+	int res = 0;
+
+	lines = syslog_lines;
+	memset(fill_data, 'x', sizeof(fill_data));
+
+	res |= fake_device_add_service(NULL, BENCH_PORT_ECHO, echo_handler, 0, NULL);
+	res |= fake_device_add_service(NULL, BENCH_PORT_SINK, sink_handler, 0, NULL);
+	res |= fake_device_add_service(NULL, BENCH_PORT_SOURCE, source_handler, 0, NULL);
+	if (fake_device_has_ssl()) {
+		res |= fake_device_add_service(NULL, BENCH_PORT_ECHO_SSL, echo_handler, 1, NULL);
+		res |= fake_device_add_service(NULL, BENCH_PORT_SINK_SSL, sink_handler, 1, NULL);
+		res |= fake_device_add_service(NULL, BENCH_PORT_SOURCE_SSL, source_handler, 1, NULL);
+	}
+	res |= fake_device_add_service(BENCH_PLIST_ECHO_SERVICE_NAME, 5020, plist_echo_handler, 0, NULL);
+	res |= fake_device_add_service(AFC_SERVICE_NAME, 5030, afc_handler, 0, NULL);
+	res |= fake_device_add_service(MOBILEBACKUP2_SERVICE_NAME, 5040, mobilebackup2_handler, 0, NULL);
+	res |= fake_device_add_service(SYSLOG_RELAY_SERVICE_NAME, 5050, syslog_relay_handler, 0, &lines);
+
+	return (res < 0) ? -1 : 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * responders.h
+ * Scripted service responders of the fake device - header file
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RESPONDERS_H
+#define __RESPONDERS_H
+
+#include <stdint.h>
+
+/*
+ * Raw services, connected to directly by port:
+ *  echo    receives a be32 length followed by that many bytes and sends
+ *          the bytes back
+ *  sink    receives a be64 length followed by that many bytes and
+ *          acknowledges them with a single byte
+ *  source  receives a be64 length and sends that many bytes
+ * The _SSL variants expect an SSL handshake right after connecting.
+ */
+#define BENCH_PORT_ECHO       5001
+#define BENCH_PORT_SINK       5002
+#define BENCH_PORT_SOURCE     5003
+#define BENCH_PORT_ECHO_SSL   5011
+#define BENCH_PORT_SINK_SSL   5012
+#define BENCH_PORT_SOURCE_SSL 5013
+
+/* sends every plist it receives back in the same format */
+#define BENCH_PLIST_ECHO_SERVICE_NAME "org.libimobiledevice.bench.plist_echo"
+
+/*
+ * The AFC responder reports the number following this prefix as the
+ * st_size of a path, so clients can tell which request a response
+ * answers. Other paths get a fixed size of 1 MiB.
+ */
+#define BENCH_AFC_SIZED_PATH_PREFIX "/bench/size/"
+
+/* options of the Backup request telling the responder what to stream */
+#define BENCH_BACKUP_FILE_COUNT_KEY "BenchFileCount"
+#define BENCH_BACKUP_FILE_SIZE_KEY "BenchFileSize"
+
+/* size of the blocks files are streamed in by the mobilebackup2 responder */
+#define BENCH_BACKUP_BLOCK_SIZE (32 * 1024)
+
+/* the syslog_relay responder sends lines of this length, newline included */
+#define BENCH_SYSLOG_LINE_LENGTH 128
+
+/**
+ * Registers lockdownd services and raw ports of all responders with the
+ * fake device. The syslog_relay responder sends syslog_lines lines per
+ * connection and then waits for the client to disconnect.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int responders_register(uint32_t syslog_lines);
+
+#endif
@@ -40,10 +40,19 @@
 #endif
 
 static int debug_level;
+static unsigned int debug_categories = DEBUG_CATEGORY_ALL;
+unsigned int internal_debug_mask = 0;
 
 void internal_set_debug_level(int level)
 {
 	debug_level = level;
+	internal_debug_mask = (debug_level) ? debug_categories : 0;
+}
+
+void internal_set_debug_categories(unsigned int categories)
+{
+	debug_categories = categories & DEBUG_CATEGORY_ALL;
+	internal_debug_mask = (debug_level) ? debug_categories : 0;
 }
 
 #define MAX_PRINT_LEN 16*1024
@@ -51,30 +60,17 @@ void internal_set_debug_level(int level)
 #ifndef STRIP_DEBUG_CODE
 static void debug_print_line(const char *func, const char *file, int line, const char *buffer)
 {
-	char *str_time = NULL;
-	char *header = NULL;
+	char str_time[16];
 	time_t the_time;
 
 	time(&the_time);
-	str_time = (char*)malloc(255);
-	strftime(str_time, 254, "%H:%M:%S", localtime (&the_time));
-
-	/* generate header text */
-	(void)asprintf(&header, "%s %s:%d %s()", str_time, file, line, func);
-	free (str_time);
+	strftime(str_time, sizeof(str_time), "%H:%M:%S", localtime (&the_time));
 
-	/* trim ending newlines */
-
-	/* print header */
-	printf ("%s: ", header);
-
-	/* print actual debug content */
-	printf ("%s\n", buffer);
+	/* print header and actual debug content */
+	printf ("%s %s:%d %s(): %s\n", str_time, file, line, func, buffer);
 
 	/* flush this output, as we need to debug */
 	fflush (stdout);
-
-	free (header);
 }
 #endif
 
@@ -84,7 +80,7 @@ void debug_info_real(const char *func, const char *file, int line, const char *f
 	va_list args;
 	char *buffer = NULL;
 
-	if (!debug_level)
+	if (!debug_enabled(DEBUG_CATEGORY_INFO))
 		return;
 
 	/* run the real fprintf */
@@ -98,14 +94,14 @@ void debug_info_real(const char *func, const char *file, int line, const char *f
 #endif
 }
 
-void debug_buffer(const char *data, const int length)
+void debug_buffer_real(const char *data, const int length)
 {
 #ifndef STRIP_DEBUG_CODE
 	int i;
 	int j;
 	unsigned char c;
 
-	if (debug_level) {
+	if (debug_enabled(DEBUG_CATEGORY_BUFFER)) {
 		for (i = 0; i < length; i += 16) {
 			fprintf(stderr, "%04x: ", i);
 			for (j = 0; j < 16; j++) {
@@ -133,10 +129,10 @@ void debug_buffer(const char *data, const int length)
 #endif
 }
 
-void debug_buffer_to_file(const char *file, const char *data, const int length)
+void debug_buffer_to_file_real(const char *file, const char *data, const int length)
 {
 #ifndef STRIP_DEBUG_CODE
-	if (debug_level) {
+	if (debug_enabled(DEBUG_CATEGORY_BUFFER)) {
 		FILE *f = fopen(file, "wb");
 		fwrite(data, 1, length, f);
 		fflush(f);
@@ -148,7 +144,7 @@ void debug_buffer_to_file(const char *file, const char *data, const int length)
 void debug_plist_real(const char *func, const char *file, int line, plist_t plist)
 {
 #ifndef STRIP_DEBUG_CODE
-	if (!plist)
+	if (!plist || !debug_enabled(DEBUG_CATEGORY_PLIST))
 		return;
 
 	char *buffer = NULL;
@@ -159,10 +155,15 @@ void debug_plist_real(const char *func, const char *file, int line, plist_t plis
 	if (buffer[length-1] == '\n')
 		buffer[length-1] = '\0';
 
+	char *msg = NULL;
 	if (length <= MAX_PRINT_LEN)
-		debug_info_real(func, file, line, "printing %i bytes plist:\n%s", length, buffer);
+		(void)asprintf(&msg, "printing %i bytes plist:\n%s", length, buffer);
 	else
-		debug_info_real(func, file, line, "supress printing %i bytes plist...\n", length);
+		(void)asprintf(&msg, "supress printing %i bytes plist...\n", length);
+	if (msg) {
+		debug_print_line(func, file, line, msg);
+		free(msg);
+	}
 
 	free(buffer);
 #endif
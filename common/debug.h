@@ -25,29 +25,48 @@
 
 #include <plist/plist.h>
 
+/* categories of debug output, matching enum idevice_debug_category */
+#define DEBUG_CATEGORY_INFO   (1 << 0)
+#define DEBUG_CATEGORY_PLIST  (1 << 1)
+#define DEBUG_CATEGORY_BUFFER (1 << 2)
+#define DEBUG_CATEGORY_ALL    (DEBUG_CATEGORY_INFO | DEBUG_CATEGORY_PLIST | DEBUG_CATEGORY_BUFFER)
+
+/* categories currently printed; 0 whenever the debug level is 0 */
+extern unsigned int internal_debug_mask;
+
+#ifndef STRIP_DEBUG_CODE
+#define debug_enabled(category) (internal_debug_mask & (category))
+#else
+#define debug_enabled(category) 0
+#endif
+
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L && !defined(STRIP_DEBUG_CODE)
-#define debug_info(...) debug_info_real (__func__, __FILE__, __LINE__, __VA_ARGS__)
-#define debug_plist(a) debug_plist_real (__func__, __FILE__, __LINE__, a)
+#define debug_info(...) do { if (debug_enabled(DEBUG_CATEGORY_INFO)) debug_info_real (__func__, __FILE__, __LINE__, __VA_ARGS__); } while (0)
+#define debug_plist(a) do { if (debug_enabled(DEBUG_CATEGORY_PLIST)) debug_plist_real (__func__, __FILE__, __LINE__, a); } while (0)
 #elif defined(__GNUC__) && __GNUC__ >= 3 && !defined(STRIP_DEBUG_CODE)
-#define debug_info(...) debug_info_real (__FUNCTION__, __FILE__, __LINE__, __VA_ARGS__)
-#define debug_plist(a) debug_plist_real (__FUNCTION__, __FILE__, __LINE__, a)
+#define debug_info(...) do { if (debug_enabled(DEBUG_CATEGORY_INFO)) debug_info_real (__FUNCTION__, __FILE__, __LINE__, __VA_ARGS__); } while (0)
+#define debug_plist(a) do { if (debug_enabled(DEBUG_CATEGORY_PLIST)) debug_plist_real (__FUNCTION__, __FILE__, __LINE__, a); } while (0)
 #else
 #define debug_info(...)
 #define debug_plist(a)
 #endif
 
+#define debug_buffer(data, length) do { if (debug_enabled(DEBUG_CATEGORY_BUFFER)) debug_buffer_real(data, length); } while (0)
+#define debug_buffer_to_file(file, data, length) do { if (debug_enabled(DEBUG_CATEGORY_BUFFER)) debug_buffer_to_file_real(file, data, length); } while (0)
+
 void debug_info_real(const char *func,
 											const char *file,
 											int	line,
 											const char *format, ...);
 
-void debug_buffer(const char *data, const int length);
-void debug_buffer_to_file(const char *file, const char *data, const int length);
+void debug_buffer_real(const char *data, const int length);
+void debug_buffer_to_file_real(const char *file, const char *data, const int length);
 void debug_plist_real(const char *func,
 											const char *file,
 											int	line,
 											plist_t plist);
 
 void internal_set_debug_level(int level);
+void internal_set_debug_categories(unsigned int categories);
 
 #endif
@@ -0,0 +1,134 @@
+/*
+ * histogram.c
+ * Log-linear latency histograms
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "histogram.h"
+
+static int histogram_bucket_index(uint64_t value)
+{
+	int exponent = 0;
+
+	if (value < 2 * HISTOGRAM_SUB_BUCKETS) {
+		return (int)value;
+	}
+	/* shift the value until it lies in [SUB_BUCKETS, 2 * SUB_BUCKETS) */
+	while ((value >> exponent) >= 2 * HISTOGRAM_SUB_BUCKETS) {
+		exponent++;
+	}
+	if (exponent > HISTOGRAM_MAX_EXPONENT) {
+		return HISTOGRAM_BUCKETS - 1;
+	}
+	return (exponent + 1) * HISTOGRAM_SUB_BUCKETS + (int)((value >> exponent) - HISTOGRAM_SUB_BUCKETS);
+}
+
+uint64_t histogram_bucket_value(int bucket)
+{
+	int exponent;
+
+	if (bucket < 2 * HISTOGRAM_SUB_BUCKETS) {
+		return (uint64_t)bucket;
+	}
+	exponent = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return (uint64_t)(bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS) << exponent;
+}
+
+void histogram_reset(struct histogram *hist)
+{
+	memset(hist, '\0', sizeof(struct histogram));
+}
+
+void histogram_record(struct histogram *hist, uint64_t value)
+{
+	if (hist->count == 0 || value < hist->min) {
+		hist->min = value;
+	}
+	if (value > hist->max) {
+		hist->max = value;
+	}
+	hist->count++;
+	hist->sum += value;
+	hist->buckets[histogram_bucket_index(value)]++;
+}
+
+uint64_t histogram_percentile(const struct histogram *hist, double percentile)
+{
+	uint64_t target;
+	uint64_t seen = 0;
+	int i;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+	target = (uint64_t)((percentile / 100.0) * (double)hist->count + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			/* report the upper end of the bucket, capped by the real maximum */
+			uint64_t value = (i + 1 < HISTOGRAM_BUCKETS) ? histogram_bucket_value(i + 1) - 1 : hist->max;
+			return (value > hist->max) ? hist->max : value;
+		}
+	}
+	return hist->max;
+}
+
+char *histogram_to_json(const struct histogram *hist)
+{
+	size_t size = 512;
+	size_t len;
+	char *json;
+	int first = 1;
+	int i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (hist->buckets[i]) {
+			size += 48;
+		}
+	}
+	json = (char*)malloc(size);
+	if (!json) {
+		return NULL;
+	}
+
+	len = snprintf(json, size, "{\"count\": %" PRIu64 ", \"min\": %" PRIu64 ", \"max\": %" PRIu64 ", \"mean\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"p999\": %" PRIu64 ", \"buckets\": [",
+		hist->count, hist->min, hist->max, (hist->count) ? hist->sum / hist->count : 0,
+		histogram_percentile(hist, 50.0), histogram_percentile(hist, 90.0),
+		histogram_percentile(hist, 99.0), histogram_percentile(hist, 99.9));
+	for (i = 0; i < HISTOGRAM_BUCKETS && len < size; i++) {
+		if (!hist->buckets[i]) {
+			continue;
+		}
+		len += snprintf(json + len, size - len, "%s[%" PRIu64 ", %" PRIu64 "]", (first) ? "" : ", ", histogram_bucket_value(i), hist->buckets[i]);
+		first = 0;
+	}
+	if (len < size) {
+		snprintf(json + len, size - len, "]}");
+	}
+
+	return json;
+}
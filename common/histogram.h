@@ -0,0 +1,67 @@
+/*
+ * histogram.h
+ * Log-linear latency histograms - header file
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Values below 2 * HISTOGRAM_SUB_BUCKETS get a bucket each; above that every
+ * power of two range is split into HISTOGRAM_SUB_BUCKETS equal buckets, so
+ * a recorded value is off by at most 1/HISTOGRAM_SUB_BUCKETS (6.25%) over
+ * the whole range up to 2^40.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_EXPONENT 36
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_EXPONENT + 2) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_reset(struct histogram *hist);
+void histogram_record(struct histogram *hist, uint64_t value);
+
+/**
+ * @return The lowest value counted in the given bucket.
+ */
+uint64_t histogram_bucket_value(int bucket);
+
+/**
+ * @return The value below which the given percentage of the recorded
+ *     values lie, or 0 if the histogram is empty.
+ */
+uint64_t histogram_percentile(const struct histogram *hist, double percentile);
+
+/**
+ * Formats a histogram as a JSON object with count, min, max, mean,
+ * p50, p90, p99 and p999 members and a buckets array holding a
+ * [lowest value, count] pair for every non-empty bucket.
+ *
+ * @return A newly allocated string that has to be freed by the caller.
+ */
+char *histogram_to_json(const struct histogram *hist);
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * trace.c
+ * Binary per-thread trace ring buffers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+#include "trace.h"
+#include "thread.h"
+
+/*
+ * Every thread records into its own ring, so writing a record needs no
+ * lock: only the owning thread advances head, and it publishes a record by
+ * storing the new head with release semantics after filling it in. Like a
+ * seqlock writer it first announces the slot it is about to overwrite in
+ * claimed, followed by a fence that keeps the record stores after it.
+ * Readers copy the records up to head, then load claimed after an acquire
+ * fence and drop every record the owner may have touched in the meantime.
+ * The ring of an exited thread is handed to the next new thread; on WIN32
+ * rings are not reused.
+ */
+struct trace_ring {
+	uint64_t head;
+	uint64_t claimed;
+	uint32_t thread;
+	int in_use;
+	struct trace_record records[TRACE_RING_SIZE];
+};
+
+unsigned int internal_trace_mask = 0;
+
+static struct trace_ring *rings[TRACE_MAX_RINGS];
+static int ring_count = 0;
+static uint32_t next_thread = 1;
+static mutex_t rings_mutex;
+static thread_once_t init_once = THREAD_ONCE_INIT;
+static __thread struct trace_ring *local_ring = NULL;
+/* set once all rings were taken, so the thread stops asking for one */
+static __thread int local_ring_unavailable = 0;
+#ifndef WIN32
+static pthread_key_t ring_key;
+#endif
+
+#ifndef WIN32
+static void trace_ring_release(void *data)
+{
+	struct trace_ring *ring = (struct trace_ring*)data;
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+static void trace_init(void)
+{
+	mutex_init(&rings_mutex);
+#ifndef WIN32
+	pthread_key_create(&ring_key, trace_ring_release);
+#endif
+}
+
+/**
+ * Assigns a ring to the calling thread, reusing the ring of a thread that
+ * has exited if possible.
+ *
+ * @return The ring, or NULL if all rings are in use.
+ */
+static struct trace_ring *trace_ring_acquire(void)
+{
+	struct trace_ring *ring = NULL;
+	int i;
+
+	thread_once(&init_once, trace_init);
+
+	mutex_lock(&rings_mutex);
+	for (i = 0; i < ring_count; i++) {
+		if (!__atomic_load_n(&rings[i]->in_use, __ATOMIC_ACQUIRE)) {
+			ring = rings[i];
+			break;
+		}
+	}
+	if (!ring && (ring_count < TRACE_MAX_RINGS)) {
+		ring = (struct trace_ring*)calloc(1, sizeof(struct trace_ring));
+		if (ring) {
+			rings[ring_count++] = ring;
+		}
+	}
+	if (ring) {
+		ring->thread = next_thread++;
+		ring->in_use = 1;
+	}
+	mutex_unlock(&rings_mutex);
+
+	if (ring) {
+#ifndef WIN32
+		pthread_setspecific(ring_key, ring);
+#endif
+		local_ring = ring;
+	}
+	return ring;
+}
+
+static uint64_t trace_now(void)
+{
+#ifdef WIN32
+	FILETIME ft;
+	uint64_t t;
+	GetSystemTimeAsFileTime(&ft);
+	t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	/* 100ns intervals since 1601-01-01 */
+	return (t - 116444736000000000ULL) * 100;
+#elif defined(CLOCK_REALTIME)
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000ULL + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+void trace_write(uint16_t category, uint16_t event, int32_t result, uint64_t arg0, uint64_t arg1, const char *tag)
+{
+	struct trace_ring *ring = local_ring;
+	struct trace_record *record;
+	uint64_t head;
+
+	if (!ring) {
+		if (local_ring_unavailable) {
+			return;
+		}
+		ring = trace_ring_acquire();
+		if (!ring) {
+			local_ring_unavailable = 1;
+			return;
+		}
+	}
+
+	head = ring->head;
+	__atomic_store_n(&ring->claimed, head + 1, __ATOMIC_RELAXED);
+	/* the record must not change before readers can see the claim */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+	record->timestamp = trace_now();
+	record->thread = ring->thread;
+	record->result = result;
+	record->category = category;
+	record->event = event;
+	record->reserved = 0;
+	record->arg0 = arg0;
+	record->arg1 = arg1;
+	if (tag) {
+		strncpy(record->tag, tag, TRACE_TAG_SIZE);
+	} else {
+		record->tag[0] = '\0';
+	}
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void internal_set_trace_categories(unsigned int categories)
+{
+	internal_trace_mask = categories & TRACE_CATEGORY_ALL;
+}
+
+/**
+ * Copies the valid records of a ring.
+ *
+ * @return The number of records stored in buffer.
+ */
+static uint32_t trace_ring_snapshot(struct trace_ring *ring, struct trace_record *buffer)
+{
+	uint64_t start;
+	uint64_t end;
+	uint64_t first;
+	uint64_t i;
+	uint32_t count = 0;
+
+	end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	start = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+	for (i = start; i < end; i++) {
+		buffer[i - start] = ring->records[i & (TRACE_RING_SIZE - 1)];
+	}
+
+	/* drop what the owner overwrote while we were copying, including the
+	 * slot it may be writing right now */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	first = __atomic_load_n(&ring->claimed, __ATOMIC_RELAXED);
+	first = (first > TRACE_RING_SIZE) ? first - TRACE_RING_SIZE : 0;
+	if (first > start) {
+		if (first >= end) {
+			return 0;
+		}
+		memmove(buffer, buffer + (first - start), (size_t)(end - first) * sizeof(struct trace_record));
+		count = (uint32_t)(end - first);
+	} else {
+		count = (uint32_t)(end - start);
+	}
+	return count;
+}
+
+int trace_save(const char *path)
+{
+	struct trace_record *records = NULL;
+	uint32_t header[3];
+	uint32_t total = 0;
+	int count;
+	int i;
+	FILE *f;
+
+	thread_once(&init_once, trace_init);
+
+	f = fopen(path, "wb");
+	if (!f) {
+		return -1;
+	}
+
+	mutex_lock(&rings_mutex);
+	count = ring_count;
+	if (count > 0) {
+		records = (struct trace_record*)malloc((size_t)count * TRACE_RING_SIZE * sizeof(struct trace_record));
+		if (!records) {
+			mutex_unlock(&rings_mutex);
+			fclose(f);
+			return -1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		total += trace_ring_snapshot(rings[i], records + total);
+	}
+	mutex_unlock(&rings_mutex);
+
+	header[0] = TRACE_FILE_BYTE_ORDER;
+	header[1] = sizeof(struct trace_record);
+	header[2] = total;
+
+	int res = 0;
+	if ((fwrite(TRACE_FILE_MAGIC, 1, TRACE_FILE_MAGIC_LEN, f) != TRACE_FILE_MAGIC_LEN)
+	    || (fwrite(header, sizeof(uint32_t), 3, f) != 3)
+	    || (total > 0 && fwrite(records, sizeof(struct trace_record), total, f) != total)) {
+		res = -1;
+	}
+	if (fclose(f) != 0) {
+		res = -1;
+	}
+	free(records);
+
+	return res;
+}
+
+int trace_file_read(const char *path, trace_record_cb_t callback, void *user_data)
+{
+	char magic[TRACE_FILE_MAGIC_LEN];
+	struct trace_record record;
+	uint32_t header[3];
+	uint32_t i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		return -1;
+	}
+
+	if ((fread(magic, 1, TRACE_FILE_MAGIC_LEN, f) != TRACE_FILE_MAGIC_LEN)
+	    || memcmp(magic, TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_LEN)
+	    || (fread(header, sizeof(uint32_t), 3, f) != 3)
+	    || (header[0] != TRACE_FILE_BYTE_ORDER)
+	    || (header[1] != sizeof(struct trace_record))) {
+		fclose(f);
+		return -1;
+	}
+
+	for (i = 0; i < header[2]; i++) {
+		if (fread(&record, sizeof(struct trace_record), 1, f) != 1) {
+			break;
+		}
+		callback(&record, user_data);
+	}
+	fclose(f);
+
+	return (int)i;
+}
+
+const char *trace_category_name(uint16_t category)
+{
+	switch (category) {
+	case TRACE_CATEGORY_CONNECTION:
+		return "connection";
+	case TRACE_CATEGORY_SSL:
+		return "ssl";
+	case TRACE_CATEGORY_LOCKDOWN:
+		return "lockdown";
+	case TRACE_CATEGORY_AFC:
+		return "afc";
+	default:
+		break;
+	}
+	return "unknown";
+}
+
+static const struct {
+	const char *name;
+	const char *arg0;
+	const char *arg1;
+} trace_events[TRACE_EVENT_MAX] = {
+	{ "unknown", NULL, NULL },
+	{ "send", "length", "sent" },
+	{ "receive", "length", "received" },
+	{ "handshake_begin", NULL, NULL },
+	{ "handshake_end", "resumed", NULL },
+	{ "request", NULL, NULL },
+	{ "response", NULL, NULL },
+	{ "request", "operation", "packet" },
+	{ "response", "operation", "packet" }
+};
+
+const char *trace_event_name(uint16_t event)
+{
+	if (event >= TRACE_EVENT_MAX) {
+		event = 0;
+	}
+	return trace_events[event].name;
+}
+
+const char *trace_event_arg_name(uint16_t event, int arg)
+{
+	if (event >= TRACE_EVENT_MAX) {
+		return NULL;
+	}
+	return (arg == 0) ? trace_events[event].arg0 : trace_events[event].arg1;
+}
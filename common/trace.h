@@ -0,0 +1,109 @@
+/*
+ * trace.h
+ * Binary per-thread trace ring buffers - header file
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+/* categories of trace events, matching enum idevice_trace_category */
+#define TRACE_CATEGORY_CONNECTION (1 << 0)
+#define TRACE_CATEGORY_SSL        (1 << 1)
+#define TRACE_CATEGORY_LOCKDOWN   (1 << 2)
+#define TRACE_CATEGORY_AFC        (1 << 3)
+#define TRACE_CATEGORY_ALL        (TRACE_CATEGORY_CONNECTION | TRACE_CATEGORY_SSL | TRACE_CATEGORY_LOCKDOWN | TRACE_CATEGORY_AFC)
+
+/* event IDs; new events must be appended to keep trace files readable */
+enum trace_event_id {
+	TRACE_EVENT_CONNECTION_SEND = 1,
+	TRACE_EVENT_CONNECTION_RECEIVE,
+	TRACE_EVENT_SSL_HANDSHAKE_BEGIN,
+	TRACE_EVENT_SSL_HANDSHAKE_END,
+	TRACE_EVENT_LOCKDOWN_REQUEST,
+	TRACE_EVENT_LOCKDOWN_RESPONSE,
+	TRACE_EVENT_AFC_REQUEST,
+	TRACE_EVENT_AFC_RESPONSE,
+	TRACE_EVENT_MAX
+};
+
+/* long enough for a UDID or "StartService/<service identifier>" */
+#define TRACE_TAG_SIZE 48
+
+struct trace_record {
+	uint64_t timestamp;        /* nanoseconds since the epoch */
+	uint32_t thread;           /* sequential ID of the recording thread */
+	int32_t result;            /* error code of the traced call */
+	uint16_t category;
+	uint16_t event;
+	uint32_t reserved;
+	uint64_t arg0;             /* event specific, see trace_event_arg_name() */
+	uint64_t arg1;
+	char tag[TRACE_TAG_SIZE];  /* short name, not necessarily terminated */
+};
+
+/* number of records kept per thread, must be a power of two */
+#define TRACE_RING_SIZE 4096
+/* maximum number of threads recording at the same time */
+#define TRACE_MAX_RINGS 64
+
+/*
+ * A trace file holds a header followed by the records of all rings:
+ *   char magic[8]        TRACE_FILE_MAGIC
+ *   uint32 byte_order    TRACE_FILE_BYTE_ORDER in the writer's byte order
+ *   uint32 record_size   sizeof(struct trace_record)
+ *   uint32 record_count
+ *   struct trace_record records[record_count]
+ * Records are grouped by ring and are not sorted by time.
+ */
+#define TRACE_FILE_MAGIC "IDVTRAC1"
+#define TRACE_FILE_MAGIC_LEN 8
+#define TRACE_FILE_BYTE_ORDER 0x01020304
+
+/* categories currently recorded, 0 when tracing is off */
+extern unsigned int internal_trace_mask;
+
+#define trace_enabled(category) (internal_trace_mask & (category))
+#define trace_log(category, event, result, arg0, arg1, tag) do { if (trace_enabled(category)) trace_write(category, event, result, arg0, arg1, tag); } while (0)
+
+void trace_write(uint16_t category, uint16_t event, int32_t result, uint64_t arg0, uint64_t arg1, const char *tag);
+
+void internal_set_trace_categories(unsigned int categories);
+
+/**
+ * Writes a snapshot of all trace rings to a file.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int trace_save(const char *path);
+
+typedef void (*trace_record_cb_t)(const struct trace_record *record, void *user_data);
+
+/**
+ * Reads a trace file written by trace_save() and passes every record to
+ * the callback.
+ *
+ * @return The number of records read, or -1 on error.
+ */
+int trace_file_read(const char *path, trace_record_cb_t callback, void *user_data);
+
+const char *trace_category_name(uint16_t category);
+const char *trace_event_name(uint16_t event);
+const char *trace_event_arg_name(uint16_t event, int arg);
+
+#endif
@@ -53,6 +53,7 @@
 #include <libgen.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef WIN32
 #include <shlobj.h>
@@ -61,6 +62,7 @@
 #include "userpref.h"
 #include "debug.h"
 #include "utils.h"
+#include "thread.h"
 
 #ifndef HAVE_OPENSSL
 const ASN1_ARRAY_TYPE pkcs1_asn1_tab[] = {
@@ -91,7 +93,28 @@ const ASN1_ARRAY_TYPE pkcs1_asn1_tab[] = {
 
 #define USERPREF_CONFIG_FILE "SystemConfiguration"USERPREF_CONFIG_EXTENSION
 
+#define USERPREF_CACHE_DIR "libimobiledevice"DIR_SEP_S"devices"
+
 static char *__config_dir = NULL;
+static char *__cache_dir = NULL;
+
+/** Parsed pair record of a device, kept to avoid reading it from usbmuxd again. */
+struct pair_record_cache_entry {
+	char *udid;
+	plist_t pair_record;
+	struct pair_record_cache_entry *next;
+};
+
+static struct pair_record_cache_entry *pair_record_cache = NULL;
+static mutex_t pair_record_cache_mutex;
+/* incremented on each invalidation, so records read concurrently are not cached */
+static uint32_t pair_record_cache_generation = 0;
+static thread_once_t pair_record_cache_once = THREAD_ONCE_INIT;
+
+static void pair_record_cache_init(void)
+{
+	mutex_init(&pair_record_cache_mutex);
+}
 
 #ifdef WIN32
 static char *userpref_utf16_to_utf8(wchar_t *unistr, long len, long *items_read, long *items_written)
@@ -172,6 +195,168 @@ const char *userpref_get_config_dir()
 	return __config_dir;
 }
 
+/**
+ * Returns the per-user directory where device facts are cached, i.e.
+ * $XDG_CACHE_HOME/libimobiledevice/devices, ~/.cache/libimobiledevice/devices
+ * or %LOCALAPPDATA%\libimobiledevice\devices on Windows.
+ *
+ * @return The cache directory, or NULL if it could not be determined.
+ */
+static const char *userpref_get_cache_dir(void)
+{
+	if (__cache_dir)
+		return __cache_dir;
+
+#ifdef WIN32
+	const char *base = getenv("LOCALAPPDATA");
+	if (base) {
+		__cache_dir = string_build_path(base, USERPREF_CACHE_DIR, NULL);
+	}
+#else
+	const char *base = getenv("XDG_CACHE_HOME");
+	if (base && *base) {
+		__cache_dir = string_build_path(base, USERPREF_CACHE_DIR, NULL);
+	} else {
+		base = getenv("HOME");
+		if (!base) {
+			struct passwd *pw = getpwuid(getuid());
+			if (pw)
+				base = pw->pw_dir;
+		}
+		if (base) {
+			__cache_dir = string_build_path(base, ".cache", USERPREF_CACHE_DIR, NULL);
+		}
+	}
+#endif
+
+	debug_info("initialized cache_dir to %s", __cache_dir);
+
+	return __cache_dir;
+}
+
+static int userpref_mkdir_with_parents(const char *dir)
+{
+	struct stat st;
+	char *parent;
+	int res;
+
+	if (stat(dir, &st) == 0)
+		return S_ISDIR(st.st_mode) ? 0 : -1;
+
+	parent = strdup(dir);
+	res = userpref_mkdir_with_parents(dirname(parent));
+	free(parent);
+	if (res != 0)
+		return res;
+
+#ifdef WIN32
+	res = mkdir(dir);
+#else
+	res = mkdir(dir, 0755);
+#endif
+	return ((res == 0) || (errno == EEXIST)) ? 0 : -1;
+}
+
+/**
+ * Reads the cached facts about a device, like its ProductVersion, that allow
+ * skipping requests when connecting to it.
+ *
+ * @param udid The udid of the device
+ * @param max_age Maximum age of the cached facts in seconds
+ * @param facts Set to a #PLIST_DICT with the facts on success
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_CONF if no facts
+ *     are cached or they are older than max_age seconds.
+ */
+userpref_error_t userpref_read_device_facts(const char *udid, uint32_t max_age, plist_t *facts)
+{
+	const char *cache_dir = userpref_get_cache_dir();
+	char *path = NULL;
+	plist_t facts_loc = NULL;
+	uint64_t timestamp = 0;
+
+	if (!udid || !facts)
+		return USERPREF_E_INVALID_ARG;
+	if (!cache_dir)
+		return USERPREF_E_INVALID_CONF;
+
+	path = string_concat(cache_dir, DIR_SEP_S, udid, USERPREF_CONFIG_EXTENSION, NULL);
+	plist_read_from_filename(&facts_loc, path);
+	free(path);
+
+	if (!facts_loc || (plist_get_node_type(facts_loc) != PLIST_DICT)) {
+		plist_free(facts_loc);
+		return USERPREF_E_INVALID_CONF;
+	}
+
+	plist_t node = plist_dict_get_item(facts_loc, "Timestamp");
+	if (node && (plist_get_node_type(node) == PLIST_UINT)) {
+		plist_get_uint_val(node, &timestamp);
+	}
+	if ((timestamp == 0) || ((uint64_t)time(NULL) > timestamp + max_age)) {
+		debug_info("cached device facts for %s are outdated", udid);
+		plist_free(facts_loc);
+		return USERPREF_E_INVALID_CONF;
+	}
+
+	*facts = facts_loc;
+
+	return USERPREF_E_SUCCESS;
+}
+
+/**
+ * Caches facts about a device. A timestamp is added to the facts.
+ *
+ * @param udid The udid of the device
+ * @param facts A #PLIST_DICT with the facts to cache
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_WRITE_ERROR if the
+ *     facts could not be written.
+ */
+userpref_error_t userpref_save_device_facts(const char *udid, plist_t facts)
+{
+	const char *cache_dir = userpref_get_cache_dir();
+	char *path = NULL;
+	int res;
+
+	if (!udid || !facts || (plist_get_node_type(facts) != PLIST_DICT))
+		return USERPREF_E_INVALID_ARG;
+	if (!cache_dir || (userpref_mkdir_with_parents(cache_dir) != 0))
+		return USERPREF_E_WRITE_ERROR;
+
+	plist_dict_set_item(facts, "Timestamp", plist_new_uint((uint64_t)time(NULL)));
+
+	path = string_concat(cache_dir, DIR_SEP_S, udid, USERPREF_CONFIG_EXTENSION, NULL);
+	res = plist_write_to_filename(facts, path, PLIST_FORMAT_BINARY);
+	free(path);
+
+	return res ? USERPREF_E_SUCCESS : USERPREF_E_WRITE_ERROR;
+}
+
+/**
+ * Removes the cached facts about a device.
+ *
+ * @param udid The udid of the device
+ *
+ * @return USERPREF_E_SUCCESS on success.
+ */
+userpref_error_t userpref_delete_device_facts(const char *udid)
+{
+	const char *cache_dir = userpref_get_cache_dir();
+	char *path = NULL;
+
+	if (!udid)
+		return USERPREF_E_INVALID_ARG;
+	if (!cache_dir)
+		return USERPREF_E_SUCCESS;
+
+	path = string_concat(cache_dir, DIR_SEP_S, udid, USERPREF_CONFIG_EXTENSION, NULL);
+	remove(path);
+	free(path);
+
+	return USERPREF_E_SUCCESS;
+}
+
 /**
  * Reads the SystemBUID from a previously generated configuration file.
  *
@@ -287,6 +472,8 @@ userpref_error_t userpref_save_pair_record(const char *udid, plist_t pair_record
 
 	int res = usbmuxd_save_pair_record(udid, record_data, record_size);
 
+	userpref_pair_record_cache_invalidate(udid);
+
 	free(record_data);
 
 	return res == 0 ? USERPREF_E_SUCCESS: USERPREF_E_UNKNOWN_ERROR;
@@ -305,6 +492,21 @@ userpref_error_t userpref_read_pair_record(const char *udid, plist_t *pair_recor
 {
 	char* record_data = NULL;
 	uint32_t record_size = 0;
+	uint32_t generation;
+	struct pair_record_cache_entry *entry;
+
+	thread_once(&pair_record_cache_once, pair_record_cache_init);
+
+	mutex_lock(&pair_record_cache_mutex);
+	generation = pair_record_cache_generation;
+	for (entry = pair_record_cache; entry; entry = entry->next) {
+		if (strcmp(entry->udid, udid) == 0) {
+			*pair_record = plist_copy(entry->pair_record);
+			mutex_unlock(&pair_record_cache_mutex);
+			return USERPREF_E_SUCCESS;
+		}
+	}
+	mutex_unlock(&pair_record_cache_mutex);
 
 	int res = usbmuxd_read_pair_record(udid, &record_data, &record_size);
 
@@ -324,9 +526,53 @@ userpref_error_t userpref_read_pair_record(const char *udid, plist_t *pair_recor
 
 	free(record_data);
 
+	if ((res == 0) && *pair_record) {
+		mutex_lock(&pair_record_cache_mutex);
+		for (entry = pair_record_cache; entry; entry = entry->next) {
+			if (strcmp(entry->udid, udid) == 0)
+				break;
+		}
+		if (!entry && (generation == pair_record_cache_generation)) {
+			entry = (struct pair_record_cache_entry*)malloc(sizeof(struct pair_record_cache_entry));
+			entry->udid = strdup(udid);
+			entry->pair_record = plist_copy(*pair_record);
+			entry->next = pair_record_cache;
+			pair_record_cache = entry;
+		}
+		mutex_unlock(&pair_record_cache_mutex);
+	}
+
 	return res == 0 ? USERPREF_E_SUCCESS: USERPREF_E_UNKNOWN_ERROR;
 }
 
+/**
+ * Drop the cached pair record of a device so that the next call to
+ * userpref_read_pair_record() reads it from usbmuxd again.
+ *
+ * @param udid The udid of the device, or NULL to drop all cached records
+ */
+void userpref_pair_record_cache_invalidate(const char *udid)
+{
+	struct pair_record_cache_entry **prev = &pair_record_cache;
+
+	thread_once(&pair_record_cache_once, pair_record_cache_init);
+
+	mutex_lock(&pair_record_cache_mutex);
+	pair_record_cache_generation++;
+	while (*prev) {
+		struct pair_record_cache_entry *entry = *prev;
+		if (!udid || (strcmp(entry->udid, udid) == 0)) {
+			*prev = entry->next;
+			plist_free(entry->pair_record);
+			free(entry->udid);
+			free(entry);
+		} else {
+			prev = &entry->next;
+		}
+	}
+	mutex_unlock(&pair_record_cache_mutex);
+}
+
 /**
  * Remove the pairing record stored for a device from this host.
  *
@@ -336,6 +582,8 @@ userpref_error_t userpref_read_pair_record(const char *udid, plist_t *pair_recor
  */
 userpref_error_t userpref_delete_pair_record(const char *udid)
 {
+	userpref_pair_record_cache_invalidate(udid);
+
 	int res = usbmuxd_delete_pair_record(udid);
 
 	return res == 0 ? USERPREF_E_SUCCESS: USERPREF_E_UNKNOWN_ERROR;
@@ -200,6 +200,25 @@ char *generate_uuid()
 	return uuid;
 }
 
+uint64_t time_monotonic_usec(void)
+{
+#ifdef WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000ULL + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+#endif
+}
+
 void buffer_read_from_filename(const char *filename, char **buffer, uint64_t *length)
 {
 	FILE *f;
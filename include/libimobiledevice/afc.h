@@ -82,6 +82,56 @@ typedef enum {
 	AFC_SYMLINK = 2
 } afc_link_type_t;
 
+/** File types reported in afc_file_info_t */
+typedef enum {
+	AFC_FILE_TYPE_UNKNOWN      = 0,
+	AFC_FILE_TYPE_REGULAR      = 1, /**< S_IFREG */
+	AFC_FILE_TYPE_DIRECTORY    = 2, /**< S_IFDIR */
+	AFC_FILE_TYPE_SYMLINK      = 3, /**< S_IFLNK */
+	AFC_FILE_TYPE_CHAR_DEVICE  = 4, /**< S_IFCHR */
+	AFC_FILE_TYPE_BLOCK_DEVICE = 5, /**< S_IFBLK */
+	AFC_FILE_TYPE_FIFO         = 6, /**< S_IFIFO */
+	AFC_FILE_TYPE_SOCKET       = 7  /**< S_IFSOCK */
+} afc_file_type_t;
+
+/** Parsed information about a file */
+typedef struct {
+	uint64_t size; /**< st_size: size of the file in bytes */
+	uint64_t blocks; /**< st_blocks: number of blocks allocated for the file */
+	uint32_t nlink; /**< st_nlink: number of hard links */
+	afc_file_type_t type; /**< st_ifmt: type of the file */
+	uint64_t mtime; /**< st_mtime: modification time in nanoseconds since the epoch */
+	uint64_t birthtime; /**< st_birthtime: creation time in nanoseconds since the epoch */
+} afc_file_info_t;
+
+/** Parsed information about the device's file system */
+typedef struct {
+	char model[32]; /**< Model: the device model, e.g. "iPhone5,2" */
+	uint64_t total_bytes; /**< FSTotalBytes: size of the file system in bytes */
+	uint64_t free_bytes; /**< FSFreeBytes: free space on the file system in bytes */
+	uint32_t block_size; /**< FSBlockSize: block size of the file system */
+} afc_device_info_t;
+
+/** Progress and throughput counters of a tree copy */
+typedef struct {
+	uint64_t files_copied; /**< number of files copied so far */
+	uint64_t directories_copied; /**< number of directories copied so far */
+	uint64_t bytes_copied; /**< number of bytes of file contents copied so far */
+	uint64_t errors; /**< number of files and directories that failed to copy */
+	uint64_t skipped; /**< number of symbolic links and special files that were not copied */
+	uint64_t elapsed_ms; /**< time since the copy started in milliseconds */
+} afc_copy_stats_t;
+
+/**
+ * Callback reporting the progress of a tree copy. It is invoked from the
+ * worker threads, but never concurrently.
+ *
+ * @param stats The current counters of the copy.
+ * @param path The path of the file or directory that was just processed.
+ * @param user_data The user data passed to the copy function.
+ */
+typedef void (*afc_copy_progress_cb_t)(const afc_copy_stats_t *stats, const char *path, void *user_data);
+
 /** Lock operation flags */
 typedef enum {
 	AFC_LOCK_SH = 1 | 4, /**< shared lock */
@@ -92,6 +142,22 @@ typedef enum {
 typedef struct afc_client_private afc_client_private;
 typedef afc_client_private *afc_client_t; /**< The client handle. */
 
+typedef struct afc_dir_private afc_dir_private;
+typedef afc_dir_private *afc_dir_t; /**< The handle of a directory enumerator. */
+
+typedef struct afc_operation_private afc_operation_private;
+typedef afc_operation_private *afc_operation_t; /**< The handle of an asynchronous operation. */
+
+/**
+ * Callback invoked when an asynchronous operation completes.
+ *
+ * @param operation The operation that completed.
+ * @param result AFC_E_SUCCESS if the operation succeeded or an AFC_E_* error
+ *        value otherwise.
+ * @param user_data The user data passed when submitting the operation.
+ */
+typedef void (*afc_completion_cb_t)(afc_operation_t operation, afc_error_t result, void *user_data);
+
 /* Interface */
 
 /**
@@ -143,6 +209,20 @@ afc_error_t afc_client_free(afc_client_t client);
  */
 afc_error_t afc_get_device_info(afc_client_t client, char ***device_information);
 
+/**
+ * Gets parsed information about the device's file system.
+ *
+ * Unlike afc_get_device_info() the response is decoded directly into the
+ * given structure without allocating a list of strings.
+ *
+ * @param client The client to get device info for.
+ * @param device_info Pointer to a structure that will be filled with the
+ *        device information.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_get_device_info_parsed(afc_client_t client, afc_device_info_t *device_info);
+
 /**
  * Gets a directory listing of the directory requested.
  *
@@ -156,6 +236,44 @@ afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
  */
 afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***directory_information);
 
+/**
+ * Opens a directory for reading its entries one by one.
+ *
+ * Unlike afc_read_directory() the entries are fetched from the device in
+ * batches while iterating, so the memory used does not depend on the
+ * number of entries in the directory. On devices that do not support
+ * directory enumerators the whole listing is fetched at once.
+ *
+ * @param client The client to use.
+ * @param path The directory to enumerate. (must be a fully-qualified path)
+ * @param dir Pointer that will be set to the directory enumerator. Must be
+ *        closed with afc_dir_close().
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_dir_open(afc_client_t client, const char *path, afc_dir_t *dir);
+
+/**
+ * Gets the next entry of a directory opened with afc_dir_open().
+ *
+ * @param dir The directory enumerator.
+ * @param name Pointer that will be set to the name of the next entry, or
+ *        NULL if there are no more entries. The name is only valid until
+ *        the next call to afc_dir_read() or afc_dir_close().
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_dir_read(afc_dir_t dir, const char **name);
+
+/**
+ * Closes a directory enumerator and frees its resources.
+ *
+ * @param dir The directory enumerator to close.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_dir_close(afc_dir_t dir);
+
 /**
  * Gets information about a specific file.
  *
@@ -169,6 +287,40 @@ afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***di
  */
 afc_error_t afc_get_file_info(afc_client_t client, const char *filename, char ***file_information);
 
+/**
+ * Gets parsed information about a specific file.
+ *
+ * Unlike afc_get_file_info() the response is decoded directly into the
+ * given structure without allocating a list of strings.
+ *
+ * @param client The client to use to get the information of the file.
+ * @param path The fully-qualified path to the file.
+ * @param file_info Pointer to a structure that will be filled with the file
+ *        information.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_get_file_info_parsed(afc_client_t client, const char *path, afc_file_info_t *file_info);
+
+/**
+ * Gets information about many files at once.
+ *
+ * The requests for all paths are sent back-to-back without waiting for the
+ * responses in between, so the whole batch costs roughly one round trip.
+ *
+ * @param client The client to use to get the information of the files.
+ * @param paths Array of fully-qualified paths.
+ * @param count Number of paths in the array.
+ * @param infos Array of count elements that will be filled with the parsed
+ *        information of each file.
+ * @param results Array of count elements that will be filled with the
+ *        result for each file. Can be NULL.
+ *
+ * @return AFC_E_SUCCESS if the information of all files was retrieved, or
+ *         the first AFC_E_* error value that occurred otherwise.
+ */
+afc_error_t afc_get_file_info_batch(afc_client_t client, const char **paths, uint32_t count, afc_file_info_t *infos, afc_error_t *results);
+
 /**
  * Opens a file on the device.
  *
@@ -266,6 +418,86 @@ afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *positi
  */
 afc_error_t afc_file_truncate(afc_client_t client, uint64_t handle, uint64_t newsize);
 
+/**
+ * Attempts to read the given number of bytes from the given position of an
+ * opened file, without changing the file position.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param offset The position in the file to read from.
+ * @param data The pointer to the memory region to store the read data.
+ * @param length The number of bytes to read.
+ * @param bytes_read The number of bytes actually read.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ *
+ * @note Requires iOS 7 or later.
+ */
+afc_error_t afc_file_read_with_offset(afc_client_t client, uint64_t handle, uint64_t offset, char *data, uint32_t length, uint32_t *bytes_read);
+
+/**
+ * Writes a given number of bytes to the given position of an opened file,
+ * without changing the file position.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param offset The position in the file to write to.
+ * @param data The data to write to the file.
+ * @param length How much data to write.
+ * @param bytes_written The number of bytes actually written to the file.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ *
+ * @note Requires iOS 7 or later.
+ */
+afc_error_t afc_file_write_with_offset(afc_client_t client, uint64_t handle, uint64_t offset, const char *data, uint32_t length, uint32_t *bytes_written);
+
+/**
+ * Reads a large range of an opened file by splitting it into chunks and
+ * keeping several positional read requests in flight at the same time.
+ *
+ * As the requests do not depend on the file position, several clients may
+ * read different ranges of the same file in parallel.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param offset The position in the file to start reading from.
+ * @param data The pointer to the memory region to store the read data.
+ * @param length The number of bytes to read.
+ * @param chunk_size The number of bytes to request per read request.
+ * @param max_in_flight The maximum number of read requests in flight.
+ * @param bytes_read The number of bytes actually read. Less than length if
+ *        the end of the file was reached.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ *
+ * @note Chunks the device answers only partially are requested again for
+ *       the missing range. Only an empty response is taken as the end of
+ *       the file.
+ * @note Requires iOS 7 or later.
+ */
+afc_error_t afc_file_read_parallel(afc_client_t client, uint64_t handle, uint64_t offset, char *data, uint64_t length, uint32_t chunk_size, unsigned int max_in_flight, uint64_t *bytes_read);
+
+/**
+ * Writes a large buffer to an opened file by splitting it into chunks and
+ * keeping several positional write requests in flight at the same time.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param offset The position in the file to start writing to.
+ * @param data The data to write to the file.
+ * @param length How much data to write.
+ * @param chunk_size The number of bytes to send per write request.
+ * @param max_in_flight The maximum number of write requests in flight.
+ * @param bytes_written The number of bytes written from the start of the
+ *        buffer before an error occurred.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ *
+ * @note Requires iOS 7 or later.
+ */
+afc_error_t afc_file_write_parallel(afc_client_t client, uint64_t handle, uint64_t offset, const char *data, uint64_t length, uint32_t chunk_size, unsigned int max_in_flight, uint64_t *bytes_written);
+
 /**
  * Deletes a file or directory.
  *
@@ -344,6 +576,59 @@ afc_error_t afc_set_file_time(afc_client_t client, const char *path, uint64_t mt
  */
 afc_error_t afc_remove_path_and_contents(afc_client_t client, const char *path);
 
+/**
+ * Gets the hash of a file as calculated by the device.
+ *
+ * @param client The client to use.
+ * @param path The fully-qualified path to the file.
+ * @param hash Pointer that will be set to the raw hash value. Free with
+ *        free().
+ * @param hash_length Pointer that will be set to the length of the hash.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_get_file_hash(afc_client_t client, const char *path, char **hash, uint32_t *hash_length);
+
+/**
+ * Gets the hash of a range of a file as calculated by the device.
+ *
+ * @param client The client to use.
+ * @param path The fully-qualified path to the file.
+ * @param offset The start of the range in the file.
+ * @param length The length of the range.
+ * @param hash Pointer that will be set to the raw hash value. Free with
+ *        free().
+ * @param hash_length Pointer that will be set to the length of the hash.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_get_file_hash_range(afc_client_t client, const char *path, uint64_t offset, uint64_t length, char **hash, uint32_t *hash_length);
+
+/**
+ * Updates a local copy of a file by comparing the hashes of fixed size
+ * blocks and only downloading the blocks that differ.
+ *
+ * The hashes of all blocks are requested from the device and compared with
+ * the SHA1 hashes of the corresponding blocks of the local copy. Blocks
+ * whose hashes do not match are read from the device into the local copy.
+ *
+ * @param client The client to use.
+ * @param path The fully-qualified path to the file on the device.
+ * @param data The local copy of the file that will be updated. Its length
+ *        must match the size of the file on the device.
+ * @param length The length of the local copy.
+ * @param block_size The size of the blocks to compare.
+ * @param bytes_updated Pointer that will be set to the number of bytes that
+ *        were downloaded. Can be NULL.
+ *
+ * @return AFC_E_SUCCESS on success, AFC_E_NOT_ENOUGH_DATA if the file on
+ *     the device ended before a changed block was read completely, or an
+ *     AFC_E_* error value.
+ *
+ * @note Requires iOS 7 or later.
+ */
+afc_error_t afc_file_update_changed_blocks(afc_client_t client, const char *path, char *data, uint64_t length, uint32_t block_size, uint64_t *bytes_updated);
+
 /* Helper functions */
 
 /**
@@ -368,6 +653,274 @@ afc_error_t afc_get_device_info_key(afc_client_t client, const char *key, char *
  */
 afc_error_t afc_dictionary_free(char **dictionary);
 
+/* Tree copy */
+
+/**
+ * Recursively copies a directory from the device to the host.
+ *
+ * The copy is spread over a pool of workers that each own an AFC
+ * connection to the device. Directories are listed and queued as they are
+ * discovered, so workers pick up files while the tree is still being
+ * walked. File contents are transferred with pipelined positional reads
+ * where supported.
+ *
+ * A file fails with AFC_E_NOT_ENOUGH_DATA if the number of bytes copied
+ * does not match the size the device reported for it. Symbolic links and
+ * special files are not copied. They are counted in the skipped counter
+ * and passed to the progress callback.
+ *
+ * @param device The device to copy from.
+ * @param device_path The fully-qualified path of the directory to copy.
+ * @param host_path The local directory to copy to. Created if needed.
+ * @param workers The number of AFC connections to use. If the device
+ *        refuses some connections, fewer workers are used.
+ * @param progress_cb Callback to report progress to. Can be NULL.
+ * @param user_data User data passed to the callback.
+ * @param stats Pointer that will be filled with the final counters. Can be
+ *        NULL.
+ *
+ * @return AFC_E_SUCCESS if everything was copied, or the first AFC_E_* error
+ *         value that occurred otherwise.
+ */
+afc_error_t afc_copy_tree_to_host(idevice_t device, const char *device_path, const char *host_path, unsigned int workers, afc_copy_progress_cb_t progress_cb, void *user_data, afc_copy_stats_t *stats);
+
+/**
+ * Recursively copies a directory from the host to the device.
+ *
+ * @param device The device to copy to.
+ * @param host_path The local directory to copy.
+ * @param device_path The fully-qualified path of the directory to copy to.
+ *        Created if needed.
+ * @param workers The number of AFC connections to use. If the device
+ *        refuses some connections, fewer workers are used.
+ * @param progress_cb Callback to report progress to. Can be NULL.
+ * @param user_data User data passed to the callback.
+ * @param stats Pointer that will be filled with the final counters. Can be
+ *        NULL.
+ *
+ * @return AFC_E_SUCCESS if everything was copied, or the first AFC_E_* error
+ *         value that occurred otherwise.
+ *
+ * @see afc_copy_tree_to_host()
+ */
+afc_error_t afc_copy_tree_to_device(idevice_t device, const char *host_path, const char *device_path, unsigned int workers, afc_copy_progress_cb_t progress_cb, void *user_data, afc_copy_stats_t *stats);
+
+/* Asynchronous interface */
+
+/**
+ * Submits a request to open a file on the device without waiting for the
+ * response.
+ *
+ * @param client The client to use to open the file.
+ * @param filename The file to open. (must be a fully-qualified path)
+ * @param file_mode The mode to use to open the file.
+ * @param callback Function to call when the operation completes. Can be NULL
+ *        if operation is not NULL.
+ * @param user_data User data passed to the callback.
+ * @param operation Pointer that will be set to the submitted operation. Must
+ *        be freed with afc_operation_free(). If NULL, the operation is freed
+ *        automatically after the callback returned.
+ *
+ * @return AFC_E_SUCCESS if the request was sent or an AFC_E_* error value.
+ *
+ * @note Use afc_operation_get_handle() to get the file handle once the
+ *       operation completed.
+ */
+afc_error_t afc_file_open_async(afc_client_t client, const char *filename, afc_file_mode_t file_mode, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation);
+
+/**
+ * Submits a request to read data from an opened file without waiting for the
+ * response.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param data The buffer the data is stored in. It must stay valid until the
+ *        operation completed.
+ * @param length The number of bytes to read.
+ * @param callback Function to call when the operation completes. Can be NULL
+ *        if operation is not NULL.
+ * @param user_data User data passed to the callback.
+ * @param operation Pointer that will be set to the submitted operation, or
+ *        NULL to free the operation automatically after the callback.
+ *
+ * @return AFC_E_SUCCESS if the request was sent or an AFC_E_* error value.
+ *
+ * @note Use afc_operation_get_length() to get the number of bytes read.
+ */
+afc_error_t afc_file_read_async(afc_client_t client, uint64_t handle, char *data, uint32_t length, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation);
+
+/**
+ * Submits a request to write data to an opened file without waiting for the
+ * response.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param data The data to write to the file. It is sent before this function
+ *        returns.
+ * @param length The number of bytes to write.
+ * @param callback Function to call when the operation completes. Can be NULL
+ *        if operation is not NULL.
+ * @param user_data User data passed to the callback.
+ * @param operation Pointer that will be set to the submitted operation, or
+ *        NULL to free the operation automatically after the callback.
+ *
+ * @return AFC_E_SUCCESS if the request was sent or an AFC_E_* error value.
+ *
+ * @note Use afc_operation_get_length() to get the number of bytes written.
+ */
+afc_error_t afc_file_write_async(afc_client_t client, uint64_t handle, const char *data, uint32_t length, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation);
+
+/**
+ * Submits a request to close a file on the device without waiting for the
+ * response.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file.
+ * @param callback Function to call when the operation completes. Can be NULL
+ *        if operation is not NULL.
+ * @param user_data User data passed to the callback.
+ * @param operation Pointer that will be set to the submitted operation, or
+ *        NULL to free the operation automatically after the callback.
+ *
+ * @return AFC_E_SUCCESS if the request was sent or an AFC_E_* error value.
+ */
+afc_error_t afc_file_close_async(afc_client_t client, uint64_t handle, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation);
+
+/**
+ * Submits a request to get information about a specific file without
+ * waiting for the response.
+ *
+ * @param client The client to use to get the information of the file.
+ * @param path The fully-qualified path to the file.
+ * @param callback Function to call when the operation completes. Can be NULL
+ *        if operation is not NULL.
+ * @param user_data User data passed to the callback.
+ * @param operation Pointer that will be set to the submitted operation, or
+ *        NULL to free the operation automatically after the callback.
+ *
+ * @return AFC_E_SUCCESS if the request was sent or an AFC_E_* error value.
+ *
+ * @note Use afc_operation_get_list() to get the file information once the
+ *       operation completed.
+ */
+afc_error_t afc_get_file_info_async(afc_client_t client, const char *path, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation);
+
+/**
+ * Submits a request to get a directory listing without waiting for the
+ * response.
+ *
+ * @param client The client to get a directory listing from.
+ * @param path The directory for listing. (must be a fully-qualified path)
+ * @param callback Function to call when the operation completes. Can be NULL
+ *        if operation is not NULL.
+ * @param user_data User data passed to the callback.
+ * @param operation Pointer that will be set to the submitted operation, or
+ *        NULL to free the operation automatically after the callback.
+ *
+ * @return AFC_E_SUCCESS if the request was sent or an AFC_E_* error value.
+ *
+ * @note Use afc_operation_get_list() to get the directory listing once the
+ *       operation completed.
+ */
+afc_error_t afc_read_directory_async(afc_client_t client, const char *path, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation);
+
+/**
+ * Receives responses for pending asynchronous operations and invokes the
+ * callbacks of the operations that completed.
+ *
+ * Responses are received as long as operations are pending and a response
+ * arrives within the given timeout. This function is meant to be called
+ * from an event loop when the descriptor returned by afc_client_get_fd()
+ * becomes readable.
+ *
+ * @param client The client to process completions for.
+ * @param timeout Maximum time in milliseconds to wait for each response.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value if receiving
+ *         failed.
+ */
+afc_error_t afc_process_completions(afc_client_t client, unsigned int timeout);
+
+/**
+ * Gets the file descriptor of the connection used by the client, for use
+ * with select() or poll().
+ *
+ * The client stops buffering received data, so the descriptor becomes
+ * readable whenever a response is pending. Responses that were already
+ * buffered are handed to their operations or queued for their callers
+ * before this function returns.
+ *
+ * @param client The client to get the file descriptor for.
+ * @param fd Pointer to an int that will be set to the file descriptor.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_client_get_fd(afc_client_t client, int *fd);
+
+/**
+ * Waits until an asynchronous operation completed.
+ *
+ * @param operation The operation to wait for.
+ *
+ * @return The result of the operation, or an AFC_E_* error value if
+ *         receiving the response failed.
+ */
+afc_error_t afc_operation_wait(afc_operation_t operation);
+
+/**
+ * Gets the result of an asynchronous operation.
+ *
+ * @param operation The operation to get the result of.
+ *
+ * @return The result of the operation, or AFC_E_OP_IN_PROGRESS if the
+ *         operation did not complete yet.
+ */
+afc_error_t afc_operation_get_result(afc_operation_t operation);
+
+/**
+ * Gets the file handle returned by a completed afc_file_open_async()
+ * operation.
+ *
+ * @param operation The completed operation.
+ * @param handle Pointer to a uint64_t that will hold the file handle.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_operation_get_handle(afc_operation_t operation, uint64_t *handle);
+
+/**
+ * Gets the number of bytes transferred by a completed afc_file_read_async()
+ * or afc_file_write_async() operation.
+ *
+ * @param operation The completed operation.
+ * @param length Pointer to a uint32_t that will hold the number of bytes.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_operation_get_length(afc_operation_t operation, uint32_t *length);
+
+/**
+ * Gets the list returned by a completed afc_get_file_info_async() or
+ * afc_read_directory_async() operation.
+ *
+ * @param operation The completed operation.
+ * @param list Pointer that will be set to the list. Free with
+ *        afc_dictionary_free().
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_operation_get_list(afc_operation_t operation, char ***list);
+
+/**
+ * Frees an asynchronous operation. If the operation is still pending, it is
+ * freed once its response arrives.
+ *
+ * @param operation The operation to free.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_operation_free(afc_operation_t operation);
+
 #ifdef __cplusplus
 }
 #endif
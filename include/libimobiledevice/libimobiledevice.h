@@ -67,6 +67,61 @@ typedef struct {
 	int conn_type; /**< The connection type. Currently only 1 for usbmuxd. */
 } idevice_event_t;
 
+/** Describes a buffer to send with idevice_connection_sendv(). */
+typedef struct {
+	const char *data; /**< Pointer to the data to send. */
+	uint32_t length; /**< Number of bytes to send. */
+} idevice_iovec_t;
+
+/** Performance counters of a connection, see idevice_connection_get_stats(). */
+typedef struct {
+	uint64_t bytes_sent;           /**< Payload bytes sent. */
+	uint64_t bytes_received;       /**< Payload bytes received. */
+	uint64_t messages_sent;        /**< Send calls on the connection. */
+	uint64_t messages_received;    /**< Receive calls that returned data. */
+	uint64_t syscalls;             /**< Socket reads and writes issued by libimobiledevice, including those of the TLS layer and of I/O loops. */
+	uint64_t tls_records_sent;     /**< TLS records written, handshake included, counted from the record headers on the wire. */
+	uint64_t tls_records_received; /**< TLS records read, handshake included, counted from the record headers on the wire. */
+	uint64_t handshake_usec;       /**< Duration of the TLS handshake in microseconds. */
+	uint64_t requests;             /**< Completed plist request/response round trips. */
+	uint64_t request_usec;         /**< Total time spent in round trips in microseconds. */
+	uint64_t request_usec_p50;     /**< Median round-trip time in microseconds, within about 6%. */
+	uint64_t request_usec_p90;     /**< 90th percentile of the round-trip time in microseconds. */
+	uint64_t request_usec_p99;     /**< 99th percentile of the round-trip time in microseconds. */
+	uint64_t request_usec_max;     /**< Slowest round trip in microseconds. */
+} idevice_connection_stats_t;
+
+typedef struct idevice_io_loop_private idevice_io_loop_private;
+typedef idevice_io_loop_private *idevice_io_loop_t; /**< The I/O loop handle. */
+
+/** How the data received on a connection in an I/O loop is split into frames. */
+typedef enum {
+	IDEVICE_IO_FRAME_RAW = 0,     /**< Whatever was received, as it arrives */
+	IDEVICE_IO_FRAME_BE32_LENGTH, /**< Big endian 32 bit length followed by payload (plist services) */
+	IDEVICE_IO_FRAME_LINE,        /**< Newline terminated lines, without the newline */
+	IDEVICE_IO_FRAME_AFC          /**< Complete AFC packets including their header */
+} idevice_io_frame_t;
+
+/** Callback invoked for every received frame, or with a NULL frame when the connection closed or failed. */
+typedef void (*idevice_io_frame_cb_t) (idevice_connection_t connection, const char *frame, uint32_t length, void *user_data);
+
+/** Categories of debug output, see idevice_set_debug_categories() */
+enum idevice_debug_category {
+	IDEVICE_DEBUG_INFO   = 1 << 0, /**< debug messages */
+	IDEVICE_DEBUG_PLIST  = 1 << 1, /**< XML dumps of sent and received plists */
+	IDEVICE_DEBUG_BUFFER = 1 << 2, /**< hex dumps of raw protocol data */
+	IDEVICE_DEBUG_ALL    = 0x7
+};
+
+/** Categories of trace events, see idevice_trace_set_categories() */
+enum idevice_trace_category {
+	IDEVICE_TRACE_CONNECTION = 1 << 0, /**< connection sends and receives */
+	IDEVICE_TRACE_SSL        = 1 << 1, /**< TLS handshakes */
+	IDEVICE_TRACE_LOCKDOWN   = 1 << 2, /**< lockdownd requests and responses */
+	IDEVICE_TRACE_AFC        = 1 << 3, /**< AFC requests and responses */
+	IDEVICE_TRACE_ALL        = 0xf
+};
+
 /* event callback function prototype */
 /** Callback to notifiy if a device was added or removed. */
 typedef void (*idevice_event_cb_t) (const idevice_event_t *event, void *user_data);
@@ -80,6 +135,38 @@ typedef void (*idevice_event_cb_t) (const idevice_event_t *event, void *user_dat
  */
 void idevice_set_debug_level(int level);
 
+/**
+ * Select which categories of debug output are printed while debugging is
+ * enabled with idevice_set_debug_level(). All categories are enabled by
+ * default. Disabled categories are skipped before any formatting happens.
+ *
+ * @param categories A bitmask of idevice_debug_category values.
+ */
+void idevice_set_debug_categories(unsigned int categories);
+
+/**
+ * Select which categories of events are recorded into the in-memory trace
+ * buffers. Each thread records into its own fixed size ring buffer holding
+ * its most recent events, so tracing can stay enabled with little overhead.
+ * Tracing is off by default, unless the LIBIMOBILEDEVICE_TRACE environment
+ * variable names a file the trace is saved to when the library is unloaded.
+ *
+ * @param categories A bitmask of idevice_trace_category values, or 0 to
+ *    stop recording.
+ */
+void idevice_trace_set_categories(unsigned int categories);
+
+/**
+ * Save the recorded trace events to a file that can be decoded with
+ * idevicetracedump.
+ *
+ * @param path The file to write.
+ *
+ * @return IDEVICE_E_SUCCESS on success, IDEVICE_E_INVALID_ARG if path is
+ *    NULL, or IDEVICE_E_UNKNOWN_ERROR if the file could not be written.
+ */
+idevice_error_t idevice_trace_save(const char *path);
+
 /**
  * Register a callback function that will be called when device add/remove
  * events occur.
@@ -186,6 +273,21 @@ idevice_error_t idevice_disconnect(idevice_connection_t connection);
  */
 idevice_error_t idevice_connection_send(idevice_connection_t connection, const char *data, uint32_t len, uint32_t *sent_bytes);
 
+/**
+ * Send several buffers to a device via the given connection as one message.
+ * The buffers are written with a single gather write, or coalesced into a
+ * single SSL record if SSL is enabled for the connection.
+ *
+ * @param connection The connection to send data over.
+ * @param iov Array of buffers to send, in order.
+ * @param iovcnt Number of buffers in the array.
+ * @param sent_bytes Pointer to an uint32_t that will be filled
+ *   with the total number of bytes actually sent.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, otherwise an error code.
+ */
+idevice_error_t idevice_connection_sendv(idevice_connection_t connection, const idevice_iovec_t *iov, unsigned int iovcnt, uint32_t *sent_bytes);
+
 /**
  * Receive data from a device via the given connection.
  * This function will return after the given timeout even if no data has been
@@ -240,6 +342,25 @@ idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection);
  */
 idevice_error_t idevice_connection_disable_ssl(idevice_connection_t connection);
 
+/**
+ * Enables, resizes or disables the receive buffer of a connection.
+ *
+ * With a receive buffer, small reads are served from data that was received
+ * with a single large read before, instead of issuing a read on the
+ * underlying socket or SSL session for each of them.
+ *
+ * @param connection The connection to set the receive buffer for.
+ * @param size The size of the receive buffer in bytes, or 0 to disable it.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, IDEVICE_E_NOT_ENOUGH_DATA if the current
+ *     buffer still holds data that was not read yet, or another error code
+ *     otherwise.
+ *
+ * @note The file descriptor returned by idevice_connection_get_fd() might
+ *     not become readable while data is still buffered.
+ */
+idevice_error_t idevice_connection_set_receive_buffer(idevice_connection_t connection, uint32_t size);
+
 /**
  * Get the underlying file descriptor for a connection
  *
@@ -247,9 +368,122 @@ idevice_error_t idevice_connection_disable_ssl(idevice_connection_t connection);
  * @param fd Pointer to an int where the fd is stored
  *
  * @return IDEVICE_E_SUCCESS if ok, otherwise an error code.
+ *
+ * @note Connections of property list service and syslog_relay clients have
+ *     a receive buffer. Disable it with idevice_connection_set_receive_buffer()
+ *     before waiting for the descriptor to become readable.
  */
 idevice_error_t idevice_connection_get_fd(idevice_connection_t connection, int *fd);
 
+/**
+ * Get the performance counters of a connection.
+ *
+ * Counters are kept for every connection. Set the LIBIMOBILEDEVICE_STATS
+ * environment variable to have the counters of each connection printed to
+ * stderr when it is closed, and the lockdownd request latencies (see
+ * lockdownd_get_latency_stats()) when the library is unloaded.
+ *
+ * @param connection The connection to get the counters of.
+ * @param stats Pointer to a structure the counters are copied to.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, otherwise an error code.
+ */
+idevice_error_t idevice_connection_get_stats(idevice_connection_t connection, idevice_connection_stats_t *stats);
+
+/**
+ * Reset the performance counters of a connection to zero.
+ *
+ * @param connection The connection to reset the counters of.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, otherwise an error code.
+ */
+idevice_error_t idevice_connection_reset_stats(idevice_connection_t connection);
+
+/* I/O loop */
+
+/**
+ * Creates a new I/O loop that drives many connections from a single thread.
+ *
+ * Connections added to the loop are switched to nonblocking mode and must
+ * only be used through the loop until they are removed again. An I/O loop
+ * is not thread safe; all functions must be called from the same thread.
+ *
+ * @param loop Pointer that will be set to the newly created loop.
+ *
+ * @return IDEVICE_E_SUCCESS on success, or an error code otherwise.
+ */
+idevice_error_t idevice_io_loop_new(idevice_io_loop_t *loop);
+
+/**
+ * Frees an I/O loop. Connections still registered are handed back in
+ * blocking mode but are not disconnected.
+ *
+ * @param loop The loop to free.
+ *
+ * @return IDEVICE_E_SUCCESS on success, or an error code otherwise.
+ */
+idevice_error_t idevice_io_loop_free(idevice_io_loop_t loop);
+
+/**
+ * Registers a connection with an I/O loop.
+ *
+ * Data already held in the receive buffer of the connection is taken over
+ * and dispatched on the next call to idevice_io_loop_run_once().
+ *
+ * @param loop The loop to add the connection to.
+ * @param connection The connection to add.
+ * @param framing How received data is split into frames for the callback.
+ * @param callback Function invoked for each received frame. It is invoked
+ *    with a NULL frame once the connection was closed or failed, after
+ *    which the connection is no longer part of the loop.
+ * @param user_data Application-specific data passed to the callback.
+ *
+ * @return IDEVICE_E_SUCCESS on success, IDEVICE_E_INVALID_ARG if the
+ *     connection is already part of the loop, IDEVICE_E_SSL_ERROR if the
+ *     SSL session of the connection can not be driven by the loop, or an
+ *     error code otherwise.
+ */
+idevice_error_t idevice_io_loop_add(idevice_io_loop_t loop, idevice_connection_t connection, idevice_io_frame_t framing, idevice_io_frame_cb_t callback, void *user_data);
+
+/**
+ * Removes a connection from an I/O loop and restores its blocking mode.
+ * May be called from within a frame callback. Data queued for sending that
+ * was not written yet is discarded.
+ *
+ * @param loop The loop to remove the connection from.
+ * @param connection The connection to remove.
+ *
+ * @return IDEVICE_E_SUCCESS on success, or an error code otherwise.
+ */
+idevice_error_t idevice_io_loop_remove(idevice_io_loop_t loop, idevice_connection_t connection);
+
+/**
+ * Queues data for sending on a connection of an I/O loop. As much as
+ * possible is written immediately, the remainder is sent by
+ * idevice_io_loop_run_once() once the connection becomes writable.
+ *
+ * @param loop The loop the connection is part of.
+ * @param connection The connection to send data on.
+ * @param data Buffer with the data to send.
+ * @param len Size of the buffer to send.
+ *
+ * @return IDEVICE_E_SUCCESS on success, or an error code otherwise.
+ */
+idevice_error_t idevice_io_loop_send(idevice_io_loop_t loop, idevice_connection_t connection, const char *data, uint32_t len);
+
+/**
+ * Waits for activity on the connections of an I/O loop and dispatches
+ * received frames and pending writes.
+ *
+ * @param loop The loop to run.
+ * @param timeout Maximum time to wait in milliseconds, 0 to return
+ *    immediately or -1 to wait indefinitely.
+ *
+ * @return The number of connections that had activity, 0 on timeout, or
+ *     -1 on error.
+ */
+int idevice_io_loop_run_once(idevice_io_loop_t loop, int timeout);
+
 /* misc */
 
 /**
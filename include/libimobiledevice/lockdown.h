@@ -464,6 +464,32 @@ lockdownd_error_t lockdownd_data_classes_free(char **classes);
  */
 lockdownd_error_t lockdownd_service_descriptor_free(lockdownd_service_descriptor_t service);
 
+/**
+ * Get the round-trip latencies of all lockdownd requests sent by this
+ * process as JSON.
+ *
+ * Latencies are kept in log-linear histograms with about 6% precision, one
+ * per request name. StartService requests are recorded per service, using
+ * "StartService/" followed by the service name. The result has the form
+ * {"unit": "us", "requests": {"GetValue": {"count": ..., "min": ...,
+ * "max": ..., "mean": ..., "p50": ..., "p90": ..., "p99": ..., "p999": ...,
+ * "buckets": [[lowest value, count], ...]}, ...}}.
+ *
+ * @param json Pointer that will be set to a newly allocated string holding
+ *    the JSON document. It has to be freed by the caller.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_INVALID_ARG if json is
+ *    NULL, or LOCKDOWN_E_UNKNOWN_ERROR if out of memory.
+ */
+lockdownd_error_t lockdownd_get_latency_stats(char **json);
+
+/**
+ * Clear the recorded latencies of lockdownd requests.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success
+ */
+lockdownd_error_t lockdownd_reset_latency_stats(void);
+
 #ifdef __cplusplus
 }
 #endif
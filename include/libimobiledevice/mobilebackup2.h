@@ -142,6 +142,21 @@ mobilebackup2_error_t mobilebackup2_receive_message(mobilebackup2_client_t clien
  */
 mobilebackup2_error_t mobilebackup2_send_raw(mobilebackup2_client_t client, const char *data, uint32_t length, uint32_t *bytes);
 
+/**
+ * Send several buffers of binary data to the device as one write, e.g. a
+ * length prefix and code followed by the data it describes.
+ *
+ * @param client The MobileBackup client to send to.
+ * @param iov Array of buffers to send, in order.
+ * @param iovcnt Number of buffers in the array.
+ * @param bytes Total number of bytes actually sent
+ *
+ * @return MOBILEBACKUP2_E_SUCCESS if any data was successfully sent,
+ *     MOBILEBACKUP2_E_INVALID_ARG if one of the parameters is invalid,
+ *     or MOBILEBACKUP2_E_MUX_ERROR if sending of the data failed.
+ */
+mobilebackup2_error_t mobilebackup2_send_rawv(mobilebackup2_client_t client, const idevice_iovec_t *iov, unsigned int iovcnt, uint32_t *bytes);
+
 /**
  * Receive binary from the device.
  *
@@ -105,6 +105,21 @@ service_error_t service_client_free(service_client_t client);
  */
 service_error_t service_send(service_client_t client, const char *data, uint32_t size, uint32_t *sent);
 
+/**
+ * Sends several buffers as one message using the given service client.
+ *
+ * @param client The service client to use for sending.
+ * @param iov Array of buffers to send, in order.
+ * @param iovcnt Number of buffers in the array.
+ * @param sent Total number of bytes sent (can be NULL to ignore)
+ *
+ * @return SERVICE_E_SUCCESS on success,
+ *      SERVICE_E_INVALID_ARG when one or more parameters are
+ *      invalid, or SERVICE_E_UNKNOWN_ERROR when an unspecified
+ *      error occurs.
+ */
+service_error_t service_sendv(service_client_t client, const idevice_iovec_t *iov, unsigned int iovcnt, uint32_t *sent);
+
 /**
  * Receives data using the given service client with specified timeout.
  *
@@ -162,6 +177,18 @@ service_error_t service_enable_ssl(service_client_t client);
  */
 service_error_t service_disable_ssl(service_client_t client);
 
+/**
+ * Get the performance counters of the connection of a service client.
+ *
+ * @param client The service client to get the counters of.
+ * @param stats Pointer to a structure the counters are copied to.
+ *
+ * @return SERVICE_E_SUCCESS on success,
+ *     SERVICE_E_INVALID_ARG if client, client->connection or stats is NULL,
+ *     or SERVICE_E_UNKNOWN_ERROR otherwise.
+ */
+service_error_t service_get_stats(service_client_t client, idevice_connection_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -44,9 +44,30 @@ typedef enum {
 typedef struct syslog_relay_client_private syslog_relay_client_private;
 typedef syslog_relay_client_private *syslog_relay_client_t; /**< The client handle. */
 
+typedef struct syslog_relay_filter_private syslog_relay_filter_private;
+typedef syslog_relay_filter_private *syslog_relay_filter_t; /**< A compiled set of syslog line predicates. */
+
+/** Severity of a syslog line, most severe first. */
+typedef enum {
+	SYSLOG_RELAY_LEVEL_EMERGENCY = 0,
+	SYSLOG_RELAY_LEVEL_ALERT     = 1,
+	SYSLOG_RELAY_LEVEL_CRITICAL  = 2,
+	SYSLOG_RELAY_LEVEL_ERROR     = 3,
+	SYSLOG_RELAY_LEVEL_WARNING   = 4,
+	SYSLOG_RELAY_LEVEL_NOTICE    = 5,
+	SYSLOG_RELAY_LEVEL_INFO      = 6,
+	SYSLOG_RELAY_LEVEL_DEBUG     = 7
+} syslog_relay_level_t;
+
 /** Receives each character received from the device. */
 typedef void (*syslog_relay_receive_cb_t)(char c, void *user_data);
 
+/** Callback receiving a single syslog line, NUL terminated and without the trailing newline. */
+typedef void (*syslog_relay_line_cb_t)(const char *line, uint32_t length, void *user_data);
+
+/** Callback receiving a batch of syslog lines, each NUL terminated and without the trailing newline. */
+typedef void (*syslog_relay_lines_cb_t)(const char **lines, const uint32_t *lengths, uint32_t count, void *user_data);
+
 /* Interface */
 
 /**
@@ -106,6 +127,47 @@ syslog_relay_error_t syslog_relay_client_free(syslog_relay_client_t client);
  */
 syslog_relay_error_t syslog_relay_start_capture(syslog_relay_client_t client, syslog_relay_receive_cb_t callback, void* user_data);
 
+/**
+ * Starts capturing the syslog of the device using a callback that receives
+ * complete lines.
+ *
+ * The syslog is read in large blocks and split into lines at newline and
+ * NUL characters. The line passed to the callback is only valid until the
+ * callback returns.
+ *
+ * Use syslog_relay_stop_capture() to stop receiving the syslog.
+ *
+ * @param client The syslog_relay client to use
+ * @param callback Callback to receive each line from the syslog.
+ * @param user_data Custom pointer passed to the callback function.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success,
+ *      SYSLOG_RELAY_E_INVALID_ARG when one or more parameters are
+ *      invalid or SYSLOG_RELAY_E_UNKNOWN_ERROR when an unspecified
+ *      error occurs or a syslog capture has already been started.
+ */
+syslog_relay_error_t syslog_relay_start_capture_lines(syslog_relay_client_t client, syslog_relay_line_cb_t callback, void* user_data);
+
+/**
+ * Starts capturing the syslog of the device using a callback that receives
+ * all complete lines of each block read from the device at once.
+ *
+ * The lines passed to the callback are only valid until the callback
+ * returns.
+ *
+ * Use syslog_relay_stop_capture() to stop receiving the syslog.
+ *
+ * @param client The syslog_relay client to use
+ * @param callback Callback to receive batches of lines from the syslog.
+ * @param user_data Custom pointer passed to the callback function.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success,
+ *      SYSLOG_RELAY_E_INVALID_ARG when one or more parameters are
+ *      invalid or SYSLOG_RELAY_E_UNKNOWN_ERROR when an unspecified
+ *      error occurs or a syslog capture has already been started.
+ */
+syslog_relay_error_t syslog_relay_start_capture_batch(syslog_relay_client_t client, syslog_relay_lines_cb_t callback, void* user_data);
+
 /**
  * Stops capturing the syslog of the device.
  *
@@ -120,6 +182,123 @@ syslog_relay_error_t syslog_relay_start_capture(syslog_relay_client_t client, sy
  */
 syslog_relay_error_t syslog_relay_stop_capture(syslog_relay_client_t client);
 
+/* Filtering */
+
+/**
+ * Creates a new, empty syslog line filter that lets every line pass.
+ *
+ * Predicates added to the filter are combined as follows: a line passes
+ * if its process name matches any of the added process names or its PID
+ * matches any of the added PIDs (when any were added), and its level is at
+ * least as severe as the set level, and it contains the set substring, and
+ * it matches the set regular expression.
+ *
+ * @param filter Pointer that will be set to the newly created filter.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, or an SYSLOG_RELAY_E_* error
+ *     code otherwise.
+ */
+syslog_relay_error_t syslog_relay_filter_new(syslog_relay_filter_t *filter);
+
+/**
+ * Frees a syslog line filter.
+ *
+ * @param filter The filter to free.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     filter is NULL.
+ */
+syslog_relay_error_t syslog_relay_filter_free(syslog_relay_filter_t filter);
+
+/**
+ * Adds a process name to a filter.
+ *
+ * @param filter The filter to modify.
+ * @param process The process name as it appears in the syslog, e.g.
+ *    "SpringBoard".
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     one or more parameters are invalid.
+ */
+syslog_relay_error_t syslog_relay_filter_add_process(syslog_relay_filter_t filter, const char *process);
+
+/**
+ * Adds a process ID to a filter.
+ *
+ * @param filter The filter to modify.
+ * @param pid The process ID.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     filter is NULL.
+ */
+syslog_relay_error_t syslog_relay_filter_add_pid(syslog_relay_filter_t filter, uint32_t pid);
+
+/**
+ * Sets the least severe level of the lines a filter lets pass. Lines
+ * without a level always pass this predicate.
+ *
+ * @param filter The filter to modify.
+ * @param level The least severe level to let pass.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     one or more parameters are invalid.
+ */
+syslog_relay_error_t syslog_relay_filter_set_level(syslog_relay_filter_t filter, syslog_relay_level_t level);
+
+/**
+ * Sets a substring that lines must contain to pass a filter.
+ *
+ * @param filter The filter to modify.
+ * @param match The substring to look for, or NULL to remove it.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     filter is NULL.
+ */
+syslog_relay_error_t syslog_relay_filter_set_match(syslog_relay_filter_t filter, const char *match);
+
+/**
+ * Sets a POSIX extended regular expression that lines must match to pass
+ * a filter.
+ *
+ * @param filter The filter to modify.
+ * @param pattern The regular expression, or NULL to remove it.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     filter is NULL or the pattern can not be compiled, or
+ *     SYSLOG_RELAY_E_UNKNOWN_ERROR if regular expressions are not supported
+ *     on this platform.
+ */
+syslog_relay_error_t syslog_relay_filter_set_regex(syslog_relay_filter_t filter, const char *pattern);
+
+/**
+ * Checks if a syslog line passes a filter.
+ *
+ * @param filter The filter to check against.
+ * @param line The NUL terminated line, without the trailing newline.
+ * @param length The length of the line.
+ *
+ * @return 1 if the line passes the filter, 0 otherwise.
+ */
+int syslog_relay_filter_match(syslog_relay_filter_t filter, const char *line, uint32_t length);
+
+/**
+ * Sets the filter applied to each line before it is passed to the callback
+ * of syslog_relay_start_capture_lines() or syslog_relay_start_capture_batch().
+ * The per-character callback of syslog_relay_start_capture() is not
+ * filtered.
+ *
+ * The filter is not copied and must stay valid until it is replaced or the
+ * client is freed. It must not be changed while a capture is running.
+ *
+ * @param client The syslog_relay client to set the filter for.
+ * @param filter The filter to apply, or NULL to pass all lines.
+ *
+ * @return SYSLOG_RELAY_E_SUCCESS on success, SYSLOG_RELAY_E_INVALID_ARG when
+ *     client is NULL, or SYSLOG_RELAY_E_UNKNOWN_ERROR when a capture is
+ *     running.
+ */
+syslog_relay_error_t syslog_relay_set_filter(syslog_relay_client_t client, syslog_relay_filter_t filter);
+
 /* Receiving */
 
 /**
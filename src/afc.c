@@ -29,11 +29,22 @@
 #include <unistd.h>
 #include <string.h>
 
+#ifdef HAVE_OPENSSL
+#include <openssl/sha.h>
+#else
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#endif
+
 #include "afc.h"
 #include "idevice.h"
 #include "common/debug.h"
+#include "common/trace.h"
 #include "endianness.h"
 
+static void afc_operation_finish(afc_operation_t operation, afc_error_t error, char *data, uint32_t length);
+static void afc_run_callbacks(struct afc_operation_private *completed);
+
 /**
  * Locks an AFC client, done for thread safety stuff
  *
@@ -90,7 +101,12 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_new_with_service_client(service_clie
 	memcpy(client_loc->afc_packet->magic, AFC_MAGIC, AFC_MAGIC_LEN);
 	client_loc->file_handle = 0;
 	client_loc->lock = 0;
+	client_loc->responses = NULL;
+	client_loc->operations = NULL;
+	client_loc->abandoned = NULL;
+	client_loc->abandoned_count = 0;
 	mutex_init(&client_loc->mutex);
+	mutex_init(&client_loc->recv_mutex);
 
 	*client = client_loc;
 	return AFC_E_SUCCESS;
@@ -106,6 +122,9 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_new(idevice_t device, lockdownd_serv
 		return AFC_E_MUX_ERROR;
 	}
 
+	/* serve packet headers from a buffer, afc_client_get_fd() turns it off */
+	idevice_connection_set_receive_buffer(parent->connection, SERVICE_RECEIVE_BUFFER_SIZE);
+
 	afc_error_t err = afc_client_new_with_service_client(parent, client);
 	if (err != AFC_E_SUCCESS) {
 		service_client_free(parent);
@@ -124,6 +143,9 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_start_service(idevice_t device, afc_
 
 LIBIMOBILEDEVICE_API afc_error_t afc_client_free(afc_client_t client)
 {
+	struct afc_operation_private *completed = NULL;
+	struct afc_operation_private *op = NULL;
+
 	if (!client || !client->afc_packet)
 		return AFC_E_INVALID_ARG;
 
@@ -131,8 +153,23 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_free(afc_client_t client)
 		service_client_free(client->parent);
 		client->parent = NULL;
 	}
+	while (client->responses) {
+		struct afc_response *next = client->responses->next;
+		free(client->responses->data);
+		free(client->responses);
+		client->responses = next;
+	}
+	/* pending operations will never complete now */
+	completed = client->operations;
+	client->operations = NULL;
+	for (op = completed; op; op = op->next) {
+		afc_operation_finish(op, AFC_E_OP_INTERRUPTED, NULL, 0);
+	}
+	afc_run_callbacks(completed);
+	free(client->abandoned);
 	free(client->afc_packet);
 	mutex_destroy(&client->mutex);
+	mutex_destroy(&client->recv_mutex);
 	free(client);
 	return AFC_E_SUCCESS;
 }
@@ -140,6 +177,12 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_free(afc_client_t client)
 /**
  * Dispatches an AFC packet over a client.
  *
+ * The client is locked while the packet is sent so that requests issued
+ * concurrently from several threads do not interleave on the wire. The lock
+ * is released before returning, the response has to be collected with
+ * afc_receive_data() using the returned packet number. This allows several
+ * requests to be in flight on the same connection at the same time.
+ *
  * @param client The client to send data through.
  * @param operation The operation to perform.
  * @param data The data to send together with the header.
@@ -147,12 +190,18 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_free(afc_client_t client)
  * @param payload The data to send after the header has been sent.
  * @param payload_length The length of data to send after the header.
  * @param bytes_sent The total number of bytes actually sent.
+ * @param packet_num Will be set to the packet number the request was tagged
+ *     with.
  *
- * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ * @return AFC_E_SUCCESS on success, AFC_E_MUX_ERROR if the packet could not
+ *     be sent completely (no response will arrive for it then), or
+ *     AFC_E_INVALID_ARG.
  */
-static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation, const char *data, uint32_t data_length, const char* payload, uint32_t payload_length, uint32_t *bytes_sent)
+static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation, const char *data, uint32_t data_length, const char* payload, uint32_t payload_length, uint32_t *bytes_sent, uint64_t *packet_num)
 {
-	uint32_t sent = 0;
+	idevice_iovec_t iov[3];
+	unsigned int iovcnt = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
 
 	if (!client || !client->parent || !client->afc_packet)
 		return AFC_E_INVALID_ARG;
@@ -164,514 +213,2126 @@ static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation,
 	if (!payload || !payload_length)
 		payload_length = 0;
 
+	afc_lock(client);
+
 	client->afc_packet->packet_num++;
 	client->afc_packet->operation = operation;
 	client->afc_packet->entire_length = sizeof(AFCPacket) + data_length + payload_length;
 	client->afc_packet->this_length = sizeof(AFCPacket) + data_length;
+	*packet_num = client->afc_packet->packet_num;
 
 	debug_info("packet length = %i", client->afc_packet->this_length);
 
 	debug_buffer((char*)client->afc_packet, sizeof(AFCPacket));
 
-	/* send AFC packet header */
-	AFCPacket_to_LE(client->afc_packet);
-	sent = 0;
-	service_send(client->parent, (void*)client->afc_packet, sizeof(AFCPacket), &sent);
-	AFCPacket_from_LE(client->afc_packet);
-	*bytes_sent += sent;
-	if (sent < sizeof(AFCPacket)) {
-		return AFC_E_SUCCESS;
-	}
-
-	/* send AFC packet data (if there's data to send) */
-	sent = 0;
 	if (data_length > 0) {
 		debug_info("packet data follows");
 		debug_buffer(data, data_length);
-		service_send(client->parent, data, data_length, &sent);
-	}
-	*bytes_sent += sent;
-	if (sent < data_length) {
-		return AFC_E_SUCCESS;
 	}
-
-	sent = 0;
 	if (payload_length > 0) {
 		debug_info("packet payload follows");
 		debug_buffer(payload, payload_length);
-		service_send(client->parent, payload, payload_length, &sent);
 	}
-	*bytes_sent += sent;
-	if (sent < payload_length) {
-		return AFC_E_SUCCESS;
+
+	/* send AFC packet header, data and payload with a single write */
+	iov[0].data = (const char*)client->afc_packet;
+	iov[0].length = sizeof(AFCPacket);
+	iov[1].data = data;
+	iov[1].length = data_length;
+	iov[2].data = payload;
+	iov[2].length = payload_length;
+	iovcnt = (payload_length > 0) ? 3 : ((data_length > 0) ? 2 : 1);
+
+	AFCPacket_to_LE(client->afc_packet);
+	if ((service_sendv(client->parent, iov, iovcnt, bytes_sent) != SERVICE_E_SUCCESS) || (*bytes_sent != sizeof(AFCPacket) + data_length + payload_length)) {
+		debug_info("Failed to send packet %lld (sent %d of %lld bytes)", *packet_num, *bytes_sent, sizeof(AFCPacket) + data_length + payload_length);
+		ret = AFC_E_MUX_ERROR;
 	}
+	AFCPacket_from_LE(client->afc_packet);
 
-	return AFC_E_SUCCESS;
+	trace_log(TRACE_CATEGORY_AFC, TRACE_EVENT_AFC_REQUEST, ret, operation, *packet_num, NULL);
+
+	afc_unlock(client);
+
+	return ret;
 }
 
 /**
- * Receives data through an AFC client and sets a variable to the received data.
+ * Receives the header of the next AFC packet from the connection.
  *
  * @param client The client to receive data on.
- * @param bytes The char* to point to the newly-received data.
- * @param bytes_recv How much data was received.
+ * @param header Will be filled with the (host endian) packet header.
+ * @param timeout Maximum time in milliseconds to wait for the packet to
+ *     arrive.
  *
- * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ * @return AFC_E_SUCCESS on success, AFC_E_OP_TIMEOUT if no packet arrived
+ *     within the given timeout, or an AFC_E_* error value if the header
+ *     could not be received.
  */
-static afc_error_t afc_receive_data(afc_client_t client, char **bytes, uint32_t *bytes_recv)
+static afc_error_t afc_receive_header(afc_client_t client, AFCPacket *header, unsigned int timeout)
 {
-	AFCPacket header;
-	uint32_t entire_len = 0;
-	uint32_t this_len = 0;
 	uint32_t current_count = 0;
-	uint64_t param1 = -1;
-	char* dump_here = NULL;
-
-	if (bytes_recv) {
-		*bytes_recv = 0;
-	}
-	if (bytes) {
-		*bytes = NULL;
-	}
+	uint32_t recv_len = 0;
 
 	/* first, read the AFC header */
-	service_receive(client->parent, (char*)&header, sizeof(AFCPacket), bytes_recv);
-	AFCPacket_from_LE(&header);
-	if (*bytes_recv == 0) {
+	service_receive_with_timeout(client->parent, (char*)header, sizeof(AFCPacket), &recv_len, timeout);
+	if (recv_len == 0) {
 		debug_info("Just didn't get enough.");
-		return AFC_E_MUX_ERROR;
-	} else if (*bytes_recv < sizeof(AFCPacket)) {
-		debug_info("Did not even get the AFCPacket header");
-		return AFC_E_MUX_ERROR;
+		return AFC_E_OP_TIMEOUT;
+	}
+	current_count = recv_len;
+	while (current_count < sizeof(AFCPacket)) {
+		service_receive(client->parent, (char*)header + current_count, sizeof(AFCPacket) - current_count, &recv_len);
+		if (recv_len == 0) {
+			debug_info("Did not even get the AFCPacket header");
+			return AFC_E_MUX_ERROR;
+		}
+		current_count += recv_len;
 	}
+	AFCPacket_from_LE(header);
 
 	/* check if it's a valid AFC header */
-	if (strncmp(header.magic, AFC_MAGIC, AFC_MAGIC_LEN)) {
+	if (strncmp(header->magic, AFC_MAGIC, AFC_MAGIC_LEN)) {
 		debug_info("Invalid AFC packet received (magic != " AFC_MAGIC ")!");
 	}
 
-	/* check if it has the correct packet number */
-	if (header.packet_num != client->afc_packet->packet_num) {
-		/* otherwise print a warning but do not abort */
-		debug_info("ERROR: Unexpected packet number (%lld != %lld) aborting.", header.packet_num, client->afc_packet->packet_num);
+	if ((header->this_length < sizeof(AFCPacket)) || (header->entire_length < header->this_length)) {
+		debug_info("Invalid AFCPacket header received!");
 		return AFC_E_OP_HEADER_INVALID;
 	}
 
-	/* then, read the attached packet */
-	if (header.this_length < sizeof(AFCPacket)) {
-		debug_info("Invalid AFCPacket header received!");
-		return AFC_E_OP_HEADER_INVALID;
-	} else if ((header.this_length == header.entire_length)
-			&& header.entire_length == sizeof(AFCPacket)) {
-		debug_info("Empty AFCPacket received!");
-		*bytes_recv = 0;
-		if (header.operation == AFC_OP_DATA) {
-			return AFC_E_SUCCESS;
-		} else {
-			return AFC_E_IO_ERROR;
+	debug_info("received AFC packet, full len=%lld, this len=%lld, operation=0x%llx", header->entire_length, header->this_length, header->operation);
+	trace_log(TRACE_CATEGORY_AFC, TRACE_EVENT_AFC_RESPONSE, AFC_E_SUCCESS, header->operation, header->packet_num, NULL);
+
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Receives the data attached to an AFC packet into the given buffer.
+ *
+ * @param client The client to receive data on.
+ * @param buffer The buffer to store the data in, or NULL to discard it.
+ * @param length How much data to receive.
+ * @param bytes_recv How much data was actually received.
+ *
+ * @return AFC_E_SUCCESS on success or AFC_E_NOT_ENOUGH_DATA if no data
+ *     could be received at all.
+ */
+static afc_error_t afc_receive_payload(afc_client_t client, char *buffer, uint32_t length, uint32_t *bytes_recv)
+{
+	char discard[4096];
+	uint32_t current_count = 0;
+	uint32_t recv_len = 0;
+	uint32_t chunk = 0;
+
+	*bytes_recv = 0;
+
+	while (current_count < length) {
+		chunk = length - current_count;
+		if (!buffer && (chunk > sizeof(discard))) {
+			chunk = sizeof(discard);
+		}
+		service_receive(client->parent, buffer ? buffer + current_count : discard, chunk, &recv_len);
+		if (recv_len <= 0) {
+			debug_info("Error receiving data (recv returned %d)", recv_len);
+			break;
 		}
+		current_count += recv_len;
+	}
+	*bytes_recv = current_count;
+
+	if ((length > 0) && (current_count == 0)) {
+		debug_info("Did not get packet contents!");
+		return AFC_E_NOT_ENOUGH_DATA;
+	} else if (current_count < length) {
+		debug_info("WARNING: could not receive full packet (read %d, size %d)", current_count, length);
 	}
 
-	debug_info("received AFC packet, full len=%lld, this len=%lld, operation=0x%llx", header.entire_length, header.this_length, header.operation);
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Receives the data attached to an AFC packet into a newly allocated buffer.
+ *
+ * @param client The client to receive data on.
+ * @param header The (host endian) header of the packet.
+ * @param bytes Will point to the newly allocated packet data, or NULL if the
+ *     packet has no data.
+ * @param bytes_recv How much packet data was received.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value if the packet
+ *     data could not be received.
+ */
+static afc_error_t afc_receive_body(afc_client_t client, AFCPacket *header, char **bytes, uint32_t *bytes_recv)
+{
+	uint32_t entire_len = 0;
+	char* dump_here = NULL;
+	afc_error_t ret;
+
+	*bytes = NULL;
+	*bytes_recv = 0;
+
+	if (header->entire_length == sizeof(AFCPacket)) {
+		debug_info("Empty AFCPacket received!");
+		return AFC_E_SUCCESS;
+	}
 
-	entire_len = (uint32_t)header.entire_length - sizeof(AFCPacket);
-	this_len = (uint32_t)header.this_length - sizeof(AFCPacket);
+	entire_len = (uint32_t)header->entire_length - sizeof(AFCPacket);
 
 	dump_here = (char*)malloc(entire_len);
-	if (this_len > 0) {
-		service_receive(client->parent, dump_here, this_len, bytes_recv);
-		if (*bytes_recv <= 0) {
-			free(dump_here);
-			debug_info("Did not get packet contents!");
-			return AFC_E_NOT_ENOUGH_DATA;
-		} else if (*bytes_recv < this_len) {
-			free(dump_here);
-			debug_info("Could not receive this_len=%d bytes", this_len);
-			return AFC_E_NOT_ENOUGH_DATA;
-		}
+	ret = afc_receive_payload(client, dump_here, entire_len, bytes_recv);
+	if (ret != AFC_E_SUCCESS) {
+		free(dump_here);
+		return ret;
 	}
 
-	current_count = this_len;
+	debug_info("packet data size = %i", *bytes_recv);
+	debug_info("packet data follows");
+	debug_buffer(dump_here, *bytes_recv);
 
-	if (entire_len > this_len) {
-		while (current_count < entire_len) {
-			service_receive(client->parent, dump_here+current_count, entire_len - current_count, bytes_recv);
-			if (*bytes_recv <= 0) {
-				debug_info("Error receiving data (recv returned %d)", *bytes_recv);
-				break;
-			}
-			current_count += *bytes_recv;
-		}
-		if (current_count < entire_len) {
-			debug_info("WARNING: could not receive full packet (read %s, size %d)", current_count, entire_len);
+	*bytes = dump_here;
+
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Evaluates the operation code and status of a received AFC packet.
+ *
+ * @param header The header of the received packet.
+ * @param bytes Pointer to the received packet data. The data is freed and
+ *     the pointer set to NULL if the packet does not carry a result.
+ * @param bytes_recv Pointer to the length of the received packet data.
+ *
+ * @return AFC_E_SUCCESS on success or the AFC_E_* error value reported by
+ *     the device.
+ */
+static afc_error_t afc_check_response(AFCPacket *header, char **bytes, uint32_t *bytes_recv)
+{
+	uint64_t param1 = -1;
+
+	if (!*bytes) {
+		*bytes_recv = 0;
+		if (header->operation == AFC_OP_DATA) {
+			return AFC_E_SUCCESS;
+		} else {
+			return AFC_E_IO_ERROR;
 		}
 	}
 
-	if (current_count >= sizeof(uint64_t)) {
-		param1 = le64toh(*(uint64_t*)(dump_here));
+	if (*bytes_recv >= sizeof(uint64_t)) {
+		param1 = le64toh(*(uint64_t*)(*bytes));
 	}
 
-	debug_info("packet data size = %i", current_count);
-	debug_info("packet data follows");
-	debug_buffer(dump_here, current_count);
-
 	/* check operation types */
-	if (header.operation == AFC_OP_STATUS) {
+	if (header->operation == AFC_OP_STATUS) {
 		/* status response */
 		debug_info("got a status response, code=%lld", param1);
 
 		if (param1 != AFC_E_SUCCESS) {
 			/* error status */
 			/* free buffer */
-			free(dump_here);
+			free(*bytes);
+			*bytes = NULL;
 			return (afc_error_t)param1;
 		}
-	} else if (header.operation == AFC_OP_DATA) {
+	} else if (header->operation == AFC_OP_DATA) {
 		/* data response */
 		debug_info("got a data response");
-	} else if (header.operation == AFC_OP_FILE_OPEN_RES) {
+	} else if (header->operation == AFC_OP_FILE_OPEN_RES) {
 		/* file handle response */
 		debug_info("got a file handle response, handle=%lld", param1);
-	} else if (header.operation == AFC_OP_FILE_TELL_RES) {
+	} else if (header->operation == AFC_OP_FILE_TELL_RES) {
 		/* tell response */
 		debug_info("got a tell response, position=%lld", param1);
+	} else if (header->operation == AFC_OP_DIR_OPEN_RESULT) {
+		/* directory enumerator handle response */
+		debug_info("got a directory handle response, handle=%lld", param1);
 	} else {
 		/* unknown operation code received */
-		free(dump_here);
+		free(*bytes);
+		*bytes = NULL;
 		*bytes_recv = 0;
 
-		debug_info("WARNING: Unknown operation code received 0x%llx param1=%lld", header.operation, param1);
+		debug_info("WARNING: Unknown operation code received 0x%llx param1=%lld", header->operation, param1);
 #ifndef WIN32
-		fprintf(stderr, "%s: WARNING: Unknown operation code received 0x%llx param1=%lld", __func__, (long long)header.operation, (long long)param1);
+		fprintf(stderr, "%s: WARNING: Unknown operation code received 0x%llx param1=%lld", __func__, (long long)header->operation, (long long)param1);
 #endif
 
 		return AFC_E_OP_NOT_SUPPORTED;
 	}
 
-	if (bytes) {
-		*bytes = dump_here;
-	} else {
-		free(dump_here);
-	}
-
-	*bytes_recv = current_count;
 	return AFC_E_SUCCESS;
 }
 
 /**
- * Returns counts of null characters within a string.
+ * Receives the next response from the connection and evaluates it.
+ * The receive lock of the client has to be held by the caller.
+ *
+ * @param client The client to receive the response on.
+ * @param timeout Maximum time in milliseconds to wait for the response.
+ * @param response Will be filled with the received response.
+ *
+ * @return AFC_E_SUCCESS if a response was received, AFC_E_OP_TIMEOUT if no
+ *     response arrived within the given timeout, or an AFC_E_* error value
+ *     if receiving failed.
  */
-static uint32_t count_nullspaces(char *string, uint32_t number)
+static afc_error_t afc_receive_response(afc_client_t client, unsigned int timeout, struct afc_response *response)
 {
-	uint32_t i = 0, nulls = 0;
+	AFCPacket header;
+	afc_error_t ret;
 
-	for (i = 0; i < number; i++) {
-		if (string[i] == '\0')
-			nulls++;
+	response->data = NULL;
+	response->length = 0;
+	response->next = NULL;
+
+	ret = afc_receive_header(client, &header, timeout);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
+	ret = afc_receive_body(client, &header, &response->data, &response->length);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
 	}
+	response->packet_num = header.packet_num;
+	response->error = afc_check_response(&header, &response->data, &response->length);
 
-	return nulls;
+	return AFC_E_SUCCESS;
 }
 
 /**
- * Splits a string of tokens by null characters and returns each token in a
- * char array/list.
- *
- * @param tokens The characters to split into a list.
- * @param length The length of the tokens string.
+ * Takes a response that has already been received for the given packet
+ * number out of the queue of the client.
+ * The receive lock of the client has to be held by the caller.
  *
- * @return A char ** list with each token found in the string. The caller is
- *  responsible for freeing the memory.
+ * @return 1 if a matching response was found, 0 otherwise.
  */
-static char **make_strings_list(char *tokens, uint32_t length)
+static int afc_take_response(afc_client_t client, uint64_t packet_num, struct afc_response *response)
 {
-	uint32_t nulls = 0, i = 0, j = 0;
-	char **list = NULL;
-
-	if (!tokens || !length)
-		return NULL;
+	struct afc_response **prev = NULL;
+	struct afc_response *found = NULL;
 
-	nulls = count_nullspaces(tokens, length);
-	list = (char **) malloc(sizeof(char *) * (nulls + 1));
-	for (i = 0; i < nulls; i++) {
-		list[i] = strdup(tokens + j);
-		j += strlen(list[i]) + 1;
+	for (prev = &client->responses; *prev; prev = &(*prev)->next) {
+		if ((*prev)->packet_num == packet_num)
+			break;
+	}
+	if (!*prev) {
+		return 0;
 	}
-	list[i] = NULL;
 
-	return list;
+	found = *prev;
+	*prev = found->next;
+	*response = *found;
+	response->next = NULL;
+	free(found);
+
+	return 1;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***directory_information)
+/**
+ * Remembers that nobody waits for the response to a request anymore, so it
+ * is dropped instead of queued when it arrives late.
+ * The receive lock of the client has to be held by the caller.
+ */
+static void afc_abandon_response(afc_client_t client, uint64_t packet_num)
 {
-	uint32_t bytes = 0;
-	char *data = NULL, **list_loc = NULL;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	if (!client->abandoned) {
+		client->abandoned = (uint64_t*)malloc(AFC_MAX_ABANDONED * sizeof(uint64_t));
+		if (!client->abandoned)
+			return;
+	}
+	if (client->abandoned_count == AFC_MAX_ABANDONED) {
+		/* forget the oldest one, its response is most likely lost */
+		memmove(client->abandoned, client->abandoned + 1, (AFC_MAX_ABANDONED - 1) * sizeof(uint64_t));
+		client->abandoned_count--;
+	}
+	client->abandoned[client->abandoned_count++] = packet_num;
+}
 
-	if (!client || !path || !directory_information || (directory_information && *directory_information))
-		return AFC_E_INVALID_ARG;
+/**
+ * Checks if a response belongs to an abandoned request and forgets the
+ * request if so.
+ * The receive lock of the client has to be held by the caller.
+ */
+static int afc_take_abandoned(afc_client_t client, uint64_t packet_num)
+{
+	uint32_t i;
+	for (i = 0; i < client->abandoned_count; i++) {
+		if (client->abandoned[i] == packet_num) {
+			client->abandoned_count--;
+			memmove(client->abandoned + i, client->abandoned + i + 1, (client->abandoned_count - i) * sizeof(uint64_t));
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	afc_lock(client);
+/**
+ * Stores the result of a response in an asynchronous operation and marks
+ * the operation as complete.
+ */
+static void afc_operation_finish(afc_operation_t operation, afc_error_t error, char *data, uint32_t length)
+{
+	mutex_lock(&operation->mutex);
+	operation->error = error;
 
-	/* Send the command */
-	ret = afc_dispatch_packet(client, AFC_OP_READ_DIR, path, strlen(path)+1, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		if (data)
+	switch (operation->operation) {
+		case AFC_OP_FILE_OPEN:
+			if ((error == AFC_E_SUCCESS) && data && (length >= sizeof(uint64_t))) {
+				memcpy(&operation->handle, data, sizeof(uint64_t));
+			}
 			free(data);
-		afc_unlock(client);
-		return ret;
+			break;
+		case AFC_OP_FILE_READ:
+			/* the buffer is gone if the operation was freed while pending */
+			if ((error == AFC_E_SUCCESS) && data && operation->buffer) {
+				operation->length = (length > operation->buffer_size) ? operation->buffer_size : length;
+				memcpy(operation->buffer, data, operation->length);
+			}
+			free(data);
+			break;
+		case AFC_OP_FILE_WRITE:
+			free(data);
+			break;
+		default:
+			operation->data = data;
+			operation->length = length;
+			break;
 	}
-	/* Parse the data */
-	list_loc = make_strings_list(data, bytes);
-	if (data)
-		free(data);
-
-	afc_unlock(client);
-	*directory_information = list_loc;
 
-	return ret;
+	/* a completed operation no longer depends on its client */
+	operation->client = NULL;
+	operation->complete = 1;
+	/* owned by afc_run_callbacks() until the callback returned */
+	operation->dispatching = 1;
+	mutex_unlock(&operation->mutex);
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
+/**
+ * Hands a received response to the asynchronous operation it belongs to,
+ * or queues it for the caller that waits for it.
+ * The receive lock of the client has to be held by the caller.
+ *
+ * @param client The client the response was received on.
+ * @param response The received response.
+ * @param completed List the operation is added to if the response
+ *     completed an asynchronous operation.
+ */
+static void afc_queue_response(afc_client_t client, struct afc_response *response, struct afc_operation_private **completed)
 {
-	uint32_t bytes = 0;
-	char *data = NULL, **list = NULL;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	if (!client || !device_information)
-		return AFC_E_INVALID_ARG;
-
-	afc_lock(client);
+	struct afc_operation_private **prev = NULL;
+	struct afc_operation_private *operation = NULL;
+	struct afc_response *queued = NULL;
 
-	/* Send the command */
-	ret = afc_dispatch_packet(client, AFC_OP_GET_DEVINFO, NULL, 0, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	for (prev = &client->operations; *prev; prev = &(*prev)->next) {
+		if ((*prev)->packet_num == response->packet_num)
+			break;
 	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		if (data)
-			free(data);
-		afc_unlock(client);
-		return ret;
+	if (*prev) {
+		operation = *prev;
+		*prev = operation->next;
+		afc_operation_finish(operation, response->error, response->data, response->length);
+		operation->next = *completed;
+		*completed = operation;
+		return;
 	}
-	/* Parse the data */
-	list = make_strings_list(data, bytes);
-	if (data)
-		free(data);
 
-	afc_unlock(client);
-
-	*device_information = list;
+	if (afc_take_abandoned(client, response->packet_num)) {
+		debug_info("dropping late response for packet %lld", response->packet_num);
+		free(response->data);
+		response->data = NULL;
+		return;
+	}
 
-	return ret;
+	/* the response belongs to another request, queue it for its owner */
+	debug_info("queueing response for packet %lld", response->packet_num);
+	queued = (struct afc_response*)malloc(sizeof(struct afc_response));
+	*queued = *response;
+	queued->next = client->responses;
+	client->responses = queued;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info_key(afc_client_t client, const char *key, char **value)
+/**
+ * Invokes the callbacks of completed asynchronous operations. Must be
+ * called without holding the receive lock so callbacks can submit new
+ * operations.
+ */
+static void afc_run_callbacks(struct afc_operation_private *completed)
 {
-	afc_error_t ret = AFC_E_INTERNAL_ERROR;
-	char **kvps, **ptr;
+	while (completed) {
+		struct afc_operation_private *next = completed->next;
+		afc_completion_cb_t callback = NULL;
+		int auto_free = 0;
+
+		completed->next = NULL;
+		mutex_lock(&completed->mutex);
+		callback = completed->callback;
+		mutex_unlock(&completed->mutex);
+		if (callback) {
+			callback(completed, completed->error, completed->user_data);
+		}
 
-	*value = NULL;
-	if (key == NULL)
-		return AFC_E_INVALID_ARG;
+		/* afc_operation_free() only marks operations that are being dispatched */
+		mutex_lock(&completed->mutex);
+		completed->dispatching = 0;
+		auto_free = completed->auto_free;
+		mutex_unlock(&completed->mutex);
+		if (auto_free) {
+			afc_operation_free(completed);
+		}
+		completed = next;
+	}
+}
 
-	ret = afc_get_device_info(client, &kvps);
-	if (ret != AFC_E_SUCCESS)
-		return ret;
+/**
+ * Receives the response to a previously dispatched request through an AFC
+ * client and sets a variable to the received data.
+ *
+ * Responses are matched to requests by their packet number. Responses that
+ * belong to requests of other callers are received as well and queued for
+ * them, so every caller can wait for its own response regardless of how
+ * many other requests are in flight on the same connection.
+ *
+ * @param client The client to receive data on.
+ * @param packet_num The packet number returned by afc_dispatch_packet().
+ * @param bytes The char* to point to the newly-received data.
+ * @param bytes_recv How much data was received.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_receive_data(afc_client_t client, uint64_t packet_num, char **bytes, uint32_t *bytes_recv)
+{
+	struct afc_response response;
+	struct afc_operation_private *completed = NULL;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (bytes_recv) {
+		*bytes_recv = 0;
+	}
+	if (bytes) {
+		*bytes = NULL;
+	}
+
+	mutex_lock(&client->recv_mutex);
+	while (1) {
+		/* check if the response was already received for us */
+		if (afc_take_response(client, packet_num, &response)) {
+			ret = response.error;
+			break;
+		}
+
+		ret = afc_receive_response(client, 10000, &response);
+		if (ret != AFC_E_SUCCESS) {
+			if (ret == AFC_E_OP_TIMEOUT) {
+				ret = AFC_E_MUX_ERROR;
+			}
+			afc_abandon_response(client, packet_num);
+			break;
+		}
+		if (response.packet_num == packet_num) {
+			ret = response.error;
+			break;
+		}
+
+		afc_queue_response(client, &response, &completed);
+	}
+	mutex_unlock(&client->recv_mutex);
+
+	afc_run_callbacks(completed);
+
+	if (bytes) {
+		*bytes = response.data;
+	} else {
+		free(response.data);
+	}
+	if (bytes_recv) {
+		*bytes_recv = response.length;
+	}
+
+	return ret;
+}
+
+/**
+ * Receives the data response to a previously dispatched read request
+ * directly into the given buffer.
+ *
+ * Unlike afc_receive_data() the payload of the response is not copied
+ * through an intermediate heap buffer if it is read from the connection by
+ * the caller itself. Data exceeding the buffer size is discarded.
+ *
+ * @param client The client to receive data on.
+ * @param packet_num The packet number returned by afc_dispatch_packet().
+ * @param data The buffer to store the received data in.
+ * @param length The size of the buffer.
+ * @param bytes_recv How much data was stored in the buffer.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_receive_data_into(afc_client_t client, uint64_t packet_num, char *data, uint32_t length, uint32_t *bytes_recv)
+{
+	AFCPacket header;
+	struct afc_response response;
+	struct afc_operation_private *completed = NULL;
+	uint32_t payload_len = 0;
+	uint32_t discarded = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	*bytes_recv = 0;
+	response.data = NULL;
+	response.length = 0;
+
+	mutex_lock(&client->recv_mutex);
+	while (1) {
+		/* check if the response was already received for us */
+		if (afc_take_response(client, packet_num, &response)) {
+			ret = response.error;
+			break;
+		}
+
+		ret = afc_receive_header(client, &header, 10000);
+		if (ret != AFC_E_SUCCESS) {
+			if (ret == AFC_E_OP_TIMEOUT) {
+				ret = AFC_E_MUX_ERROR;
+			}
+			afc_abandon_response(client, packet_num);
+			break;
+		}
+
+		if ((header.packet_num == packet_num) && (header.operation == AFC_OP_DATA)) {
+			/* receive the payload straight into the caller's buffer */
+			payload_len = (uint32_t)header.entire_length - sizeof(AFCPacket);
+			ret = afc_receive_payload(client, data, (payload_len > length) ? length : payload_len, bytes_recv);
+			if ((ret == AFC_E_SUCCESS) && (payload_len > length)) {
+				ret = afc_receive_payload(client, NULL, payload_len - length, &discarded);
+			}
+			break;
+		}
+
+		response.packet_num = header.packet_num;
+		response.next = NULL;
+		ret = afc_receive_body(client, &header, &response.data, &response.length);
+		if (ret != AFC_E_SUCCESS) {
+			break;
+		}
+		response.error = afc_check_response(&header, &response.data, &response.length);
+		if (header.packet_num == packet_num) {
+			ret = response.error;
+			break;
+		}
+
+		afc_queue_response(client, &response, &completed);
+		response.data = NULL;
+		response.length = 0;
+	}
+	mutex_unlock(&client->recv_mutex);
+
+	afc_run_callbacks(completed);
+
+	if (response.data) {
+		*bytes_recv = (response.length > length) ? length : response.length;
+		memcpy(data, response.data, *bytes_recv);
+		free(response.data);
+	}
+
+	return ret;
+}
+
+/**
+ * Creates a new asynchronous operation for the given client.
+ */
+static afc_operation_t afc_operation_new(afc_client_t client, uint64_t operation, afc_completion_cb_t callback, void *user_data, afc_operation_t *handle)
+{
+	afc_operation_t op = (afc_operation_t)calloc(1, sizeof(struct afc_operation_private));
+	if (!op) {
+		return NULL;
+	}
+	mutex_init(&op->mutex);
+	op->client = client;
+	op->operation = operation;
+	op->callback = callback;
+	op->user_data = user_data;
+	op->auto_free = (handle == NULL);
+
+	return op;
+}
+
+/**
+ * Releases an operation that is not referenced by the client anymore.
+ */
+static void afc_operation_destroy(afc_operation_t op)
+{
+	mutex_destroy(&op->mutex);
+	free(op->data);
+	free(op);
+}
+
+/**
+ * Sends the request of an asynchronous operation and registers the
+ * operation with the client so its response gets matched when it arrives.
+ *
+ * @param op The operation to submit. It is freed if sending fails.
+ * @param data The data to send together with the header.
+ * @param data_length The length of the data to send with the header.
+ * @param payload The data to send after the header has been sent.
+ * @param payload_length The length of data to send after the header.
+ * @param handle Will be set to the operation on success. Can be NULL.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_operation_submit(afc_operation_t op, const char *data, uint32_t data_length, const char *payload, uint32_t payload_length, afc_operation_t *handle)
+{
+	afc_client_t client = op->client;
+	struct afc_response response;
+	struct afc_operation_private *completed = NULL;
+	uint32_t bytes = 0;
+
+	afc_error_t ret = afc_dispatch_packet(client, op->operation, data, data_length, payload, payload_length, &bytes, &op->packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		/* never registered, no response will be matched to it */
+		afc_operation_destroy(op);
+		return ret;
+	}
+	if (op->operation == AFC_OP_FILE_WRITE) {
+		op->length = bytes - (sizeof(AFCPacket) + data_length);
+	}
+
+	if (handle) {
+		*handle = op;
+	}
+
+	mutex_lock(&client->recv_mutex);
+	if (afc_take_response(client, op->packet_num, &response)) {
+		/* another caller already received the response */
+		afc_operation_finish(op, response.error, response.data, response.length);
+		completed = op;
+	} else {
+		op->next = client->operations;
+		client->operations = op;
+	}
+	mutex_unlock(&client->recv_mutex);
+
+	afc_run_callbacks(completed);
+
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Returns counts of null characters within a string.
+ */
+static uint32_t count_nullspaces(char *string, uint32_t number)
+{
+	uint32_t i = 0, nulls = 0;
+
+	for (i = 0; i < number; i++) {
+		if (string[i] == '\0')
+			nulls++;
+	}
+
+	return nulls;
+}
+
+/**
+ * Splits a string of tokens by null characters and returns each token in a
+ * char array/list.
+ *
+ * @param tokens The characters to split into a list.
+ * @param length The length of the tokens string.
+ *
+ * @return A char ** list with each token found in the string. The caller is
+ *  responsible for freeing the memory.
+ */
+static char **make_strings_list(char *tokens, uint32_t length)
+{
+	uint32_t nulls = 0, i = 0, j = 0;
+	char **list = NULL;
+
+	if (!tokens || !length)
+		return NULL;
+
+	nulls = count_nullspaces(tokens, length);
+	list = (char **) malloc(sizeof(char *) * (nulls + 1));
+	for (i = 0; i < nulls; i++) {
+		list[i] = strdup(tokens + j);
+		j += strlen(list[i]) + 1;
+	}
+	list[i] = NULL;
+
+	return list;
+}
+
+/**
+ * Converts an st_ifmt value as reported by the device to a file type.
+ */
+static afc_file_type_t afc_file_type_from_string(const char *ifmt)
+{
+	if (!strcmp(ifmt, "S_IFREG")) {
+		return AFC_FILE_TYPE_REGULAR;
+	} else if (!strcmp(ifmt, "S_IFDIR")) {
+		return AFC_FILE_TYPE_DIRECTORY;
+	} else if (!strcmp(ifmt, "S_IFLNK")) {
+		return AFC_FILE_TYPE_SYMLINK;
+	} else if (!strcmp(ifmt, "S_IFCHR")) {
+		return AFC_FILE_TYPE_CHAR_DEVICE;
+	} else if (!strcmp(ifmt, "S_IFBLK")) {
+		return AFC_FILE_TYPE_BLOCK_DEVICE;
+	} else if (!strcmp(ifmt, "S_IFIFO")) {
+		return AFC_FILE_TYPE_FIFO;
+	} else if (!strcmp(ifmt, "S_IFSOCK")) {
+		return AFC_FILE_TYPE_SOCKET;
+	}
+	return AFC_FILE_TYPE_UNKNOWN;
+}
+
+/**
+ * Parses a file information response in place.
+ *
+ * @param data The received key/value list, separated by NUL characters.
+ * @param length The length of the received data.
+ * @param info The file information to fill.
+ */
+static void afc_parse_file_info(const char *data, uint32_t length, afc_file_info_t *info)
+{
+	uint32_t pos = 0;
+	uint32_t key_len, value_len;
+
+	memset(info, '\0', sizeof(afc_file_info_t));
+
+	while (pos < length) {
+		const char *key = data + pos;
+		key_len = strnlen(key, length - pos);
+		if (pos + key_len + 1 >= length)
+			break;
+		const char *value = key + key_len + 1;
+		value_len = strnlen(value, length - (pos + key_len + 1));
+		if (pos + key_len + 1 + value_len >= length)
+			break;
+		pos += key_len + 1 + value_len + 1;
+
+		if (!strcmp(key, "st_size")) {
+			info->size = strtoull(value, NULL, 10);
+		} else if (!strcmp(key, "st_blocks")) {
+			info->blocks = strtoull(value, NULL, 10);
+		} else if (!strcmp(key, "st_nlink")) {
+			info->nlink = (uint32_t)strtoul(value, NULL, 10);
+		} else if (!strcmp(key, "st_ifmt")) {
+			info->type = afc_file_type_from_string(value);
+		} else if (!strcmp(key, "st_mtime")) {
+			info->mtime = strtoull(value, NULL, 10);
+		} else if (!strcmp(key, "st_birthtime")) {
+			info->birthtime = strtoull(value, NULL, 10);
+		}
+	}
+}
+
+/**
+ * Parses a device information response in place.
+ *
+ * @param data The received key/value list, separated by NUL characters.
+ * @param length The length of the received data.
+ * @param info The device information to fill.
+ */
+static void afc_parse_device_info(const char *data, uint32_t length, afc_device_info_t *info)
+{
+	uint32_t pos = 0;
+	uint32_t key_len, value_len;
+
+	memset(info, '\0', sizeof(afc_device_info_t));
+
+	while (pos < length) {
+		const char *key = data + pos;
+		key_len = strnlen(key, length - pos);
+		if (pos + key_len + 1 >= length)
+			break;
+		const char *value = key + key_len + 1;
+		value_len = strnlen(value, length - (pos + key_len + 1));
+		if (pos + key_len + 1 + value_len >= length)
+			break;
+		pos += key_len + 1 + value_len + 1;
+
+		if (!strcmp(key, "Model")) {
+			strncpy(info->model, value, sizeof(info->model) - 1);
+		} else if (!strcmp(key, "FSTotalBytes")) {
+			info->total_bytes = strtoull(value, NULL, 10);
+		} else if (!strcmp(key, "FSFreeBytes")) {
+			info->free_bytes = strtoull(value, NULL, 10);
+		} else if (!strcmp(key, "FSBlockSize")) {
+			info->block_size = (uint32_t)strtoul(value, NULL, 10);
+		}
+	}
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***directory_information)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	char *data = NULL, **list_loc = NULL;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !directory_information || (directory_information && *directory_information))
+		return AFC_E_INVALID_ARG;
+
+	/* Send the command */
+	ret = afc_dispatch_packet(client, AFC_OP_READ_DIR, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive the data */
+	ret = afc_receive_data(client, packet_num, &data, &bytes);
+	if (ret != AFC_E_SUCCESS) {
+		if (data)
+			free(data);
+		return ret;
+	}
+	/* Parse the data */
+	list_loc = make_strings_list(data, bytes);
+	if (data)
+		free(data);
+
+	*directory_information = list_loc;
+
+	return ret;
+}
+
+/**
+ * Stores a batch of directory entries in an enumerator. If the device did
+ * not terminate the last entry, the buffer is grown by one byte and the
+ * terminator is added after the data.
+ *
+ * @param dir The directory enumerator.
+ * @param data The received entries. Owned by the enumerator afterwards, or
+ *     freed on error.
+ * @param length The length of the received entries.
+ *
+ * @return AFC_E_SUCCESS on success or AFC_E_NO_MEM.
+ */
+static afc_error_t afc_dir_set_buffer(afc_dir_t dir, char *data, uint32_t length)
+{
+	char *buffer = NULL;
+
+	if (data && (length > 0) && (data[length - 1] != '\0')) {
+		buffer = (char*)realloc(data, length + 1);
+		if (!buffer) {
+			free(data);
+			return AFC_E_NO_MEM;
+		}
+		buffer[length] = '\0';
+		data = buffer;
+	}
+	dir->buffer = data;
+	dir->length = length;
+	dir->pos = 0;
+
+	return AFC_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_dir_open(afc_client_t client, const char *path, afc_dir_t *dir)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	char *data = NULL;
+	afc_dir_t dir_loc = NULL;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !dir)
+		return AFC_E_INVALID_ARG;
+
+	*dir = NULL;
+
+	dir_loc = (afc_dir_t)calloc(1, sizeof(struct afc_dir_private));
+	if (!dir_loc)
+		return AFC_E_NO_MEM;
+	dir_loc->client = client;
+
+	/* Send the command */
+	ret = afc_dispatch_packet(client, AFC_OP_DIR_OPEN, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		free(dir_loc);
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive the handle */
+	ret = afc_receive_data(client, packet_num, &data, &bytes);
+	if ((ret == AFC_E_SUCCESS) && data && (bytes >= sizeof(uint64_t))) {
+		memcpy(&dir_loc->handle, data, sizeof(uint64_t));
+		free(data);
+		*dir = dir_loc;
+		return ret;
+	}
+	free(data);
+	data = NULL;
+
+	if ((ret != AFC_E_OP_NOT_SUPPORTED) && (ret != AFC_E_UNKNOWN_PACKET_TYPE)) {
+		free(dir_loc);
+		return (ret == AFC_E_SUCCESS) ? AFC_E_IO_ERROR : ret;
+	}
+
+	/* no directory enumerator support, fall back to reading the whole listing */
+	debug_info("directory enumerators not supported, falling back to ReadDir");
+	ret = afc_dispatch_packet(client, AFC_OP_READ_DIR, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		free(dir_loc);
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	ret = afc_receive_data(client, packet_num, &data, &bytes);
+	if (ret != AFC_E_SUCCESS) {
+		free(data);
+		free(dir_loc);
+		return ret;
+	}
+	dir_loc->legacy = 1;
+	dir_loc->eof = 1;
+	ret = afc_dir_set_buffer(dir_loc, data, bytes);
+	if (ret != AFC_E_SUCCESS) {
+		free(dir_loc);
+		return ret;
+	}
+	*dir = dir_loc;
+
+	return AFC_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_dir_read(afc_dir_t dir, const char **name)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	char *data = NULL;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!dir || !name)
+		return AFC_E_INVALID_ARG;
+
+	*name = NULL;
+
+	while (dir->pos >= dir->length) {
+		if (dir->eof)
+			return AFC_E_SUCCESS;
+
+		/* fetch the next batch of entries, replacing the previous one */
+		free(dir->buffer);
+		dir->buffer = NULL;
+		dir->length = 0;
+		dir->pos = 0;
+
+		ret = afc_dispatch_packet(dir->client, AFC_OP_DIR_READ, (const char*)&dir->handle, 8, NULL, 0, &bytes, &packet_num);
+		if (ret != AFC_E_SUCCESS) {
+			return AFC_E_NOT_ENOUGH_DATA;
+		}
+		ret = afc_receive_data(dir->client, packet_num, &data, &bytes);
+		if (ret != AFC_E_SUCCESS) {
+			free(data);
+			return ret;
+		}
+		if (!data || (bytes == 0)) {
+			free(data);
+			dir->eof = 1;
+			continue;
+		}
+		ret = afc_dir_set_buffer(dir, data, bytes);
+		if (ret != AFC_E_SUCCESS) {
+			return ret;
+		}
+	}
+
+	/* entries are NUL separated, the buffer is terminated after the last one */
+	*name = dir->buffer + dir->pos;
+	while ((dir->pos < dir->length) && dir->buffer[dir->pos])
+		dir->pos++;
+	dir->pos++;
+
+	return AFC_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_dir_close(afc_dir_t dir)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!dir)
+		return AFC_E_INVALID_ARG;
+
+	if (!dir->legacy) {
+		ret = afc_dispatch_packet(dir->client, AFC_OP_DIR_CLOSE, (const char*)&dir->handle, 8, NULL, 0, &bytes, &packet_num);
+		if (ret == AFC_E_SUCCESS) {
+			ret = afc_receive_data(dir->client, packet_num, NULL, NULL);
+		} else {
+			ret = AFC_E_NOT_ENOUGH_DATA;
+		}
+	}
+
+	free(dir->buffer);
+	free(dir);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	char *data = NULL, **list = NULL;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !device_information)
+		return AFC_E_INVALID_ARG;
+
+	/* Send the command */
+	ret = afc_dispatch_packet(client, AFC_OP_GET_DEVINFO, NULL, 0, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive the data */
+	ret = afc_receive_data(client, packet_num, &data, &bytes);
+	if (ret != AFC_E_SUCCESS) {
+		if (data)
+			free(data);
+		return ret;
+	}
+	/* Parse the data */
+	list = make_strings_list(data, bytes);
+	if (data)
+		free(data);
+
+	*device_information = list;
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info_parsed(afc_client_t client, afc_device_info_t *device_info)
+{
+	char *received = NULL;
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !device_info)
+		return AFC_E_INVALID_ARG;
+
+	memset(device_info, '\0', sizeof(afc_device_info_t));
+
+	/* Send the command */
+	ret = afc_dispatch_packet(client, AFC_OP_GET_DEVINFO, NULL, 0, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+
+	/* Parse the response in place, however long it is */
+	ret = afc_receive_data(client, packet_num, &received, &bytes);
+	if ((ret == AFC_E_SUCCESS) && received) {
+		afc_parse_device_info(received, bytes, device_info);
+	}
+	free(received);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info_key(afc_client_t client, const char *key, char **value)
+{
+	afc_error_t ret = AFC_E_INTERNAL_ERROR;
+	char **kvps, **ptr;
+
+	*value = NULL;
+	if (key == NULL)
+		return AFC_E_INVALID_ARG;
+
+	ret = afc_get_device_info(client, &kvps);
+	if (ret != AFC_E_SUCCESS)
+		return ret;
+
+	for (ptr = kvps; *ptr; ptr++) {
+		if (!strcmp(*ptr, key)) {
+			*value = strdup(*(ptr+1));
+			break;
+		}
+	}
+	for (ptr = kvps; *ptr; ptr++) {
+		free(*ptr);
+	}
+	free(kvps);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_remove_path(afc_client_t client, const char *path)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !client->afc_packet || !client->parent)
+		return AFC_E_INVALID_ARG;
+
+	/* Send command */
+	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	/* special case; unknown error actually means directory not empty */
+	if (ret == AFC_E_UNKNOWN_ERROR)
+		ret = AFC_E_DIR_NOT_EMPTY;
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_rename_path(afc_client_t client, const char *from, const char *to)
+{
+	if (!client || !from || !to || !client->afc_packet || !client->parent)
+		return AFC_E_INVALID_ARG;
+
+	char *buffer = (char *) malloc(sizeof(char) * (strlen(from) + strlen(to) + 1 + sizeof(uint32_t)));
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	/* Send command */
+	memcpy(buffer, from, strlen(from) + 1);
+	memcpy(buffer + strlen(from) + 1, to, strlen(to) + 1);
+	ret = afc_dispatch_packet(client, AFC_OP_RENAME_PATH, buffer, strlen(to)+1 + strlen(from)+1, NULL, 0, &bytes, &packet_num);
+	free(buffer);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_make_directory(afc_client_t client, const char *path)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client)
+		return AFC_E_INVALID_ARG;
+
+	/* Send command */
+	ret = afc_dispatch_packet(client, AFC_OP_MAKE_DIR, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information)
+{
+	char *received = NULL;
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !file_information)
+		return AFC_E_INVALID_ARG;
+
+	/* Send command */
+	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+
+	/* Receive data */
+	ret = afc_receive_data(client, packet_num, &received, &bytes);
+	if (received) {
+		*file_information = make_strings_list(received, bytes);
+		free(received);
+	}
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info_parsed(afc_client_t client, const char *path, afc_file_info_t *file_info)
+{
+	char *received = NULL;
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !file_info)
+		return AFC_E_INVALID_ARG;
+
+	memset(file_info, '\0', sizeof(afc_file_info_t));
+
+	/* Send command */
+	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+
+	/* Parse the response in place, however long it is */
+	ret = afc_receive_data(client, packet_num, &received, &bytes);
+	if ((ret == AFC_E_SUCCESS) && received) {
+		afc_parse_file_info(received, bytes, file_info);
+	}
+	free(received);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info_batch(afc_client_t client, const char **paths, uint32_t count, afc_file_info_t *infos, afc_error_t *results)
+{
+	uint64_t packet_nums[AFC_MAX_INFO_REQUESTS_IN_FLIGHT];
+	uint32_t sent = 0, done = 0;
+	uint32_t bytes = 0;
+	char *received = NULL;
+	afc_error_t ret = AFC_E_SUCCESS;
+	afc_error_t res;
+
+	if (!client || !paths || !infos)
+		return AFC_E_INVALID_ARG;
+
+	while (done < count) {
+		/* send as many requests as possible before waiting */
+		while ((sent < count) && (sent - done < AFC_MAX_INFO_REQUESTS_IN_FLIGHT)) {
+			if (!paths[sent]) {
+				break;
+			}
+			res = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, paths[sent], strlen(paths[sent])+1, NULL, 0, &bytes, &packet_nums[sent % AFC_MAX_INFO_REQUESTS_IN_FLIGHT]);
+			if (res != AFC_E_SUCCESS) {
+				break;
+			}
+			sent++;
+		}
+
+		if (done == sent) {
+			/* the request could not be sent */
+			memset(&infos[done], '\0', sizeof(afc_file_info_t));
+			res = paths[done] ? AFC_E_NOT_ENOUGH_DATA : AFC_E_INVALID_ARG;
+			if (results)
+				results[done] = res;
+			if (ret == AFC_E_SUCCESS)
+				ret = res;
+			done++;
+			sent++;
+			continue;
+		}
+
+		/* collect the oldest response */
+		res = afc_receive_data(client, packet_nums[done % AFC_MAX_INFO_REQUESTS_IN_FLIGHT], &received, &bytes);
+		if ((res == AFC_E_SUCCESS) && received) {
+			afc_parse_file_info(received, bytes, &infos[done]);
+		} else {
+			memset(&infos[done], '\0', sizeof(afc_file_info_t));
+			if (res == AFC_E_SUCCESS)
+				res = AFC_E_IO_ERROR;
+		}
+		free(received);
+		received = NULL;
+
+		if (results)
+			results[done] = res;
+		if (ret == AFC_E_SUCCESS)
+			ret = res;
+		done++;
+	}
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_open(afc_client_t client, const char *filename, afc_file_mode_t file_mode, uint64_t *handle)
+{
+	if (!client || !client->parent || !client->afc_packet)
+		return AFC_E_INVALID_ARG;
+
+	uint64_t file_mode_loc = htole64(file_mode);
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	char *data = (char *) malloc(sizeof(char) * (8 + strlen(filename) + 1));
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	/* set handle to 0 so in case an error occurs, the handle is invalid */
+	*handle = 0;
+
+	/* Send command */
+	memcpy(data, &file_mode_loc, 8);
+	memcpy(data + 8, filename, strlen(filename));
+	data[8 + strlen(filename)] = '\0';
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_OPEN, data, 8 + strlen(filename) + 1, NULL, 0, &bytes, &packet_num);
+	free(data);
+
+	if (ret != AFC_E_SUCCESS) {
+		debug_info("Didn't receive a response to the command");
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive the data */
+	data = NULL;
+	ret = afc_receive_data(client, packet_num, &data, &bytes);
+	if ((ret == AFC_E_SUCCESS) && (bytes > 0) && data) {
+		/* Get the file handle */
+		memcpy(handle, data, sizeof(uint64_t));
+		free(data);
+		return ret;
+	}
+	/* in case memory was allocated but no data received or an error occurred */
+	free(data);
+
+	debug_info("Didn't get any further data");
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_read(afc_client_t client, uint64_t handle, char *data, uint32_t length, uint32_t *bytes_read)
+{
+	uint32_t bytes_loc = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !client->afc_packet || !client->parent || handle == 0)
+		return AFC_E_INVALID_ARG;
+	debug_info("called for length %i", length);
+
+	/* Send the read command */
+	struct {
+		uint64_t handle;
+		uint64_t size;
+	} readinfo;
+	readinfo.handle = handle;
+	readinfo.size = htole64(length);
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_READ, (const char*)&readinfo, sizeof(readinfo), NULL, 0, &bytes_loc, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive the data */
+	ret = afc_receive_data_into(client, packet_num, data, length, &bytes_loc);
+	debug_info("afc_receive_data_into returned error: %d", ret);
+	debug_info("bytes returned: %i", bytes_loc);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
+	*bytes_read = bytes_loc;
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_write(afc_client_t client, uint64_t handle, const char *data, uint32_t length, uint32_t *bytes_written)
+{
+	uint32_t current_count = 0;
+	uint32_t bytes_loc = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !client->afc_packet || !client->parent || !bytes_written || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	debug_info("Write length: %i", length);
+
+	*bytes_written = 0;
+
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE, (const char*)&handle, 8, data, length, &bytes_loc, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		/* a partially sent request is never answered */
+		return ret;
+	}
+
+	current_count += bytes_loc - (sizeof(AFCPacket) + 8);
+
+	ret = afc_receive_data(client, packet_num, NULL, &bytes_loc);
+	if (ret != AFC_E_SUCCESS) {
+		debug_info("uh oh?");
+	}
+	*bytes_written = current_count;
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_close(afc_client_t client, uint64_t handle)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	debug_info("File handle %i", handle);
+
+	/* Send command */
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_CLOSE, (const char*)&handle, 8, NULL, 0, &bytes, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_UNKNOWN_ERROR;
+	}
+
+	/* Receive the response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_lock(afc_client_t client, uint64_t handle, afc_lock_op_t operation)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	struct {
+		uint64_t handle;
+		uint64_t op;
+	} lockinfo;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	debug_info("file handle %i", handle);
+
+	/* Send command */
+	lockinfo.handle = handle;
+	lockinfo.op = htole64(operation);
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_LOCK, (const char*)&lockinfo, sizeof(lockinfo), NULL, 0, &bytes, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		debug_info("could not send lock command");
+		return AFC_E_UNKNOWN_ERROR;
+	}
+	/* Receive the response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_seek(afc_client_t client, uint64_t handle, int64_t offset, int whence)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	struct {
+		uint64_t handle;
+		uint64_t whence;
+		int64_t offset;
+	} seekinfo;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	/* Send the command */
+	seekinfo.handle = handle;
+	seekinfo.whence = htole64(whence);
+	seekinfo.offset = (int64_t)htole64(offset);
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_SEEK, (const char*)&seekinfo, sizeof(seekinfo), NULL, 0, &bytes, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *position)
+{
+	char *buffer = NULL;
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	/* Send the command */
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_TELL, (const char*)&handle, 8, NULL, 0, &bytes, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+
+	/* Receive the data */
+	ret = afc_receive_data(client, packet_num, &buffer, &bytes);
+	if (bytes > 0 && buffer) {
+		/* Get the position */
+		memcpy(position, buffer, sizeof(uint64_t));
+		*position = le64toh(*position);
+	}
+	free(buffer);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_truncate(afc_client_t client, uint64_t handle, uint64_t newsize)
+{
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	struct {
+		uint64_t handle;
+		uint64_t newsize;
+	} truncinfo;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	/* Send command */
+	truncinfo.handle = handle;
+	truncinfo.newsize = htole64(newsize);
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_SET_SIZE, (const char*)&truncinfo, sizeof(truncinfo), NULL, 0, &bytes, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_read_with_offset(afc_client_t client, uint64_t handle, uint64_t offset, char *data, uint32_t length, uint32_t *bytes_read)
+{
+	uint32_t bytes_loc = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !client->afc_packet || !client->parent || (handle == 0) || !data || !bytes_read)
+		return AFC_E_INVALID_ARG;
+	debug_info("called for length %i at offset %lld", length, offset);
+
+	*bytes_read = 0;
+
+	/* Send the read command */
+	struct {
+		uint64_t handle;
+		uint64_t offset;
+		uint64_t size;
+	} readinfo;
+	readinfo.handle = handle;
+	readinfo.offset = htole64(offset);
+	readinfo.size = htole64(length);
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_READ_OFFSET, (const char*)&readinfo, sizeof(readinfo), NULL, 0, &bytes_loc, &packet_num);
+
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive the data */
+	ret = afc_receive_data_into(client, packet_num, data, length, &bytes_loc);
+	if (ret == AFC_E_SUCCESS) {
+		*bytes_read = bytes_loc;
+	}
 
-	for (ptr = kvps; *ptr; ptr++) {
-		if (!strcmp(*ptr, key)) {
-			*value = strdup(*(ptr+1));
-			break;
-		}
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_write_with_offset(afc_client_t client, uint64_t handle, uint64_t offset, const char *data, uint32_t length, uint32_t *bytes_written)
+{
+	uint32_t bytes_loc = 0;
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !client->afc_packet || !client->parent || !bytes_written || (handle == 0))
+		return AFC_E_INVALID_ARG;
+
+	debug_info("Write length: %i at offset %lld", length, offset);
+
+	*bytes_written = 0;
+
+	struct {
+		uint64_t handle;
+		uint64_t offset;
+	} writeinfo;
+	writeinfo.handle = handle;
+	writeinfo.offset = htole64(offset);
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE_OFFSET, (const char*)&writeinfo, sizeof(writeinfo), data, length, &bytes_loc, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
 	}
-	for (ptr = kvps; *ptr; ptr++) {
-		free(*ptr);
+	if (bytes_loc < sizeof(AFCPacket) + sizeof(writeinfo)) {
+		return AFC_E_MUX_ERROR;
+	}
+
+	ret = afc_receive_data(client, packet_num, NULL, NULL);
+	if (ret == AFC_E_SUCCESS) {
+		*bytes_written = bytes_loc - (sizeof(AFCPacket) + sizeof(writeinfo));
 	}
-	free(kvps);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_remove_path(afc_client_t client, const char *path)
+/** A chunk request of a parallel transfer. */
+struct afc_chunk {
+	uint64_t packet_num;
+	uint64_t pos;
+	uint32_t length;
+};
+
+/**
+ * Sends a positional read request for a chunk of a file.
+ */
+static afc_error_t afc_dispatch_read_chunk(afc_client_t client, uint64_t handle, uint64_t offset, struct afc_chunk *chunk)
 {
 	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	struct {
+		uint64_t handle;
+		uint64_t offset;
+		uint64_t size;
+	} readinfo;
+
+	readinfo.handle = handle;
+	readinfo.offset = htole64(offset + chunk->pos);
+	readinfo.size = htole64(chunk->length);
+
+	return afc_dispatch_packet(client, AFC_OP_FILE_READ_OFFSET, (const char*)&readinfo, sizeof(readinfo), NULL, 0, &bytes, &chunk->packet_num);
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_read_parallel(afc_client_t client, uint64_t handle, uint64_t offset, char *data, uint64_t length, uint32_t chunk_size, unsigned int max_in_flight, uint64_t *bytes_read)
+{
+	struct afc_chunk chunks[AFC_MAX_CHUNKS_IN_FLIGHT];
+	unsigned int head = 0, count = 0;
+	uint64_t next = 0;
+	uint64_t eof_pos = length;
+	uint32_t bytes_loc = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !client->afc_packet || !client->parent || (handle == 0) || !data || !bytes_read || (chunk_size == 0))
+		return AFC_E_INVALID_ARG;
+
+	if (max_in_flight == 0)
+		max_in_flight = 1;
+	else if (max_in_flight > AFC_MAX_CHUNKS_IN_FLIGHT)
+		max_in_flight = AFC_MAX_CHUNKS_IN_FLIGHT;
+
+	*bytes_read = 0;
+
+	while ((next < eof_pos) || (count > 0)) {
+		/* keep the pipeline filled */
+		while ((ret == AFC_E_SUCCESS) && (next < eof_pos) && (count < max_in_flight)) {
+			struct afc_chunk *chunk = &chunks[(head + count) % AFC_MAX_CHUNKS_IN_FLIGHT];
+			chunk->pos = next;
+			chunk->length = ((length - next) < chunk_size) ? (uint32_t)(length - next) : chunk_size;
+			ret = afc_dispatch_read_chunk(client, handle, offset, chunk);
+			if (ret != AFC_E_SUCCESS) {
+				break;
+			}
+			next += chunk->length;
+			count++;
+		}
+		if (count == 0) {
+			break;
+		}
+
+		/* collect the oldest request, its slot may be reused right away */
+		struct afc_chunk chunk = chunks[head];
+		head = (head + 1) % AFC_MAX_CHUNKS_IN_FLIGHT;
+		count--;
+		if ((ret != AFC_E_SUCCESS) || (chunk.pos >= eof_pos)) {
+			/* drain responses that are not needed anymore */
+			afc_receive_data(client, chunk.packet_num, NULL, NULL);
+			continue;
+		}
+		ret = afc_receive_data_into(client, chunk.packet_num, data + chunk.pos, chunk.length, &bytes_loc);
+		if (ret != AFC_E_SUCCESS) {
+			continue;
+		}
+		*bytes_read += bytes_loc;
+		if (bytes_loc == 0) {
+			/* only an empty read marks the end of the file */
+			eof_pos = chunk.pos;
+		} else if (bytes_loc < chunk.length) {
+			/* the device may cap the read size, ask for the rest again */
+			struct afc_chunk *rest = &chunks[(head + count) % AFC_MAX_CHUNKS_IN_FLIGHT];
+			rest->pos = chunk.pos + bytes_loc;
+			rest->length = chunk.length - bytes_loc;
+			ret = afc_dispatch_read_chunk(client, handle, offset, rest);
+			if (ret == AFC_E_SUCCESS) {
+				count++;
+			}
+		}
+	}
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_write_parallel(afc_client_t client, uint64_t handle, uint64_t offset, const char *data, uint64_t length, uint32_t chunk_size, unsigned int max_in_flight, uint64_t *bytes_written)
+{
+	struct afc_chunk chunks[AFC_MAX_CHUNKS_IN_FLIGHT];
+	unsigned int head = 0, count = 0;
+	uint64_t next = 0;
+	uint32_t bytes_loc = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+	afc_error_t res;
+
+	if (!client || !client->afc_packet || !client->parent || (handle == 0) || !data || !bytes_written || (chunk_size == 0))
+		return AFC_E_INVALID_ARG;
+
+	if (max_in_flight == 0)
+		max_in_flight = 1;
+	else if (max_in_flight > AFC_MAX_CHUNKS_IN_FLIGHT)
+		max_in_flight = AFC_MAX_CHUNKS_IN_FLIGHT;
+
+	*bytes_written = 0;
+
+	struct {
+		uint64_t handle;
+		uint64_t offset;
+	} writeinfo;
+	writeinfo.handle = handle;
+
+	while ((next < length) || (count > 0)) {
+		/* keep the pipeline filled */
+		while ((ret == AFC_E_SUCCESS) && (next < length) && (count < max_in_flight)) {
+			struct afc_chunk *chunk = &chunks[(head + count) % AFC_MAX_CHUNKS_IN_FLIGHT];
+			chunk->pos = next;
+			chunk->length = ((length - next) < chunk_size) ? (uint32_t)(length - next) : chunk_size;
+			writeinfo.offset = htole64(offset + chunk->pos);
+			ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE_OFFSET, (const char*)&writeinfo, sizeof(writeinfo), data + chunk->pos, chunk->length, &bytes_loc, &chunk->packet_num);
+			if (ret != AFC_E_SUCCESS) {
+				break;
+			}
+			if (bytes_loc != sizeof(AFCPacket) + sizeof(writeinfo) + chunk->length) {
+				/* the request was not sent completely, no response will arrive */
+				ret = AFC_E_MUX_ERROR;
+				break;
+			}
+			next += chunk->length;
+			count++;
+		}
+		if (count == 0) {
+			break;
+		}
+
+		/* collect the oldest request */
+		struct afc_chunk *chunk = &chunks[head];
+		head = (head + 1) % AFC_MAX_CHUNKS_IN_FLIGHT;
+		count--;
+		res = afc_receive_data(client, chunk->packet_num, NULL, NULL);
+		if (ret != AFC_E_SUCCESS) {
+			continue;
+		}
+		ret = res;
+		if (ret == AFC_E_SUCCESS) {
+			*bytes_written += chunk->length;
+		}
+	}
+
+	return ret;
+}
 
+LIBIMOBILEDEVICE_API afc_error_t afc_truncate(afc_client_t client, const char *path, uint64_t newsize)
+{
 	if (!client || !path || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	char *buffer = (char *) malloc(sizeof(char) * (strlen(path) + 1 + 8));
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	uint64_t size_requested = htole64(newsize);
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	/* Send command */
-	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH, path, strlen(path)+1, NULL, 0, &bytes);
+	memcpy(buffer, &size_requested, 8);
+	memcpy(buffer + 8, path, strlen(path) + 1);
+	ret = afc_dispatch_packet(client, AFC_OP_TRUNCATE, buffer, 8 + strlen(path) + 1, NULL, 0, &bytes, &packet_num);
+	free(buffer);
+
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return AFC_E_NOT_ENOUGH_DATA;
 	}
 	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	/* special case; unknown error actually means directory not empty */
-	if (ret == AFC_E_UNKNOWN_ERROR)
-		ret = AFC_E_DIR_NOT_EMPTY;
-
-	afc_unlock(client);
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_rename_path(afc_client_t client, const char *from, const char *to)
+LIBIMOBILEDEVICE_API afc_error_t afc_make_link(afc_client_t client, afc_link_type_t linktype, const char *target, const char *linkname)
 {
-	if (!client || !from || !to || !client->afc_packet || !client->parent)
+	if (!client || !target || !linkname || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	char *buffer = (char *) malloc(sizeof(char) * (strlen(from) + strlen(to) + 1 + sizeof(uint32_t)));
+	char *buffer = (char *) malloc(sizeof(char) * (strlen(target)+1 + strlen(linkname)+1 + 8));
 	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	uint64_t type = htole64(linktype);
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	afc_lock(client);
+	debug_info("link type: %lld", type);
+	debug_info("target: %s, length:%d", target, strlen(target));
+	debug_info("linkname: %s, length:%d", linkname, strlen(linkname));
 
 	/* Send command */
-	memcpy(buffer, from, strlen(from) + 1);
-	memcpy(buffer + strlen(from) + 1, to, strlen(to) + 1);
-	ret = afc_dispatch_packet(client, AFC_OP_RENAME_PATH, buffer, strlen(to)+1 + strlen(from)+1, NULL, 0, &bytes);
+	memcpy(buffer, &type, 8);
+	memcpy(buffer + 8, target, strlen(target) + 1);
+	memcpy(buffer + 8 + strlen(target) + 1, linkname, strlen(linkname) + 1);
+	ret = afc_dispatch_packet(client, AFC_OP_MAKE_LINK, buffer, 8 + strlen(linkname) + 1 + strlen(target) + 1, NULL, 0, &bytes, &packet_num);
 	free(buffer);
-
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return AFC_E_NOT_ENOUGH_DATA;
 	}
 	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
 
-	afc_unlock(client);
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_set_file_time(afc_client_t client, const char *path, uint64_t mtime)
+{
+	if (!client || !path || !client->afc_packet || !client->parent)
+		return AFC_E_INVALID_ARG;
+
+	char *buffer = (char *) malloc(sizeof(char) * (strlen(path) + 1 + 8));
+	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
+	uint64_t mtime_loc = htole64(mtime);
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	/* Send command */
+	memcpy(buffer, &mtime_loc, 8);
+	memcpy(buffer + 8, path, strlen(path) + 1);
+	ret = afc_dispatch_packet(client, AFC_OP_SET_FILE_MOD_TIME, buffer, 8 + strlen(path) + 1, NULL, 0, &bytes, &packet_num);
+	free(buffer);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	/* Receive response */
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_make_directory(afc_client_t client, const char *path)
+LIBIMOBILEDEVICE_API afc_error_t afc_remove_path_and_contents(afc_client_t client, const char *path)
 {
 	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (!client)
+	if (!client || !path || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
 	/* Send command */
-	ret = afc_dispatch_packet(client, AFC_OP_MAKE_DIR, path, strlen(path)+1, NULL, 0, &bytes);
+	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH_AND_CONTENTS, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return AFC_E_NOT_ENOUGH_DATA;
 	}
 	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	ret = afc_receive_data(client, packet_num, NULL, &bytes);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information)
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_hash(afc_client_t client, const char *path, char **hash, uint32_t *hash_length)
 {
-	char *received = NULL;
 	uint32_t bytes = 0;
+	uint64_t packet_num = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (!client || !path || !file_information)
+	if (!client || !path || !hash || !hash_length)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	*hash = NULL;
+	*hash_length = 0;
 
 	/* Send command */
-	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, path, strlen(path)+1, NULL, 0, &bytes);
+	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_HASH, path, strlen(path)+1, NULL, 0, &bytes, &packet_num);
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return AFC_E_NOT_ENOUGH_DATA;
 	}
 
 	/* Receive data */
-	ret = afc_receive_data(client, &received, &bytes);
-	if (received) {
-		*file_information = make_strings_list(received, bytes);
-		free(received);
-	}
+	return afc_receive_data(client, packet_num, hash, hash_length);
+}
 
-	afc_unlock(client);
+/**
+ * Sends a request for the hash of a range of a file without waiting for
+ * the response.
+ */
+static afc_error_t afc_request_file_hash_range(afc_client_t client, const char *path, uint64_t offset, uint64_t length, uint64_t *packet_num)
+{
+	uint32_t bytes = 0;
+	uint64_t offset_loc = htole64(offset);
+	uint64_t length_loc = htole64(length);
+	uint32_t data_len = 16 + strlen(path) + 1;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	return ret;
+	char *data = (char*)malloc(data_len);
+	if (!data)
+		return AFC_E_NO_MEM;
+	memcpy(data, &offset_loc, 8);
+	memcpy(data + 8, &length_loc, 8);
+	memcpy(data + 16, path, strlen(path) + 1);
+
+	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_HASH_RANGE, data, data_len, NULL, 0, &bytes, packet_num);
+	free(data);
+	if (ret != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+
+	return AFC_E_SUCCESS;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_open(afc_client_t client, const char *filename, afc_file_mode_t file_mode, uint64_t *handle)
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_hash_range(afc_client_t client, const char *path, uint64_t offset, uint64_t length, char **hash, uint32_t *hash_length)
 {
-	if (!client || !client->parent || !client->afc_packet)
+	uint64_t packet_num = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !hash || !hash_length)
 		return AFC_E_INVALID_ARG;
 
-	uint64_t file_mode_loc = htole64(file_mode);
-	uint32_t bytes = 0;
-	char *data = (char *) malloc(sizeof(char) * (8 + strlen(filename) + 1));
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	*hash = NULL;
+	*hash_length = 0;
 
-	/* set handle to 0 so in case an error occurs, the handle is invalid */
-	*handle = 0;
+	ret = afc_request_file_hash_range(client, path, offset, length, &packet_num);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
 
-	afc_lock(client);
+	return afc_receive_data(client, packet_num, hash, hash_length);
+}
 
-	/* Send command */
-	memcpy(data, &file_mode_loc, 8);
-	memcpy(data + 8, filename, strlen(filename));
-	data[8 + strlen(filename)] = '\0';
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_OPEN, data, 8 + strlen(filename) + 1, NULL, 0, &bytes);
-	free(data);
+/**
+ * Calculates the SHA1 hash of a buffer.
+ */
+static void afc_sha1(const char *input, uint32_t size, unsigned char *hash_out)
+{
+#ifdef HAVE_OPENSSL
+	SHA1((const unsigned char*)input, size, hash_out);
+#else
+	gnutls_hash_fast(GNUTLS_DIG_SHA1, input, size, hash_out);
+#endif
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_update_changed_blocks(afc_client_t client, const char *path, char *data, uint64_t length, uint32_t block_size, uint64_t *bytes_updated)
+{
+	struct afc_chunk chunks[AFC_MAX_CHUNKS_IN_FLIGHT];
+	unsigned int head = 0, count = 0;
+	unsigned char local_hash[20];
+	uint64_t next = 0;
+	uint64_t updated = 0;
+	uint64_t handle = 0;
+	char *remote_hash = NULL;
+	uint32_t hash_len = 0;
+	uint32_t bytes_loc = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !path || (!data && length > 0) || (block_size == 0))
+		return AFC_E_INVALID_ARG;
 
+	ret = afc_file_open(client, path, AFC_FOPEN_RDONLY, &handle);
 	if (ret != AFC_E_SUCCESS) {
-		debug_info("Didn't receive a response to the command");
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+		return ret;
 	}
-	/* Receive the data */
-	data = NULL;
-	ret = afc_receive_data(client, &data, &bytes);
-	if ((ret == AFC_E_SUCCESS) && (bytes > 0) && data) {
-		afc_unlock(client);
 
-		/* Get the file handle */
-		memcpy(handle, data, sizeof(uint64_t));
+	while ((next < length) || (count > 0)) {
+		/* keep hash requests for the next blocks in flight */
+		while ((ret == AFC_E_SUCCESS) && (next < length) && (count < AFC_MAX_CHUNKS_IN_FLIGHT)) {
+			struct afc_chunk *chunk = &chunks[(head + count) % AFC_MAX_CHUNKS_IN_FLIGHT];
+			chunk->pos = next;
+			chunk->length = ((length - next) < block_size) ? (uint32_t)(length - next) : block_size;
+			ret = afc_request_file_hash_range(client, path, chunk->pos, chunk->length, &chunk->packet_num);
+			if (ret != AFC_E_SUCCESS) {
+				break;
+			}
+			next += chunk->length;
+			count++;
+		}
+		if (count == 0) {
+			break;
+		}
+
+		struct afc_chunk *chunk = &chunks[head];
+		head = (head + 1) % AFC_MAX_CHUNKS_IN_FLIGHT;
+		count--;
+		if (ret != AFC_E_SUCCESS) {
+			/* drain the remaining responses */
+			afc_receive_data(client, chunk->packet_num, NULL, NULL);
+			continue;
+		}
+		ret = afc_receive_data(client, chunk->packet_num, &remote_hash, &hash_len);
+		if (ret != AFC_E_SUCCESS) {
+			free(remote_hash);
+			remote_hash = NULL;
+			continue;
+		}
+
+		afc_sha1(data + chunk->pos, chunk->length, local_hash);
+		if (!remote_hash || (hash_len != sizeof(local_hash)) || memcmp(remote_hash, local_hash, sizeof(local_hash))) {
+			/* block differs, download it */
+			uint32_t done = 0;
+			debug_info("block at %lld differs", chunk->pos);
+			/* reads may be short, keep going until the whole block arrived */
+			while ((ret == AFC_E_SUCCESS) && (done < chunk->length)) {
+				ret = afc_file_read_with_offset(client, handle, chunk->pos + done, data + chunk->pos + done, chunk->length - done, &bytes_loc);
+				if ((ret == AFC_E_SUCCESS) && (bytes_loc == 0)) {
+					ret = AFC_E_NOT_ENOUGH_DATA;
+				}
+				if (ret == AFC_E_SUCCESS) {
+					done += bytes_loc;
+				}
+			}
+			updated += done;
+		}
+		free(remote_hash);
+		remote_hash = NULL;
+	}
+
+	afc_file_close(client, handle);
+
+	if (bytes_updated)
+		*bytes_updated = updated;
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_dictionary_free(char **dictionary)
+{
+	int i = 0;
+
+	if (!dictionary)
+		return AFC_E_INVALID_ARG;
+
+	for (i = 0; dictionary[i]; i++) {
+		free(dictionary[i]);
+	}
+	free(dictionary);
+
+	return AFC_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_open_async(afc_client_t client, const char *filename, afc_file_mode_t file_mode, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation)
+{
+	if (!client || !client->parent || !client->afc_packet || !filename || (!callback && !operation))
+		return AFC_E_INVALID_ARG;
+
+	uint64_t file_mode_loc = htole64(file_mode);
+	afc_operation_t op = NULL;
+	char *data = NULL;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (operation)
+		*operation = NULL;
+
+	op = afc_operation_new(client, AFC_OP_FILE_OPEN, callback, user_data, operation);
+	data = (char *) malloc(sizeof(char) * (8 + strlen(filename) + 1));
+	if (!op || !data) {
+		if (op)
+			afc_operation_destroy(op);
 		free(data);
-		return ret;
+		return AFC_E_NO_MEM;
 	}
-	/* in case memory was allocated but no data received or an error occurred */
-	free(data);
-
-	debug_info("Didn't get any further data");
 
-	afc_unlock(client);
+	/* Send command */
+	memcpy(data, &file_mode_loc, 8);
+	memcpy(data + 8, filename, strlen(filename));
+	data[8 + strlen(filename)] = '\0';
+	ret = afc_operation_submit(op, data, 8 + strlen(filename) + 1, NULL, 0, operation);
+	free(data);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_read(afc_client_t client, uint64_t handle, char *data, uint32_t length, uint32_t *bytes_read)
+LIBIMOBILEDEVICE_API afc_error_t afc_file_read_async(afc_client_t client, uint64_t handle, char *data, uint32_t length, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation)
 {
-	char *input = NULL;
-	uint32_t current_count = 0, bytes_loc = 0;
-	afc_error_t ret = AFC_E_SUCCESS;
+	afc_operation_t op = NULL;
 
-	if (!client || !client->afc_packet || !client->parent || handle == 0)
+	if (!client || !client->afc_packet || !client->parent || handle == 0 || !data || (!callback && !operation))
 		return AFC_E_INVALID_ARG;
-	debug_info("called for length %i", length);
 
-	afc_lock(client);
+	if (operation)
+		*operation = NULL;
+
+	op = afc_operation_new(client, AFC_OP_FILE_READ, callback, user_data, operation);
+	if (!op)
+		return AFC_E_NO_MEM;
+	op->buffer = data;
+	op->buffer_size = length;
 
 	/* Send the read command */
 	struct {
@@ -680,359 +2341,297 @@ LIBIMOBILEDEVICE_API afc_error_t afc_file_read(afc_client_t client, uint64_t han
 	} readinfo;
 	readinfo.handle = handle;
 	readinfo.size = htole64(length);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_READ, (const char*)&readinfo, sizeof(readinfo), NULL, 0, &bytes_loc);
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &input, &bytes_loc);
-	debug_info("afc_receive_data returned error: %d", ret);
-	debug_info("bytes returned: %i", bytes_loc);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return ret;
-	} else if (bytes_loc == 0) {
-		if (input)
-			free(input);
-		afc_unlock(client);
-		*bytes_read = current_count;
-		/* FIXME: check that's actually a success */
-		return ret;
-	} else {
-		if (input) {
-			debug_info("%d", bytes_loc);
-			memcpy(data + current_count, input, (bytes_loc > length) ? length : bytes_loc);
-			free(input);
-			input = NULL;
-			current_count += (bytes_loc > length) ? length : bytes_loc;
-		}
-	}
-	afc_unlock(client);
-	*bytes_read = current_count;
-	return ret;
+	return afc_operation_submit(op, (const char*)&readinfo, sizeof(readinfo), NULL, 0, operation);
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_write(afc_client_t client, uint64_t handle, const char *data, uint32_t length, uint32_t *bytes_written)
+LIBIMOBILEDEVICE_API afc_error_t afc_file_write_async(afc_client_t client, uint64_t handle, const char *data, uint32_t length, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation)
 {
-	uint32_t current_count = 0;
-	uint32_t bytes_loc = 0;
-	afc_error_t ret = AFC_E_SUCCESS;
+	afc_operation_t op = NULL;
 
-	if (!client || !client->afc_packet || !client->parent || !bytes_written || (handle == 0))
+	if (!client || !client->afc_packet || !client->parent || (handle == 0) || (!callback && !operation))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	debug_info("Write length: %i", length);
-
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE, (const char*)&handle, 8, data, length, &bytes_loc);
+	if (operation)
+		*operation = NULL;
 
-	current_count += bytes_loc - (sizeof(AFCPacket) + 8);
+	op = afc_operation_new(client, AFC_OP_FILE_WRITE, callback, user_data, operation);
+	if (!op)
+		return AFC_E_NO_MEM;
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		*bytes_written = current_count;
-		return AFC_E_SUCCESS;
-	}
+	debug_info("Write length: %i", length);
 
-	ret = afc_receive_data(client, NULL, &bytes_loc);
-	afc_unlock(client);
-	if (ret != AFC_E_SUCCESS) {
-		debug_info("uh oh?");
-	}
-	*bytes_written = current_count;
-	return ret;
+	return afc_operation_submit(op, (const char*)&handle, 8, data, length, operation);
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_close(afc_client_t client, uint64_t handle)
+LIBIMOBILEDEVICE_API afc_error_t afc_file_close_async(afc_client_t client, uint64_t handle, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation)
 {
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	afc_operation_t op = NULL;
 
-	if (!client || (handle == 0))
+	if (!client || (handle == 0) || (!callback && !operation))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	if (operation)
+		*operation = NULL;
+
+	op = afc_operation_new(client, AFC_OP_FILE_CLOSE, callback, user_data, operation);
+	if (!op)
+		return AFC_E_NO_MEM;
 
 	debug_info("File handle %i", handle);
 
-	/* Send command */
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_CLOSE, (const char*)&handle, 8, NULL, 0, &bytes);
+	return afc_operation_submit(op, (const char*)&handle, 8, NULL, 0, operation);
+}
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_UNKNOWN_ERROR;
-	}
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info_async(afc_client_t client, const char *path, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation)
+{
+	afc_operation_t op = NULL;
 
-	/* Receive the response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	if (!client || !path || (!callback && !operation))
+		return AFC_E_INVALID_ARG;
 
-	afc_unlock(client);
+	if (operation)
+		*operation = NULL;
 
-	return ret;
+	op = afc_operation_new(client, AFC_OP_GET_FILE_INFO, callback, user_data, operation);
+	if (!op)
+		return AFC_E_NO_MEM;
+
+	return afc_operation_submit(op, path, strlen(path)+1, NULL, 0, operation);
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_lock(afc_client_t client, uint64_t handle, afc_lock_op_t operation)
+LIBIMOBILEDEVICE_API afc_error_t afc_read_directory_async(afc_client_t client, const char *path, afc_completion_cb_t callback, void *user_data, afc_operation_t *operation)
 {
-	uint32_t bytes = 0;
-	struct {
-		uint64_t handle;
-		uint64_t op;
-	} lockinfo;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	afc_operation_t op = NULL;
 
-	if (!client || (handle == 0))
+	if (!client || !path || (!callback && !operation))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	debug_info("file handle %i", handle);
-
-	/* Send command */
-	lockinfo.handle = handle;
-	lockinfo.op = htole64(operation);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_LOCK, (const char*)&lockinfo, sizeof(lockinfo), NULL, 0, &bytes);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		debug_info("could not send lock command");
-		return AFC_E_UNKNOWN_ERROR;
-	}
-	/* Receive the response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	if (operation)
+		*operation = NULL;
 
-	afc_unlock(client);
+	op = afc_operation_new(client, AFC_OP_READ_DIR, callback, user_data, operation);
+	if (!op)
+		return AFC_E_NO_MEM;
 
-	return ret;
+	return afc_operation_submit(op, path, strlen(path)+1, NULL, 0, operation);
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_seek(afc_client_t client, uint64_t handle, int64_t offset, int whence)
+LIBIMOBILEDEVICE_API afc_error_t afc_process_completions(afc_client_t client, unsigned int timeout)
 {
-	uint32_t bytes = 0;
-	struct {
-		uint64_t handle;
-		uint64_t whence;
-		int64_t offset;
-	} seekinfo;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	struct afc_response response;
+	struct afc_operation_private *completed = NULL;
+	afc_error_t ret = AFC_E_SUCCESS;
 
-	if (!client || (handle == 0))
+	if (!client || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	seekinfo.handle = handle;
-	seekinfo.whence = htole64(whence);
-	seekinfo.offset = (int64_t)htole64(offset);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_SEEK, (const char*)&seekinfo, sizeof(seekinfo), NULL, 0, &bytes);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	mutex_lock(&client->recv_mutex);
+	while (client->operations) {
+		ret = afc_receive_response(client, timeout, &response);
+		if (ret != AFC_E_SUCCESS) {
+			if (ret == AFC_E_OP_TIMEOUT) {
+				/* nothing more to process right now */
+				ret = AFC_E_SUCCESS;
+			}
+			break;
+		}
+		afc_queue_response(client, &response, &completed);
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	mutex_unlock(&client->recv_mutex);
 
-	afc_unlock(client);
+	afc_run_callbacks(completed);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *position)
+LIBIMOBILEDEVICE_API afc_error_t afc_client_get_fd(afc_client_t client, int *fd)
 {
-	char *buffer = NULL;
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	struct afc_response response;
+	struct afc_operation_private *completed = NULL;
+	afc_error_t ret = AFC_E_SUCCESS;
 
-	if (!client || (handle == 0))
+	if (!client || !client->parent || !fd)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_TELL, (const char*)&handle, 8, NULL, 0, &bytes);
+	if (idevice_connection_get_fd(client->parent->connection, fd) != IDEVICE_E_SUCCESS)
+		return AFC_E_MUX_ERROR;
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	/*
+	 * Buffered data does not make the descriptor readable. Move responses
+	 * that were already read ahead into the queue and stop buffering.
+	 */
+	mutex_lock(&client->recv_mutex);
+	while (idevice_connection_get_buffered(client->parent->connection) > 0) {
+		ret = afc_receive_response(client, 0, &response);
+		if (ret != AFC_E_SUCCESS) {
+			break;
+		}
+		afc_queue_response(client, &response, &completed);
 	}
-
-	/* Receive the data */
-	ret = afc_receive_data(client, &buffer, &bytes);
-	if (bytes > 0 && buffer) {
-		/* Get the position */
-		memcpy(position, buffer, sizeof(uint64_t));
-		*position = le64toh(*position);
+	if (ret == AFC_E_SUCCESS) {
+		idevice_connection_set_receive_buffer(client->parent->connection, 0);
 	}
-	free(buffer);
+	mutex_unlock(&client->recv_mutex);
 
-	afc_unlock(client);
+	afc_run_callbacks(completed);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_file_truncate(afc_client_t client, uint64_t handle, uint64_t newsize)
+LIBIMOBILEDEVICE_API afc_error_t afc_operation_wait(afc_operation_t operation)
 {
-	uint32_t bytes = 0;
-	struct {
-		uint64_t handle;
-		uint64_t newsize;
-	} truncinfo;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	struct afc_response response;
+	struct afc_operation_private *completed = NULL;
+	afc_client_t client = NULL;
+	afc_error_t ret = AFC_E_SUCCESS;
 
-	if (!client || (handle == 0))
+	if (!operation)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send command */
-	truncinfo.handle = handle;
-	truncinfo.newsize = htole64(newsize);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_SET_SIZE, (const char*)&truncinfo, sizeof(truncinfo), NULL, 0, &bytes);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	client = operation->client;
+	if (!client)
+		return operation->error;
+
+	mutex_lock(&client->recv_mutex);
+	while (!operation->complete) {
+		ret = afc_receive_response(client, 10000, &response);
+		if (ret != AFC_E_SUCCESS) {
+			if (ret == AFC_E_OP_TIMEOUT) {
+				ret = AFC_E_MUX_ERROR;
+			}
+			break;
+		}
+		afc_queue_response(client, &response, &completed);
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	if (operation->complete) {
+		ret = operation->error;
+	}
+	mutex_unlock(&client->recv_mutex);
 
-	afc_unlock(client);
+	afc_run_callbacks(completed);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_truncate(afc_client_t client, const char *path, uint64_t newsize)
+LIBIMOBILEDEVICE_API afc_error_t afc_operation_get_result(afc_operation_t operation)
 {
-	if (!client || !path || !client->afc_packet || !client->parent)
-		return AFC_E_INVALID_ARG;
-
-	char *buffer = (char *) malloc(sizeof(char) * (strlen(path) + 1 + 8));
-	uint32_t bytes = 0;
-	uint64_t size_requested = htole64(newsize);
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	afc_lock(client);
-
-	/* Send command */
-	memcpy(buffer, &size_requested, 8);
-	memcpy(buffer + 8, path, strlen(path) + 1);
-	ret = afc_dispatch_packet(client, AFC_OP_TRUNCATE, buffer, 8 + strlen(path) + 1, NULL, 0, &bytes);
-	free(buffer);
+	afc_client_t client = NULL;
+	afc_error_t ret = AFC_E_OP_IN_PROGRESS;
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	if (!operation)
+		return AFC_E_INVALID_ARG;
 
-	afc_unlock(client);
+	client = operation->client;
+	if (client)
+		mutex_lock(&client->recv_mutex);
+	if (operation->complete)
+		ret = operation->error;
+	if (client)
+		mutex_unlock(&client->recv_mutex);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_make_link(afc_client_t client, afc_link_type_t linktype, const char *target, const char *linkname)
+LIBIMOBILEDEVICE_API afc_error_t afc_operation_get_handle(afc_operation_t operation, uint64_t *handle)
 {
-	if (!client || !target || !linkname || !client->afc_packet || !client->parent)
-		return AFC_E_INVALID_ARG;
-
-	char *buffer = (char *) malloc(sizeof(char) * (strlen(target)+1 + strlen(linkname)+1 + 8));
-	uint32_t bytes = 0;
-	uint64_t type = htole64(linktype);
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	afc_client_t client = NULL;
+	afc_error_t ret = AFC_E_OP_IN_PROGRESS;
 
-	afc_lock(client);
-
-	debug_info("link type: %lld", type);
-	debug_info("target: %s, length:%d", target, strlen(target));
-	debug_info("linkname: %s, length:%d", linkname, strlen(linkname));
+	if (!operation || !handle || (operation->operation != AFC_OP_FILE_OPEN))
+		return AFC_E_INVALID_ARG;
 
-	/* Send command */
-	memcpy(buffer, &type, 8);
-	memcpy(buffer + 8, target, strlen(target) + 1);
-	memcpy(buffer + 8 + strlen(target) + 1, linkname, strlen(linkname) + 1);
-	ret = afc_dispatch_packet(client, AFC_OP_MAKE_LINK, buffer, 8 + strlen(linkname) + 1 + strlen(target) + 1, NULL, 0, &bytes);
-	free(buffer);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	client = operation->client;
+	if (client)
+		mutex_lock(&client->recv_mutex);
+	if (operation->complete) {
+		*handle = operation->handle;
+		ret = operation->error;
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	if (client)
+		mutex_unlock(&client->recv_mutex);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_set_file_time(afc_client_t client, const char *path, uint64_t mtime)
+LIBIMOBILEDEVICE_API afc_error_t afc_operation_get_length(afc_operation_t operation, uint32_t *length)
 {
-	if (!client || !path || !client->afc_packet || !client->parent)
-		return AFC_E_INVALID_ARG;
-
-	char *buffer = (char *) malloc(sizeof(char) * (strlen(path) + 1 + 8));
-	uint32_t bytes = 0;
-	uint64_t mtime_loc = htole64(mtime);
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	afc_client_t client = NULL;
+	afc_error_t ret = AFC_E_OP_IN_PROGRESS;
 
-	afc_lock(client);
+	if (!operation || !length)
+		return AFC_E_INVALID_ARG;
 
-	/* Send command */
-	memcpy(buffer, &mtime_loc, 8);
-	memcpy(buffer + 8, path, strlen(path) + 1);
-	ret = afc_dispatch_packet(client, AFC_OP_SET_FILE_MOD_TIME, buffer, 8 + strlen(path) + 1, NULL, 0, &bytes);
-	free(buffer);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	client = operation->client;
+	if (client)
+		mutex_lock(&client->recv_mutex);
+	if (operation->complete) {
+		*length = operation->length;
+		ret = operation->error;
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	if (client)
+		mutex_unlock(&client->recv_mutex);
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_remove_path_and_contents(afc_client_t client, const char *path)
+LIBIMOBILEDEVICE_API afc_error_t afc_operation_get_list(afc_operation_t operation, char ***list)
 {
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	afc_client_t client = NULL;
+	afc_error_t ret = AFC_E_OP_IN_PROGRESS;
+	char *data = NULL;
+	uint32_t length = 0;
 
-	if (!client || !path || !client->afc_packet || !client->parent)
+	if (!operation || !list)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send command */
-	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH_AND_CONTENTS, path, strlen(path)+1, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	client = operation->client;
+	if (client)
+		mutex_lock(&client->recv_mutex);
+	if (operation->complete) {
+		ret = operation->error;
+		if (ret == AFC_E_SUCCESS) {
+			/* take over the data, the list can only be retrieved once */
+			data = operation->data;
+			length = operation->length;
+			operation->data = NULL;
+			operation->length = 0;
+		}
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	if (client)
+		mutex_unlock(&client->recv_mutex);
 
-	afc_unlock(client);
+	if (ret == AFC_E_OP_IN_PROGRESS)
+		return ret;
+
+	*list = NULL;
+	if (data) {
+		*list = make_strings_list(data, length);
+		free(data);
+	}
 
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_dictionary_free(char **dictionary)
+LIBIMOBILEDEVICE_API afc_error_t afc_operation_free(afc_operation_t operation)
 {
-	int i = 0;
-
-	if (!dictionary)
+	if (!operation)
 		return AFC_E_INVALID_ARG;
 
-	for (i = 0; dictionary[i]; i++) {
-		free(dictionary[i]);
+	mutex_lock(&operation->mutex);
+	if (!operation->complete || operation->dispatching) {
+		/* free it once the response arrived and the callback returned */
+		operation->callback = NULL;
+		operation->auto_free = 1;
+		/* the caller may release the read buffer right after this */
+		operation->buffer = NULL;
+		operation->buffer_size = 0;
+		mutex_unlock(&operation->mutex);
+		return AFC_E_SUCCESS;
 	}
-	free(dictionary);
+	mutex_unlock(&operation->mutex);
+
+	afc_operation_destroy(operation);
 
 	return AFC_E_SUCCESS;
 }
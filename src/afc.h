@@ -33,6 +33,15 @@
 #define AFC_MAGIC "CFA6LPAA"
 #define AFC_MAGIC_LEN (8)
 
+/* maximum number of chunk requests a parallel transfer keeps in flight */
+#define AFC_MAX_CHUNKS_IN_FLIGHT 64
+
+/* maximum number of file info requests a batch keeps in flight */
+#define AFC_MAX_INFO_REQUESTS_IN_FLIGHT 256
+
+/* number of abandoned requests whose late responses are dropped */
+#define AFC_MAX_ABANDONED 1024
+
 typedef struct {
 	char magic[AFC_MAGIC_LEN];
 	uint64_t entire_length, this_length, packet_num, operation;
@@ -50,12 +59,54 @@ typedef struct {
 	(x)->packet_num    = le64toh((x)->packet_num); \
 	(x)->operation     = le64toh((x)->operation);
 
+struct afc_response {
+	uint64_t packet_num;
+	afc_error_t error;
+	char *data;
+	uint32_t length;
+	struct afc_response *next;
+};
+
+struct afc_operation_private {
+	afc_client_t client;
+	uint64_t packet_num;
+	uint64_t operation;
+	mutex_t mutex;
+	int complete;
+	int dispatching; /* completed, callback not run yet */
+	int auto_free;
+	afc_error_t error;
+	char *data;
+	uint32_t length;
+	char *buffer;
+	uint32_t buffer_size;
+	uint64_t handle;
+	afc_completion_cb_t callback;
+	void *user_data;
+	struct afc_operation_private *next;
+};
+
+struct afc_dir_private {
+	afc_client_t client;
+	uint64_t handle;
+	int legacy;
+	int eof;
+	char *buffer;
+	uint32_t length;
+	uint32_t pos;
+};
+
 struct afc_client_private {
 	service_client_t parent;
 	AFCPacket *afc_packet;
 	int file_handle;
 	int lock;
 	mutex_t mutex;
+	mutex_t recv_mutex;
+	struct afc_response *responses;
+	struct afc_operation_private *operations;
+	uint64_t *abandoned;
+	uint32_t abandoned_count;
 	int free_parent;
 };
 
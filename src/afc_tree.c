@@ -0,0 +1,544 @@
+/*
+ * afc_tree.c
+ * Recursive copying of directory trees between host and device via AFC.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "afc.h"
+#include "common/debug.h"
+#include "common/thread.h"
+#include "common/utils.h"
+
+#ifdef WIN32
+#include <windows.h>
+#define AFC_TREE_IDLE() Sleep(1)
+#else
+#define AFC_TREE_IDLE() usleep(1000)
+#endif
+
+/* size of the buffer each worker transfers file contents through */
+#define AFC_TREE_BUFFER_SIZE (1024 * 1024)
+/* size of the positional requests a file transfer is split into */
+#define AFC_TREE_CHUNK_SIZE (64 * 1024)
+/* number of positional requests a file transfer keeps in flight */
+#define AFC_TREE_CHUNKS_IN_FLIGHT 8
+
+/** A file or directory waiting to be copied. */
+struct afc_tree_item {
+	char *src;
+	char *dst;
+	int is_dir;
+	uint64_t size; /* expected size of a file pulled from the device */
+	struct afc_tree_item *next;
+};
+
+/** State shared by all workers of a tree copy. */
+struct afc_tree_copy {
+	idevice_t device;
+	int to_device;
+	mutex_t mutex;
+	struct afc_tree_item *queue;
+	unsigned int busy;
+	afc_copy_stats_t stats;
+	afc_error_t error;
+	struct timeval start;
+	afc_copy_progress_cb_t progress_cb;
+	void *user_data;
+};
+
+/** A worker owning its own AFC connection. */
+struct afc_tree_worker {
+	struct afc_tree_copy *copy;
+	afc_client_t afc;
+	char *buffer;
+	int no_offset_io;
+	int started;
+	thread_t thread;
+};
+
+static void afc_tree_push_item(struct afc_tree_copy *copy, char *src, char *dst, int is_dir, uint64_t size)
+{
+	struct afc_tree_item *item = (struct afc_tree_item*)malloc(sizeof(struct afc_tree_item));
+	item->src = src;
+	item->dst = dst;
+	item->is_dir = is_dir;
+	item->size = size;
+
+	mutex_lock(&copy->mutex);
+	item->next = copy->queue;
+	copy->queue = item;
+	mutex_unlock(&copy->mutex);
+}
+
+static void afc_tree_item_free(struct afc_tree_item *item)
+{
+	free(item->src);
+	free(item->dst);
+	free(item);
+}
+
+/**
+ * Updates the elapsed time and invokes the progress callback.
+ * The mutex of the copy has to be held by the caller.
+ */
+static void afc_tree_notify(struct afc_tree_copy *copy, const char *path)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	copy->stats.elapsed_ms = (uint64_t)(now.tv_sec - copy->start.tv_sec) * 1000 + (now.tv_usec - copy->start.tv_usec) / 1000;
+	if (copy->progress_cb) {
+		copy->progress_cb(&copy->stats, path, copy->user_data);
+	}
+}
+
+/**
+ * Updates the counters of a tree copy and reports the progress.
+ */
+static void afc_tree_report(struct afc_tree_copy *copy, const char *path, int is_dir, uint64_t bytes, afc_error_t result)
+{
+	mutex_lock(&copy->mutex);
+	if (result != AFC_E_SUCCESS) {
+		copy->stats.errors++;
+		if (copy->error == AFC_E_SUCCESS)
+			copy->error = result;
+	} else if (is_dir) {
+		copy->stats.directories_copied++;
+	} else {
+		copy->stats.files_copied++;
+	}
+	copy->stats.bytes_copied += bytes;
+	afc_tree_notify(copy, path);
+	mutex_unlock(&copy->mutex);
+}
+
+/**
+ * Counts an entry that is neither a regular file nor a directory, like a
+ * symbolic link, and reports it as skipped.
+ */
+static void afc_tree_report_skipped(struct afc_tree_copy *copy, const char *path)
+{
+	debug_info("skipping %s, not a regular file or directory", path);
+	mutex_lock(&copy->mutex);
+	copy->stats.skipped++;
+	afc_tree_notify(copy, path);
+	mutex_unlock(&copy->mutex);
+}
+
+static int afc_tree_mkdir(const char *path)
+{
+#ifdef WIN32
+	int res = mkdir(path);
+#else
+	int res = mkdir(path, 0755);
+#endif
+	if ((res < 0) && (errno == EEXIST))
+		res = 0;
+	return res;
+}
+
+/**
+ * Copies a file from the device to the host.
+ */
+static afc_error_t afc_tree_pull_file(struct afc_tree_worker *worker, const char *src, const char *dst, uint64_t size, uint64_t *bytes_copied)
+{
+	uint64_t handle = 0;
+	uint64_t offset = 0;
+	uint64_t bytes_read = 0;
+	uint32_t bytes_loc = 0;
+	afc_error_t ret;
+	FILE *f = NULL;
+
+	ret = afc_file_open(worker->afc, src, AFC_FOPEN_RDONLY, &handle);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
+
+	f = fopen(dst, "wb");
+	if (!f) {
+		debug_info("could not open local file %s", dst);
+		afc_file_close(worker->afc, handle);
+		return AFC_E_IO_ERROR;
+	}
+
+	while (1) {
+		if (!worker->no_offset_io) {
+			ret = afc_file_read_parallel(worker->afc, handle, offset, worker->buffer, AFC_TREE_BUFFER_SIZE, AFC_TREE_CHUNK_SIZE, AFC_TREE_CHUNKS_IN_FLIGHT, &bytes_read);
+			if ((offset == 0) && ((ret == AFC_E_OP_NOT_SUPPORTED) || (ret == AFC_E_UNKNOWN_PACKET_TYPE))) {
+				/* device does not support positional reads */
+				debug_info("falling back to sequential reads");
+				worker->no_offset_io = 1;
+				continue;
+			}
+		} else {
+			ret = afc_file_read(worker->afc, handle, worker->buffer, AFC_TREE_CHUNK_SIZE, &bytes_loc);
+			bytes_read = bytes_loc;
+		}
+		if ((ret != AFC_E_SUCCESS) || (bytes_read == 0)) {
+			break;
+		}
+		if (fwrite(worker->buffer, 1, bytes_read, f) != bytes_read) {
+			ret = AFC_E_IO_ERROR;
+			break;
+		}
+		offset += bytes_read;
+		if (!worker->no_offset_io && (bytes_read < AFC_TREE_BUFFER_SIZE)) {
+			break;
+		}
+	}
+
+	fclose(f);
+	afc_file_close(worker->afc, handle);
+
+	/* a short read must not go unnoticed as a complete copy */
+	if ((ret == AFC_E_SUCCESS) && (offset != size)) {
+		debug_info("copied %llu bytes of %s, expected %llu", (unsigned long long)offset, src, (unsigned long long)size);
+		ret = AFC_E_NOT_ENOUGH_DATA;
+	}
+
+	*bytes_copied = offset;
+
+	return ret;
+}
+
+/**
+ * Copies a file from the host to the device.
+ */
+static afc_error_t afc_tree_push_file(struct afc_tree_worker *worker, const char *src, const char *dst, uint64_t *bytes_copied)
+{
+	uint64_t handle = 0;
+	uint64_t offset = 0;
+	uint64_t bytes_written = 0;
+	uint32_t bytes_loc = 0;
+	size_t bytes_read = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+	FILE *f = NULL;
+
+	f = fopen(src, "rb");
+	if (!f) {
+		debug_info("could not open local file %s", src);
+		return AFC_E_IO_ERROR;
+	}
+
+	ret = afc_file_open(worker->afc, dst, AFC_FOPEN_WRONLY, &handle);
+	if (ret != AFC_E_SUCCESS) {
+		fclose(f);
+		return ret;
+	}
+
+	while ((bytes_read = fread(worker->buffer, 1, AFC_TREE_BUFFER_SIZE, f)) > 0) {
+		if (!worker->no_offset_io) {
+			ret = afc_file_write_parallel(worker->afc, handle, offset, worker->buffer, bytes_read, AFC_TREE_CHUNK_SIZE, AFC_TREE_CHUNKS_IN_FLIGHT, &bytes_written);
+			if ((offset == 0) && (bytes_written == 0) && ((ret == AFC_E_OP_NOT_SUPPORTED) || (ret == AFC_E_UNKNOWN_PACKET_TYPE))) {
+				/* device does not support positional writes */
+				debug_info("falling back to sequential writes");
+				worker->no_offset_io = 1;
+			}
+		}
+		if (worker->no_offset_io) {
+			bytes_written = 0;
+			ret = AFC_E_SUCCESS;
+			while ((ret == AFC_E_SUCCESS) && (bytes_written < bytes_read)) {
+				uint32_t length = ((bytes_read - bytes_written) < AFC_TREE_CHUNK_SIZE) ? (uint32_t)(bytes_read - bytes_written) : AFC_TREE_CHUNK_SIZE;
+				ret = afc_file_write(worker->afc, handle, worker->buffer + bytes_written, length, &bytes_loc);
+				if (bytes_loc == 0)
+					break;
+				bytes_written += bytes_loc;
+			}
+		}
+		offset += bytes_written;
+		if ((ret != AFC_E_SUCCESS) || (bytes_written < bytes_read)) {
+			if (ret == AFC_E_SUCCESS)
+				ret = AFC_E_IO_ERROR;
+			break;
+		}
+	}
+
+	fclose(f);
+	afc_file_close(worker->afc, handle);
+
+	*bytes_copied = offset;
+
+	return ret;
+}
+
+/**
+ * Lists a directory on the device and queues its entries.
+ */
+static afc_error_t afc_tree_pull_dir(struct afc_tree_worker *worker, const char *src, const char *dst)
+{
+	afc_dir_t dir = NULL;
+	const char *name = NULL;
+	char **paths = NULL;
+	char **names = NULL;
+	uint32_t count = 0, capacity = 0, i;
+	afc_file_info_t *infos = NULL;
+	afc_error_t *results = NULL;
+	afc_error_t ret;
+
+	if (afc_tree_mkdir(dst) < 0) {
+		debug_info("could not create local directory %s", dst);
+		return AFC_E_IO_ERROR;
+	}
+
+	ret = afc_dir_open(worker->afc, src, &dir);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
+	while (((ret = afc_dir_read(dir, &name)) == AFC_E_SUCCESS) && name) {
+		if (!strcmp(name, ".") || !strcmp(name, "..")) {
+			continue;
+		}
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			paths = (char**)realloc(paths, capacity * sizeof(char*));
+			names = (char**)realloc(names, capacity * sizeof(char*));
+		}
+		paths[count] = string_build_path(src, name, NULL);
+		names[count] = strdup(name);
+		count++;
+	}
+	afc_dir_close(dir);
+
+	if ((ret == AFC_E_SUCCESS) && (count > 0)) {
+		/* stat all entries with one pipelined batch */
+		infos = (afc_file_info_t*)malloc(count * sizeof(afc_file_info_t));
+		results = (afc_error_t*)malloc(count * sizeof(afc_error_t));
+		afc_get_file_info_batch(worker->afc, (const char**)paths, count, infos, results);
+		for (i = 0; i < count; i++) {
+			if (results[i] != AFC_E_SUCCESS) {
+				afc_tree_report(worker->copy, paths[i], 0, 0, results[i]);
+				continue;
+			}
+			if (infos[i].type == AFC_FILE_TYPE_DIRECTORY) {
+				afc_tree_push_item(worker->copy, paths[i], string_build_path(dst, names[i], NULL), 1, 0);
+				paths[i] = NULL;
+			} else if (infos[i].type == AFC_FILE_TYPE_REGULAR) {
+				afc_tree_push_item(worker->copy, paths[i], string_build_path(dst, names[i], NULL), 0, infos[i].size);
+				paths[i] = NULL;
+			} else {
+				afc_tree_report_skipped(worker->copy, paths[i]);
+			}
+		}
+		free(infos);
+		free(results);
+	}
+
+	for (i = 0; i < count; i++) {
+		free(paths[i]);
+		free(names[i]);
+	}
+	free(paths);
+	free(names);
+
+	return ret;
+}
+
+/**
+ * Lists a directory on the host and queues its entries.
+ */
+static afc_error_t afc_tree_push_dir(struct afc_tree_worker *worker, const char *src, const char *dst)
+{
+	DIR *dir = NULL;
+	struct dirent *ep = NULL;
+	struct stat st;
+	afc_error_t ret;
+
+	ret = afc_make_directory(worker->afc, dst);
+	if ((ret != AFC_E_SUCCESS) && (ret != AFC_E_OBJECT_EXISTS)) {
+		return ret;
+	}
+
+	dir = opendir(src);
+	if (!dir) {
+		debug_info("could not open local directory %s", src);
+		return AFC_E_IO_ERROR;
+	}
+	while ((ep = readdir(dir))) {
+		if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, "..")) {
+			continue;
+		}
+		char *path = string_build_path(src, ep->d_name, NULL);
+		if (stat(path, &st) < 0) {
+			debug_info("could not stat local file %s", path);
+			afc_tree_report(worker->copy, path, 0, 0, AFC_E_IO_ERROR);
+			free(path);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			afc_tree_push_item(worker->copy, path, string_build_path(dst, ep->d_name, NULL), 1, 0);
+		} else if (S_ISREG(st.st_mode)) {
+			afc_tree_push_item(worker->copy, path, string_build_path(dst, ep->d_name, NULL), 0, (uint64_t)st.st_size);
+		} else {
+			afc_tree_report_skipped(worker->copy, path);
+			free(path);
+		}
+	}
+	closedir(dir);
+
+	return AFC_E_SUCCESS;
+}
+
+static void *afc_tree_worker_thread(void *arg)
+{
+	struct afc_tree_worker *worker = (struct afc_tree_worker*)arg;
+	struct afc_tree_copy *copy = worker->copy;
+	struct afc_tree_item *item = NULL;
+	uint64_t bytes = 0;
+	afc_error_t ret;
+
+	while (1) {
+		mutex_lock(&copy->mutex);
+		item = copy->queue;
+		if (item) {
+			copy->queue = item->next;
+			copy->busy++;
+		} else if (copy->busy == 0) {
+			/* queue is empty and nobody can add to it anymore */
+			mutex_unlock(&copy->mutex);
+			break;
+		}
+		mutex_unlock(&copy->mutex);
+
+		if (!item) {
+			/* wait for the other workers to queue more entries */
+			AFC_TREE_IDLE();
+			continue;
+		}
+
+		bytes = 0;
+		if (item->is_dir) {
+			if (copy->to_device)
+				ret = afc_tree_push_dir(worker, item->src, item->dst);
+			else
+				ret = afc_tree_pull_dir(worker, item->src, item->dst);
+		} else {
+			if (copy->to_device)
+				ret = afc_tree_push_file(worker, item->src, item->dst, &bytes);
+			else
+				ret = afc_tree_pull_file(worker, item->src, item->dst, item->size, &bytes);
+		}
+		afc_tree_report(copy, item->src, item->is_dir, bytes, ret);
+		afc_tree_item_free(item);
+
+		mutex_lock(&copy->mutex);
+		copy->busy--;
+		mutex_unlock(&copy->mutex);
+	}
+
+	return NULL;
+}
+
+/**
+ * Copies a directory tree using a pool of workers that each own an AFC
+ * connection to the device.
+ */
+static afc_error_t afc_copy_tree(idevice_t device, const char *src, const char *dst, int to_device, unsigned int workers, afc_copy_progress_cb_t progress_cb, void *user_data, afc_copy_stats_t *stats)
+{
+	struct afc_tree_copy copy;
+	struct afc_tree_worker *pool = NULL;
+	unsigned int connected = 0;
+	unsigned int i;
+
+	if (!device || !src || !dst)
+		return AFC_E_INVALID_ARG;
+
+	if (workers == 0)
+		workers = 1;
+
+	memset(&copy, '\0', sizeof(copy));
+	copy.device = device;
+	copy.to_device = to_device;
+	copy.progress_cb = progress_cb;
+	copy.user_data = user_data;
+	copy.error = AFC_E_SUCCESS;
+	mutex_init(&copy.mutex);
+	gettimeofday(&copy.start, NULL);
+
+	pool = (struct afc_tree_worker*)calloc(workers, sizeof(struct afc_tree_worker));
+	if (!pool) {
+		mutex_destroy(&copy.mutex);
+		return AFC_E_NO_MEM;
+	}
+
+	/* connect as many workers as the device allows */
+	for (i = 0; i < workers; i++) {
+		if (afc_client_start_service(device, &pool[connected].afc, "afc_copy_tree") != AFC_E_SUCCESS) {
+			debug_info("could only start %d of %d AFC connections", connected, workers);
+			break;
+		}
+		pool[connected].copy = &copy;
+		pool[connected].buffer = (char*)malloc(AFC_TREE_BUFFER_SIZE);
+		connected++;
+	}
+	if (connected == 0) {
+		free(pool);
+		mutex_destroy(&copy.mutex);
+		return AFC_E_SERVICE_NOT_CONNECTED;
+	}
+
+	afc_tree_push_item(&copy, strdup(src), strdup(dst), 1, 0);
+
+	for (i = 0; i < connected; i++) {
+		pool[i].started = (thread_new(&pool[i].thread, afc_tree_worker_thread, &pool[i]) == 0);
+	}
+	for (i = 0; i < connected; i++) {
+		if (pool[i].started) {
+			thread_join(pool[i].thread);
+			thread_free(pool[i].thread);
+		}
+	}
+
+	/* all workers failed to start, copy on this thread */
+	if (copy.queue) {
+		afc_tree_worker_thread(&pool[0]);
+	}
+
+	for (i = 0; i < connected; i++) {
+		afc_client_free(pool[i].afc);
+		free(pool[i].buffer);
+	}
+	free(pool);
+	mutex_destroy(&copy.mutex);
+
+	if (stats) {
+		*stats = copy.stats;
+	}
+
+	return copy.error;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_copy_tree_to_host(idevice_t device, const char *device_path, const char *host_path, unsigned int workers, afc_copy_progress_cb_t progress_cb, void *user_data, afc_copy_stats_t *stats)
+{
+	return afc_copy_tree(device, device_path, host_path, 0, workers, progress_cb, user_data, stats);
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_copy_tree_to_device(idevice_t device, const char *host_path, const char *device_path, unsigned int workers, afc_copy_progress_cb_t progress_cb, void *user_data, afc_copy_stats_t *stats)
+{
+	return afc_copy_tree(device, host_path, device_path, 1, workers, progress_cb, user_data, stats);
+}
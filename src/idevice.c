@@ -25,12 +25,16 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #ifdef WIN32
 #include <windows.h>
+#else
+#include <sys/uio.h>
 #endif
 
 #include <usbmuxd.h>
@@ -43,9 +47,12 @@
 #endif
 
 #include "idevice.h"
+#include "libimobiledevice/lockdown.h"
 #include "common/userpref.h"
 #include "common/thread.h"
 #include "common/debug.h"
+#include "common/trace.h"
+#include "common/utils.h"
 
 #ifdef HAVE_OPENSSL
 
@@ -86,8 +93,120 @@ static unsigned long id_function(void)
 #endif
 #endif
 
+#ifdef HAVE_OPENSSL
+/** SSL context with the loaded credentials of a device and its last session. */
+struct ssl_cache_entry {
+	char *udid;
+	SSL_CTX *ctx;
+	SSL_SESSION *session;
+	struct ssl_cache_entry *next;
+};
+#else
+/** Credentials imported from the pair record of a device. */
+struct ssl_credentials {
+	int refcount;
+	gnutls_certificate_credentials_t certificate;
+	gnutls_x509_privkey_t root_privkey;
+	gnutls_x509_crt_t root_cert;
+	gnutls_x509_privkey_t host_privkey;
+	gnutls_x509_crt_t host_cert;
+};
+
+/** Credentials of a device and data of its last session, used to resume it. */
+struct ssl_cache_entry {
+	char *udid;
+	struct ssl_credentials *credentials;
+	gnutls_datum_t session;
+	struct ssl_cache_entry *next;
+};
+
+static void internal_ssl_credentials_release(struct ssl_credentials *credentials)
+{
+	if (!credentials || (__atomic_sub_fetch(&credentials->refcount, 1, __ATOMIC_ACQ_REL) > 0))
+		return;
+
+	gnutls_certificate_free_credentials(credentials->certificate);
+	gnutls_x509_crt_deinit(credentials->root_cert);
+	gnutls_x509_crt_deinit(credentials->host_cert);
+	gnutls_x509_privkey_deinit(credentials->root_privkey);
+	gnutls_x509_privkey_deinit(credentials->host_privkey);
+	free(credentials);
+}
+#endif
+
+static struct ssl_cache_entry *ssl_cache = NULL;
+static mutex_t ssl_cache_mutex;
+
+static struct ssl_cache_entry *internal_ssl_cache_find(const char *udid)
+{
+	struct ssl_cache_entry *entry;
+	for (entry = ssl_cache; entry; entry = entry->next) {
+		if (strcmp(entry->udid, udid) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static void internal_ssl_cache_entry_free(struct ssl_cache_entry *entry)
+{
+#ifdef HAVE_OPENSSL
+	if (entry->session)
+		SSL_SESSION_free(entry->session);
+	/* connections still using the context hold their own reference */
+	if (entry->ctx)
+		SSL_CTX_free(entry->ctx);
+#else
+	if (entry->session.data)
+		gnutls_free(entry->session.data);
+	/* connections still using the credentials hold their own reference */
+	internal_ssl_credentials_release(entry->credentials);
+#endif
+	free(entry->udid);
+	free(entry);
+}
+
+/**
+ * Drops the cached SSL state of a device, e.g. when its pair record changed.
+ * Must be called with ssl_cache_mutex held.
+ */
+static void internal_ssl_cache_remove(const char *udid)
+{
+	struct ssl_cache_entry **prev = &ssl_cache;
+	while (*prev) {
+		struct ssl_cache_entry *entry = *prev;
+		if (strcmp(entry->udid, udid) == 0) {
+			*prev = entry->next;
+			internal_ssl_cache_entry_free(entry);
+			return;
+		}
+		prev = &entry->next;
+	}
+}
+
+void idevice_ssl_cache_invalidate(const char *udid)
+{
+	if (!udid)
+		return;
+	mutex_lock(&ssl_cache_mutex);
+	internal_ssl_cache_remove(udid);
+	mutex_unlock(&ssl_cache_mutex);
+}
+
+static char *trace_path = NULL;
+static int stats_print = 0;
+
 static void internal_idevice_init(void)
 {
+	mutex_init(&ssl_cache_mutex);
+
+	const char *stats_env = getenv("LIBIMOBILEDEVICE_STATS");
+	stats_print = (stats_env && *stats_env) ? 1 : 0;
+
+	const char *trace_env = getenv("LIBIMOBILEDEVICE_TRACE");
+	if (trace_env && *trace_env) {
+		trace_path = strdup(trace_env);
+		internal_set_trace_categories(TRACE_CATEGORY_ALL);
+	}
 #ifdef HAVE_OPENSSL
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 	int i;
@@ -109,6 +228,27 @@ static void internal_idevice_init(void)
 
 static void internal_idevice_deinit(void)
 {
+	if (stats_print) {
+		char *json = NULL;
+		if (lockdownd_get_latency_stats(&json) == LOCKDOWN_E_SUCCESS) {
+			fprintf(stderr, "libimobiledevice lockdown latency: %s\n", json);
+			free(json);
+		}
+	}
+	if (trace_path) {
+		internal_set_trace_categories(0);
+		trace_save(trace_path);
+		free(trace_path);
+		trace_path = NULL;
+	}
+
+	while (ssl_cache) {
+		struct ssl_cache_entry *next = ssl_cache->next;
+		internal_ssl_cache_entry_free(ssl_cache);
+		ssl_cache = next;
+	}
+	mutex_destroy(&ssl_cache_mutex);
+
 #ifdef HAVE_OPENSSL
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 	int i;
@@ -247,6 +387,24 @@ LIBIMOBILEDEVICE_API void idevice_set_debug_level(int level)
 	internal_set_debug_level(level);
 }
 
+LIBIMOBILEDEVICE_API void idevice_set_debug_categories(unsigned int categories)
+{
+	internal_set_debug_categories(categories);
+}
+
+LIBIMOBILEDEVICE_API void idevice_trace_set_categories(unsigned int categories)
+{
+	internal_set_trace_categories(categories);
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_trace_save(const char *path)
+{
+	if (!path)
+		return IDEVICE_E_INVALID_ARG;
+
+	return (trace_save(path) == 0) ? IDEVICE_E_SUCCESS : IDEVICE_E_UNKNOWN_ERROR;
+}
+
 LIBIMOBILEDEVICE_API idevice_error_t idevice_new(idevice_t * device, const char *udid)
 {
 	usbmuxd_device_info_t muxdev;
@@ -257,6 +415,10 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_new(idevice_t * device, const char
 		dev->conn_type = CONNECTION_USBMUXD;
 		dev->conn_data = (void*)(long)muxdev.handle;
 		dev->version = 0;
+		dev->lockdown_session = NULL;
+		mutex_init(&dev->lockdown_session_mutex);
+		dev->service_names = NULL;
+		mutex_init(&dev->service_names_mutex);
 		*device = dev;
 		return IDEVICE_E_SUCCESS;
 	}
@@ -273,6 +435,19 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_free(idevice_t device)
 
 	ret = IDEVICE_E_SUCCESS;
 
+	if (device->lockdown_session) {
+		lockdownd_client_free(device->lockdown_session);
+		device->lockdown_session = NULL;
+	}
+	mutex_destroy(&device->lockdown_session_mutex);
+	while (device->service_names) {
+		struct idevice_service_name *next = device->service_names->next;
+		free(device->service_names->name);
+		free(device->service_names);
+		device->service_names = next;
+	}
+	mutex_destroy(&device->service_names_mutex);
+
 	free(device->udid);
 
 	if (device->conn_type == CONNECTION_USBMUXD) {
@@ -285,6 +460,177 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_free(idevice_t device)
 	return ret;
 }
 
+/**
+ * Prints the counters of a connection to stderr as a single line.
+ */
+static void internal_connection_print_stats(idevice_connection_t connection)
+{
+	idevice_connection_stats_t stats;
+
+	idevice_connection_get_stats(connection, &stats);
+	fprintf(stderr, "libimobiledevice stats: udid=%s service=%s sent=%" PRIu64 "/%" PRIu64 " received=%" PRIu64 "/%" PRIu64 " syscalls=%" PRIu64 " tls_records=%" PRIu64 "/%" PRIu64 " handshake_us=%" PRIu64 " requests=%" PRIu64 " request_us=%" PRIu64 " latency_us=%" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n",
+		connection->udid ? connection->udid : "", connection->label ? connection->label : "-",
+		stats.bytes_sent, stats.messages_sent, stats.bytes_received, stats.messages_received,
+		stats.syscalls, stats.tls_records_sent, stats.tls_records_received,
+		stats.handshake_usec, stats.requests, stats.request_usec,
+		stats.request_usec_p50, stats.request_usec_p90, stats.request_usec_p99, stats.request_usec_max);
+}
+
+void idevice_connection_set_label(idevice_connection_t connection, const char *label)
+{
+	if (!connection)
+		return;
+
+	free(connection->label);
+	connection->label = (label) ? strdup(label) : NULL;
+}
+
+void idevice_set_service_name(idevice_t device, uint16_t port, const char *name)
+{
+	struct idevice_service_name *entry;
+
+	if (!device || !port || !name)
+		return;
+
+	mutex_lock(&device->service_names_mutex);
+	for (entry = device->service_names; entry; entry = entry->next) {
+		if (entry->port == port)
+			break;
+	}
+	if (!entry) {
+		entry = (struct idevice_service_name*)calloc(1, sizeof(struct idevice_service_name));
+		entry->port = port;
+		entry->next = device->service_names;
+		device->service_names = entry;
+	}
+	free(entry->name);
+	entry->name = strdup(name);
+	mutex_unlock(&device->service_names_mutex);
+}
+
+/**
+ * Takes the name of the service started on the given port, if any.
+ *
+ * @return The name, to be freed by the caller, or NULL.
+ */
+static char *internal_take_service_name(idevice_t device, uint16_t port)
+{
+	struct idevice_service_name **prev;
+	char *name = NULL;
+
+	mutex_lock(&device->service_names_mutex);
+	for (prev = &device->service_names; *prev; prev = &(*prev)->next) {
+		if ((*prev)->port == port) {
+			struct idevice_service_name *entry = *prev;
+			*prev = entry->next;
+			name = entry->name;
+			free(entry);
+			break;
+		}
+	}
+	mutex_unlock(&device->service_names_mutex);
+
+	return name;
+}
+
+/**
+ * Counts the TLS records whose header is contained in the given part of
+ * the encrypted stream.
+ */
+static void internal_count_tls_records(struct tls_record_counter *counter, uint64_t *records, const unsigned char *data, size_t length)
+{
+	while (length > 0) {
+		if (counter->remaining > 0) {
+			size_t skip = (length < counter->remaining) ? length : counter->remaining;
+			counter->remaining -= skip;
+			data += skip;
+			length -= skip;
+			continue;
+		}
+		counter->header[counter->header_len++] = *data++;
+		length--;
+		if (counter->header_len == sizeof(counter->header)) {
+			/* content type, version, 16 bit big endian length */
+			counter->remaining = ((uint32_t)counter->header[3] << 8) | counter->header[4];
+			counter->header_len = 0;
+			(*records)++;
+		}
+	}
+}
+
+#ifdef HAVE_OPENSSL
+/**
+ * Callback of the socket BIO under a TLS connection, the socket is read and
+ * written by OpenSSL directly so the counters are updated here.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+static long internal_bio_callback(BIO *bio, int oper, const char *argp, size_t len, int argi, long argl, int ret, size_t *processed)
+{
+	idevice_connection_t connection = (idevice_connection_t)BIO_get_callback_arg(bio);
+	size_t done = (ret > 0 && processed) ? *processed : 0;
+#else
+static long internal_bio_callback(BIO *bio, int oper, const char *argp, int argi, long argl, long ret)
+{
+	idevice_connection_t connection = (idevice_connection_t)BIO_get_callback_arg(bio);
+	size_t done = (ret > 0) ? (size_t)ret : 0;
+#endif
+	if (oper == (BIO_CB_READ | BIO_CB_RETURN)) {
+		connection->stats.syscalls++;
+		internal_count_tls_records(&connection->tls_in, &connection->stats.tls_records_received, (const unsigned char*)argp, done);
+	} else if (oper == (BIO_CB_WRITE | BIO_CB_RETURN)) {
+		connection->stats.syscalls++;
+		internal_count_tls_records(&connection->tls_out, &connection->stats.tls_records_sent, (const unsigned char*)argp, done);
+	}
+	return ret;
+}
+#endif
+
+void idevice_connection_request_begin(idevice_connection_t connection)
+{
+	if (connection && !connection->request_start) {
+		connection->request_start = time_monotonic_usec();
+	}
+}
+
+void idevice_connection_request_end(idevice_connection_t connection)
+{
+	uint64_t elapsed;
+
+	if (!connection || !connection->request_start)
+		return;
+
+	elapsed = time_monotonic_usec() - connection->request_start;
+	connection->request_start = 0;
+
+	connection->stats.requests++;
+	connection->stats.request_usec += elapsed;
+	histogram_record(&connection->request_latency, elapsed);
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_get_stats(idevice_connection_t connection, idevice_connection_stats_t *stats)
+{
+	if (!connection || !stats)
+		return IDEVICE_E_INVALID_ARG;
+
+	*stats = connection->stats;
+	stats->request_usec_p50 = histogram_percentile(&connection->request_latency, 50.0);
+	stats->request_usec_p90 = histogram_percentile(&connection->request_latency, 90.0);
+	stats->request_usec_p99 = histogram_percentile(&connection->request_latency, 99.0);
+	stats->request_usec_max = connection->request_latency.max;
+	return IDEVICE_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_reset_stats(idevice_connection_t connection)
+{
+	if (!connection)
+		return IDEVICE_E_INVALID_ARG;
+
+	memset(&connection->stats, '\0', sizeof(idevice_connection_stats_t));
+	histogram_reset(&connection->request_latency);
+	connection->request_start = 0;
+	return IDEVICE_E_SUCCESS;
+}
+
 LIBIMOBILEDEVICE_API idevice_error_t idevice_connect(idevice_t device, uint16_t port, idevice_connection_t *connection)
 {
 	if (!device) {
@@ -301,6 +647,16 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connect(idevice_t device, uint16_t
 		new_connection->type = CONNECTION_USBMUXD;
 		new_connection->data = (void*)(long)sfd;
 		new_connection->ssl_data = NULL;
+		new_connection->recv_buffer = NULL;
+		new_connection->recv_buffer_size = 0;
+		new_connection->recv_start = 0;
+		new_connection->recv_end = 0;
+		new_connection->label = internal_take_service_name(device, port);
+		memset(&new_connection->stats, '\0', sizeof(idevice_connection_stats_t));
+		histogram_reset(&new_connection->request_latency);
+		memset(&new_connection->tls_out, '\0', sizeof(struct tls_record_counter));
+		memset(&new_connection->tls_in, '\0', sizeof(struct tls_record_counter));
+		new_connection->request_start = 0;
 		idevice_get_udid(device, &new_connection->udid);
 		*connection = new_connection;
 		return IDEVICE_E_SUCCESS;
@@ -320,6 +676,9 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_disconnect(idevice_connection_t con
 	if (connection->ssl_data) {
 		idevice_connection_disable_ssl(connection);
 	}
+	if (stats_print) {
+		internal_connection_print_stats(connection);
+	}
 	idevice_error_t result = IDEVICE_E_UNKNOWN_ERROR;
 	if (connection->type == CONNECTION_USBMUXD) {
 		usbmuxd_disconnect((int)(long)connection->data);
@@ -332,6 +691,8 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_disconnect(idevice_connection_t con
 	if (connection->udid)
 		free(connection->udid);
 
+	free(connection->recv_buffer);
+	free(connection->label);
 	free(connection);
 	connection = NULL;
 
@@ -348,6 +709,7 @@ static idevice_error_t internal_connection_send(idevice_connection_t connection,
 	}
 
 	if (connection->type == CONNECTION_USBMUXD) {
+		connection->stats.syscalls++;
 		int res = usbmuxd_send((int)(long)connection->data, data, len, sent_bytes);
 		if (res < 0) {
 			debug_info("ERROR: usbmuxd_send returned %d (%s)", res, strerror(-res));
@@ -367,6 +729,7 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_send(idevice_connection_
 		return IDEVICE_E_INVALID_ARG;
 	}
 
+	idevice_error_t res;
 	if (connection->ssl_data) {
 #ifdef HAVE_OPENSSL
 		int sent = SSL_write(connection->ssl_data->session, (const void*)data, (int)len);
@@ -376,12 +739,128 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_send(idevice_connection_
 #endif
 		if ((uint32_t)sent == (uint32_t)len) {
 			*sent_bytes = sent;
-			return IDEVICE_E_SUCCESS;
+			res = IDEVICE_E_SUCCESS;
+		} else {
+			*sent_bytes = 0;
+			res = IDEVICE_E_SSL_ERROR;
+		}
+	} else {
+		res = internal_connection_send(connection, data, len, sent_bytes);
+	}
+	if (res == IDEVICE_E_SUCCESS) {
+		connection->stats.messages_sent++;
+		connection->stats.bytes_sent += *sent_bytes;
+	}
+	trace_log(TRACE_CATEGORY_CONNECTION, TRACE_EVENT_CONNECTION_SEND, res, len, (res == IDEVICE_E_SUCCESS) ? *sent_bytes : 0, NULL);
+	return res;
+}
+
+#ifndef WIN32
+/** Maximum number of buffers passed to a single writev() call. */
+#define IDEVICE_SENDV_MAX 16
+
+/**
+ * Internally used function to send several buffers over the given connection
+ * with a gather write.
+ */
+static idevice_error_t internal_connection_sendv(idevice_connection_t connection, const idevice_iovec_t *iov, unsigned int iovcnt, uint32_t *sent_bytes)
+{
+	struct iovec vec[IDEVICE_SENDV_MAX];
+	unsigned int first = 0;
+	unsigned int i;
+
+	*sent_bytes = 0;
+
+	if (connection->type != CONNECTION_USBMUXD) {
+		debug_info("Unknown connection type %d", connection->type);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		vec[i].iov_base = (void*)iov[i].data;
+		vec[i].iov_len = iov[i].length;
+	}
+
+	while (first < iovcnt) {
+		connection->stats.syscalls++;
+		ssize_t res = writev((int)(long)connection->data, vec + first, iovcnt - first);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			debug_info("ERROR: writev returned %d (%s)", (int)res, strerror(errno));
+			return IDEVICE_E_UNKNOWN_ERROR;
+		}
+		*sent_bytes += (uint32_t)res;
+		/* skip the buffers that were sent completely */
+		while ((first < iovcnt) && ((size_t)res >= vec[first].iov_len)) {
+			res -= vec[first].iov_len;
+			first++;
+		}
+		if (first < iovcnt) {
+			vec[first].iov_base = (char*)vec[first].iov_base + res;
+			vec[first].iov_len -= res;
 		}
-		*sent_bytes = 0;
-		return IDEVICE_E_SSL_ERROR;
 	}
-	return internal_connection_send(connection, data, len, sent_bytes);
+
+	return IDEVICE_E_SUCCESS;
+}
+#endif
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_sendv(idevice_connection_t connection, const idevice_iovec_t *iov, unsigned int iovcnt, uint32_t *sent_bytes)
+{
+	idevice_error_t res;
+	uint32_t total = 0;
+	uint32_t offset = 0;
+	char *buf = NULL;
+	unsigned int i;
+
+	if (!connection || !iov || !sent_bytes || (connection->ssl_data && !connection->ssl_data->session)) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+
+	if (iovcnt == 1) {
+		return idevice_connection_send(connection, iov[0].data, iov[0].length, sent_bytes);
+	}
+
+#ifndef WIN32
+	if (!connection->ssl_data && (iovcnt <= IDEVICE_SENDV_MAX)) {
+		res = internal_connection_sendv(connection, iov, iovcnt, sent_bytes);
+		if (res == IDEVICE_E_SUCCESS) {
+			connection->stats.messages_sent++;
+			connection->stats.bytes_sent += *sent_bytes;
+		}
+		if (trace_enabled(TRACE_CATEGORY_CONNECTION)) {
+			for (i = 0; i < iovcnt; i++) {
+				total += iov[i].length;
+			}
+			trace_write(TRACE_CATEGORY_CONNECTION, TRACE_EVENT_CONNECTION_SEND, res, total, *sent_bytes, NULL);
+		}
+		return res;
+	}
+#endif
+
+	/* coalesce the buffers so they go out in a single write or SSL record */
+	for (i = 0; i < iovcnt; i++) {
+		total += iov[i].length;
+	}
+	*sent_bytes = 0;
+	if (total == 0) {
+		return IDEVICE_E_SUCCESS;
+	}
+	buf = (char*)malloc(total);
+	if (!buf) {
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].length > 0) {
+			memcpy(buf + offset, iov[i].data, iov[i].length);
+			offset += iov[i].length;
+		}
+	}
+	res = idevice_connection_send(connection, buf, total, sent_bytes);
+	free(buf);
+
+	return res;
 }
 
 /**
@@ -395,6 +874,7 @@ static idevice_error_t internal_connection_receive_timeout(idevice_connection_t
 	}
 
 	if (connection->type == CONNECTION_USBMUXD) {
+		connection->stats.syscalls++;
 		int res = usbmuxd_recv_timeout((int)(long)connection->data, data, len, recv_bytes, timeout);
 		if (res < 0) {
 			debug_info("ERROR: usbmuxd_recv_timeout returned %d (%s)", res, strerror(errno));
@@ -407,12 +887,12 @@ static idevice_error_t internal_connection_receive_timeout(idevice_connection_t
 	return IDEVICE_E_UNKNOWN_ERROR;
 }
 
-LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
+/**
+ * Internally used function for receiving data over the given connection
+ * using a timeout, bypassing the receive buffer.
+ */
+static idevice_error_t internal_unbuffered_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
 {
-	if (!connection || (connection->ssl_data && !connection->ssl_data->session)) {
-		return IDEVICE_E_INVALID_ARG;
-	}
-
 	if (connection->ssl_data) {
 		uint32_t received = 0;
 		while (received < len) {
@@ -448,6 +928,7 @@ static idevice_error_t internal_connection_receive(idevice_connection_t connecti
 	}
 
 	if (connection->type == CONNECTION_USBMUXD) {
+		connection->stats.syscalls++;
 		int res = usbmuxd_recv((int)(long)connection->data, data, len, recv_bytes);
 		if (res < 0) {
 			debug_info("ERROR: usbmuxd_recv returned %d (%s)", res, strerror(-res));
@@ -461,12 +942,12 @@ static idevice_error_t internal_connection_receive(idevice_connection_t connecti
 	return IDEVICE_E_UNKNOWN_ERROR;
 }
 
-LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+/**
+ * Internally used function for receiving data over the given connection,
+ * bypassing the receive buffer.
+ */
+static idevice_error_t internal_unbuffered_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
 {
-	if (!connection || (connection->ssl_data && !connection->ssl_data->session)) {
-		return IDEVICE_E_INVALID_ARG;
-	}
-
 	if (connection->ssl_data) {
 #ifdef HAVE_OPENSSL
 		int received = SSL_read(connection->ssl_data->session, (void*)data, (int)len);
@@ -484,6 +965,148 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_receive(idevice_connecti
 	return internal_connection_receive(connection, data, len, recv_bytes);
 }
 
+/**
+ * Internally used function for receiving data through the receive buffer of
+ * the given connection. Small reads are served from the buffer, which is
+ * refilled with a single large read when it runs empty.
+ */
+static idevice_error_t internal_buffered_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout, int use_timeout)
+{
+	idevice_error_t res = IDEVICE_E_SUCCESS;
+	uint32_t received = 0;
+	uint32_t avail;
+
+	*recv_bytes = 0;
+
+	while (received < len) {
+		avail = connection->recv_end - connection->recv_start;
+		if (avail == 0) {
+			uint32_t bytes = 0;
+			if (received > 0 && !connection->ssl_data) {
+				/* do not block for more than what is already available */
+				break;
+			}
+			if ((len - received) >= connection->recv_buffer_size) {
+				/* large reads go directly to the caller's buffer */
+				if (use_timeout)
+					res = internal_unbuffered_receive_timeout(connection, data + received, len - received, &bytes, timeout);
+				else
+					res = internal_unbuffered_receive(connection, data + received, len - received, &bytes);
+				received += bytes;
+				break;
+			}
+			connection->recv_start = 0;
+			connection->recv_end = 0;
+			if (use_timeout && !connection->ssl_data)
+				res = internal_connection_receive_timeout(connection, connection->recv_buffer, connection->recv_buffer_size, &bytes, timeout);
+			else
+				res = internal_unbuffered_receive(connection, connection->recv_buffer, connection->recv_buffer_size, &bytes);
+			if ((res != IDEVICE_E_SUCCESS) || (bytes == 0)) {
+				break;
+			}
+			connection->recv_end = bytes;
+			avail = bytes;
+		}
+		if (avail > len - received) {
+			avail = len - received;
+		}
+		memcpy(data + received, connection->recv_buffer + connection->recv_start, avail);
+		connection->recv_start += avail;
+		received += avail;
+		if (!use_timeout) {
+			/* like recv(), return whatever is available */
+			break;
+		}
+	}
+
+	*recv_bytes = received;
+	if (received > 0) {
+		return IDEVICE_E_SUCCESS;
+	}
+	return res;
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
+{
+	if (!connection || (connection->ssl_data && !connection->ssl_data->session)) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+
+	idevice_error_t res;
+	if (connection->recv_buffer) {
+		res = internal_buffered_receive(connection, data, len, recv_bytes, timeout, 1);
+	} else {
+		res = internal_unbuffered_receive_timeout(connection, data, len, recv_bytes, timeout);
+	}
+	if (*recv_bytes > 0) {
+		connection->stats.messages_received++;
+		connection->stats.bytes_received += *recv_bytes;
+	}
+	trace_log(TRACE_CATEGORY_CONNECTION, TRACE_EVENT_CONNECTION_RECEIVE, res, len, *recv_bytes, NULL);
+	return res;
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+{
+	if (!connection || (connection->ssl_data && !connection->ssl_data->session)) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+
+	idevice_error_t res;
+	if (connection->recv_buffer) {
+		res = internal_buffered_receive(connection, data, len, recv_bytes, 0, 0);
+	} else {
+		res = internal_unbuffered_receive(connection, data, len, recv_bytes);
+	}
+	if (*recv_bytes > 0) {
+		connection->stats.messages_received++;
+		connection->stats.bytes_received += *recv_bytes;
+	}
+	trace_log(TRACE_CATEGORY_CONNECTION, TRACE_EVENT_CONNECTION_RECEIVE, res, len, *recv_bytes, NULL);
+	return res;
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_set_receive_buffer(idevice_connection_t connection, uint32_t size)
+{
+	char *buffer = NULL;
+
+	if (!connection) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+
+	if (connection->recv_end > connection->recv_start) {
+		/* buffered data would be lost */
+		return IDEVICE_E_NOT_ENOUGH_DATA;
+	}
+
+	if (size > 0) {
+		buffer = (char*)malloc(size);
+		if (!buffer) {
+			return IDEVICE_E_UNKNOWN_ERROR;
+		}
+	}
+
+	free(connection->recv_buffer);
+	connection->recv_buffer = buffer;
+	connection->recv_buffer_size = size;
+	connection->recv_start = 0;
+	connection->recv_end = 0;
+
+	return IDEVICE_E_SUCCESS;
+}
+
+/**
+ * @return The number of received bytes held in the receive buffer of the
+ *     connection that were not read yet.
+ */
+uint32_t idevice_connection_get_buffered(idevice_connection_t connection)
+{
+	if (!connection || !connection->recv_buffer)
+		return 0;
+
+	return connection->recv_end - connection->recv_start;
+}
+
 LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_get_fd(idevice_connection_t connection, int *fd)
 {
 	if (!connection || !fd) {
@@ -547,6 +1170,7 @@ static ssize_t internal_ssl_read(gnutls_transport_ptr_t transport, char *buffer,
 			return res;
 		}
 		debug_info("post-read we got %i bytes", bytes);
+		internal_count_tls_records(&connection->tls_in, &connection->stats.tls_records_received, (const unsigned char*)recv_buffer, bytes);
 
 		/* increase read count */
 		tbytes += bytes;
@@ -583,6 +1207,7 @@ static ssize_t internal_ssl_write(gnutls_transport_ptr_t transport, char *buffer
 		return -1;
 	}
 	debug_info("post-send sent %i bytes", bytes);
+	internal_count_tls_records(&connection->tls_out, &connection->stats.tls_records_sent, (const unsigned char*)buffer, bytes);
 	return bytes;
 }
 #endif
@@ -606,21 +1231,7 @@ static void internal_ssl_cleanup(ssl_data_t ssl_data)
 	if (ssl_data->session) {
 		gnutls_deinit(ssl_data->session);
 	}
-	if (ssl_data->certificate) {
-		gnutls_certificate_free_credentials(ssl_data->certificate);
-	}
-	if (ssl_data->root_cert) {
-		gnutls_x509_crt_deinit(ssl_data->root_cert);
-	}
-	if (ssl_data->host_cert) {
-		gnutls_x509_crt_deinit(ssl_data->host_cert);
-	}
-	if (ssl_data->root_privkey) {
-		gnutls_x509_privkey_deinit(ssl_data->root_privkey);
-	}
-	if (ssl_data->host_privkey) {
-		gnutls_x509_privkey_deinit(ssl_data->host_privkey);
-	}
+	internal_ssl_credentials_release(ssl_data->credentials);
 #endif
 }
 
@@ -673,7 +1284,7 @@ static int internal_cert_callback(gnutls_session_t session, const gnutls_datum_t
 	gnutls_certificate_type_t type = gnutls_certificate_type_get(session);
 	if (type == GNUTLS_CRT_X509) {
 		ssl_data_t ssl_data = (ssl_data_t)gnutls_session_get_ptr(session);
-		if (ssl_data && ssl_data->host_privkey && ssl_data->host_cert) {
+		if (ssl_data && ssl_data->credentials) {
 			debug_info("Passing certificate");
 #if GNUTLS_VERSION_NUMBER >= 0x020b07
 			st->cert_type = type;
@@ -682,8 +1293,8 @@ static int internal_cert_callback(gnutls_session_t session, const gnutls_datum_t
 			st->type = type;
 #endif
 			st->ncerts = 1;
-			st->cert.x509 = &ssl_data->host_cert;
-			st->key.x509 = ssl_data->host_privkey;
+			st->cert.x509 = &ssl_data->credentials->host_cert;
+			st->key.x509 = ssl_data->credentials->host_privkey;
 			st->deinit_all = 0;
 			res = 0;
 		}
@@ -692,47 +1303,121 @@ static int internal_cert_callback(gnutls_session_t session, const gnutls_datum_t
 }
 #endif
 
-LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection)
+#ifndef HAVE_OPENSSL
+/**
+ * Imports the certificates and keys from the pair record of a device.
+ */
+static struct ssl_credentials *internal_ssl_credentials_new(const char *udid)
 {
-	if (!connection || connection->ssl_data)
-		return IDEVICE_E_INVALID_ARG;
+	plist_t pair_record = NULL;
 
-	idevice_error_t ret = IDEVICE_E_SSL_ERROR;
-#ifdef HAVE_OPENSSL
-	uint32_t return_me = 0;
+	userpref_read_pair_record(udid, &pair_record);
+	if (!pair_record) {
+		debug_info("ERROR: Failed enabling SSL. Unable to read pair record for udid %s.", udid);
+		return NULL;
+	}
+
+	struct ssl_credentials *credentials = (struct ssl_credentials*)calloc(1, sizeof(struct ssl_credentials));
+	credentials->refcount = 1;
+	gnutls_certificate_allocate_credentials(&credentials->certificate);
+#if GNUTLS_VERSION_NUMBER >= 0x020b07
+	gnutls_certificate_set_retrieve_function(credentials->certificate, internal_cert_callback);
 #else
-	int return_me = 0;
+	gnutls_certificate_client_set_retrieve_function(credentials->certificate, internal_cert_callback);
+#endif
+
+	gnutls_x509_crt_init(&credentials->root_cert);
+	gnutls_x509_crt_init(&credentials->host_cert);
+	gnutls_x509_privkey_init(&credentials->root_privkey);
+	gnutls_x509_privkey_init(&credentials->host_privkey);
+
+	pair_record_import_crt_with_name(pair_record, USERPREF_ROOT_CERTIFICATE_KEY, credentials->root_cert);
+	pair_record_import_crt_with_name(pair_record, USERPREF_HOST_CERTIFICATE_KEY, credentials->host_cert);
+	pair_record_import_key_with_name(pair_record, USERPREF_ROOT_PRIVATE_KEY_KEY, credentials->root_privkey);
+	pair_record_import_key_with_name(pair_record, USERPREF_HOST_PRIVATE_KEY_KEY, credentials->host_privkey);
+
+	plist_free(pair_record);
+
+	return credentials;
+}
+
+/**
+ * Returns a reference to the cached credentials of a device, importing
+ * them from its pair record on first use.
+ */
+static struct ssl_credentials *internal_ssl_credentials_get(const char *udid)
+{
+	struct ssl_cache_entry *entry;
+	struct ssl_credentials *credentials = NULL;
+
+	mutex_lock(&ssl_cache_mutex);
+	entry = internal_ssl_cache_find(udid);
+	if (entry && entry->credentials) {
+		credentials = entry->credentials;
+		__atomic_add_fetch(&credentials->refcount, 1, __ATOMIC_RELAXED);
+	}
+	mutex_unlock(&ssl_cache_mutex);
+	if (credentials) {
+		return credentials;
+	}
+
+	/* the pair record is read without holding the lock */
+	credentials = internal_ssl_credentials_new(udid);
+	if (!credentials) {
+		return NULL;
+	}
+
+	mutex_lock(&ssl_cache_mutex);
+	entry = internal_ssl_cache_find(udid);
+	if (entry && entry->credentials) {
+		/* another thread was faster */
+		internal_ssl_credentials_release(credentials);
+		credentials = entry->credentials;
+	} else {
+		if (!entry) {
+			entry = (struct ssl_cache_entry*)calloc(1, sizeof(struct ssl_cache_entry));
+			entry->udid = strdup(udid);
+			entry->next = ssl_cache;
+			ssl_cache = entry;
+		}
+		entry->credentials = credentials;
+	}
+	__atomic_add_fetch(&credentials->refcount, 1, __ATOMIC_RELAXED);
+	mutex_unlock(&ssl_cache_mutex);
+
+	return credentials;
+}
 #endif
+
+#ifdef HAVE_OPENSSL
+/**
+ * Creates an SSL context with the root certificate and key from the pair
+ * record of a device loaded.
+ */
+static SSL_CTX *internal_ssl_ctx_new(const char *udid)
+{
 	plist_t pair_record = NULL;
 
-	userpref_read_pair_record(connection->udid, &pair_record);
+	userpref_read_pair_record(udid, &pair_record);
 	if (!pair_record) {
-		debug_info("ERROR: Failed enabling SSL. Unable to read pair record for udid %s.", connection->udid);
-		return ret;
+		debug_info("ERROR: Failed enabling SSL. Unable to read pair record for udid %s.", udid);
+		return NULL;
 	}
 
-#ifdef HAVE_OPENSSL
 	key_data_t root_cert = { NULL, 0 };
 	key_data_t root_privkey = { NULL, 0 };
 
 	pair_record_import_crt_with_name(pair_record, USERPREF_ROOT_CERTIFICATE_KEY, &root_cert);
 	pair_record_import_key_with_name(pair_record, USERPREF_ROOT_PRIVATE_KEY_KEY, &root_privkey);
 
-	if (pair_record)
-		plist_free(pair_record);
-
-	BIO *ssl_bio = BIO_new(BIO_s_socket());
-	if (!ssl_bio) {
-		debug_info("ERROR: Could not create SSL bio.");
-		return ret;
-	}
-	BIO_set_fd(ssl_bio, (int)(long)connection->data, BIO_NOCLOSE);
+	plist_free(pair_record);
 
 	SSL_CTX *ssl_ctx = SSL_CTX_new(TLSv1_method());
 	if (ssl_ctx == NULL) {
 		debug_info("ERROR: Could not create SSL context.");
-		BIO_free(ssl_bio);
-		return ret;
+		free(root_cert.data);
+		free(root_privkey.data);
+		return NULL;
 	}
 
 	BIO* membp;
@@ -756,11 +1441,94 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_enable_ssl(idevice_conne
 	RSA_free(rootPrivKey);
 	free(root_privkey.data);
 
-	SSL *ssl = SSL_new(ssl_ctx);
+	return ssl_ctx;
+}
+
+/**
+ * Creates an SSL object for a connection to a device, using the cached SSL
+ * context of the device and its last session if available.
+ */
+static SSL *internal_ssl_new(const char *udid)
+{
+	SSL *ssl = NULL;
+	struct ssl_cache_entry *entry;
+
+	mutex_lock(&ssl_cache_mutex);
+	entry = internal_ssl_cache_find(udid);
+	if (entry) {
+		ssl = SSL_new(entry->ctx);
+		if (ssl && entry->session) {
+			SSL_set_session(ssl, entry->session);
+		}
+	}
+	mutex_unlock(&ssl_cache_mutex);
+	if (entry) {
+		return ssl;
+	}
+
+	/* the credentials are loaded without holding the lock */
+	SSL_CTX *ssl_ctx = internal_ssl_ctx_new(udid);
+	if (!ssl_ctx) {
+		return NULL;
+	}
+
+	mutex_lock(&ssl_cache_mutex);
+	entry = internal_ssl_cache_find(udid);
+	if (entry) {
+		/* another thread was faster */
+		SSL_CTX_free(ssl_ctx);
+	} else {
+		entry = (struct ssl_cache_entry*)calloc(1, sizeof(struct ssl_cache_entry));
+		entry->udid = strdup(udid);
+		entry->ctx = ssl_ctx;
+		entry->next = ssl_cache;
+		ssl_cache = entry;
+	}
+	ssl = SSL_new(entry->ctx);
+	mutex_unlock(&ssl_cache_mutex);
+
+	return ssl;
+}
+#endif
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection)
+{
+	if (!connection || connection->ssl_data)
+		return IDEVICE_E_INVALID_ARG;
+
+	if (connection->recv_end > connection->recv_start) {
+		debug_info("WARNING: %d bytes of buffered data precede the SSL handshake", connection->recv_end - connection->recv_start);
+	}
+
+	trace_log(TRACE_CATEGORY_SSL, TRACE_EVENT_SSL_HANDSHAKE_BEGIN, 0, 0, 0, connection->udid);
+	memset(&connection->tls_out, '\0', sizeof(struct tls_record_counter));
+	memset(&connection->tls_in, '\0', sizeof(struct tls_record_counter));
+	uint64_t handshake_start = time_monotonic_usec();
+
+	idevice_error_t ret = IDEVICE_E_SSL_ERROR;
+#ifdef HAVE_OPENSSL
+	uint32_t return_me = 0;
+#else
+	int return_me = 0;
+#endif
+#ifdef HAVE_OPENSSL
+	BIO *ssl_bio = BIO_new(BIO_s_socket());
+	if (!ssl_bio) {
+		debug_info("ERROR: Could not create SSL bio.");
+		return ret;
+	}
+	BIO_set_fd(ssl_bio, (int)(long)connection->data, BIO_NOCLOSE);
+	BIO_set_callback_arg(ssl_bio, (char*)connection);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	BIO_set_callback_ex(ssl_bio, internal_bio_callback);
+#else
+	BIO_set_callback(ssl_bio, internal_bio_callback);
+#endif
+
+	SSL *ssl = internal_ssl_new(connection->udid);
 	if (!ssl) {
 		debug_info("ERROR: Could not create SSL object");
 		BIO_free(ssl_bio);
-		SSL_CTX_free(ssl_ctx);
 		return ret;
 	}
 	SSL_set_connect_state(ssl);
@@ -771,46 +1539,57 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_enable_ssl(idevice_conne
 	if (return_me != 1) {
 		debug_info("ERROR in SSL_do_handshake: %s", ssl_error_to_string(SSL_get_error(ssl, return_me)));
 		SSL_free(ssl);
-		SSL_CTX_free(ssl_ctx);
+		/* reload the credentials and start without a session next time */
+		idevice_ssl_cache_invalidate(connection->udid);
+		userpref_pair_record_cache_invalidate(connection->udid);
+		trace_log(TRACE_CATEGORY_SSL, TRACE_EVENT_SSL_HANDSHAKE_END, ret, 0, 0, connection->udid);
 	} else {
 		ssl_data_t ssl_data_loc = (ssl_data_t)malloc(sizeof(struct ssl_data_private));
 		ssl_data_loc->session = ssl;
-		ssl_data_loc->ctx = ssl_ctx;
+		/* the context is owned by the cache, the session holds a reference */
+		ssl_data_loc->ctx = NULL;
 		connection->ssl_data = ssl_data_loc;
+		connection->stats.handshake_usec = time_monotonic_usec() - handshake_start;
 		ret = IDEVICE_E_SUCCESS;
-		debug_info("SSL mode enabled, cipher: %s", SSL_get_cipher(ssl));
+		debug_info("SSL mode enabled, cipher: %s, session %s", SSL_get_cipher(ssl), SSL_session_reused(ssl) ? "resumed" : "new");
+		trace_log(TRACE_CATEGORY_SSL, TRACE_EVENT_SSL_HANDSHAKE_END, ret, SSL_session_reused(ssl) ? 1 : 0, 0, connection->udid);
+
+		mutex_lock(&ssl_cache_mutex);
+		struct ssl_cache_entry *entry = internal_ssl_cache_find(connection->udid);
+		if (entry && (entry->ctx == SSL_get_SSL_CTX(ssl))) {
+			if (entry->session)
+				SSL_SESSION_free(entry->session);
+			entry->session = SSL_get1_session(ssl);
+		}
+		mutex_unlock(&ssl_cache_mutex);
 	}
 	/* required for proper multi-thread clean up to prevent leaks */
 	openssl_remove_thread_state();
 #else
+	struct ssl_credentials *credentials = internal_ssl_credentials_get(connection->udid);
+	if (!credentials) {
+		return ret;
+	}
+
 	ssl_data_t ssl_data_loc = (ssl_data_t)malloc(sizeof(struct ssl_data_private));
+	/* the session holds a reference, the credentials are owned by the cache */
+	ssl_data_loc->credentials = credentials;
 
 	/* Set up GnuTLS... */
 	debug_info("enabling SSL mode");
 	errno = 0;
-	gnutls_certificate_allocate_credentials(&ssl_data_loc->certificate);
-#if GNUTLS_VERSION_NUMBER >= 0x020b07
-	gnutls_certificate_set_retrieve_function(ssl_data_loc->certificate, internal_cert_callback);
-#else
-	gnutls_certificate_client_set_retrieve_function(ssl_data_loc->certificate, internal_cert_callback);
-#endif
 	gnutls_init(&ssl_data_loc->session, GNUTLS_CLIENT);
 	gnutls_priority_set_direct(ssl_data_loc->session, "NONE:+VERS-TLS1.0:+ANON-DH:+RSA:+AES-128-CBC:+AES-256-CBC:+SHA1:+MD5:+COMP-NULL", NULL);
-	gnutls_credentials_set(ssl_data_loc->session, GNUTLS_CRD_CERTIFICATE, ssl_data_loc->certificate);
+	gnutls_credentials_set(ssl_data_loc->session, GNUTLS_CRD_CERTIFICATE, credentials->certificate);
 	gnutls_session_set_ptr(ssl_data_loc->session, ssl_data_loc);
 
-	gnutls_x509_crt_init(&ssl_data_loc->root_cert);
-	gnutls_x509_crt_init(&ssl_data_loc->host_cert);
-	gnutls_x509_privkey_init(&ssl_data_loc->root_privkey);
-	gnutls_x509_privkey_init(&ssl_data_loc->host_privkey);
-
-	pair_record_import_crt_with_name(pair_record, USERPREF_ROOT_CERTIFICATE_KEY, ssl_data_loc->root_cert);
-	pair_record_import_crt_with_name(pair_record, USERPREF_HOST_CERTIFICATE_KEY, ssl_data_loc->host_cert);
-	pair_record_import_key_with_name(pair_record, USERPREF_ROOT_PRIVATE_KEY_KEY, ssl_data_loc->root_privkey);
-	pair_record_import_key_with_name(pair_record, USERPREF_HOST_PRIVATE_KEY_KEY, ssl_data_loc->host_privkey);
-
-	if (pair_record)
-		plist_free(pair_record);
+	/* try to resume the last session with the device */
+	mutex_lock(&ssl_cache_mutex);
+	struct ssl_cache_entry *entry = internal_ssl_cache_find(connection->udid);
+	if (entry && entry->session.data) {
+		gnutls_session_set_data(ssl_data_loc->session, entry->session.data, entry->session.size);
+	}
+	mutex_unlock(&ssl_cache_mutex);
 
 	debug_info("GnuTLS step 1...");
 	gnutls_transport_set_ptr(ssl_data_loc->session, (gnutls_transport_ptr_t)connection);
@@ -834,10 +1613,31 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_enable_ssl(idevice_conne
 		free(ssl_data_loc);
 		debug_info("GnuTLS reported something wrong: %s", gnutls_strerror(return_me));
 		debug_info("oh.. errno says %s", strerror(errno));
+		idevice_ssl_cache_invalidate(connection->udid);
+		userpref_pair_record_cache_invalidate(connection->udid);
+		trace_log(TRACE_CATEGORY_SSL, TRACE_EVENT_SSL_HANDSHAKE_END, ret, 0, 0, connection->udid);
 	} else {
 		connection->ssl_data = ssl_data_loc;
+		connection->stats.handshake_usec = time_monotonic_usec() - handshake_start;
 		ret = IDEVICE_E_SUCCESS;
-		debug_info("SSL mode enabled");
+		debug_info("SSL mode enabled, session %s", gnutls_session_is_resumed(ssl_data_loc->session) ? "resumed" : "new");
+		trace_log(TRACE_CATEGORY_SSL, TRACE_EVENT_SSL_HANDSHAKE_END, ret, gnutls_session_is_resumed(ssl_data_loc->session) ? 1 : 0, 0, connection->udid);
+
+		gnutls_datum_t session_data = { NULL, 0 };
+		if (gnutls_session_get_data2(ssl_data_loc->session, &session_data) == GNUTLS_E_SUCCESS) {
+			mutex_lock(&ssl_cache_mutex);
+			entry = internal_ssl_cache_find(connection->udid);
+			if (!entry) {
+				entry = (struct ssl_cache_entry*)calloc(1, sizeof(struct ssl_cache_entry));
+				entry->udid = strdup(connection->udid);
+				entry->next = ssl_cache;
+				ssl_cache = entry;
+			}
+			if (entry->session.data)
+				gnutls_free(entry->session.data);
+			entry->session = session_data;
+			mutex_unlock(&ssl_cache_mutex);
+		}
 	}
 #endif
 	return ret;
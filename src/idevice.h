@@ -44,6 +44,8 @@
 #endif
 
 #include "common/userpref.h"
+#include "common/thread.h"
+#include "common/histogram.h"
 #include "libimobiledevice/libimobiledevice.h"
 
 enum connection_type {
@@ -55,21 +57,42 @@ struct ssl_data_private {
 	SSL *session;
 	SSL_CTX *ctx;
 #else
-	gnutls_certificate_credentials_t certificate;
+	/* shared with the other connections to the device, see idevice.c */
+	struct ssl_credentials *credentials;
 	gnutls_session_t session;
-	gnutls_x509_privkey_t root_privkey;
-	gnutls_x509_crt_t root_cert;
-	gnutls_x509_privkey_t host_privkey;
-	gnutls_x509_crt_t host_cert;
 #endif
 };
 typedef struct ssl_data_private *ssl_data_t;
 
+/** Follows the record boundaries in one direction of a TLS stream. */
+struct tls_record_counter {
+	uint32_t remaining;     /* bytes left of the current record */
+	uint32_t header_len;    /* bytes of the next record header seen so far */
+	unsigned char header[5];
+};
+
+/** The service a port was started for, see idevice_set_service_name(). */
+struct idevice_service_name {
+	uint16_t port;
+	char *name;
+	struct idevice_service_name *next;
+};
+
 struct idevice_connection_private {
 	char *udid;
 	enum connection_type type;
 	void *data;
 	ssl_data_t ssl_data;
+	char *recv_buffer;
+	uint32_t recv_buffer_size;
+	uint32_t recv_start;
+	uint32_t recv_end;
+	char *label;
+	idevice_connection_stats_t stats;
+	struct histogram request_latency;
+	struct tls_record_counter tls_out;
+	struct tls_record_counter tls_in;
+	uint64_t request_start;
 };
 
 struct idevice_private {
@@ -77,6 +100,20 @@ struct idevice_private {
 	enum connection_type conn_type;
 	void *conn_data;
 	int version;
+	/* pooled lockdownd session shared by service_client_factory_start_service */
+	struct lockdownd_client_private *lockdown_session;
+	mutex_t lockdown_session_mutex;
+	/* names of started services by port, used to label their connections */
+	struct idevice_service_name *service_names;
+	mutex_t service_names_mutex;
 };
 
+void idevice_ssl_cache_invalidate(const char *udid);
+
+void idevice_connection_set_label(idevice_connection_t connection, const char *label);
+void idevice_set_service_name(idevice_t device, uint16_t port, const char *name);
+void idevice_connection_request_begin(idevice_connection_t connection);
+void idevice_connection_request_end(idevice_connection_t connection);
+uint32_t idevice_connection_get_buffered(idevice_connection_t connection);
+
 #endif
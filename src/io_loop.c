@@ -0,0 +1,637 @@
+/*
+ * io_loop.c
+ * Event loop driving many device connections from a single thread.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#endif
+
+#include "idevice.h"
+#include "common/debug.h"
+#include "endianness.h"
+
+/* size of a single read from a connection */
+#define IO_LOOP_READ_SIZE 65536
+/* largest frame accepted before a connection is considered broken */
+#define IO_LOOP_MAX_FRAME_SIZE (64 * 1024 * 1024)
+/* maximum number of events handled per epoll_wait() call */
+#define IO_LOOP_MAX_EVENTS 64
+
+/** A connection registered with an I/O loop. */
+struct io_loop_entry {
+	idevice_connection_t connection;
+	int fd;
+	int fd_flags;
+	idevice_io_frame_t framing;
+	idevice_io_frame_cb_t callback;
+	void *user_data;
+	char *rbuf;
+	uint32_t rlen;
+	uint32_t rcap;
+	char *wbuf;
+	uint32_t wlen;
+	uint32_t woff;
+	uint32_t wcap;
+	int read_wants_write;
+	int write_wants_read;
+	int watching_out;
+	int removed;
+	struct io_loop_entry *next;
+};
+
+struct idevice_io_loop_private {
+#ifdef HAVE_SYS_EPOLL_H
+	int epfd;
+#endif
+	struct io_loop_entry *entries;
+	int dispatching;
+};
+
+#ifndef WIN32
+
+static struct io_loop_entry *io_loop_find(idevice_io_loop_t loop, idevice_connection_t connection)
+{
+	struct io_loop_entry *entry;
+	for (entry = loop->entries; entry; entry = entry->next) {
+		if ((entry->connection == connection) && !entry->removed)
+			return entry;
+	}
+	return NULL;
+}
+
+/**
+ * Updates the events the loop waits for on a connection.
+ */
+static void io_loop_update_events(idevice_io_loop_t loop, struct io_loop_entry *entry)
+{
+	int want_out = (entry->woff < entry->wlen) || entry->read_wants_write;
+	if (want_out == entry->watching_out)
+		return;
+	entry->watching_out = want_out;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	memset(&ev, '\0', sizeof(ev));
+	ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+	ev.data.ptr = entry;
+	epoll_ctl(loop->epfd, EPOLL_CTL_MOD, entry->fd, &ev);
+#endif
+}
+
+/**
+ * Stops watching a connection and hands it back in blocking mode. This is
+ * done right away, while the caller still owns an open fd; the entry itself
+ * is only freed by io_loop_sweep() once no dispatch can refer to it.
+ */
+static void io_loop_detach(idevice_io_loop_t loop, struct io_loop_entry *entry)
+{
+	if (entry->removed)
+		return;
+	entry->removed = 1;
+#ifdef HAVE_SYS_EPOLL_H
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+#endif
+	fcntl(entry->fd, F_SETFL, entry->fd_flags);
+}
+
+static void io_loop_entry_free(idevice_io_loop_t loop, struct io_loop_entry *entry)
+{
+	io_loop_detach(loop, entry);
+	free(entry->rbuf);
+	free(entry->wbuf);
+	free(entry);
+}
+
+/**
+ * Frees the entries that were removed while dispatching.
+ */
+static void io_loop_sweep(idevice_io_loop_t loop)
+{
+	struct io_loop_entry **prev = &loop->entries;
+	while (*prev) {
+		struct io_loop_entry *entry = *prev;
+		if (entry->removed) {
+			*prev = entry->next;
+			io_loop_entry_free(loop, entry);
+		} else {
+			prev = &entry->next;
+		}
+	}
+}
+
+/**
+ * Reports a closed or broken connection and removes it from the loop.
+ */
+static void io_loop_close(idevice_io_loop_t loop, struct io_loop_entry *entry)
+{
+	if (entry->removed)
+		return;
+	/* the callback owns the connection again and may disconnect it */
+	io_loop_detach(loop, entry);
+	entry->callback(entry->connection, NULL, 0, entry->user_data);
+}
+
+/**
+ * Appends received data to the read buffer of a connection.
+ */
+static int io_loop_append(struct io_loop_entry *entry, const char *data, uint32_t length)
+{
+	if (entry->rlen + length > entry->rcap) {
+		uint32_t cap = entry->rcap ? entry->rcap : IO_LOOP_READ_SIZE;
+		while (cap < entry->rlen + length)
+			cap *= 2;
+		if (cap > IO_LOOP_MAX_FRAME_SIZE + IO_LOOP_READ_SIZE)
+			return -1;
+		char *rbuf = (char*)realloc(entry->rbuf, cap);
+		if (!rbuf)
+			return -1;
+		entry->rbuf = rbuf;
+		entry->rcap = cap;
+	}
+	memcpy(entry->rbuf + entry->rlen, data, length);
+	entry->rlen += length;
+	return 0;
+}
+
+/**
+ * Passes all complete frames in the read buffer to the callback.
+ *
+ * @return 0 on success or -1 if the stream can not be framed.
+ */
+static int io_loop_dispatch_frames(struct io_loop_entry *entry)
+{
+	uint32_t pos = 0;
+	uint32_t frame_len = 0;
+	uint32_t skip = 0;
+
+	while (!entry->removed && (pos < entry->rlen)) {
+		const char *p = entry->rbuf + pos;
+		uint32_t avail = entry->rlen - pos;
+
+		if (entry->framing == IDEVICE_IO_FRAME_RAW) {
+			frame_len = avail;
+			skip = 0;
+		} else if (entry->framing == IDEVICE_IO_FRAME_BE32_LENGTH) {
+			uint32_t nlen;
+			if (avail < sizeof(nlen))
+				break;
+			memcpy(&nlen, p, sizeof(nlen));
+			frame_len = be32toh(nlen);
+			skip = sizeof(nlen);
+			if (frame_len > IO_LOOP_MAX_FRAME_SIZE)
+				return -1;
+			if (avail - skip < frame_len)
+				break;
+		} else if (entry->framing == IDEVICE_IO_FRAME_AFC) {
+			uint64_t entire_len;
+			/* AFC packet header: 8 byte magic followed by the entire length */
+			if (avail < 40)
+				break;
+			memcpy(&entire_len, p + 8, sizeof(entire_len));
+			entire_len = le64toh(entire_len);
+			if ((entire_len < 40) || (entire_len > IO_LOOP_MAX_FRAME_SIZE))
+				return -1;
+			frame_len = (uint32_t)entire_len;
+			skip = 0;
+			if (avail < frame_len)
+				break;
+		} else {
+			/* newline terminated lines */
+			const char *nl = memchr(p, '\n', avail);
+			if (!nl)
+				break;
+			frame_len = nl - p;
+			skip = 0;
+			entry->callback(entry->connection, p, frame_len, entry->user_data);
+			pos += frame_len + 1;
+			continue;
+		}
+
+		entry->callback(entry->connection, p + skip, frame_len, entry->user_data);
+		pos += skip + frame_len;
+	}
+
+	if (pos > 0) {
+		memmove(entry->rbuf, entry->rbuf + pos, entry->rlen - pos);
+		entry->rlen -= pos;
+	}
+	if ((entry->framing == IDEVICE_IO_FRAME_LINE) && (entry->rlen > IO_LOOP_MAX_FRAME_SIZE))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Reads everything that is available on a connection without blocking.
+ *
+ * @return 1 if data was read, 0 if nothing was available, -1 if the
+ *     connection was closed or broke.
+ */
+static int io_loop_read(struct io_loop_entry *entry)
+{
+	char buf[IO_LOOP_READ_SIZE];
+	int got_data = 0;
+
+	entry->read_wants_write = 0;
+
+	while (1) {
+		int n;
+		if (entry->connection->ssl_data) {
+#ifdef HAVE_OPENSSL
+			n = SSL_read(entry->connection->ssl_data->session, buf, sizeof(buf));
+			if (n <= 0) {
+				int err = SSL_get_error(entry->connection->ssl_data->session, n);
+				if (err == SSL_ERROR_WANT_READ)
+					break;
+				if (err == SSL_ERROR_WANT_WRITE) {
+					entry->read_wants_write = 1;
+					break;
+				}
+				return -1;
+			}
+#else
+			/* rejected by idevice_io_loop_add() */
+			return -1;
+#endif
+		} else {
+			entry->connection->stats.syscalls++;
+			n = recv(entry->fd, buf, sizeof(buf), 0);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				return -1;
+			}
+			if (n == 0)
+				return -1;
+		}
+		if (io_loop_append(entry, buf, n) < 0)
+			return -1;
+		got_data = 1;
+	}
+
+	return got_data;
+}
+
+/**
+ * Writes as much of the pending data of a connection as possible without
+ * blocking.
+ *
+ * @return 0 on success or -1 if the connection broke.
+ */
+static int io_loop_flush(struct io_loop_entry *entry)
+{
+	entry->write_wants_read = 0;
+
+	while (entry->woff < entry->wlen) {
+		int n;
+		if (entry->connection->ssl_data) {
+#ifdef HAVE_OPENSSL
+			n = SSL_write(entry->connection->ssl_data->session, entry->wbuf + entry->woff, entry->wlen - entry->woff);
+			if (n <= 0) {
+				int err = SSL_get_error(entry->connection->ssl_data->session, n);
+				if (err == SSL_ERROR_WANT_WRITE)
+					break;
+				if (err == SSL_ERROR_WANT_READ) {
+					entry->write_wants_read = 1;
+					break;
+				}
+				return -1;
+			}
+#else
+			/* rejected by idevice_io_loop_add() */
+			return -1;
+#endif
+		} else {
+			entry->connection->stats.syscalls++;
+			n = send(entry->fd, entry->wbuf + entry->woff, entry->wlen - entry->woff, 0);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				return -1;
+			}
+		}
+		entry->woff += n;
+	}
+
+	if (entry->woff == entry->wlen) {
+		entry->woff = 0;
+		entry->wlen = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * Handles the readiness of a connection.
+ */
+static void io_loop_handle(idevice_io_loop_t loop, struct io_loop_entry *entry, int readable, int writable, int hangup)
+{
+	if (entry->removed)
+		return;
+
+	if (writable && (entry->woff < entry->wlen)) {
+		if (io_loop_flush(entry) < 0) {
+			io_loop_close(loop, entry);
+			return;
+		}
+	}
+	if (readable && entry->write_wants_read) {
+		if (io_loop_flush(entry) < 0) {
+			io_loop_close(loop, entry);
+			return;
+		}
+	}
+	if (readable || hangup || (writable && entry->read_wants_write)) {
+		int res = io_loop_read(entry);
+		if ((res != 0) && (io_loop_dispatch_frames(entry) < 0)) {
+			res = -1;
+		}
+		if (res < 0) {
+			io_loop_close(loop, entry);
+			return;
+		}
+	}
+	io_loop_update_events(loop, entry);
+}
+
+#endif
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_io_loop_new(idevice_io_loop_t *loop)
+{
+#ifdef WIN32
+	return IDEVICE_E_UNKNOWN_ERROR;
+#else
+	if (!loop)
+		return IDEVICE_E_INVALID_ARG;
+
+	idevice_io_loop_t loop_loc = (idevice_io_loop_t)calloc(1, sizeof(struct idevice_io_loop_private));
+	if (!loop_loc)
+		return IDEVICE_E_UNKNOWN_ERROR;
+
+#ifdef HAVE_SYS_EPOLL_H
+	loop_loc->epfd = epoll_create(IO_LOOP_MAX_EVENTS);
+	if (loop_loc->epfd < 0) {
+		debug_info("ERROR: epoll_create failed: %s", strerror(errno));
+		free(loop_loc);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+#endif
+
+	*loop = loop_loc;
+	return IDEVICE_E_SUCCESS;
+#endif
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_io_loop_free(idevice_io_loop_t loop)
+{
+	if (!loop)
+		return IDEVICE_E_INVALID_ARG;
+
+#ifndef WIN32
+	while (loop->entries) {
+		struct io_loop_entry *next = loop->entries->next;
+		io_loop_entry_free(loop, loop->entries);
+		loop->entries = next;
+	}
+#ifdef HAVE_SYS_EPOLL_H
+	close(loop->epfd);
+#endif
+#endif
+	free(loop);
+
+	return IDEVICE_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_io_loop_add(idevice_io_loop_t loop, idevice_connection_t connection, idevice_io_frame_t framing, idevice_io_frame_cb_t callback, void *user_data)
+{
+#ifdef WIN32
+	return IDEVICE_E_UNKNOWN_ERROR;
+#else
+	int fd = -1;
+
+	if (!loop || !connection || !callback)
+		return IDEVICE_E_INVALID_ARG;
+
+	if (io_loop_find(loop, connection))
+		return IDEVICE_E_INVALID_ARG;
+
+	if (idevice_connection_get_fd(connection, &fd) != IDEVICE_E_SUCCESS)
+		return IDEVICE_E_UNKNOWN_ERROR;
+
+#ifndef HAVE_OPENSSL
+	if (connection->ssl_data) {
+		/* the GnuTLS transport functions can not be driven nonblocking */
+		debug_info("ERROR: SSL connections are only supported with OpenSSL");
+		return IDEVICE_E_SSL_ERROR;
+	}
+#endif
+
+	struct io_loop_entry *entry = (struct io_loop_entry*)calloc(1, sizeof(struct io_loop_entry));
+	if (!entry)
+		return IDEVICE_E_UNKNOWN_ERROR;
+	entry->connection = connection;
+	entry->fd = fd;
+	entry->framing = framing;
+	entry->callback = callback;
+	entry->user_data = user_data;
+
+	/* take over data the connection already buffered */
+	if (connection->recv_end > connection->recv_start) {
+		io_loop_append(entry, connection->recv_buffer + connection->recv_start, connection->recv_end - connection->recv_start);
+		connection->recv_start = connection->recv_end = 0;
+	}
+
+	entry->fd_flags = fcntl(fd, F_GETFL, 0);
+	if ((entry->fd_flags < 0) || (fcntl(fd, F_SETFL, entry->fd_flags | O_NONBLOCK) < 0)) {
+		debug_info("ERROR: could not make connection nonblocking: %s", strerror(errno));
+		free(entry->rbuf);
+		free(entry);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	memset(&ev, '\0', sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		debug_info("ERROR: epoll_ctl failed: %s", strerror(errno));
+		fcntl(fd, F_SETFL, entry->fd_flags);
+		free(entry->rbuf);
+		free(entry);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+#endif
+
+	entry->next = loop->entries;
+	loop->entries = entry;
+
+	return IDEVICE_E_SUCCESS;
+#endif
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_io_loop_remove(idevice_io_loop_t loop, idevice_connection_t connection)
+{
+#ifdef WIN32
+	return IDEVICE_E_UNKNOWN_ERROR;
+#else
+	if (!loop || !connection)
+		return IDEVICE_E_INVALID_ARG;
+
+	struct io_loop_entry *entry = io_loop_find(loop, connection);
+	if (!entry)
+		return IDEVICE_E_INVALID_ARG;
+
+	io_loop_detach(loop, entry);
+	if (!loop->dispatching)
+		io_loop_sweep(loop);
+
+	return IDEVICE_E_SUCCESS;
+#endif
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_io_loop_send(idevice_io_loop_t loop, idevice_connection_t connection, const char *data, uint32_t len)
+{
+#ifdef WIN32
+	return IDEVICE_E_UNKNOWN_ERROR;
+#else
+	if (!loop || !connection || !data)
+		return IDEVICE_E_INVALID_ARG;
+
+	struct io_loop_entry *entry = io_loop_find(loop, connection);
+	if (!entry)
+		return IDEVICE_E_INVALID_ARG;
+
+	if (entry->wlen + len > entry->wcap) {
+		uint32_t cap = entry->wcap ? entry->wcap : IO_LOOP_READ_SIZE;
+		while (cap < entry->wlen + len)
+			cap *= 2;
+		char *wbuf = (char*)realloc(entry->wbuf, cap);
+		if (!wbuf)
+			return IDEVICE_E_UNKNOWN_ERROR;
+		entry->wbuf = wbuf;
+		entry->wcap = cap;
+	}
+	memcpy(entry->wbuf + entry->wlen, data, len);
+	entry->wlen += len;
+
+	/* try to send right away, the rest is sent when the socket is writable */
+	if (io_loop_flush(entry) < 0) {
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	io_loop_update_events(loop, entry);
+
+	return IDEVICE_E_SUCCESS;
+#endif
+}
+
+LIBIMOBILEDEVICE_API int idevice_io_loop_run_once(idevice_io_loop_t loop, int timeout)
+{
+#ifdef WIN32
+	return -1;
+#else
+	struct io_loop_entry *entry;
+	int count = 0;
+	int i;
+
+	if (!loop)
+		return -1;
+
+	loop->dispatching = 1;
+
+	/* data that was taken over on registration is dispatched first */
+	for (entry = loop->entries; entry; entry = entry->next) {
+		if (!entry->removed && (entry->rlen > 0)) {
+			if (io_loop_dispatch_frames(entry) < 0)
+				io_loop_close(loop, entry);
+		}
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event events[IO_LOOP_MAX_EVENTS];
+	count = epoll_wait(loop->epfd, events, IO_LOOP_MAX_EVENTS, timeout);
+	if (count < 0) {
+		int res = (errno == EINTR) ? 0 : -1;
+		loop->dispatching = 0;
+		io_loop_sweep(loop);
+		return res;
+	}
+	for (i = 0; i < count; i++) {
+		entry = (struct io_loop_entry*)events[i].data.ptr;
+		io_loop_handle(loop, entry, events[i].events & EPOLLIN, events[i].events & EPOLLOUT, events[i].events & (EPOLLHUP | EPOLLERR));
+	}
+#else
+	struct pollfd *fds = NULL;
+	struct io_loop_entry **polled = NULL;
+	int nfds = 0;
+
+	for (entry = loop->entries; entry; entry = entry->next)
+		nfds++;
+	fds = (struct pollfd*)calloc(nfds ? nfds : 1, sizeof(struct pollfd));
+	polled = (struct io_loop_entry**)calloc(nfds ? nfds : 1, sizeof(struct io_loop_entry*));
+	nfds = 0;
+	for (entry = loop->entries; entry; entry = entry->next) {
+		if (entry->removed)
+			continue;
+		fds[nfds].fd = entry->fd;
+		fds[nfds].events = POLLIN | (entry->watching_out ? POLLOUT : 0);
+		polled[nfds] = entry;
+		nfds++;
+	}
+	count = poll(fds, nfds, timeout);
+	if (count < 0) {
+		int res = (errno == EINTR) ? 0 : -1;
+		free(fds);
+		free(polled);
+		loop->dispatching = 0;
+		io_loop_sweep(loop);
+		return res;
+	}
+	for (i = 0; i < nfds; i++) {
+		if (fds[i].revents) {
+			io_loop_handle(loop, polled[i], fds[i].revents & POLLIN, fds[i].revents & POLLOUT, fds[i].revents & (POLLHUP | POLLERR));
+		}
+	}
+	free(fds);
+	free(polled);
+#endif
+
+	loop->dispatching = 0;
+	io_loop_sweep(loop);
+
+	return count;
+#endif
+}
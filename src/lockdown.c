@@ -48,8 +48,11 @@
 #include "lockdown.h"
 #include "idevice.h"
 #include "common/debug.h"
+#include "common/trace.h"
+#include "common/histogram.h"
 #include "common/userpref.h"
 #include "common/utils.h"
+#include "common/thread.h"
 #include "asprintf.h"
 
 #ifdef WIN32
@@ -342,6 +345,7 @@ static lockdownd_error_t lockdownd_client_free_simple(lockdownd_client_t client)
 	if (client->label) {
 		free(client->label);
 	}
+	free(client->pending_request);
 
 	free(client);
 	client = NULL;
@@ -375,12 +379,115 @@ LIBIMOBILEDEVICE_API void lockdownd_client_set_label(lockdownd_client_t client,
 	}
 }
 
+/**
+ * Latency histogram of one kind of lockdownd request.
+ */
+struct lockdownd_latency_entry {
+	char *request;
+	struct histogram hist;
+	struct lockdownd_latency_entry *next;
+};
+
+static struct lockdownd_latency_entry *latency_stats = NULL;
+static mutex_t latency_mutex;
+static thread_once_t latency_once = THREAD_ONCE_INIT;
+
+static void lockdownd_latency_init(void)
+{
+	mutex_init(&latency_mutex);
+}
+
+/**
+ * Adds the round-trip time of a request to the histogram of its name.
+ */
+static void lockdownd_latency_record(const char *request, uint64_t usec)
+{
+	struct lockdownd_latency_entry *entry;
+
+	thread_once(&latency_once, lockdownd_latency_init);
+
+	mutex_lock(&latency_mutex);
+	for (entry = latency_stats; entry; entry = entry->next) {
+		if (!strcmp(entry->request, request))
+			break;
+	}
+	if (!entry) {
+		entry = (struct lockdownd_latency_entry*)malloc(sizeof(struct lockdownd_latency_entry));
+		if (entry) {
+			entry->request = strdup(request);
+			histogram_reset(&entry->hist);
+			entry->next = latency_stats;
+			latency_stats = entry;
+		}
+	}
+	if (entry) {
+		histogram_record(&entry->hist, usec);
+	}
+	mutex_unlock(&latency_mutex);
+}
+
+/**
+ * Builds the name a lockdownd message is accounted under: the value of its
+ * Request key, followed by the service name for StartService.
+ *
+ * @return The name, or NULL if the message has no Request key. The caller
+ *     has to free the returned string.
+ */
+static char *lockdownd_request_name(plist_t dict)
+{
+	char *request = NULL;
+	char *service = NULL;
+	char *name = NULL;
+	char *p;
+
+	plist_t node = (dict) ? plist_dict_get_item(dict, "Request") : NULL;
+	if (!node || (plist_get_node_type(node) != PLIST_STRING)) {
+		return NULL;
+	}
+	plist_get_string_val(node, &request);
+	if (!request) {
+		return NULL;
+	}
+
+	node = plist_dict_get_item(dict, "Service");
+	if (!strcmp(request, "StartService") && node && (plist_get_node_type(node) == PLIST_STRING)) {
+		plist_get_string_val(node, &service);
+	}
+	if (service) {
+		name = string_concat(request, "/", service, NULL);
+		free(request);
+		free(service);
+	} else {
+		name = request;
+	}
+
+	/* keep the name safe to embed in JSON */
+	for (p = name; p && *p; p++) {
+		if ((*p == '"') || (*p == '\\') || ((unsigned char)*p < 0x20))
+			*p = '_';
+	}
+	return name;
+}
+
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_receive(lockdownd_client_t client, plist_t *plist)
 {
 	if (!client || !plist || (plist && *plist))
 		return LOCKDOWN_E_INVALID_ARG;
 
-	return lockdownd_error(property_list_service_receive_plist(client->parent, plist));
+	lockdownd_error_t ret = lockdownd_error(property_list_service_receive_plist(client->parent, plist));
+	if (client->pending_request) {
+		if (ret == LOCKDOWN_E_SUCCESS) {
+			lockdownd_latency_record(client->pending_request, time_monotonic_usec() - client->request_start);
+		}
+		free(client->pending_request);
+		client->pending_request = NULL;
+	}
+	if (trace_enabled(TRACE_CATEGORY_LOCKDOWN)) {
+		char *request = lockdownd_request_name(*plist);
+		trace_write(TRACE_CATEGORY_LOCKDOWN, TRACE_EVENT_LOCKDOWN_RESPONSE, ret, 0, 0, request);
+		free(request);
+	}
+	return ret;
 }
 
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_send(lockdownd_client_t client, plist_t plist)
@@ -388,7 +495,67 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_send(lockdownd_client_t client,
 	if (!client || !plist)
 		return LOCKDOWN_E_INVALID_ARG;
 
-	return lockdownd_error(property_list_service_send_xml_plist(client->parent, plist));
+	lockdownd_error_t ret = lockdownd_error(property_list_service_send_xml_plist(client->parent, plist));
+	char *request = lockdownd_request_name(plist);
+	trace_log(TRACE_CATEGORY_LOCKDOWN, TRACE_EVENT_LOCKDOWN_REQUEST, ret, 0, 0, request);
+
+	/* time the round trip until lockdownd_receive gets the response */
+	free(client->pending_request);
+	client->pending_request = NULL;
+	if ((ret == LOCKDOWN_E_SUCCESS) && request) {
+		client->pending_request = request;
+		client->request_start = time_monotonic_usec();
+	} else {
+		free(request);
+	}
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_latency_stats(char **json)
+{
+	struct lockdownd_latency_entry *entry;
+	char *result;
+
+	if (!json)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	thread_once(&latency_once, lockdownd_latency_init);
+
+	result = strdup("{\"unit\": \"us\", \"requests\": {");
+	mutex_lock(&latency_mutex);
+	for (entry = latency_stats; entry && result; entry = entry->next) {
+		char *hist = histogram_to_json(&entry->hist);
+		char *tmp = string_concat(result, (entry == latency_stats) ? "\"" : ", \"", entry->request, "\": ", hist ? hist : "{}", NULL);
+		free(hist);
+		free(result);
+		result = tmp;
+	}
+	mutex_unlock(&latency_mutex);
+	if (result) {
+		char *tmp = string_concat(result, "}}", NULL);
+		free(result);
+		result = tmp;
+	}
+	if (!result)
+		return LOCKDOWN_E_UNKNOWN_ERROR;
+
+	*json = result;
+	return LOCKDOWN_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_reset_latency_stats(void)
+{
+	struct lockdownd_latency_entry *entry;
+
+	thread_once(&latency_once, lockdownd_latency_init);
+
+	mutex_lock(&latency_mutex);
+	for (entry = latency_stats; entry; entry = entry->next) {
+		histogram_reset(&entry->hist);
+	}
+	mutex_unlock(&latency_mutex);
+
+	return LOCKDOWN_E_SUCCESS;
 }
 
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_query_type(lockdownd_client_t client, char **type)
@@ -663,6 +830,7 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new(idevice_t device, lo
 		debug_info("could not connect to lockdownd (device %s)", device->udid);
 		return LOCKDOWN_E_MUX_ERROR;
 	}
+	idevice_connection_set_label(plistclient->parent->connection, "com.apple.mobile.lockdown");
 
 	lockdownd_client_t client_loc = (lockdownd_client_t) malloc(sizeof(struct lockdownd_client_private));
 	client_loc->parent = plistclient;
@@ -675,6 +843,8 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new(idevice_t device, lo
 	debug_info("device udid: %s", client_loc->udid);
 
 	client_loc->label = label ? strdup(label) : NULL;
+	client_loc->pending_request = NULL;
+	client_loc->request_start = 0;
 
 	*client = client_loc;
 
@@ -691,6 +861,9 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new_with_handshake(idevi
 	plist_t pair_record = NULL;
 	char *host_id = NULL;
 	char *type = NULL;
+	plist_t facts = NULL;
+	int have_facts = 0;
+	uint8_t validate_pair = 0;
 
 	ret = lockdownd_client_new(device, &client_loc, label);
 	if (LOCKDOWN_E_SUCCESS != ret) {
@@ -698,14 +871,41 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new_with_handshake(idevi
 		return ret;
 	}
 
-	/* perform handshake */
-	ret = lockdownd_query_type(client_loc, &type);
-	if (LOCKDOWN_E_SUCCESS != ret) {
-		debug_info("QueryType failed in the lockdownd client.");
-	} else if (strcmp("com.apple.mobile.lockdown", type)) {
-		debug_info("Warning QueryType request returned \"%s\".", type);
+	/* skip QueryType and GetValue if the device is known already */
+	if (userpref_read_device_facts(client_loc->udid, LOCKDOWN_DEVICE_FACTS_MAX_AGE, &facts) == USERPREF_E_SUCCESS) {
+		uint64_t version = 0;
+		plist_t node = plist_dict_get_item(facts, "ProductVersion");
+		if (node && (plist_get_node_type(node) == PLIST_UINT)) {
+			plist_get_uint_val(node, &version);
+		}
+		if (version != 0) {
+			debug_info("using cached device facts");
+			if (device->version == 0) {
+				device->version = (int)version;
+			}
+			node = plist_dict_get_item(facts, "ValidatePair");
+			if (node && (plist_get_node_type(node) == PLIST_BOOLEAN)) {
+				plist_get_bool_val(node, &validate_pair);
+				have_facts = 1;
+			}
+		}
+		plist_free(facts);
+		facts = NULL;
+	}
+
+	if (!have_facts) {
+		/* perform handshake */
+		ret = lockdownd_query_type(client_loc, &type);
+		if (LOCKDOWN_E_SUCCESS != ret) {
+			debug_info("QueryType failed in the lockdownd client.");
+		} else if (strcmp("com.apple.mobile.lockdown", type)) {
+			debug_info("Warning QueryType request returned \"%s\".", type);
+		} else {
+			/* only a regular lockdownd is worth remembering */
+			facts = plist_new_dict();
+		}
+		free(type);
 	}
-	free(type);
 
 	if (device->version == 0) {
 		plist_t p_version = NULL;
@@ -718,6 +918,12 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new_with_handshake(idevi
 			}
 			free(s_version);
 		}
+		plist_free(p_version);
+	}
+
+	if (!have_facts) {
+		/* for older devices, we need to validate pairing to receive trusted host status */
+		validate_pair = (device->version < 0x070000);
 	}
 
 	userpref_read_pair_record(client_loc->udid, &pair_record);
@@ -736,8 +942,7 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new_with_handshake(idevi
 	plist_free(pair_record);
 	pair_record = NULL;
 
-	if (device->version < 0x070000) {
-		/* for older devices, we need to validate pairing to receive trusted host status */
+	if (validate_pair) {
 		ret = lockdownd_validate_pair(client_loc, NULL);
 
 		/* if not paired yet, let's do it now */
@@ -767,6 +972,18 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_client_new_with_handshake(idevi
 
 	}
 
+	if (LOCKDOWN_E_SUCCESS == ret) {
+		if (facts && (device->version != 0)) {
+			plist_dict_set_item(facts, "ProductVersion", plist_new_uint(device->version));
+			plist_dict_set_item(facts, "ValidatePair", plist_new_bool(validate_pair));
+			userpref_save_device_facts(client_loc->udid, facts);
+		}
+	} else if (have_facts) {
+		/* do the full handshake next time */
+		userpref_delete_device_facts(client_loc->udid);
+	}
+	plist_free(facts);
+
 	if (LOCKDOWN_E_SUCCESS == ret) {
 		*client = client_loc;
 	} else {
@@ -1006,6 +1223,10 @@ static lockdownd_error_t lockdownd_do_pair(lockdownd_client_t client, lockdownd_
 		} else {
 			debug_info("external pairing mode");
 		}
+		if (strcmp("ValidatePair", verb)) {
+			/* cached SSL state was set up with the previous pair record */
+			idevice_ssl_cache_invalidate(client->udid);
+		}
 	} else {
 		debug_info("%s failure", verb);
 		plist_t error_node = NULL;
@@ -1379,6 +1600,76 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_start_service_with_escrow_bag(l
 	return lockdownd_do_start_service(client, identifier, 1, service);
 }
 
+/**
+ * Checks whether a StartService error means the session it was sent over
+ * is no longer usable, as opposed to the service request itself failing.
+ * Refusals like an unknown service or a locked device are reported by the
+ * device over an intact session and are not retried.
+ */
+static int lockdownd_session_error_is_fatal(lockdownd_error_t err)
+{
+	switch (err) {
+	case LOCKDOWN_E_MUX_ERROR:
+	case LOCKDOWN_E_SSL_ERROR:
+	case LOCKDOWN_E_RECEIVE_TIMEOUT:
+	case LOCKDOWN_E_NO_RUNNING_SESSION:
+	case LOCKDOWN_E_SESSION_INACTIVE:
+	case LOCKDOWN_E_INVALID_SESSION_ID:
+		return 1;
+	default:
+		break;
+	}
+	return 0;
+}
+
+lockdownd_error_t lockdownd_session_pool_start_service(idevice_t device, const char *label, const char *identifier, lockdownd_service_descriptor_t *service)
+{
+	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
+	int attempt;
+
+	if (!device || !identifier || !service)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	mutex_lock(&device->lockdown_session_mutex);
+	for (attempt = 0; attempt < 2; attempt++) {
+		lockdownd_client_t client = device->lockdown_session;
+		int reused = (client != NULL);
+
+		if (!client) {
+			ret = lockdownd_client_new_with_handshake(device, &client, label);
+			if (ret != LOCKDOWN_E_SUCCESS) {
+				debug_info("Could not create a lockdown client, error %d", ret);
+				break;
+			}
+			device->lockdown_session = client;
+		} else if (label && (!client->label || strcmp(client->label, label) != 0)) {
+			free(client->label);
+			client->label = strdup(label);
+		}
+
+		ret = lockdownd_start_service(client, identifier, service);
+		if (ret == LOCKDOWN_E_SUCCESS) {
+			/* idevice_connect() labels the connection to the port with it */
+			idevice_set_service_name(device, (*service)->port, identifier);
+			break;
+		}
+		if (!lockdownd_session_error_is_fatal(ret)) {
+			break;
+		}
+
+		/* the device closed or invalidated the session, drop it */
+		debug_info("Pooled lockdown session failed with error %d, discarding it", ret);
+		device->lockdown_session = NULL;
+		lockdownd_client_free(client);
+		if (!reused) {
+			break;
+		}
+	}
+	mutex_unlock(&device->lockdown_session_mutex);
+
+	return ret;
+}
+
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_activate(lockdownd_client_t client, plist_t activation_record)
 {
 	if (!client)
@@ -28,12 +28,24 @@
 
 #define LOCKDOWN_PROTOCOL_VERSION "2"
 
+/* maximum age of cached device facts in seconds */
+#define LOCKDOWN_DEVICE_FACTS_MAX_AGE (24 * 60 * 60)
+
 struct lockdownd_client_private {
 	property_list_service_client_t parent;
 	int ssl_enabled;
 	char *session_id;
 	char *udid;
 	char *label;
+	char *pending_request;
+	uint64_t request_start;
 };
 
+/**
+ * Starts a service over the pooled lockdownd session of a device, creating
+ * the session with a full handshake on first use. Requests are serialized
+ * on the device, and a session the device has dropped is replaced once.
+ */
+lockdownd_error_t lockdownd_session_pool_start_service(idevice_t device, const char *label, const char *identifier, lockdownd_service_descriptor_t *service);
+
 #endif
@@ -65,6 +65,9 @@ LIBIMOBILEDEVICE_API property_list_service_error_t property_list_service_client_
 		return service_to_property_list_service_error(rerr);
 	}
 
+	/* serve the small length prefix reads from a buffer instead of the socket */
+	idevice_connection_set_receive_buffer(parent->connection, SERVICE_RECEIVE_BUFFER_SIZE);
+
 	/* create client object */
 	property_list_service_client_t client_loc = (property_list_service_client_t)malloc(sizeof(struct property_list_service_client_private));
 	client_loc->parent = parent;
@@ -108,7 +111,8 @@ static property_list_service_error_t internal_plist_send(property_list_service_c
 	char *content = NULL;
 	uint32_t length = 0;
 	uint32_t nlen = 0;
-	int bytes = 0;
+	uint32_t bytes = 0;
+	idevice_iovec_t iov[2];
 
 	if (!client || (client && !client->parent) || !plist) {
 		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
@@ -126,20 +130,27 @@ static property_list_service_error_t internal_plist_send(property_list_service_c
 
 	nlen = htobe32(length);
 	debug_info("sending %d bytes", length);
-	service_send(client->parent, (const char*)&nlen, sizeof(nlen), (uint32_t*)&bytes);
-	if (bytes == sizeof(nlen)) {
-		service_send(client->parent, content, length, (uint32_t*)&bytes);
-		if (bytes > 0) {
-			debug_info("sent %d bytes", bytes);
-			debug_plist(plist);
-			if ((uint32_t)bytes == length) {
-				res = PROPERTY_LIST_SERVICE_E_SUCCESS;
-			} else {
-				debug_info("ERROR: Could not send all data (%d of %d)!", bytes, length);
-			}
+	/* send the length prefix and the plist with a single write */
+	iov[0].data = (const char*)&nlen;
+	iov[0].length = sizeof(nlen);
+	iov[1].data = content;
+	iov[1].length = length;
+	service_sendv(client->parent, iov, 2, &bytes);
+	if (bytes > sizeof(nlen)) {
+		bytes -= sizeof(nlen);
+		debug_info("sent %d bytes", bytes);
+		debug_plist(plist);
+		if (bytes == length) {
+			res = PROPERTY_LIST_SERVICE_E_SUCCESS;
+			/* time the round trip until the response is received */
+			idevice_connection_request_begin(client->parent->connection);
+		} else {
+			debug_info("ERROR: Could not send all data (%d of %d)!", bytes, length);
 		}
+	} else {
+		bytes = 0;
 	}
-	if (bytes <= 0) {
+	if (bytes == 0) {
 		debug_info("ERROR: sending to device failed.");
 		res = PROPERTY_LIST_SERVICE_E_MUX_ERROR;
 	}
@@ -239,6 +250,7 @@ static property_list_service_error_t internal_plist_receive_timeout(property_lis
 		}
 		if (*plist) {
 			debug_plist(*plist);
+			idevice_connection_request_end(client->parent->connection);
 			res = PROPERTY_LIST_SERVICE_E_SUCCESS;
 		} else {
 			res = PROPERTY_LIST_SERVICE_E_PLIST_ERROR;
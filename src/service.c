@@ -26,6 +26,7 @@
 
 #include "service.h"
 #include "idevice.h"
+#include "lockdown.h"
 #include "common/debug.h"
 
 /**
@@ -80,15 +81,8 @@ LIBIMOBILEDEVICE_API service_error_t service_client_factory_start_service(idevic
 {
 	*client = NULL;
 
-	lockdownd_client_t lckd = NULL;
-	if (LOCKDOWN_E_SUCCESS != lockdownd_client_new_with_handshake(device, &lckd, label)) {
-		debug_info("Could not create a lockdown client.");
-		return SERVICE_E_START_SERVICE_ERROR;
-	}
-
 	lockdownd_service_descriptor_t service = NULL;
-	lockdownd_start_service(lckd, service_name, &service);
-	lockdownd_client_free(lckd);
+	lockdownd_session_pool_start_service(device, label, service_name, &service);
 
 	if (!service || service->port == 0) {
 		debug_info("Could not start service %s!", service_name);
@@ -149,6 +143,27 @@ LIBIMOBILEDEVICE_API service_error_t service_send(service_client_t client, const
 	return res;
 }
 
+LIBIMOBILEDEVICE_API service_error_t service_sendv(service_client_t client, const idevice_iovec_t *iov, unsigned int iovcnt, uint32_t *sent)
+{
+	service_error_t res = SERVICE_E_UNKNOWN_ERROR;
+	uint32_t bytes = 0;
+
+	if (!client || (client && !client->connection) || !iov || (iovcnt == 0)) {
+		return SERVICE_E_INVALID_ARG;
+	}
+
+	res = idevice_to_service_error(idevice_connection_sendv(client->connection, iov, iovcnt, &bytes));
+	debug_info("sent %d bytes from %d buffers", bytes, iovcnt);
+	if (bytes == 0) {
+		debug_info("ERROR: sending to device failed.");
+	}
+	if (sent) {
+		*sent = bytes;
+	}
+
+	return res;
+}
+
 LIBIMOBILEDEVICE_API service_error_t service_receive_with_timeout(service_client_t client, char* data, uint32_t size, uint32_t *received, unsigned int timeout)
 {
 	service_error_t res = SERVICE_E_UNKNOWN_ERROR;
@@ -188,3 +203,10 @@ LIBIMOBILEDEVICE_API service_error_t service_disable_ssl(service_client_t client
 	return idevice_to_service_error(idevice_connection_disable_ssl(client->connection));
 }
 
+LIBIMOBILEDEVICE_API service_error_t service_get_stats(service_client_t client, idevice_connection_stats_t *stats)
+{
+	if (!client || !client->connection)
+		return SERVICE_E_INVALID_ARG;
+	return idevice_to_service_error(idevice_connection_get_stats(client->connection, stats));
+}
+
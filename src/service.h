@@ -25,6 +25,12 @@
 #include "libimobiledevice/lockdown.h"
 #include "idevice.h"
 
+/*
+ * size of the receive buffer enabled by clients that only read through
+ * blocking calls, like property list services, AFC and syslog_relay
+ */
+#define SERVICE_RECEIVE_BUFFER_SIZE 16384
+
 struct service_client_private {
 	idevice_connection_t connection;
 };
@@ -32,9 +32,27 @@
 struct syslog_relay_worker_thread {
 	syslog_relay_client_t client;
 	syslog_relay_receive_cb_t cbfunc;
+	syslog_relay_line_cb_t line_cb;
+	syslog_relay_lines_cb_t lines_cb;
+	syslog_relay_filter_t filter;
 	void *user_data;
 };
 
+static const struct {
+	const char *name;
+	syslog_relay_level_t level;
+} syslog_relay_levels[] = {
+	{ "Emergency", SYSLOG_RELAY_LEVEL_EMERGENCY },
+	{ "Alert", SYSLOG_RELAY_LEVEL_ALERT },
+	{ "Critical", SYSLOG_RELAY_LEVEL_CRITICAL },
+	{ "Error", SYSLOG_RELAY_LEVEL_ERROR },
+	{ "Warning", SYSLOG_RELAY_LEVEL_WARNING },
+	{ "Notice", SYSLOG_RELAY_LEVEL_NOTICE },
+	{ "Info", SYSLOG_RELAY_LEVEL_INFO },
+	{ "Debug", SYSLOG_RELAY_LEVEL_DEBUG },
+	{ NULL, 0 }
+};
+
 /**
  * Convert a service_error_t value to a syslog_relay_error_t value.
  * Used internally to get correct error codes.
@@ -79,9 +97,13 @@ LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_client_new(idevice_t devi
 		return ret;
 	}
 
+	/* the syslog arrives in many small writes */
+	idevice_connection_set_receive_buffer(parent->connection, SERVICE_RECEIVE_BUFFER_SIZE);
+
 	syslog_relay_client_t client_loc = (syslog_relay_client_t) malloc(sizeof(struct syslog_relay_client_private));
 	client_loc->parent = parent;
 	client_loc->worker = (thread_t)NULL;
+	client_loc->filter = NULL;
 
 	*client = client_loc;
 
@@ -139,45 +161,408 @@ LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_receive_with_timeout(sysl
 	return res;
 }
 
+/**
+ * Locates the process name, PID and level in a syslog line of the form
+ * "Oct 17 12:00:00 iPhone SpringBoard(UIKit)[55] <Notice>: message".
+ *
+ * @param line The line to parse
+ * @param length The length of the line
+ * @param process Set to the start of the process name or NULL
+ * @param process_length Set to the length of the process name
+ * @param pid Set to the PID, or -1 if the line has none
+ * @param level Set to the level, or -1 if the line has none
+ */
+static void syslog_relay_parse_line(const char *line, uint32_t length, const char **process, uint32_t *process_length, int64_t *pid, int *level)
+{
+	const char *p = line;
+	const char *end = line + length;
+
+	*process = NULL;
+	*process_length = 0;
+	*pid = -1;
+	*level = -1;
+
+	/* skip the timestamp */
+	if (length < 16)
+		return;
+	p += 16;
+
+	/* skip the device name */
+	p = (const char*)memchr(p, ' ', end - p);
+	if (!p)
+		return;
+	p++;
+
+	*process = p;
+	while ((p < end) && (*p != '[') && (*p != '(') && (*p != ':') && (*p != ' '))
+		p++;
+	*process_length = p - *process;
+
+	/* library name, e.g. "(UIKit)" */
+	if ((p < end) && (*p == '(')) {
+		while ((p < end) && (*p != ')'))
+			p++;
+		if (p < end)
+			p++;
+	}
+
+	if ((p < end) && (*p == '[')) {
+		p++;
+		*pid = 0;
+		while ((p < end) && (*p >= '0') && (*p <= '9')) {
+			*pid = (*pid * 10) + (*p - '0');
+			p++;
+		}
+	}
+
+	while ((p < end) && (*p != ' '))
+		p++;
+	if ((end - p > 2) && (p[1] == '<')) {
+		int i;
+		p += 2;
+		for (i = 0; syslog_relay_levels[i].name; i++) {
+			size_t nlen = strlen(syslog_relay_levels[i].name);
+			if (((size_t)(end - p) > nlen) && (strncmp(p, syslog_relay_levels[i].name, nlen) == 0) && (p[nlen] == '>')) {
+				*level = syslog_relay_levels[i].level;
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * Checks if a line contains a substring.
+ */
+static int syslog_relay_contains(const char *line, uint32_t length, const char *match, uint32_t match_length)
+{
+	const char *p = line;
+	const char *end = line + length;
+
+	if (match_length == 0)
+		return 1;
+
+	while ((uint32_t)(end - p) >= match_length) {
+		p = (const char*)memchr(p, match[0], (end - p) - match_length + 1);
+		if (!p)
+			return 0;
+		if (memcmp(p, match, match_length) == 0)
+			return 1;
+		p++;
+	}
+
+	return 0;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_new(syslog_relay_filter_t *filter)
+{
+	if (!filter)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	syslog_relay_filter_t filter_loc = (syslog_relay_filter_t)calloc(1, sizeof(struct syslog_relay_filter_private));
+	if (!filter_loc)
+		return SYSLOG_RELAY_E_UNKNOWN_ERROR;
+	filter_loc->level = SYSLOG_RELAY_LEVEL_DEBUG;
+
+	*filter = filter_loc;
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_free(syslog_relay_filter_t filter)
+{
+	uint32_t i;
+
+	if (!filter)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	for (i = 0; i < filter->num_processes; i++) {
+		free(filter->processes[i]);
+	}
+	free(filter->processes);
+	free(filter->process_lengths);
+	free(filter->pids);
+	free(filter->match);
+#ifdef HAVE_REGEX_H
+	if (filter->has_regex) {
+		regfree(&filter->regex);
+	}
+#endif
+	free(filter);
+
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_add_process(syslog_relay_filter_t filter, const char *process)
+{
+	if (!filter || !process)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	char **processes = (char**)realloc(filter->processes, sizeof(char*) * (filter->num_processes + 1));
+	if (!processes)
+		return SYSLOG_RELAY_E_UNKNOWN_ERROR;
+	filter->processes = processes;
+	uint32_t *lengths = (uint32_t*)realloc(filter->process_lengths, sizeof(uint32_t) * (filter->num_processes + 1));
+	if (!lengths)
+		return SYSLOG_RELAY_E_UNKNOWN_ERROR;
+	filter->process_lengths = lengths;
+
+	filter->processes[filter->num_processes] = strdup(process);
+	filter->process_lengths[filter->num_processes] = strlen(process);
+	filter->num_processes++;
+
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_add_pid(syslog_relay_filter_t filter, uint32_t pid)
+{
+	if (!filter)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	uint32_t *pids = (uint32_t*)realloc(filter->pids, sizeof(uint32_t) * (filter->num_pids + 1));
+	if (!pids)
+		return SYSLOG_RELAY_E_UNKNOWN_ERROR;
+	filter->pids = pids;
+	filter->pids[filter->num_pids++] = pid;
+
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_set_level(syslog_relay_filter_t filter, syslog_relay_level_t level)
+{
+	if (!filter || (level < SYSLOG_RELAY_LEVEL_EMERGENCY) || (level > SYSLOG_RELAY_LEVEL_DEBUG))
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	filter->level = level;
+
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_set_match(syslog_relay_filter_t filter, const char *match)
+{
+	if (!filter)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	free(filter->match);
+	filter->match = NULL;
+	filter->match_length = 0;
+	if (match && (*match != '\0')) {
+		filter->match = strdup(match);
+		filter->match_length = strlen(match);
+	}
+
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_filter_set_regex(syslog_relay_filter_t filter, const char *pattern)
+{
+	if (!filter)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+#ifdef HAVE_REGEX_H
+	if (filter->has_regex) {
+		regfree(&filter->regex);
+		filter->has_regex = 0;
+	}
+	if (pattern) {
+		int err = regcomp(&filter->regex, pattern, REG_EXTENDED | REG_NOSUB);
+		if (err != 0) {
+			char errbuf[256];
+			regerror(err, &filter->regex, errbuf, sizeof(errbuf));
+			debug_info("Could not compile regular expression '%s': %s", pattern, errbuf);
+			return SYSLOG_RELAY_E_INVALID_ARG;
+		}
+		filter->has_regex = 1;
+	}
+	return SYSLOG_RELAY_E_SUCCESS;
+#else
+	if (!pattern)
+		return SYSLOG_RELAY_E_SUCCESS;
+	debug_info("Regular expressions are not supported on this platform");
+	return SYSLOG_RELAY_E_UNKNOWN_ERROR;
+#endif
+}
+
+LIBIMOBILEDEVICE_API int syslog_relay_filter_match(syslog_relay_filter_t filter, const char *line, uint32_t length)
+{
+	const char *process = NULL;
+	uint32_t process_length = 0;
+	int64_t pid = -1;
+	int level = -1;
+	uint32_t i;
+
+	if (!filter)
+		return 1;
+	if (!line)
+		return 0;
+
+	if ((filter->num_processes > 0) || (filter->num_pids > 0) || (filter->level < SYSLOG_RELAY_LEVEL_DEBUG)) {
+		syslog_relay_parse_line(line, length, &process, &process_length, &pid, &level);
+
+		if ((filter->num_processes > 0) || (filter->num_pids > 0)) {
+			int found = 0;
+			for (i = 0; !found && process && (i < filter->num_processes); i++) {
+				found = (process_length == filter->process_lengths[i]) && (memcmp(process, filter->processes[i], process_length) == 0);
+			}
+			for (i = 0; !found && (pid >= 0) && (i < filter->num_pids); i++) {
+				found = (pid == filter->pids[i]);
+			}
+			if (!found)
+				return 0;
+		}
+
+		if ((level >= 0) && (level > filter->level))
+			return 0;
+	}
+
+	if (filter->match && !syslog_relay_contains(line, length, filter->match, filter->match_length))
+		return 0;
+
+#ifdef HAVE_REGEX_H
+	if (filter->has_regex && (regexec(&filter->regex, line, 0, NULL, 0) != 0))
+		return 0;
+#endif
+
+	return 1;
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_set_filter(syslog_relay_client_t client, syslog_relay_filter_t filter)
+{
+	if (!client)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	if (client->worker) {
+		debug_info("Can not change the filter while a syslog capture is running.");
+		return SYSLOG_RELAY_E_UNKNOWN_ERROR;
+	}
+
+	client->filter = filter;
+
+	return SYSLOG_RELAY_E_SUCCESS;
+}
+
+/**
+ * Splits the received data into lines and passes them to the line or batch
+ * callback of the capture. Lines end with a newline or a NUL byte, the
+ * terminator is replaced with a NUL byte so lines can be used as strings.
+ * Empty lines caused by the NUL byte the device sends after each newline
+ * are skipped.
+ *
+ * @param srwt The capture to dispatch the lines for
+ * @param buf Buffer with the received data, with room for one more byte
+ * @param len Number of bytes in the buffer, updated to the number of bytes
+ *    of the incomplete line that was moved to the start of the buffer.
+ * @param flush Also dispatch the incomplete line at the end of the buffer.
+ */
+static void syslog_relay_dispatch_lines(struct syslog_relay_worker_thread *srwt, char *buf, uint32_t *len, int flush)
+{
+	const char *lines[SYSLOG_RELAY_MAX_BATCH_LINES];
+	uint32_t lengths[SYSLOG_RELAY_MAX_BATCH_LINES];
+	uint32_t count = 0;
+	uint32_t start = 0;
+	uint32_t i;
+
+	for (i = 0; i <= *len; i++) {
+		if (i == *len) {
+			if (!flush || (start == i))
+				break;
+			buf[i] = '\0';
+		} else if ((buf[i] == '\n') || ((buf[i] == '\0') && (i > start))) {
+			buf[i] = '\0';
+		} else {
+			if (buf[i] == '\0')
+				start = i + 1;
+			continue;
+		}
+
+		if (srwt->filter && !syslog_relay_filter_match(srwt->filter, buf + start, i - start)) {
+			/* filtered out */
+		} else if (srwt->lines_cb) {
+			lines[count] = buf + start;
+			lengths[count] = i - start;
+			count++;
+			if (count == SYSLOG_RELAY_MAX_BATCH_LINES) {
+				srwt->lines_cb(lines, lengths, count, srwt->user_data);
+				count = 0;
+			}
+		} else {
+			srwt->line_cb(buf + start, i - start, srwt->user_data);
+		}
+		start = i + 1;
+	}
+
+	if (count > 0) {
+		srwt->lines_cb(lines, lengths, count, srwt->user_data);
+	}
+
+	if (start >= *len) {
+		*len = 0;
+	} else if (start > 0) {
+		memmove(buf, buf + start, *len - start);
+		*len -= start;
+	}
+}
+
 void *syslog_relay_worker(void *arg)
 {
 	syslog_relay_error_t ret = SYSLOG_RELAY_E_UNKNOWN_ERROR;
 	struct syslog_relay_worker_thread *srwt = (struct syslog_relay_worker_thread*)arg;
+	char *buf = NULL;
+	uint32_t len = 0;
 
 	if (!srwt)
 		return NULL;
 
+	buf = (char*)malloc(SYSLOG_RELAY_BUFFER_SIZE + 1);
+	if (!buf) {
+		free(srwt);
+		return NULL;
+	}
+
 	debug_info("Running");
 
 	while (srwt->client->parent) {
-		char c;
 		uint32_t bytes = 0;
-		ret = syslog_relay_receive_with_timeout(srwt->client, &c, 1, &bytes, 100);
+		ret = syslog_relay_receive_with_timeout(srwt->client, buf + len, SYSLOG_RELAY_BUFFER_SIZE - len, &bytes, 100);
 		if ((bytes == 0) && (ret == SYSLOG_RELAY_E_SUCCESS)) {
 			continue;
 		} else if (ret < 0) {
 			debug_info("Connection to syslog relay interrupted");
 			break;
 		}
-		if(c != 0) {
-			srwt->cbfunc(c, srwt->user_data);
+		if (srwt->cbfunc) {
+			uint32_t i;
+			for (i = 0; i < bytes; i++) {
+				if (buf[i] != 0) {
+					srwt->cbfunc(buf[i], srwt->user_data);
+				}
+			}
+			continue;
+		}
+		len += bytes;
+		syslog_relay_dispatch_lines(srwt, buf, &len, 0);
+		if (len == SYSLOG_RELAY_BUFFER_SIZE) {
+			/* line too long for the buffer, pass on what we have */
+			syslog_relay_dispatch_lines(srwt, buf, &len, 1);
 		}
 	}
 
-	if (srwt) {
-		free(srwt);
+	if (len > 0) {
+		syslog_relay_dispatch_lines(srwt, buf, &len, 1);
 	}
 
+	free(buf);
+	free(srwt);
+
 	debug_info("Exiting");
 
 	return NULL;
 }
 
-LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_start_capture(syslog_relay_client_t client, syslog_relay_receive_cb_t callback, void* user_data)
+/**
+ * Starts the capture worker thread with the given callbacks, exactly one of
+ * which must be set.
+ */
+static syslog_relay_error_t syslog_relay_start_worker(syslog_relay_client_t client, syslog_relay_receive_cb_t callback, syslog_relay_line_cb_t line_callback, syslog_relay_lines_cb_t lines_callback, void* user_data)
 {
-	if (!client || !callback)
-		return SYSLOG_RELAY_E_INVALID_ARG;
-
 	syslog_relay_error_t res = SYSLOG_RELAY_E_UNKNOWN_ERROR;
 
 	if (client->worker) {
@@ -190,16 +575,45 @@ LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_start_capture(syslog_rela
 	if (srwt) {
 		srwt->client = client;
 		srwt->cbfunc = callback;
+		srwt->line_cb = line_callback;
+		srwt->lines_cb = lines_callback;
+		srwt->filter = client->filter;
 		srwt->user_data = user_data;
 
 		if (thread_new(&client->worker, syslog_relay_worker, srwt) == 0) {
 			res = SYSLOG_RELAY_E_SUCCESS;
+		} else {
+			free(srwt);
 		}
 	}
 
 	return res;
 }
 
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_start_capture(syslog_relay_client_t client, syslog_relay_receive_cb_t callback, void* user_data)
+{
+	if (!client || !callback)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	return syslog_relay_start_worker(client, callback, NULL, NULL, user_data);
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_start_capture_lines(syslog_relay_client_t client, syslog_relay_line_cb_t callback, void* user_data)
+{
+	if (!client || !callback)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	return syslog_relay_start_worker(client, NULL, callback, NULL, user_data);
+}
+
+LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_start_capture_batch(syslog_relay_client_t client, syslog_relay_lines_cb_t callback, void* user_data)
+{
+	if (!client || !callback)
+		return SYSLOG_RELAY_E_INVALID_ARG;
+
+	return syslog_relay_start_worker(client, NULL, NULL, callback, user_data);
+}
+
 LIBIMOBILEDEVICE_API syslog_relay_error_t syslog_relay_stop_capture(syslog_relay_client_t client)
 {
 	if (client->worker) {
@@ -26,9 +26,35 @@
 #include "service.h"
 #include "common/thread.h"
 
+#ifdef HAVE_REGEX_H
+#include <regex.h>
+#endif
+
+/* size of the buffer the capture worker reads into */
+#define SYSLOG_RELAY_BUFFER_SIZE 65536
+
+/* maximum number of lines passed to a batch callback at once */
+#define SYSLOG_RELAY_MAX_BATCH_LINES 256
+
+struct syslog_relay_filter_private {
+	char **processes;
+	uint32_t *process_lengths;
+	uint32_t num_processes;
+	uint32_t *pids;
+	uint32_t num_pids;
+	int level;
+	char *match;
+	uint32_t match_length;
+#ifdef HAVE_REGEX_H
+	regex_t regex;
+	int has_regex;
+#endif
+};
+
 struct syslog_relay_client_private {
 	service_client_t parent;
 	thread_t worker;
+	syslog_relay_filter_t filter;
 };
 
 void *syslog_relay_worker(void *arg);
@@ -117,21 +117,13 @@ static void mobilebackup_afc_get_file_contents(afc_client_t afc, const char *fil
 		return;
 	}
 
-	char **fileinfo = NULL;
+	afc_file_info_t fileinfo;
 	uint32_t fsize = 0;
 
-	afc_get_file_info(afc, filename, &fileinfo);
-	if (!fileinfo) {
+	if (afc_get_file_info_parsed(afc, filename, &fileinfo) != AFC_E_SUCCESS) {
 		return;
 	}
-	int i;
-	for (i = 0; fileinfo[i]; i+=2) {
-		if (!strcmp(fileinfo[i], "st_size")) {
-			fsize = atol(fileinfo[i+1]);
-			break;
-		}
-	}
-	afc_dictionary_free(fileinfo);
+	fsize = (uint32_t)fileinfo.size;
 
 	if (fsize == 0) {
 		return;
@@ -646,6 +638,8 @@ static int mb2_handle_send_file(mobilebackup2_client_t mobilebackup2, const char
 	uint32_t bytes = 0;
 	char *localfile = string_build_path(backup_dir, path, NULL);
 	char buf[32768];
+	char hdr[5];
+	idevice_iovec_t iov[2];
 #ifdef WIN32
 	struct _stati64 fst;
 #else
@@ -667,23 +661,17 @@ static int mb2_handle_send_file(mobilebackup2_client_t mobilebackup2, const char
 
 	mobilebackup2_error_t err;
 
-	/* send path length */
+	/* send path length and path */
 	nlen = htobe32(pathlen);
-	err = mobilebackup2_send_raw(mobilebackup2, (const char*)&nlen, sizeof(nlen), &bytes);
-	if (err != MOBILEBACKUP2_E_SUCCESS) {
-		goto leave_proto_err;
-	}
-	if (bytes != (uint32_t)sizeof(nlen)) {
-		err = MOBILEBACKUP2_E_MUX_ERROR;
-		goto leave_proto_err;
-	}
-
-	/* send path */
-	err = mobilebackup2_send_raw(mobilebackup2, path, pathlen, &bytes);
+	iov[0].data = (const char*)&nlen;
+	iov[0].length = sizeof(nlen);
+	iov[1].data = path;
+	iov[1].length = pathlen;
+	err = mobilebackup2_send_rawv(mobilebackup2, iov, 2, &bytes);
 	if (err != MOBILEBACKUP2_E_SUCCESS) {
 		goto leave_proto_err;
 	}
-	if (bytes != pathlen) {
+	if (bytes != (uint32_t)sizeof(nlen) + pathlen) {
 		err = MOBILEBACKUP2_E_MUX_ERROR;
 		goto leave_proto_err;
 	}
@@ -721,31 +709,29 @@ static int mb2_handle_send_file(mobilebackup2_client_t mobilebackup2, const char
 	sent = 0;
 	do {
 		length = ((total-sent) < (long long)sizeof(buf)) ? (uint32_t)total-sent : (uint32_t)sizeof(buf);
-		/* send data size (file size + 1) */
-		nlen = htobe32(length+1);
-		memcpy(buf, &nlen, sizeof(nlen));
-		buf[4] = CODE_FILE_DATA;
-		err = mobilebackup2_send_raw(mobilebackup2, (const char*)buf, 5, &bytes);
-		if (err != MOBILEBACKUP2_E_SUCCESS) {
-			goto leave_proto_err;
-		}
-		if (bytes != 5) {
-			goto leave_proto_err;
-		}
 
-		/* send file contents */
-		size_t r = fread(buf, 1, sizeof(buf), f);
+		/* read file contents */
+		size_t r = fread(buf, 1, length, f);
 		if (r <= 0) {
 			printf("%s: read error\n", __func__);
 			errcode = errno;
 			goto leave;
 		}
-		err = mobilebackup2_send_raw(mobilebackup2, buf, r, &bytes);
+
+		/* send data size (file size + 1), code and file contents at once */
+		nlen = htobe32((uint32_t)r+1);
+		memcpy(hdr, &nlen, sizeof(nlen));
+		hdr[4] = CODE_FILE_DATA;
+		iov[0].data = hdr;
+		iov[0].length = 5;
+		iov[1].data = buf;
+		iov[1].length = (uint32_t)r;
+		err = mobilebackup2_send_rawv(mobilebackup2, iov, 2, &bytes);
 		if (err != MOBILEBACKUP2_E_SUCCESS) {
 			goto leave_proto_err;
 		}
-		if (bytes != (uint32_t)r) {
-			printf("Error: sent only %d of %d bytes\n", bytes, (int)r);
+		if (bytes != 5 + (uint32_t)r) {
+			printf("Error: sent only %d of %d bytes\n", bytes, 5 + (int)r);
 			goto leave_proto_err;
 		}
 		sent += r;
@@ -127,15 +127,30 @@ static int afc_client_copy_and_remove_crash_reports(afc_client_t afc, const char
 	}
 	int host_directory_length = strlen(target_filename);
 
+	/* gather file information of all entries at once */
+	int entry_count = 0;
+	for (k = 0; list[k]; k++) {
+		entry_count++;
+	}
+	char **entry_paths = (char**)calloc(entry_count + 1, sizeof(char*));
+	afc_file_info_t *entry_infos = (afc_file_info_t*)calloc(entry_count + 1, sizeof(afc_file_info_t));
+	afc_error_t *entry_results = (afc_error_t*)calloc(entry_count + 1, sizeof(afc_error_t));
+	for (k = 0; list[k]; k++) {
+		entry_paths[k] = (char*)malloc(device_directory_length + strlen(list[k]) + 1);
+		strcpy(entry_paths[k], source_filename);
+		strcpy(entry_paths[k] + device_directory_length, list[k]);
+	}
+	afc_get_file_info_batch(afc, (const char**)entry_paths, entry_count, entry_infos, entry_results);
+
 	/* loop over file entries */
 	for (k = 0; list[k]; k++) {
 		if (!strcmp(list[k], ".") || !strcmp(list[k], "..")) {
 			continue;
 		}
 
-		char **fileinfo = NULL;
 		struct stat stbuf;
 		stbuf.st_size = 0;
+		stbuf.st_mode = 0;
 
 		/* assemble absolute source filename */
 		strcpy(((char*)source_filename) + device_directory_length, list[k]);
@@ -152,38 +167,38 @@ static int afc_client_copy_and_remove_crash_reports(afc_client_t afc, const char
 		}
 
 		/* get file information */
-		afc_get_file_info(afc, source_filename, &fileinfo);
-		if (!fileinfo) {
+		if (entry_results[k] != AFC_E_SUCCESS) {
 			printf("Failed to read information for '%s'. Skipping...\n", source_filename);
 			continue;
 		}
 
 		/* parse file information */
-		int i;
-		for (i = 0; fileinfo[i]; i+=2) {
-			if (!strcmp(fileinfo[i], "st_size")) {
-				stbuf.st_size = atoll(fileinfo[i+1]);
-			} else if (!strcmp(fileinfo[i], "st_ifmt")) {
-				if (!strcmp(fileinfo[i+1], "S_IFREG")) {
-					stbuf.st_mode = S_IFREG;
-				} else if (!strcmp(fileinfo[i+1], "S_IFDIR")) {
-					stbuf.st_mode = S_IFDIR;
-				} else if (!strcmp(fileinfo[i+1], "S_IFLNK")) {
-					stbuf.st_mode = S_IFLNK;
-				} else if (!strcmp(fileinfo[i+1], "S_IFBLK")) {
-					stbuf.st_mode = S_IFBLK;
-				} else if (!strcmp(fileinfo[i+1], "S_IFCHR")) {
-					stbuf.st_mode = S_IFCHR;
-				} else if (!strcmp(fileinfo[i+1], "S_IFIFO")) {
-					stbuf.st_mode = S_IFIFO;
-				} else if (!strcmp(fileinfo[i+1], "S_IFSOCK")) {
-					stbuf.st_mode = S_IFSOCK;
+		stbuf.st_size = entry_infos[k].size;
+		stbuf.st_mtime = (time_t)(entry_infos[k].mtime / 1000000000);
+		switch (entry_infos[k].type) {
+			case AFC_FILE_TYPE_REGULAR:
+				stbuf.st_mode = S_IFREG;
+				break;
+			case AFC_FILE_TYPE_DIRECTORY:
+				stbuf.st_mode = S_IFDIR;
+				break;
+			case AFC_FILE_TYPE_SYMLINK:
+				stbuf.st_mode = S_IFLNK;
+				break;
+			default:
+				break;
+		}
+
+		if (entry_infos[k].type == AFC_FILE_TYPE_SYMLINK) {
+			char **fileinfo = NULL;
+			int i;
+
+			/* the link target is only part of the full file information */
+			afc_get_file_info(afc, source_filename, &fileinfo);
+			for (i = 0; fileinfo && fileinfo[i]; i+=2) {
+				if (strcmp(fileinfo[i], "LinkTarget")) {
+					continue;
 				}
-			} else if (!strcmp(fileinfo[i], "st_nlink")) {
-				stbuf.st_nlink = atoi(fileinfo[i+1]);
-			} else if (!strcmp(fileinfo[i], "st_mtime")) {
-				stbuf.st_mtime = (time_t)(atoll(fileinfo[i+1]) / 1000000000);
-			} else if (!strcmp(fileinfo[i], "LinkTarget")) {
 				/* report latest crash report filename */
 				printf("Link: %s\n", (char*)target_filename + strlen(target_directory));
 
@@ -212,10 +227,11 @@ static int afc_client_copy_and_remove_crash_reports(afc_client_t afc, const char
 
 				res = 0;
 			}
-		}
 
-		/* free file information */
-		afc_dictionary_free(fileinfo);
+			/* free file information */
+			if (fileinfo)
+				afc_dictionary_free(fileinfo);
+		}
 
 		/* recurse into child directories */
 		if (S_ISDIR(stbuf.st_mode)) {
@@ -283,6 +299,12 @@ static int afc_client_copy_and_remove_crash_reports(afc_client_t afc, const char
 		}
 	}
 	afc_dictionary_free(list);
+	for (k = 0; k < entry_count; k++) {
+		free(entry_paths[k]);
+	}
+	free(entry_paths);
+	free(entry_infos);
+	free(entry_results);
 
 	/* no reports, no error */
 	if (crash_report_count == 0)
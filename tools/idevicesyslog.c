@@ -29,6 +29,8 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
 
 #ifdef WIN32
 #include <windows.h>
@@ -36,8 +38,22 @@
 #endif
 
 #include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
 #include <libimobiledevice/syslog_relay.h>
 
+#ifdef HAVE_ZLIB
+#include "syslog_archive.h"
+
+/* pending archive blocks are written once their first line is this old */
+#define ARCHIVE_FLUSH_AGE 30000
+#endif
+
+/* longest line kept per device in aggregator mode, longer lines are split */
+#define AGGREGATE_LINE_MAX 8192
+/* seconds to wait before retrying a device that could not be attached */
+#define AGGREGATE_RETRY_MIN 2
+#define AGGREGATE_RETRY_MAX 60
+
 static int quit_flag = 0;
 
 void print_usage(int argc, char **argv);
@@ -47,12 +63,70 @@ static char* udid = NULL;
 static idevice_t device = NULL;
 static syslog_relay_client_t syslog = NULL;
 
-static void syslog_callback(char c, void *user_data)
+static char **filter_udids = NULL;
+static int filter_count = 0;
+static const char *output_dir = NULL;
+static long rotate_size = 16 * 1024 * 1024;
+static int rotate_count = 5;
+static syslog_relay_filter_t filter = NULL;
+#ifdef HAVE_ZLIB
+static syslog_archive_writer_t *archive = NULL;
+#endif
+
+/** A device followed in aggregator mode. */
+struct syslog_stream {
+	char *udid;
+	idevice_t device;
+	idevice_connection_t connection;
+	FILE *file;
+	char *path;
+	long file_size;
+	char line[AGGREGATE_LINE_MAX + 1];
+	uint32_t line_len;
+	int closed;
+	struct syslog_stream *next;
+};
+
+static struct syslog_stream *streams = NULL;
+
+/** A device that could not be attached in aggregator mode. */
+struct syslog_retry {
+	char *udid;
+	time_t next_attempt;
+	int delay;
+	int seen;
+	struct syslog_retry *next;
+};
+
+static struct syslog_retry *retries = NULL;
+
+#ifdef HAVE_ZLIB
+static uint64_t get_time_ms(void)
 {
-	putchar(c);
-	if (c == '\n') {
-		fflush(stdout);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return ((uint64_t)tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+#endif
+
+static void syslog_callback(const char **lines, const uint32_t *lengths, uint32_t count, void *user_data)
+{
+	uint32_t i;
+#ifdef HAVE_ZLIB
+	if (archive) {
+		uint64_t now = get_time_ms();
+		for (i = 0; i < count; i++) {
+			syslog_archive_write_line(archive, udid, now, lines[i], lengths[i]);
+		}
+		syslog_archive_writer_flush(archive, now, ARCHIVE_FLUSH_AGE);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++) {
+		fwrite(lines[i], 1, lengths[i], stdout);
+		putchar('\n');
 	}
+	fflush(stdout);
 }
 
 static int start_logging(void)
@@ -74,7 +148,8 @@ static int start_logging(void)
 	}
 
 	/* start capturing syslog */
-	serr = syslog_relay_start_capture(syslog, syslog_callback, NULL);
+	syslog_relay_set_filter(syslog, filter);
+	serr = syslog_relay_start_capture_batch(syslog, syslog_callback, NULL);
 	if (serr != SYSLOG_RELAY_E_SUCCESS) {
 		fprintf(stderr, "ERROR: Unable tot start capturing syslog.\n");
 		syslog_relay_client_free(syslog);
@@ -126,6 +201,363 @@ static void device_event_cb(const idevice_event_t* event, void* userdata)
 	}
 }
 
+static FILE *stream_open_file(struct syslog_stream *stream)
+{
+	stream->file = fopen(stream->path, "a");
+	if (!stream->file) {
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", stream->path, strerror(errno));
+		return NULL;
+	}
+	stream->file_size = ftell(stream->file);
+	return stream->file;
+}
+
+static void stream_rotate_file(struct syslog_stream *stream)
+{
+	size_t plen = strlen(stream->path) + 16;
+	char *from = (char*)malloc(plen);
+	char *to = (char*)malloc(plen);
+	int i;
+
+	fclose(stream->file);
+	stream->file = NULL;
+
+	for (i = rotate_count - 1; i > 0; i--) {
+		snprintf(from, plen, "%s.%d", stream->path, i);
+		snprintf(to, plen, "%s.%d", stream->path, i + 1);
+		rename(from, to);
+	}
+	if (rotate_count > 0) {
+		snprintf(to, plen, "%s.1", stream->path);
+		rename(stream->path, to);
+	} else {
+		remove(stream->path);
+	}
+	free(from);
+	free(to);
+
+	stream_open_file(stream);
+}
+
+static void stream_write_line(struct syslog_stream *stream, char *line, uint32_t length)
+{
+	line[length] = '\0';
+	if (filter && !syslog_relay_filter_match(filter, line, length)) {
+		return;
+	}
+
+#ifdef HAVE_ZLIB
+	if (archive) {
+		syslog_archive_write_line(archive, stream->udid, get_time_ms(), line, length);
+		return;
+	}
+#endif
+
+	if (!output_dir) {
+		printf("%s: ", stream->udid);
+		fwrite(line, 1, length, stdout);
+		putchar('\n');
+		return;
+	}
+
+	if (!stream->file)
+		return;
+	fwrite(line, 1, length, stream->file);
+	fputc('\n', stream->file);
+	stream->file_size += length + 1;
+	if ((rotate_size > 0) && (stream->file_size >= rotate_size)) {
+		stream_rotate_file(stream);
+	}
+}
+
+static void stream_frame_cb(idevice_connection_t connection, const char *frame, uint32_t length, void *user_data)
+{
+	struct syslog_stream *stream = (struct syslog_stream*)user_data;
+	uint32_t i;
+
+	if (!frame) {
+		stream->closed = 1;
+		return;
+	}
+
+	for (i = 0; i < length; i++) {
+		char c = frame[i];
+		if (c == '\0') {
+			continue;
+		}
+		if (c == '\n' || stream->line_len == AGGREGATE_LINE_MAX) {
+			stream_write_line(stream, stream->line, stream->line_len);
+			stream->line_len = 0;
+			if (c == '\n')
+				continue;
+		}
+		stream->line[stream->line_len++] = c;
+	}
+}
+
+static void stream_free(struct syslog_stream *stream)
+{
+	if (stream->line_len > 0) {
+		stream_write_line(stream, stream->line, stream->line_len);
+	}
+	if (stream->connection) {
+		idevice_disconnect(stream->connection);
+	}
+	if (stream->device) {
+		idevice_free(stream->device);
+	}
+	if (stream->file) {
+		fclose(stream->file);
+	}
+	free(stream->path);
+	free(stream->udid);
+	free(stream);
+}
+
+static int stream_is_wanted(const char *dev_udid)
+{
+	int i;
+	struct syslog_stream *stream;
+
+	for (stream = streams; stream; stream = stream->next) {
+		if (strcmp(stream->udid, dev_udid) == 0)
+			return 0;
+	}
+	if (filter_count == 0)
+		return 1;
+	for (i = 0; i < filter_count; i++) {
+		if (strcmp(filter_udids[i], dev_udid) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int stream_attach(idevice_io_loop_t loop, const char *dev_udid, int report)
+{
+	lockdownd_client_t lockdown = NULL;
+	lockdownd_service_descriptor_t service = NULL;
+	struct syslog_stream *stream = (struct syslog_stream*)calloc(1, sizeof(struct syslog_stream));
+
+	stream->udid = strdup(dev_udid);
+
+	if (idevice_new(&stream->device, dev_udid) != IDEVICE_E_SUCCESS) {
+		if (report)
+			fprintf(stderr, "ERROR: Device with udid %s not found\n", dev_udid);
+		stream_free(stream);
+		return -1;
+	}
+
+	if (lockdownd_client_new_with_handshake(stream->device, &lockdown, "idevicesyslog") != LOCKDOWN_E_SUCCESS) {
+		if (report)
+			fprintf(stderr, "ERROR: Could not connect to lockdownd on %s\n", dev_udid);
+		stream_free(stream);
+		return -1;
+	}
+	lockdownd_start_service(lockdown, SYSLOG_RELAY_SERVICE_NAME, &service);
+	lockdownd_client_free(lockdown);
+	if (!service || service->port == 0) {
+		if (report)
+			fprintf(stderr, "ERROR: Could not start service %s on %s\n", SYSLOG_RELAY_SERVICE_NAME, dev_udid);
+		lockdownd_service_descriptor_free(service);
+		stream_free(stream);
+		return -1;
+	}
+
+	if (idevice_connect(stream->device, service->port, &stream->connection) != IDEVICE_E_SUCCESS) {
+		if (report)
+			fprintf(stderr, "ERROR: Could not connect to %s on %s\n", SYSLOG_RELAY_SERVICE_NAME, dev_udid);
+		lockdownd_service_descriptor_free(service);
+		stream_free(stream);
+		return -1;
+	}
+	if (service->ssl_enabled && (idevice_connection_enable_ssl(stream->connection) != IDEVICE_E_SUCCESS)) {
+		if (report)
+			fprintf(stderr, "ERROR: Could not enable SSL for %s on %s\n", SYSLOG_RELAY_SERVICE_NAME, dev_udid);
+		lockdownd_service_descriptor_free(service);
+		stream_free(stream);
+		return -1;
+	}
+	lockdownd_service_descriptor_free(service);
+
+	if (output_dir) {
+		size_t plen = strlen(output_dir) + strlen(dev_udid) + 6;
+		stream->path = (char*)malloc(plen);
+		snprintf(stream->path, plen, "%s/%s.log", output_dir, dev_udid);
+		if (!stream_open_file(stream)) {
+			stream_free(stream);
+			return -1;
+		}
+	}
+
+	if (idevice_io_loop_add(loop, stream->connection, IDEVICE_IO_FRAME_RAW, stream_frame_cb, stream) != IDEVICE_E_SUCCESS) {
+		if (report)
+			fprintf(stderr, "ERROR: Could not follow syslog of %s\n", dev_udid);
+		stream_free(stream);
+		return -1;
+	}
+
+	stream->next = streams;
+	streams = stream;
+
+	fprintf(stderr, "[connected %s]\n", dev_udid);
+	return 0;
+}
+
+static struct syslog_retry *retry_find(const char *dev_udid)
+{
+	struct syslog_retry *retry;
+	for (retry = retries; retry; retry = retry->next) {
+		if (strcmp(retry->udid, dev_udid) == 0)
+			return retry;
+	}
+	return NULL;
+}
+
+static void retries_free(int all)
+{
+	struct syslog_retry **prev = &retries;
+	while (*prev) {
+		struct syslog_retry *retry = *prev;
+		if (!retry->seen || all) {
+			*prev = retry->next;
+			free(retry->udid);
+			free(retry);
+		} else {
+			retry->seen = 0;
+			prev = &retry->next;
+		}
+	}
+}
+
+static void streams_scan(idevice_io_loop_t loop, time_t now)
+{
+	char **dev_list = NULL;
+	int count = 0;
+	int i;
+
+	if (idevice_get_device_list(&dev_list, &count) < 0) {
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		struct syslog_retry *retry;
+		if (!stream_is_wanted(dev_list[i])) {
+			continue;
+		}
+		retry = retry_find(dev_list[i]);
+		if (retry) {
+			retry->seen = 1;
+			if (now < retry->next_attempt)
+				continue;
+		}
+		/* a device that is locked or not trusted fails the same way every
+		 * time, so only the first failure is reported and further attempts
+		 * back off to keep the other streams flowing */
+		if (stream_attach(loop, dev_list[i], retry == NULL) == 0) {
+			if (retry)
+				retry->seen = 0;
+			continue;
+		}
+		if (!retry) {
+			retry = (struct syslog_retry*)calloc(1, sizeof(struct syslog_retry));
+			retry->udid = strdup(dev_list[i]);
+			retry->delay = AGGREGATE_RETRY_MIN;
+			retry->next = retries;
+			retries = retry;
+			fprintf(stderr, "[waiting for %s]\n", dev_list[i]);
+		} else if (retry->delay < AGGREGATE_RETRY_MAX) {
+			retry->delay *= 2;
+			if (retry->delay > AGGREGATE_RETRY_MAX)
+				retry->delay = AGGREGATE_RETRY_MAX;
+		}
+		retry->seen = 1;
+		retry->next_attempt = now + retry->delay;
+	}
+	idevice_device_list_free(dev_list);
+
+	/* forget devices that were attached or unplugged, so a replugged
+	 * device is tried (and reported) right away */
+	retries_free(0);
+}
+
+static void streams_reap(idevice_io_loop_t loop, int all)
+{
+	struct syslog_stream **prev = &streams;
+	while (*prev) {
+		struct syslog_stream *stream = *prev;
+		if (stream->closed || all) {
+			*prev = stream->next;
+			if (!stream->closed) {
+				idevice_io_loop_remove(loop, stream->connection);
+			}
+			fprintf(stderr, "[disconnected %s]\n", stream->udid);
+			stream_free(stream);
+		} else {
+			prev = &stream->next;
+		}
+	}
+}
+
+/**
+ * Follows the syslog of all connected devices, or of the devices passed
+ * with -u, from a single thread.
+ */
+static int run_aggregator(void)
+{
+	idevice_io_loop_t loop = NULL;
+	time_t last_scan = 0;
+
+	if (idevice_io_loop_new(&loop) != IDEVICE_E_SUCCESS) {
+		fprintf(stderr, "ERROR: Could not create I/O loop\n");
+		return -1;
+	}
+
+	while (!quit_flag) {
+		time_t now = time(NULL);
+		if (now != last_scan) {
+			streams_scan(loop, now);
+			last_scan = now;
+		}
+		if (idevice_io_loop_run_once(loop, 1000) < 0) {
+			fprintf(stderr, "ERROR: I/O loop failed\n");
+			break;
+		}
+		fflush(stdout);
+#ifdef HAVE_ZLIB
+		if (archive) {
+			syslog_archive_writer_flush(archive, get_time_ms(), ARCHIVE_FLUSH_AGE);
+		}
+#endif
+		streams_reap(loop, 0);
+	}
+
+	streams_reap(loop, 1);
+	retries_free(1);
+	idevice_io_loop_free(loop);
+	fflush(stdout);
+
+	return 0;
+}
+
+static syslog_relay_filter_t get_filter(void)
+{
+	if (!filter) {
+		syslog_relay_filter_new(&filter);
+	}
+	return filter;
+}
+
+static int parse_level(const char *name)
+{
+	static const char *levels[] = { "emergency", "alert", "critical", "error", "warning", "notice", "info", "debug", NULL };
+	int i;
+	for (i = 0; levels[i]; i++) {
+		if (strcasecmp(name, levels[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 /**
  * signal handler function for cleaning up properly
  */
@@ -138,6 +570,11 @@ static void clean_exit(int sig)
 int main(int argc, char *argv[])
 {
 	int i;
+	int aggregate = 0;
+	int res = 0;
+#ifdef HAVE_ZLIB
+	const char *archive_path = NULL;
+#endif
 
 	signal(SIGINT, clean_exit);
 	signal(SIGTERM, clean_exit);
@@ -159,6 +596,99 @@ int main(int argc, char *argv[])
 				return 0;
 			}
 			udid = strdup(argv[i]);
+			filter_udids = (char**)realloc(filter_udids, sizeof(char*) * (filter_count + 1));
+			filter_udids[filter_count++] = udid;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--process")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			syslog_relay_filter_add_process(get_filter(), argv[i]);
+			continue;
+		}
+		else if (!strcmp(argv[i], "--pid")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			syslog_relay_filter_add_pid(get_filter(), (uint32_t)strtoul(argv[i], NULL, 10));
+			continue;
+		}
+		else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--level")) {
+			i++;
+			int level = argv[i] ? parse_level(argv[i]) : -1;
+			if (level < 0) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			syslog_relay_filter_set_level(get_filter(), (syslog_relay_level_t)level);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--match")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			syslog_relay_filter_set_match(get_filter(), argv[i]);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "--regex")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			if (syslog_relay_filter_set_regex(get_filter(), argv[i]) != SYSLOG_RELAY_E_SUCCESS) {
+				fprintf(stderr, "ERROR: Invalid regular expression '%s'\n", argv[i]);
+				return -1;
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--all")) {
+			aggregate = 1;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			output_dir = argv[i];
+			continue;
+		}
+#ifdef HAVE_ZLIB
+		else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--write")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			archive_path = argv[i];
+			continue;
+		}
+#endif
+		else if (!strcmp(argv[i], "--rotate-size")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			rotate_size = strtol(argv[i], NULL, 10);
+			continue;
+		}
+		else if (!strcmp(argv[i], "--rotate-count")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			rotate_count = atoi(argv[i]);
 			continue;
 		}
 		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
@@ -171,6 +701,26 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (output_dir && !aggregate) {
+		fprintf(stderr, "ERROR: --output can only be used together with --all\n");
+		print_usage(argc, argv);
+		return -1;
+	}
+
+#ifdef HAVE_ZLIB
+	if (archive_path) {
+		archive = syslog_archive_writer_open(archive_path);
+		if (!archive) {
+			return -1;
+		}
+	}
+#endif
+
+	if (aggregate) {
+		res = run_aggregator();
+		goto cleanup;
+	}
+
 	int num = 0;
 	char **devices = NULL;
 	idevice_get_device_list(&devices, &num);
@@ -178,7 +728,8 @@ int main(int argc, char *argv[])
 	if (num == 0) {
 		if (!udid) {
 			fprintf(stderr, "No device found. Plug in a device or pass UDID with -u to wait for device to be available.\n");
-			return -1;
+			res = -1;
+			goto cleanup;
 		} else {
 			fprintf(stderr, "Waiting for device with UDID %s to become available...\n", udid);
 		}
@@ -192,11 +743,25 @@ int main(int argc, char *argv[])
 	idevice_event_unsubscribe();
 	stop_logging();
 
-	if (udid) {
+cleanup:
+#ifdef HAVE_ZLIB
+	if (archive) {
+		syslog_archive_writer_close(archive);
+	}
+#endif
+	if (filter) {
+		syslog_relay_filter_free(filter);
+	}
+	if (filter_count > 0) {
+		for (i = 0; i < filter_count; i++) {
+			free(filter_udids[i]);
+		}
+		free(filter_udids);
+	} else if (udid) {
 		free(udid);
 	}
 
-	return 0;
+	return res;
 }
 
 void print_usage(int argc, char **argv)
@@ -208,6 +773,22 @@ void print_usage(int argc, char **argv)
 	printf("Relay syslog of a connected device.\n\n");
 	printf("  -d, --debug\t\tenable communication debugging\n");
 	printf("  -u, --udid UDID\ttarget specific device by its 40-digit device UDID\n");
+	printf("  -p, --process NAME\tonly show lines of process NAME (can be repeated)\n");
+	printf("  --pid PID\t\tonly show lines of process PID (can be repeated)\n");
+	printf("  -l, --level LEVEL\tonly show lines of LEVEL or more severe, one of\n");
+	printf("  \t\t\temergency, alert, critical, error, warning, notice,\n");
+	printf("  \t\t\tinfo or debug\n");
+	printf("  -m, --match STRING\tonly show lines containing STRING\n");
+	printf("  -e, --regex PATTERN\tonly show lines matching extended regex PATTERN\n");
+	printf("  -a, --all\t\tfollow all connected devices, or those passed with -u,\n");
+	printf("  \t\t\tprefixing each line with the device UDID\n");
+	printf("  -o, --output DIR\twith -a, write each device to DIR/UDID.log instead\n");
+#ifdef HAVE_ZLIB
+	printf("  -w, --write FILE\tappend lines to the compressed syslog archive FILE,\n");
+	printf("  \t\t\tto be read with idevicesyslogread\n");
+#endif
+	printf("  --rotate-size BYTES\trotate log files at BYTES size (default 16777216)\n");
+	printf("  --rotate-count N\tnumber of rotated log files to keep (default 5)\n");
 	printf("  -h, --help\t\tprints usage information\n");
 	printf("\n");
 	printf("Homepage: <" PACKAGE_URL ">\n");
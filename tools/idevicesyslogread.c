@@ -0,0 +1,172 @@
+/*
+ * idevicesyslogread.c
+ * Print the lines of a syslog archive written by idevicesyslog
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "syslog_archive.h"
+
+static void print_usage(int argc, char **argv);
+
+struct read_options {
+	int show_udid;
+	int show_time;
+};
+
+/**
+ * Parses a time given as seconds since the epoch or as local time in the
+ * form "YYYY-MM-DD HH:MM:SS" (or with a 'T' separator).
+ *
+ * @return The time in milliseconds since the epoch, or 0 on error.
+ */
+static uint64_t parse_time(const char *str)
+{
+	struct tm tm;
+	char *end = NULL;
+	unsigned long long secs = strtoull(str, &end, 10);
+
+	if (end && (*end == '\0')) {
+		return (uint64_t)secs * 1000;
+	}
+
+	memset(&tm, '\0', sizeof(tm));
+	if (sscanf(str, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 3) {
+		return 0;
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+
+	time_t t = mktime(&tm);
+	if (t == (time_t)-1) {
+		return 0;
+	}
+	return (uint64_t)t * 1000;
+}
+
+static void line_cb(const char *udid, uint64_t timestamp, const char *line, uint32_t length, void *user_data)
+{
+	struct read_options *options = (struct read_options*)user_data;
+
+	if (options->show_time) {
+		char buf[32];
+		time_t t = (time_t)(timestamp / 1000);
+		struct tm *tm = localtime(&t);
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm);
+		printf("%s.%03d ", buf, (int)(timestamp % 1000));
+	}
+	if (options->show_udid) {
+		printf("%s: ", udid);
+	}
+	fwrite(line, 1, length, stdout);
+	putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	const char *udid = NULL;
+	uint64_t since = 0;
+	uint64_t until = 0;
+	struct read_options options = { 1, 0 };
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-u") || !strcmp(argv[i], "--udid")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			udid = argv[i];
+			options.show_udid = 0;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--since")) {
+			i++;
+			if (!argv[i] || !(since = parse_time(argv[i]))) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "--until")) {
+			i++;
+			if (!argv[i] || !(until = parse_time(argv[i]))) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--time")) {
+			options.show_time = 1;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			print_usage(argc, argv);
+			return 0;
+		}
+		else if (argv[i][0] != '-' && !path) {
+			path = argv[i];
+			continue;
+		}
+		else {
+			print_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	if (!path) {
+		print_usage(argc, argv);
+		return 0;
+	}
+
+	if (syslog_archive_read(path, udid, since, until, line_cb, &options) < 0) {
+		fflush(stdout);
+		return -1;
+	}
+	fflush(stdout);
+
+	return 0;
+}
+
+static void print_usage(int argc, char **argv)
+{
+	char *name = NULL;
+
+	name = strrchr(argv[0], '/');
+	printf("Usage: %s [OPTIONS] FILE\n", (name ? name + 1: argv[0]));
+	printf("Print the syslog lines of an archive written with idevicesyslog -w.\n\n");
+	printf("  -u, --udid UDID\tonly print lines of the device with UDID\n");
+	printf("  -s, --since TIME\tskip lines before TIME\n");
+	printf("  -e, --until TIME\tskip lines after TIME\n");
+	printf("  -t, --time\t\tprefix each line with the time it was received\n");
+	printf("  -h, --help\t\tprints usage information\n");
+	printf("\n");
+	printf("TIME is either seconds since the epoch or local time given as\n");
+	printf("\"YYYY-MM-DD HH:MM:SS\".\n");
+	printf("\n");
+	printf("Homepage: <" PACKAGE_URL ">\n");
+}
@@ -0,0 +1,201 @@
+/*
+ * idevicetracedump.c
+ * Decode a libimobiledevice trace file to text or JSON
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common/trace.h"
+
+static void print_usage(int argc, char **argv);
+
+struct record_list {
+	struct trace_record *records;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+static void record_cb(const struct trace_record *record, void *user_data)
+{
+	struct record_list *list = (struct record_list*)user_data;
+
+	if (list->count == list->capacity) {
+		uint32_t capacity = (list->capacity) ? list->capacity * 2 : 4096;
+		struct trace_record *records = (struct trace_record*)realloc(list->records, capacity * sizeof(struct trace_record));
+		if (!records) {
+			return;
+		}
+		list->records = records;
+		list->capacity = capacity;
+	}
+	list->records[list->count++] = *record;
+}
+
+static int record_compare(const void *a, const void *b)
+{
+	const struct trace_record *ra = (const struct trace_record*)a;
+	const struct trace_record *rb = (const struct trace_record*)b;
+
+	if (ra->timestamp < rb->timestamp)
+		return -1;
+	if (ra->timestamp > rb->timestamp)
+		return 1;
+	return 0;
+}
+
+static int tag_length(const struct trace_record *record)
+{
+	int len = 0;
+	while ((len < TRACE_TAG_SIZE) && record->tag[len])
+		len++;
+	return len;
+}
+
+static void print_text(const struct trace_record *record)
+{
+	char buf[32];
+	time_t t = (time_t)(record->timestamp / 1000000000ULL);
+	struct tm *tm = localtime(&t);
+	const char *arg;
+	int len;
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm);
+	printf("%s.%09u [%u] %s %s result=%d", buf, (unsigned int)(record->timestamp % 1000000000ULL), record->thread, trace_category_name(record->category), trace_event_name(record->event), record->result);
+
+	arg = trace_event_arg_name(record->event, 0);
+	if (arg)
+		printf(" %s=%llu", arg, (unsigned long long)record->arg0);
+	arg = trace_event_arg_name(record->event, 1);
+	if (arg)
+		printf(" %s=%llu", arg, (unsigned long long)record->arg1);
+
+	len = tag_length(record);
+	if (len > 0)
+		printf(" %.*s", len, record->tag);
+	printf("\n");
+}
+
+static void print_json(const struct trace_record *record, int first)
+{
+	const char *arg;
+	int len;
+	int i;
+
+	printf("%s\n  {\"timestamp\": %llu, \"thread\": %u, \"category\": \"%s\", \"event\": \"%s\", \"result\": %d", (first) ? "" : ",", (unsigned long long)record->timestamp, record->thread, trace_category_name(record->category), trace_event_name(record->event), record->result);
+
+	arg = trace_event_arg_name(record->event, 0);
+	if (arg)
+		printf(", \"%s\": %llu", arg, (unsigned long long)record->arg0);
+	arg = trace_event_arg_name(record->event, 1);
+	if (arg)
+		printf(", \"%s\": %llu", arg, (unsigned long long)record->arg1);
+
+	len = tag_length(record);
+	if (len > 0) {
+		printf(", \"tag\": \"");
+		for (i = 0; i < len; i++) {
+			unsigned char c = (unsigned char)record->tag[i];
+			if ((c == '"') || (c == '\\'))
+				printf("\\%c", c);
+			else if ((c < 0x20) || (c > 0x7e))
+				printf("\\u%04x", c);
+			else
+				putchar(c);
+		}
+		printf("\"");
+	}
+	printf("}");
+}
+
+int main(int argc, char *argv[])
+{
+	struct record_list list = { NULL, 0, 0 };
+	const char *path = NULL;
+	int json = 0;
+	uint32_t i;
+
+	for (i = 1; i < (uint32_t)argc; i++) {
+		if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--json")) {
+			json = 1;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			print_usage(argc, argv);
+			return 0;
+		}
+		else if (argv[i][0] != '-' && !path) {
+			path = argv[i];
+			continue;
+		}
+		else {
+			print_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	if (!path) {
+		print_usage(argc, argv);
+		return 0;
+	}
+
+	if (trace_file_read(path, record_cb, &list) < 0) {
+		fprintf(stderr, "ERROR: Could not read trace file %s\n", path);
+		return -1;
+	}
+
+	/* records are stored per thread, merge them into one timeline */
+	if (list.count > 0) {
+		qsort(list.records, list.count, sizeof(struct trace_record), record_compare);
+	}
+
+	if (json) {
+		printf("[");
+		for (i = 0; i < list.count; i++) {
+			print_json(&list.records[i], (i == 0));
+		}
+		printf("\n]\n");
+	} else {
+		for (i = 0; i < list.count; i++) {
+			print_text(&list.records[i]);
+		}
+	}
+	free(list.records);
+
+	return 0;
+}
+
+static void print_usage(int argc, char **argv)
+{
+	char *name = NULL;
+
+	name = strrchr(argv[0], '/');
+	printf("Usage: %s [OPTIONS] FILE\n", (name ? name + 1: argv[0]));
+	printf("Decode a trace file saved by libimobiledevice.\n\n");
+	printf("  -j, --json\t\tprint the events as a JSON array\n");
+	printf("  -h, --help\t\tprints usage information\n");
+	printf("\n");
+	printf("Set LIBIMOBILEDEVICE_TRACE=FILE to record a trace of any tool.\n");
+	printf("\n");
+	printf("Homepage: <" PACKAGE_URL ">\n");
+}
@@ -0,0 +1,570 @@
+/*
+ * syslog_archive.c
+ * Compressed, indexed on-disk format for captured syslog lines
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_ZLIB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <zlib.h>
+
+#include "syslog_archive.h"
+
+/** Lines of a device not written to the archive yet. */
+struct syslog_archive_block {
+	char udid[SYSLOG_ARCHIVE_UDID_MAX + 1];
+	uint32_t udid_length;
+	char *data;
+	uint32_t length;
+	uint32_t capacity;
+	uint32_t line_count;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	struct syslog_archive_block *next;
+};
+
+struct syslog_archive_writer {
+	FILE *data;
+	FILE *index;
+	struct syslog_archive_block *blocks;
+};
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+	put_le32(p, (uint32_t)v);
+	put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+	return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/**
+ * Opens a file for appending and writes the magic if it is empty, or
+ * checks the magic if it is not.
+ */
+static FILE *archive_open_append(const char *path, const char *magic)
+{
+	char buf[SYSLOG_ARCHIVE_MAGIC_LEN];
+	FILE *f = fopen(path, "a+b");
+	if (!f) {
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	fseeko(f, 0, SEEK_END);
+	if (ftello(f) == 0) {
+		fwrite(magic, 1, SYSLOG_ARCHIVE_MAGIC_LEN, f);
+		fflush(f);
+		return f;
+	}
+	fseeko(f, 0, SEEK_SET);
+	if ((fread(buf, 1, SYSLOG_ARCHIVE_MAGIC_LEN, f) != SYSLOG_ARCHIVE_MAGIC_LEN) || (memcmp(buf, magic, SYSLOG_ARCHIVE_MAGIC_LEN) != 0)) {
+		fprintf(stderr, "ERROR: %s is not a syslog archive\n", path);
+		fclose(f);
+		return NULL;
+	}
+	fseeko(f, 0, SEEK_END);
+	return f;
+}
+
+/**
+ * Cuts a file opened for appending at the given size.
+ */
+static int archive_truncate(FILE *f, off_t size)
+{
+	fflush(f);
+#ifdef WIN32
+	if (_chsize_s(_fileno(f), size) != 0)
+		return -1;
+#else
+	if (ftruncate(fileno(f), size) != 0)
+		return -1;
+#endif
+	return fseeko(f, 0, SEEK_END);
+}
+
+/**
+ * Reads the header of the block at the given offset.
+ *
+ * @return The offset right after the block, or -1 if there is no complete
+ *     block header there.
+ */
+static off_t archive_block_end(FILE *f, off_t offset, unsigned char *header)
+{
+	if ((fseeko(f, offset, SEEK_SET) != 0) || (fread(header, 1, SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE, f) != SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE) || (memcmp(header, SYSLOG_ARCHIVE_BLOCK_MAGIC, 4) != 0) || (get_le32(header + 4) > SYSLOG_ARCHIVE_UDID_MAX)) {
+		return -1;
+	}
+	return offset + SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE + (off_t)get_le32(header + 4) + (off_t)get_le32(header + 12);
+}
+
+/**
+ * Appends the index record of a block.
+ */
+static int archive_write_index_record(syslog_archive_writer_t *writer, off_t offset, uint64_t first_timestamp, uint64_t last_timestamp, uint32_t line_count, const char *udid, uint32_t udid_length)
+{
+	unsigned char record[SYSLOG_ARCHIVE_INDEX_RECORD_SIZE];
+
+	memset(record, '\0', sizeof(record));
+	put_le64(record, (uint64_t)offset);
+	put_le64(record + 8, first_timestamp);
+	put_le64(record + 16, last_timestamp);
+	put_le32(record + 24, line_count);
+	put_le32(record + 28, udid_length);
+	memcpy(record + 32, udid, udid_length);
+	if ((fwrite(record, 1, sizeof(record), writer->index) != sizeof(record)) || (fflush(writer->index) != 0)) {
+		fprintf(stderr, "ERROR: Could not write syslog index: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Repairs an archive after a crash. A partly written index record or data
+ * block is cut off, and complete blocks the index does not know about are
+ * indexed, so new blocks are appended right after the last complete one.
+ */
+static int archive_recover(syslog_archive_writer_t *writer)
+{
+	unsigned char header[SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE];
+	unsigned char record[SYSLOG_ARCHIVE_INDEX_RECORD_SIZE];
+	char udid[SYSLOG_ARCHIVE_UDID_MAX];
+	off_t index_size, size, offset = SYSLOG_ARCHIVE_MAGIC_LEN;
+
+	if ((fseeko(writer->index, 0, SEEK_END) != 0) || ((index_size = ftello(writer->index)) < 0)
+	    || (fseeko(writer->data, 0, SEEK_END) != 0) || ((size = ftello(writer->data)) < 0)) {
+		return -1;
+	}
+
+	if ((index_size - SYSLOG_ARCHIVE_MAGIC_LEN) % SYSLOG_ARCHIVE_INDEX_RECORD_SIZE != 0) {
+		index_size -= (index_size - SYSLOG_ARCHIVE_MAGIC_LEN) % SYSLOG_ARCHIVE_INDEX_RECORD_SIZE;
+		fprintf(stderr, "WARNING: Discarding incomplete syslog index record\n");
+		if (archive_truncate(writer->index, index_size) != 0)
+			return -1;
+	}
+	if (index_size > SYSLOG_ARCHIVE_MAGIC_LEN) {
+		/* blocks are written before their record, start after the last one */
+		if ((fseeko(writer->index, index_size - SYSLOG_ARCHIVE_INDEX_RECORD_SIZE, SEEK_SET) != 0) || (fread(record, 1, sizeof(record), writer->index) != sizeof(record))) {
+			return -1;
+		}
+		offset = archive_block_end(writer->data, (off_t)get_le64(record), header);
+		if ((offset < 0) || (offset > size)) {
+			fprintf(stderr, "ERROR: Syslog index does not match the archive\n");
+			return -1;
+		}
+	}
+
+	while (offset < size) {
+		off_t next = archive_block_end(writer->data, offset, header);
+		uint32_t udid_length = get_le32(header + 4);
+		if ((next < 0) || (next > size) || (fread(udid, 1, udid_length, writer->data) != udid_length)) {
+			fprintf(stderr, "WARNING: Discarding incomplete syslog block at offset %lld\n", (long long)offset);
+			if (archive_truncate(writer->data, offset) != 0)
+				return -1;
+			break;
+		}
+		if (archive_write_index_record(writer, offset, get_le64(header + 20), get_le64(header + 28), get_le32(header + 16), udid, udid_length) < 0)
+			return -1;
+		offset = next;
+	}
+
+	fseeko(writer->index, 0, SEEK_END);
+	fseeko(writer->data, 0, SEEK_END);
+	return 0;
+}
+
+syslog_archive_writer_t *syslog_archive_writer_open(const char *path)
+{
+	size_t plen = strlen(path) + 5;
+	char *index_path = (char*)malloc(plen);
+	syslog_archive_writer_t *writer = (syslog_archive_writer_t*)calloc(1, sizeof(syslog_archive_writer_t));
+
+	snprintf(index_path, plen, "%s.idx", path);
+
+	writer->data = archive_open_append(path, SYSLOG_ARCHIVE_MAGIC);
+	if (writer->data) {
+		writer->index = archive_open_append(index_path, SYSLOG_ARCHIVE_INDEX_MAGIC);
+	}
+	free(index_path);
+
+	if (writer->index && (archive_recover(writer) < 0)) {
+		fprintf(stderr, "ERROR: Could not recover %s: %s\n", path, strerror(errno));
+		fclose(writer->index);
+		writer->index = NULL;
+	}
+	if (!writer->index) {
+		if (writer->data) {
+			fclose(writer->data);
+		}
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+/**
+ * Compresses a pending block and appends it to the data file, followed by
+ * its record in the index file.
+ */
+static int archive_write_block(syslog_archive_writer_t *writer, struct syslog_archive_block *block)
+{
+	unsigned char header[SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE];
+	uLongf clen = compressBound(block->length);
+	unsigned char *cdata = NULL;
+	off_t offset;
+	int res = -1;
+
+	if (block->line_count == 0)
+		return 0;
+
+	cdata = (unsigned char*)malloc(clen);
+	if (!cdata)
+		return -1;
+	if (compress2(cdata, &clen, (const Bytef*)block->data, block->length, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		fprintf(stderr, "ERROR: Could not compress syslog block\n");
+		goto leave;
+	}
+
+	offset = ftello(writer->data);
+
+	memcpy(header, SYSLOG_ARCHIVE_BLOCK_MAGIC, 4);
+	put_le32(header + 4, block->udid_length);
+	put_le32(header + 8, block->length);
+	put_le32(header + 12, (uint32_t)clen);
+	put_le32(header + 16, block->line_count);
+	put_le64(header + 20, block->first_timestamp);
+	put_le64(header + 28, block->last_timestamp);
+
+	if ((fwrite(header, 1, sizeof(header), writer->data) != sizeof(header))
+	    || (fwrite(block->udid, 1, block->udid_length, writer->data) != block->udid_length)
+	    || (fwrite(cdata, 1, clen, writer->data) != clen)
+	    || (fflush(writer->data) != 0)) {
+		fprintf(stderr, "ERROR: Could not write syslog block: %s\n", strerror(errno));
+		goto leave;
+	}
+
+	/* the index record is only written once the block is complete */
+	if (archive_write_index_record(writer, offset, block->first_timestamp, block->last_timestamp, block->line_count, block->udid, block->udid_length) < 0) {
+		goto leave;
+	}
+
+	block->length = 0;
+	block->line_count = 0;
+	res = 0;
+
+leave:
+	free(cdata);
+	return res;
+}
+
+int syslog_archive_write_line(syslog_archive_writer_t *writer, const char *udid, uint64_t timestamp, const char *line, uint32_t length)
+{
+	struct syslog_archive_block *block;
+	size_t udid_length = strlen(udid);
+
+	if (udid_length > SYSLOG_ARCHIVE_UDID_MAX)
+		udid_length = SYSLOG_ARCHIVE_UDID_MAX;
+
+	for (block = writer->blocks; block; block = block->next) {
+		if ((block->udid_length == udid_length) && (memcmp(block->udid, udid, udid_length) == 0))
+			break;
+	}
+	if (!block) {
+		block = (struct syslog_archive_block*)calloc(1, sizeof(struct syslog_archive_block));
+		memcpy(block->udid, udid, udid_length);
+		block->udid_length = udid_length;
+		block->next = writer->blocks;
+		writer->blocks = block;
+	}
+
+	if (block->length + 12 + length > block->capacity) {
+		uint32_t capacity = block->capacity ? block->capacity : SYSLOG_ARCHIVE_BLOCK_SIZE;
+		while (capacity < block->length + 12 + length)
+			capacity *= 2;
+		char *data = (char*)realloc(block->data, capacity);
+		if (!data)
+			return -1;
+		block->data = data;
+		block->capacity = capacity;
+	}
+
+	if (block->line_count == 0)
+		block->first_timestamp = timestamp;
+	block->last_timestamp = timestamp;
+	put_le64((unsigned char*)block->data + block->length, timestamp);
+	put_le32((unsigned char*)block->data + block->length + 8, length);
+	memcpy(block->data + block->length + 12, line, length);
+	block->length += 12 + length;
+	block->line_count++;
+
+	if (block->length >= SYSLOG_ARCHIVE_BLOCK_SIZE)
+		return archive_write_block(writer, block);
+
+	return 0;
+}
+
+int syslog_archive_writer_flush(syslog_archive_writer_t *writer, uint64_t now, uint64_t max_age)
+{
+	struct syslog_archive_block *block;
+	int res = 0;
+
+	for (block = writer->blocks; block; block = block->next) {
+		if (block->line_count == 0)
+			continue;
+		if ((max_age == 0) || (now >= block->first_timestamp + max_age)) {
+			if (archive_write_block(writer, block) < 0)
+				res = -1;
+		}
+	}
+
+	return res;
+}
+
+void syslog_archive_writer_close(syslog_archive_writer_t *writer)
+{
+	if (!writer)
+		return;
+
+	syslog_archive_writer_flush(writer, 0, 0);
+	while (writer->blocks) {
+		struct syslog_archive_block *next = writer->blocks->next;
+		free(writer->blocks->data);
+		free(writer->blocks);
+		writer->blocks = next;
+	}
+	fclose(writer->index);
+	fclose(writer->data);
+	free(writer);
+}
+
+/**
+ * Decompresses the block at the given offset and passes its lines within
+ * the time range to the callback.
+ */
+static int archive_read_block(FILE *f, off_t offset, uint64_t since, uint64_t until, syslog_archive_line_cb_t callback, void *user_data)
+{
+	unsigned char header[SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE];
+	char udid[SYSLOG_ARCHIVE_UDID_MAX + 1];
+	unsigned char *cdata = NULL;
+	unsigned char *raw = NULL;
+	uint32_t udid_length, raw_length, compressed_length;
+	uLongf dlen;
+	uint32_t pos = 0;
+	int res = -1;
+
+	if ((fseeko(f, offset, SEEK_SET) != 0) || (fread(header, 1, sizeof(header), f) != sizeof(header)) || (memcmp(header, SYSLOG_ARCHIVE_BLOCK_MAGIC, 4) != 0)) {
+		fprintf(stderr, "ERROR: No syslog block at offset %lld\n", (long long)offset);
+		return -1;
+	}
+	udid_length = get_le32(header + 4);
+	raw_length = get_le32(header + 8);
+	compressed_length = get_le32(header + 12);
+	if ((udid_length > SYSLOG_ARCHIVE_UDID_MAX) || (fread(udid, 1, udid_length, f) != udid_length)) {
+		fprintf(stderr, "ERROR: Corrupt syslog block at offset %lld\n", (long long)offset);
+		return -1;
+	}
+	udid[udid_length] = '\0';
+
+	cdata = (unsigned char*)malloc(compressed_length);
+	raw = (unsigned char*)malloc(raw_length + 1);
+	if (!cdata || !raw)
+		goto leave;
+	if (fread(cdata, 1, compressed_length, f) != compressed_length) {
+		fprintf(stderr, "ERROR: Truncated syslog block at offset %lld\n", (long long)offset);
+		goto leave;
+	}
+	dlen = raw_length;
+	if ((uncompress(raw, &dlen, cdata, compressed_length) != Z_OK) || (dlen != raw_length)) {
+		fprintf(stderr, "ERROR: Could not decompress syslog block at offset %lld\n", (long long)offset);
+		goto leave;
+	}
+
+	while (pos + 12 <= raw_length) {
+		uint64_t timestamp = get_le64(raw + pos);
+		uint32_t length = get_le32(raw + pos + 8);
+		pos += 12;
+		if (length > raw_length - pos)
+			break;
+		if ((timestamp >= since) && ((until == 0) || (timestamp <= until))) {
+			/* terminate the line in place, the byte is restored afterwards */
+			char saved = raw[pos + length];
+			raw[pos + length] = '\0';
+			callback(udid, timestamp, (const char*)raw + pos, length, user_data);
+			raw[pos + length] = saved;
+		}
+		pos += length;
+	}
+	res = 0;
+
+leave:
+	free(cdata);
+	free(raw);
+	return res;
+}
+
+static int archive_block_selected(const char *block_udid, uint32_t udid_length, uint64_t first, uint64_t last, const char *udid, uint64_t since, uint64_t until)
+{
+	if (last < since)
+		return 0;
+	if ((until != 0) && (first > until))
+		return 0;
+	if (udid && ((strlen(udid) != udid_length) || (memcmp(udid, block_udid, udid_length) != 0)))
+		return 0;
+	return 1;
+}
+
+/**
+ * Reads the blocks from the given offset to the end of the data file by
+ * walking their headers. A trailing block cut short by a crash is skipped.
+ */
+static int archive_walk_blocks(FILE *f, off_t offset, const char *udid, uint64_t since, uint64_t until, syslog_archive_line_cb_t callback, void *user_data)
+{
+	unsigned char header[SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE];
+	char block_udid[SYSLOG_ARCHIVE_UDID_MAX];
+	off_t size;
+
+	if ((fseeko(f, 0, SEEK_END) != 0) || ((size = ftello(f)) < 0)) {
+		return -1;
+	}
+	while ((offset < size) && (fseeko(f, offset, SEEK_SET) == 0)) {
+		uint32_t udid_length;
+		off_t next;
+		if (size - offset < (off_t)sizeof(header)) {
+			fprintf(stderr, "WARNING: Ignoring incomplete syslog block at offset %lld\n", (long long)offset);
+			break;
+		}
+		if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+			return -1;
+		}
+		udid_length = get_le32(header + 4);
+		if ((memcmp(header, SYSLOG_ARCHIVE_BLOCK_MAGIC, 4) != 0) || (udid_length > SYSLOG_ARCHIVE_UDID_MAX)) {
+			fprintf(stderr, "ERROR: Corrupt syslog block at offset %lld\n", (long long)offset);
+			return -1;
+		}
+		next = offset + (off_t)sizeof(header) + (off_t)udid_length + (off_t)get_le32(header + 12);
+		if (next > size) {
+			fprintf(stderr, "WARNING: Ignoring incomplete syslog block at offset %lld\n", (long long)offset);
+			break;
+		}
+		if (fread(block_udid, 1, udid_length, f) != udid_length) {
+			return -1;
+		}
+		if (archive_block_selected(block_udid, udid_length, get_le64(header + 20), get_le64(header + 28), udid, since, until)) {
+			if (archive_read_block(f, offset, since, until, callback, user_data) < 0) {
+				return -1;
+			}
+		}
+		offset = next;
+	}
+	return 0;
+}
+
+int syslog_archive_read(const char *path, const char *udid, uint64_t since, uint64_t until, syslog_archive_line_cb_t callback, void *user_data)
+{
+	char magic[SYSLOG_ARCHIVE_MAGIC_LEN];
+	size_t plen = strlen(path) + 5;
+	char *index_path = NULL;
+	FILE *index = NULL;
+	FILE *f = fopen(path, "rb");
+	off_t walk_from = SYSLOG_ARCHIVE_MAGIC_LEN;
+	int res = 0;
+
+	if (!f) {
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if ((fread(magic, 1, sizeof(magic), f) != sizeof(magic)) || (memcmp(magic, SYSLOG_ARCHIVE_MAGIC, SYSLOG_ARCHIVE_MAGIC_LEN) != 0)) {
+		fprintf(stderr, "ERROR: %s is not a syslog archive\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	index_path = (char*)malloc(plen);
+	snprintf(index_path, plen, "%s.idx", path);
+	index = fopen(index_path, "rb");
+	free(index_path);
+	if (index && ((fread(magic, 1, sizeof(magic), index) != sizeof(magic)) || (memcmp(magic, SYSLOG_ARCHIVE_INDEX_MAGIC, SYSLOG_ARCHIVE_MAGIC_LEN) != 0))) {
+		fclose(index);
+		index = NULL;
+	}
+
+	if (index) {
+		unsigned char record[SYSLOG_ARCHIVE_INDEX_RECORD_SIZE];
+		unsigned char header[SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE];
+		off_t last = -1;
+		while (fread(record, 1, sizeof(record), index) == sizeof(record)) {
+			uint32_t udid_length = get_le32(record + 28);
+			if (udid_length > SYSLOG_ARCHIVE_UDID_MAX)
+				continue;
+			if ((off_t)get_le64(record) > last)
+				last = (off_t)get_le64(record);
+			if (archive_block_selected((const char*)record + 32, udid_length, get_le64(record + 8), get_le64(record + 16), udid, since, until)) {
+				if (archive_read_block(f, (off_t)get_le64(record), since, until, callback, user_data) < 0) {
+					res = -1;
+					break;
+				}
+			}
+		}
+		fclose(index);
+		/* a block is written before its index record, so after a crash the
+		 * data file may hold blocks the index does not know about yet */
+		if (last >= 0) {
+			walk_from = archive_block_end(f, last, header);
+			if ((walk_from < 0) && (res == 0)) {
+				fprintf(stderr, "ERROR: Corrupt syslog block at offset %lld\n", (long long)last);
+				res = -1;
+			}
+		}
+	}
+	if (res == 0) {
+		/* without an index, or past its last record, walk the block headers */
+		res = archive_walk_blocks(f, walk_from, udid, since, until, callback, user_data);
+	}
+
+	fclose(f);
+
+	return res;
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * syslog_archive.h
+ * Compressed, indexed on-disk format for captured syslog lines
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __SYSLOG_ARCHIVE_H
+#define __SYSLOG_ARCHIVE_H
+
+#include <stdint.h>
+
+/*
+ * An archive consists of a data file and an index file next to it with
+ * ".idx" appended to its name. All integers are stored little endian.
+ *
+ * The data file starts with SYSLOG_ARCHIVE_MAGIC, followed by blocks:
+ *   char magic[4]            SYSLOG_ARCHIVE_BLOCK_MAGIC
+ *   uint32 udid_length
+ *   uint32 raw_length
+ *   uint32 compressed_length
+ *   uint32 line_count
+ *   uint64 first_timestamp   milliseconds since the epoch
+ *   uint64 last_timestamp
+ *   char udid[udid_length]
+ *   zlib compressed lines, each: uint64 timestamp, uint32 length, data
+ *
+ * Every block holds the lines of a single device. The index file starts
+ * with SYSLOG_ARCHIVE_INDEX_MAGIC followed by one fixed size record per
+ * block, so a reader can select the blocks of a time range and a device
+ * without decompressing anything else. Without an index the block headers
+ * of the data file are scanned instead, as are the blocks following the
+ * last index record, since a block is written before its record.
+ */
+#define SYSLOG_ARCHIVE_MAGIC "ISYSLOG1"
+#define SYSLOG_ARCHIVE_INDEX_MAGIC "ISYSIDX1"
+#define SYSLOG_ARCHIVE_BLOCK_MAGIC "BLK1"
+#define SYSLOG_ARCHIVE_MAGIC_LEN 8
+
+#define SYSLOG_ARCHIVE_BLOCK_HEADER_SIZE 36
+#define SYSLOG_ARCHIVE_UDID_MAX 64
+#define SYSLOG_ARCHIVE_INDEX_RECORD_SIZE (32 + SYSLOG_ARCHIVE_UDID_MAX)
+
+/* raw size at which a block is compressed and written */
+#define SYSLOG_ARCHIVE_BLOCK_SIZE (256 * 1024)
+
+typedef struct syslog_archive_writer syslog_archive_writer_t;
+
+/** Callback receiving a line read from an archive. */
+typedef void (*syslog_archive_line_cb_t)(const char *udid, uint64_t timestamp, const char *line, uint32_t length, void *user_data);
+
+/**
+ * Opens an archive for appending, creating it if it does not exist. A
+ * block or index record cut short by a crash is discarded first, and
+ * complete blocks missing from the index are added to it.
+ *
+ * @param path Path of the data file.
+ *
+ * @return The writer, or NULL if the archive could not be opened.
+ */
+syslog_archive_writer_t *syslog_archive_writer_open(const char *path);
+
+/**
+ * Adds a line to the pending block of a device, writing the block once it
+ * is full.
+ *
+ * @return 0 on success or -1 if a block could not be written.
+ */
+int syslog_archive_write_line(syslog_archive_writer_t *writer, const char *udid, uint64_t timestamp, const char *line, uint32_t length);
+
+/**
+ * Writes pending blocks whose first line is at least max_age milliseconds
+ * older than now, or all pending blocks if max_age is 0.
+ *
+ * @return 0 on success or -1 if a block could not be written.
+ */
+int syslog_archive_writer_flush(syslog_archive_writer_t *writer, uint64_t now, uint64_t max_age);
+
+/**
+ * Writes all pending blocks and closes an archive.
+ */
+void syslog_archive_writer_close(syslog_archive_writer_t *writer);
+
+/**
+ * Reads the lines of an archive within a time range.
+ *
+ * Lines are passed to the callback block by block in the order the blocks
+ * were written, so lines of one device are in order but lines of different
+ * devices may interleave out of order.
+ *
+ * @param path Path of the data file.
+ * @param udid Only read lines of this device, or NULL for all devices.
+ * @param since Skip lines older than this timestamp.
+ * @param until Skip lines newer than this timestamp, or 0 for no limit.
+ * @param callback Function to pass each line to.
+ * @param user_data Custom pointer passed to the callback.
+ *
+ * @return 0 on success or -1 on error.
+ */
+int syslog_archive_read(const char *path, const char *udid, uint64_t since, uint64_t until, syslog_archive_line_cb_t callback, void *user_data);
+
+#endif